@@ -1,7 +1,7 @@
 
 cbuffer MatrixBuffer
 {
-  matrix clip_m_model;
+  matrix clip_m_world;
 };
 
 struct VSInput
@@ -9,6 +9,12 @@ struct VSInput
   float3 position : POSITION;
   float3 normal : NORMAL;
   float2 tex : TEXCOORD0;
+
+  // Per object, rows of the affine world matrix
+  float4 world_row0 : INSTANCE_WORLD0;
+  float4 world_row1 : INSTANCE_WORLD1;
+  float4 world_row2 : INSTANCE_WORLD2;
+  float4 color : INSTANCE_COLOR;
 };
 
 struct VSOutput
@@ -20,13 +26,15 @@ VSOutput depth_vertex_shader(VSInput input)
 {
   VSOutput output;
 
+  float4x4 world_m_model = float4x4(input.world_row0, input.world_row1, input.world_row2, float4(0.0f, 0.0f, 0.0f, 1.0f));
+
   float4 modelspace_vertex_position;
   modelspace_vertex_position.xyz = input.position;
   modelspace_vertex_position.w = 1.0f;
 
   // Calculate the position of the vertex against the world, view, and projection matrices.
-  output.position = mul(modelspace_vertex_position, clip_m_model);
+  float4 worldspace_position = mul(world_m_model, modelspace_vertex_position);
+  output.position = mul(worldspace_position, clip_m_world);
 
   return output;
 }
-
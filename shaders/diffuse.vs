@@ -1,14 +1,14 @@
 // VertexShader.vs
 
-// Global variables
-cbuffer MatrixBuffer
+// Global variables, set once per pass
+cbuffer FrameBuffer
 {
-  matrix world_m_model;
   matrix view_m_world;
   matrix clip_m_view;
-  matrix light_clip_m_model;
-  float4 color;
+  matrix light_clip_m_world[4]; // Per shadow cascade, the pixel shader picks one
   float4 light_position;
+  float4 cascade_params[4];
+  uint cascade_count;
 };
 
 // Typedefs
@@ -17,6 +17,12 @@ struct VSInput
   float3 position : POSITION;
   float3 normal : NORMAL;
   float2 tex : TEXCOORD0;
+
+  // Per object, rows of the affine world matrix
+  float4 world_row0 : INSTANCE_WORLD0;
+  float4 world_row1 : INSTANCE_WORLD1;
+  float4 world_row2 : INSTANCE_WORLD2;
+  float4 color : INSTANCE_COLOR;
 };
 
 struct VSOutput
@@ -27,7 +33,6 @@ struct VSOutput
   float2 tex : TEXCOORD0;
   float4 blend_color : COLOR;
   float3 worldspace_light_position : LIGHT_POSITION;
-  float4 light_clipspace_position : LIGHT_CLIP_POSITION;
 };
 
 // Vertex shader
@@ -35,32 +40,32 @@ VSOutput diffuse_vertex_shader(VSInput input)
 {
   VSOutput output;
 
+  float4x4 world_m_model = float4x4(input.world_row0, input.world_row1, input.world_row2, float4(0.0f, 0.0f, 0.0f, 1.0f));
+
   float4 modelspace_vertex_position;
   modelspace_vertex_position.xyz = input.position;
   modelspace_vertex_position.w = 1.0f;
 
-  // Calculate the position of the vertex against the world, view, and projection matrices.
-  output.position = mul(modelspace_vertex_position, world_m_model);
-  output.position = mul(output.position, view_m_world);
+  // The rows are built as a real matrix so it multiplies on the left
+  float4 worldspace_position = mul(world_m_model, modelspace_vertex_position);
+
+  // Calculate the position of the vertex against the view and projection matrices.
+  output.position = mul(worldspace_position, view_m_world);
   output.position = mul(output.position, clip_m_view);
 
-  output.worldspace_position = mul(modelspace_vertex_position, world_m_model).xyz;
+  output.worldspace_position = worldspace_position.xyz;
 
   // Normal
-  output.normal = mul(float4(input.normal, 0.0f), world_m_model).xyz;
+  output.normal = mul(world_m_model, float4(input.normal, 0.0f)).xyz;
   output.normal = normalize(output.normal);
   
   // Tex coords
   output.tex = input.tex;
 
-  output.blend_color = color;
+  output.blend_color = input.color;
 
   output.worldspace_light_position = light_position.xyz;
 
 
-  output.light_clipspace_position = mul(modelspace_vertex_position, light_clip_m_model);
-
-
   return output;
 }
-
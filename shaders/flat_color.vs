@@ -1,10 +1,9 @@
 
-cbuffer MatrixBuffer
+// Set once per pass. Same layout as the start of diffuse.vs's buffer.
+cbuffer FrameBuffer
 {
-  matrix world_m_model;
   matrix view_m_world;
   matrix clip_m_view;
-  float4 color;
 };
 
 struct VSInput
@@ -12,6 +11,12 @@ struct VSInput
   float3 position : POSITION;
   float3 normal : NORMAL;
   float2 tex : TEXCOORD;
+
+  // Per object, rows of the affine world matrix
+  float4 world_row0 : INSTANCE_WORLD0;
+  float4 world_row1 : INSTANCE_WORLD1;
+  float4 world_row2 : INSTANCE_WORLD2;
+  float4 color : INSTANCE_COLOR;
 };
 
 struct VSOutput
@@ -26,16 +31,18 @@ VSOutput flat_vertex_shader(VSInput input)
 {
   VSOutput output;
 
+  float4x4 world_m_model = float4x4(input.world_row0, input.world_row1, input.world_row2, float4(0.0f, 0.0f, 0.0f, 1.0f));
+
   float4 modelspace_vertex_position;
   modelspace_vertex_position.xyz = input.position;
   modelspace_vertex_position.w = 1.0f;
 
   // Calculate the position of the vertex against the world, view, and projection matrices.
-  output.position = mul(modelspace_vertex_position, world_m_model);
+  output.position = mul(world_m_model, modelspace_vertex_position);
   output.position = mul(output.position, view_m_world);
   output.position = mul(output.position, clip_m_view);
 
-  output.color = color;
+  output.color = input.color;
   
   // Tex coords
   output.tex = input.tex;
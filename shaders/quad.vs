@@ -3,7 +3,7 @@ cbuffer MatrixBuffer
   matrix world_m_model;
   matrix view_m_world;
   matrix clip_m_view;
-  matrix light_clip_m_model;
+  matrix light_clip_m_world;
   float4 color;
 };
 
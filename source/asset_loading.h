@@ -13,7 +13,7 @@ End Header --------------------------------------------------------*/
 
 #pragma once
 
-#include "../my_math.h" // vector types
+#include "my_math.h" // vector types
 
 #include <vector>
 
@@ -0,0 +1,545 @@
+#include "bvh.h"
+#include "model_storage.h"
+
+#include <assert.h>
+#include <float.h> // FLT_MAX
+
+static const unsigned SAH_BIN_COUNT = 16;
+
+struct BuildItem
+{
+  v3 lower;
+  v3 upper;
+  v3 centroid;
+  unsigned slot;
+};
+
+static float surface_area(v3 lower, v3 upper)
+{
+  v3 d = upper - lower;
+  if(d.x < 0.0f || d.y < 0.0f || d.z < 0.0f) return 0.0f;
+  return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+static void get_item_bounds(const ModelStorage *models, unsigned slot, v3 *lower, v3 *upper)
+{
+  unsigned i = models->slots[slot].dense_index;
+  v3 center = v3(models->bounds_center_x[i], models->bounds_center_y[i], models->bounds_center_z[i]);
+  v3 extents = v3(models->bounds_extent_x[i], models->bounds_extent_y[i], models->bounds_extent_z[i]);
+  *lower = center - extents;
+  *upper = center + extents;
+}
+
+// All node bound changes go through here to keep total_area in sync
+static void set_node_bounds(Bvh *bvh, int node_index, v3 lower, v3 upper)
+{
+  BvhNode *node = &bvh->nodes[node_index];
+  bvh->total_area += surface_area(lower, upper) - surface_area(node->lower, node->upper);
+  node->lower = lower;
+  node->upper = upper;
+}
+
+static int allocate_node(Bvh *bvh)
+{
+  int index;
+  if(bvh->free_nodes.size())
+  {
+    index = bvh->free_nodes.back();
+    bvh->free_nodes.pop_back();
+  }
+  else
+  {
+    index = bvh->nodes.size();
+    bvh->nodes.push_back(BvhNode());
+  }
+
+  BvhNode *node = &bvh->nodes[index];
+  node->lower = v3(FLT_MAX, FLT_MAX, FLT_MAX);
+  node->upper = v3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+  node->parent = -1;
+  node->children[0] = -1;
+  node->children[1] = -1;
+  node->item_count = 0;
+  return index;
+}
+
+static void free_node(Bvh *bvh, int node_index)
+{
+  BvhNode *node = &bvh->nodes[node_index];
+  bvh->total_area -= surface_area(node->lower, node->upper);
+  bvh->free_nodes.push_back(node_index);
+}
+
+static bool is_leaf(const BvhNode *node) { return node->children[0] < 0; }
+
+// Recomputes bounds from the node's contents and walks up the tree until the
+// bounds stop changing
+static void refit_upwards(Bvh *bvh, const ModelStorage *models, int node_index)
+{
+  while(node_index >= 0)
+  {
+    BvhNode *node = &bvh->nodes[node_index];
+    v3 lower = v3(FLT_MAX, FLT_MAX, FLT_MAX);
+    v3 upper = v3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    if(is_leaf(node))
+    {
+      for(unsigned i = 0; i < node->item_count; i++)
+      {
+        v3 item_lower;
+        v3 item_upper;
+        get_item_bounds(models, node->items[i], &item_lower, &item_upper);
+        lower = component_min(lower, item_lower);
+        upper = component_max(upper, item_upper);
+      }
+    }
+    else
+    {
+      BvhNode *a = &bvh->nodes[node->children[0]];
+      BvhNode *b = &bvh->nodes[node->children[1]];
+      lower = component_min(a->lower, b->lower);
+      upper = component_max(a->upper, b->upper);
+    }
+
+    if(lower.x == node->lower.x && lower.y == node->lower.y && lower.z == node->lower.z &&
+       upper.x == node->upper.x && upper.y == node->upper.y && upper.z == node->upper.z)
+    {
+      break;
+    }
+
+    set_node_bounds(bvh, node_index, lower, upper);
+    node_index = node->parent;
+  }
+}
+
+static int make_leaf(Bvh *bvh, BuildItem *items, unsigned count, int parent)
+{
+  int node_index = allocate_node(bvh);
+  BvhNode *node = &bvh->nodes[node_index];
+  node->parent = parent;
+  node->item_count = count;
+
+  v3 lower = v3(FLT_MAX, FLT_MAX, FLT_MAX);
+  v3 upper = v3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+  for(unsigned i = 0; i < count; i++)
+  {
+    node->items[i] = items[i].slot;
+    bvh->item_leaf[items[i].slot] = node_index;
+    lower = component_min(lower, items[i].lower);
+    upper = component_max(upper, items[i].upper);
+  }
+  set_node_bounds(bvh, node_index, lower, upper);
+
+  return node_index;
+}
+
+// Makes the node for the items, a leaf if they fit. Interior nodes set middle
+// to where the items were split and leave making their children to the caller.
+static int build_node(Bvh *bvh, BuildItem *items, unsigned count, int parent, unsigned *middle_out)
+{
+  if(count <= BVH_LEAF_SIZE)
+  {
+    *middle_out = 0;
+    return make_leaf(bvh, items, count, parent);
+  }
+
+  v3 lower = v3(FLT_MAX, FLT_MAX, FLT_MAX);
+  v3 upper = v3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+  v3 centroid_lower = v3(FLT_MAX, FLT_MAX, FLT_MAX);
+  v3 centroid_upper = v3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+  for(unsigned i = 0; i < count; i++)
+  {
+    lower = component_min(lower, items[i].lower);
+    upper = component_max(upper, items[i].upper);
+    centroid_lower = component_min(centroid_lower, items[i].centroid);
+    centroid_upper = component_max(centroid_upper, items[i].centroid);
+  }
+
+  // Find the cheapest split plane over a few bins per axis
+  float best_cost = FLT_MAX;
+  unsigned best_axis = 0;
+  unsigned best_split = 0;
+  for(unsigned axis = 0; axis < 3; axis++)
+  {
+    float axis_lower = (&centroid_lower.x)[axis];
+    float axis_extent = (&centroid_upper.x)[axis] - axis_lower;
+    if(axis_extent <= 0.0f) continue;
+
+    v3 bin_lower[SAH_BIN_COUNT];
+    v3 bin_upper[SAH_BIN_COUNT];
+    unsigned bin_count[SAH_BIN_COUNT] = {};
+    for(unsigned b = 0; b < SAH_BIN_COUNT; b++)
+    {
+      bin_lower[b] = v3(FLT_MAX, FLT_MAX, FLT_MAX);
+      bin_upper[b] = v3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    }
+
+    float to_bin = SAH_BIN_COUNT / axis_extent;
+    for(unsigned i = 0; i < count; i++)
+    {
+      unsigned b = (unsigned)(((&items[i].centroid.x)[axis] - axis_lower) * to_bin);
+      if(b >= SAH_BIN_COUNT) b = SAH_BIN_COUNT - 1;
+      bin_count[b]++;
+      bin_lower[b] = component_min(bin_lower[b], items[i].lower);
+      bin_upper[b] = component_max(bin_upper[b], items[i].upper);
+    }
+
+    // Sweep from the right to get the cost of everything past each split
+    float right_area[SAH_BIN_COUNT];
+    unsigned right_count[SAH_BIN_COUNT];
+    v3 sweep_lower = v3(FLT_MAX, FLT_MAX, FLT_MAX);
+    v3 sweep_upper = v3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    unsigned sweep_count = 0;
+    for(unsigned b = SAH_BIN_COUNT - 1; b > 0; b--)
+    {
+      sweep_lower = component_min(sweep_lower, bin_lower[b]);
+      sweep_upper = component_max(sweep_upper, bin_upper[b]);
+      sweep_count += bin_count[b];
+      right_area[b] = surface_area(sweep_lower, sweep_upper);
+      right_count[b] = sweep_count;
+    }
+
+    // Then from the left, split b puts bins [0, b) on the left
+    sweep_lower = v3(FLT_MAX, FLT_MAX, FLT_MAX);
+    sweep_upper = v3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    sweep_count = 0;
+    for(unsigned b = 1; b < SAH_BIN_COUNT; b++)
+    {
+      sweep_lower = component_min(sweep_lower, bin_lower[b - 1]);
+      sweep_upper = component_max(sweep_upper, bin_upper[b - 1]);
+      sweep_count += bin_count[b - 1];
+      if(sweep_count == 0 || right_count[b] == 0) continue;
+
+      float cost = surface_area(sweep_lower, sweep_upper) * sweep_count + right_area[b] * right_count[b];
+      if(cost < best_cost)
+      {
+        best_cost = cost;
+        best_axis = axis;
+        best_split = b;
+      }
+    }
+  }
+
+  // Partition the items around the chosen split
+  unsigned middle = 0;
+  if(best_cost < FLT_MAX)
+  {
+    float axis_lower = (&centroid_lower.x)[best_axis];
+    float to_bin = SAH_BIN_COUNT / ((&centroid_upper.x)[best_axis] - axis_lower);
+    for(unsigned i = 0; i < count; i++)
+    {
+      unsigned b = (unsigned)(((&items[i].centroid.x)[best_axis] - axis_lower) * to_bin);
+      if(b >= SAH_BIN_COUNT) b = SAH_BIN_COUNT - 1;
+      if(b < best_split)
+      {
+        BuildItem temp = items[i];
+        items[i] = items[middle];
+        items[middle] = temp;
+        middle++;
+      }
+    }
+  }
+
+  // All centroids in the same spot, just split the list in half
+  if(middle == 0 || middle == count)
+  {
+    middle = count / 2;
+  }
+
+  int node_index = allocate_node(bvh);
+  bvh->nodes[node_index].parent = parent;
+  set_node_bounds(bvh, node_index, lower, upper);
+
+  *middle_out = middle;
+  return node_index;
+}
+
+void bvh_build(Bvh *bvh, const ModelStorage *models)
+{
+  bvh->nodes.clear();
+  bvh->free_nodes.clear();
+  bvh->root = -1;
+  bvh->total_area = 0.0f;
+  bvh->item_leaf.assign(models->slots.size(), -1);
+
+  std::vector<BuildItem> items;
+  items.reserve(models->count);
+  for(unsigned i = 0; i < models->count; i++)
+  {
+    if(models->flags[i] & MODEL_FLAG_STATIC) continue;
+
+    BuildItem item;
+    item.slot = models->dense_to_slot[i];
+    get_item_bounds(models, item.slot, &item.lower, &item.upper);
+    item.centroid = (item.lower + item.upper) * 0.5f;
+    items.push_back(item);
+  }
+
+  // Nodes still to make, with an explicit stack since nothing bounds how deep
+  // the splits go
+  struct BuildTask
+  {
+    unsigned first;
+    unsigned count;
+    int parent;
+    unsigned child;
+  };
+  std::vector<BuildTask> tasks;
+  if(items.size()) tasks.push_back({0, (unsigned)items.size(), -1, 0});
+  while(tasks.size())
+  {
+    BuildTask task = tasks.back();
+    tasks.pop_back();
+
+    unsigned middle;
+    int node_index = build_node(bvh, items.data() + task.first, task.count, task.parent, &middle);
+    if(task.parent < 0) bvh->root = node_index;
+    else bvh->nodes[task.parent].children[task.child] = node_index;
+
+    // Left popped first so nodes are made in the same order recursing would
+    if(middle)
+    {
+      tasks.push_back({task.first + middle, task.count - middle, node_index, 1});
+      tasks.push_back({task.first, middle, node_index, 0});
+    }
+  }
+
+  bvh->built_area = bvh->total_area;
+  bvh->rebuild_count++;
+}
+
+static void insert_item(Bvh *bvh, const ModelStorage *models, unsigned slot)
+{
+  v3 lower;
+  v3 upper;
+  get_item_bounds(models, slot, &lower, &upper);
+
+  if(bvh->root < 0)
+  {
+    bvh->root = allocate_node(bvh);
+  }
+
+  // Walk down to the leaf that grows the least
+  int node_index = bvh->root;
+  while(!is_leaf(&bvh->nodes[node_index]))
+  {
+    BvhNode *node = &bvh->nodes[node_index];
+    float best_growth = FLT_MAX;
+    int best_child = node->children[0];
+    for(unsigned c = 0; c < 2; c++)
+    {
+      BvhNode *child = &bvh->nodes[node->children[c]];
+      float growth = surface_area(component_min(child->lower, lower), component_max(child->upper, upper)) -
+                     surface_area(child->lower, child->upper);
+      if(growth < best_growth)
+      {
+        best_growth = growth;
+        best_child = node->children[c];
+      }
+    }
+    node_index = best_child;
+  }
+
+  BvhNode *leaf = &bvh->nodes[node_index];
+  if(leaf->item_count < BVH_LEAF_SIZE)
+  {
+    leaf->items[leaf->item_count++] = slot;
+    bvh->item_leaf[slot] = node_index;
+    refit_upwards(bvh, models, node_index);
+    return;
+  }
+
+  // Leaf is full, turn it into an internal node with two leaves
+  BuildItem items[BVH_LEAF_SIZE + 1];
+  for(unsigned i = 0; i < BVH_LEAF_SIZE; i++)
+  {
+    items[i].slot = leaf->items[i];
+  }
+  items[BVH_LEAF_SIZE].slot = slot;
+
+  v3 centroid_lower = v3(FLT_MAX, FLT_MAX, FLT_MAX);
+  v3 centroid_upper = v3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+  for(unsigned i = 0; i < BVH_LEAF_SIZE + 1; i++)
+  {
+    get_item_bounds(models, items[i].slot, &items[i].lower, &items[i].upper);
+    items[i].centroid = (items[i].lower + items[i].upper) * 0.5f;
+    centroid_lower = component_min(centroid_lower, items[i].centroid);
+    centroid_upper = component_max(centroid_upper, items[i].centroid);
+  }
+
+  // Sort along the widest axis and split down the middle
+  v3 spread = centroid_upper - centroid_lower;
+  unsigned axis = (spread.x > spread.y) ? ((spread.x > spread.z) ? 0 : 2) : ((spread.y > spread.z) ? 1 : 2);
+  for(unsigned i = 1; i < BVH_LEAF_SIZE + 1; i++)
+  {
+    for(unsigned j = i; j > 0 && (&items[j].centroid.x)[axis] < (&items[j - 1].centroid.x)[axis]; j--)
+    {
+      BuildItem temp = items[j];
+      items[j] = items[j - 1];
+      items[j - 1] = temp;
+    }
+  }
+
+  unsigned middle = (BVH_LEAF_SIZE + 1) / 2;
+  int left = make_leaf(bvh, items, middle, node_index);
+  int right = make_leaf(bvh, items + middle, BVH_LEAF_SIZE + 1 - middle, node_index);
+
+  leaf = &bvh->nodes[node_index];
+  leaf->item_count = 0;
+  leaf->children[0] = left;
+  leaf->children[1] = right;
+  refit_upwards(bvh, models, node_index);
+}
+
+void bvh_remove(Bvh *bvh, const ModelStorage *models, unsigned slot)
+{
+  if(slot >= bvh->item_leaf.size() || bvh->item_leaf[slot] < 0) return;
+
+  int leaf_index = bvh->item_leaf[slot];
+  bvh->item_leaf[slot] = -1;
+
+  BvhNode *leaf = &bvh->nodes[leaf_index];
+  for(unsigned i = 0; i < leaf->item_count; i++)
+  {
+    if(leaf->items[i] == slot)
+    {
+      leaf->items[i] = leaf->items[--leaf->item_count];
+      break;
+    }
+  }
+
+  if(leaf->item_count)
+  {
+    refit_upwards(bvh, models, leaf_index);
+    return;
+  }
+
+  // Empty leaf, collapse its parent into the sibling
+  int parent_index = leaf->parent;
+  free_node(bvh, leaf_index);
+  if(parent_index < 0)
+  {
+    bvh->root = -1;
+    return;
+  }
+
+  BvhNode *parent = &bvh->nodes[parent_index];
+  int sibling_index = (parent->children[0] == leaf_index) ? parent->children[1] : parent->children[0];
+  int grandparent_index = parent->parent;
+  bvh->nodes[sibling_index].parent = grandparent_index;
+  free_node(bvh, parent_index);
+
+  if(grandparent_index < 0)
+  {
+    bvh->root = sibling_index;
+    return;
+  }
+
+  BvhNode *grandparent = &bvh->nodes[grandparent_index];
+  if(grandparent->children[0] == parent_index) grandparent->children[0] = sibling_index;
+  else                                         grandparent->children[1] = sibling_index;
+  refit_upwards(bvh, models, grandparent_index);
+}
+
+void bvh_update(Bvh *bvh, ModelStorage *models)
+{
+  if(bvh->item_leaf.size() < models->slots.size())
+  {
+    bvh->item_leaf.resize(models->slots.size(), -1);
+  }
+
+  for(unsigned i = 0; i < models->moved_slots.size(); i++)
+  {
+    unsigned slot = models->moved_slots[i];
+    unsigned index = models->slots[slot].dense_index;
+    if(index == INVALID_MODEL_INDEX) continue;
+    if(models->flags[index] & MODEL_FLAG_STATIC) continue;
+
+    int leaf = bvh->item_leaf[slot];
+    if(leaf < 0) insert_item(bvh, models, slot);
+    else         refit_upwards(bvh, models, leaf);
+  }
+  models->moved_slots.clear();
+
+  if(bvh->root >= 0 && bvh->total_area > bvh->built_area * BVH_REBUILD_RATIO)
+  {
+    bvh_build(bvh, models);
+  }
+}
+
+unsigned bvh_cull(const Bvh *bvh, const ModelStorage *models, const Frustum *frustum, std::vector<BvhCullEntry> *stack,
+                  std::vector<unsigned> *visible)
+{
+  visible->clear();
+  if(bvh->root < 0) return 0;
+
+  stack->clear();
+  stack->push_back({bvh->root, 0x3F});
+
+  unsigned nodes_visited = 0;
+  while(stack->size())
+  {
+    BvhCullEntry entry = stack->back();
+    stack->pop_back();
+    const BvhNode *node = &bvh->nodes[entry.node];
+    nodes_visited++;
+
+    unsigned plane_mask = entry.plane_mask;
+    if(plane_mask)
+    {
+      BoundingBox box;
+      box.center = (node->lower + node->upper) * 0.5f;
+      box.extents = (node->upper - node->lower) * 0.5f;
+      int result = frustum_classify_box(frustum, box, plane_mask);
+      if(result < 0) continue;
+      plane_mask = (unsigned)result;
+    }
+
+    if(is_leaf(node))
+    {
+      unsigned indices[BVH_LEAF_SIZE];
+      unsigned count = 0;
+      for(unsigned i = 0; i < node->item_count; i++)
+      {
+        unsigned index = models->slots[node->items[i]].dense_index;
+        if(models->flags[index] & MODEL_FLAG_SHOW) indices[count++] = index;
+      }
+
+      if(!plane_mask)
+      {
+        visible->insert(visible->end(), indices, indices + count);
+        continue;
+      }
+
+      // Still straddling, test the whole leaf at once. Spare lanes repeat the
+      // first item and are ignored.
+      if(!count) continue;
+      float center_x[BVH_LEAF_SIZE], center_y[BVH_LEAF_SIZE], center_z[BVH_LEAF_SIZE];
+      float extent_x[BVH_LEAF_SIZE], extent_y[BVH_LEAF_SIZE], extent_z[BVH_LEAF_SIZE];
+      for(unsigned i = 0; i < BVH_LEAF_SIZE; i++)
+      {
+        unsigned index = indices[i < count ? i : 0];
+        center_x[i] = models->bounds_center_x[index];
+        center_y[i] = models->bounds_center_y[index];
+        center_z[i] = models->bounds_center_z[index];
+        extent_x[i] = models->bounds_extent_x[index];
+        extent_y[i] = models->bounds_extent_y[index];
+        extent_z[i] = models->bounds_extent_z[index];
+      }
+
+      unsigned lanes[BVH_LEAF_SIZE];
+      unsigned lane_count = frustum_test_boxes(frustum, center_x, center_y, center_z, extent_x, extent_y, extent_z,
+                                               BVH_LEAF_SIZE, lanes);
+      for(unsigned i = 0; i < lane_count && lanes[i] < count; i++)
+      {
+        visible->push_back(indices[lanes[i]]);
+      }
+    }
+    else
+    {
+      stack->push_back({node->children[1], plane_mask});
+      stack->push_back({node->children[0], plane_mask});
+    }
+  }
+
+  return nodes_visited;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "my_math.h" // v3
+#include "culling.h" // Frustum, BoundingBox
+
+#include <vector>
+
+struct ModelStorage;
+
+// One SSE batch, a straddling leaf's items are frustum tested together
+static const unsigned BVH_LEAF_SIZE = 4;
+
+// Rebuild once the summed node surface area grows this much past the last build
+static const float BVH_REBUILD_RATIO = 1.5f;
+
+struct BvhNode
+{
+  v3 lower;
+  v3 upper;
+
+  int parent;
+  int children[2]; // -1 for leaves
+
+  // Leaves only. Items are model slots (Model::index) so they survive the
+  // model storage reordering its packed arrays.
+  unsigned item_count;
+  unsigned items[BVH_LEAF_SIZE];
+};
+
+// Node still to visit while culling. Carries the planes its parent still
+// straddled, planes the parent was fully inside of aren't tested again.
+struct BvhCullEntry
+{
+  int node;
+  unsigned plane_mask;
+};
+
+// Bounding volume hierarchy over the world bounds of every dynamic model. Kept
+// up to date incrementally from ModelStorage::moved_slots and rebuilt with SAH
+// when refits have made it too loose. Static models are culled by cell with
+// the merged static geometry and stay out of the tree.
+struct Bvh
+{
+  std::vector<BvhNode> nodes;
+  std::vector<int> free_nodes;
+  int root = -1;
+
+  // Leaf holding each model slot, -1 if the slot isn't in the tree
+  std::vector<int> item_leaf;
+
+  // Sum of the surface area of every node. Used as the quality metric.
+  float total_area = 0.0f;
+  float built_area = 0.0f;
+
+  unsigned rebuild_count = 0;
+};
+
+// Full binned SAH build over every model in the storage
+void bvh_build(Bvh *bvh, const ModelStorage *models);
+
+// Inserts new models and refits moved ones from models->moved_slots, then clears
+// the list. Rebuilds the whole tree if it degraded past BVH_REBUILD_RATIO.
+void bvh_update(Bvh *bvh, ModelStorage *models);
+
+// Takes a model slot out of the tree. Call before the model is removed from storage.
+void bvh_remove(Bvh *bvh, const ModelStorage *models, unsigned slot);
+
+// Fills visible with the packed indices of shown models whose bounds touch the
+// frustum. Returns the number of tree nodes that were visited. The tree is only
+// read, so several culls can run at once as long as each has its own stack.
+// Keep the stack between culls so it only grows when the tree gets deeper.
+unsigned bvh_cull(const Bvh *bvh, const ModelStorage *models, const Frustum *frustum, std::vector<BvhCullEntry> *stack,
+                  std::vector<unsigned> *visible);
@@ -0,0 +1,142 @@
+#include "command_buffer.h"
+
+#include <assert.h>
+#include <string.h> // memcpy
+
+static Command *push_command(CommandBuffer *buffer, unsigned type)
+{
+  buffer->commands.push_back(Command());
+  Command *command = &buffer->commands.back();
+  command->type = type;
+  command->slot = 0;
+  command->handle = 0;
+  command->second_handle = 0;
+  return command;
+}
+
+static void push_bind(CommandBuffer *buffer, unsigned type, unsigned slot, void *handle)
+{
+  Command *command = push_command(buffer, type);
+  command->slot = slot;
+  command->handle = handle;
+}
+
+void CommandRecorder::set_vertex_buffer(unsigned slot, void *vertex_buffer, unsigned stride)
+{
+  Command *command = push_command(buffer, COMMAND_SET_VERTEX_BUFFER);
+  command->slot = slot;
+  command->handle = vertex_buffer;
+  command->args[0] = stride;
+}
+
+void CommandRecorder::set_index_buffer(void *index_buffer) { push_bind(buffer, COMMAND_SET_INDEX_BUFFER, 0, index_buffer); }
+
+void CommandRecorder::set_topology(unsigned topology)
+{
+  Command *command = push_command(buffer, COMMAND_SET_TOPOLOGY);
+  command->args[0] = topology;
+}
+
+void CommandRecorder::set_input_layout(void *layout) { push_bind(buffer, COMMAND_SET_INPUT_LAYOUT, 0, layout); }
+void CommandRecorder::set_vertex_shader(void *shader) { push_bind(buffer, COMMAND_SET_VERTEX_SHADER, 0, shader); }
+void CommandRecorder::set_pixel_shader(void *shader) { push_bind(buffer, COMMAND_SET_PIXEL_SHADER, 0, shader); }
+void CommandRecorder::set_vs_constant_buffer(unsigned slot, void *constants) { push_bind(buffer, COMMAND_SET_VS_CONSTANT_BUFFER, slot, constants); }
+void CommandRecorder::set_ps_constant_buffer(unsigned slot, void *constants) { push_bind(buffer, COMMAND_SET_PS_CONSTANT_BUFFER, slot, constants); }
+void CommandRecorder::set_ps_resource(unsigned slot, void *resource) { push_bind(buffer, COMMAND_SET_PS_RESOURCE, slot, resource); }
+void CommandRecorder::set_ps_sampler(unsigned slot, void *sampler) { push_bind(buffer, COMMAND_SET_PS_SAMPLER, slot, sampler); }
+void CommandRecorder::set_depth_stencil_state(void *state) { push_bind(buffer, COMMAND_SET_DEPTH_STENCIL_STATE, 0, state); }
+
+void CommandRecorder::set_render_target(void *render_target, void *depth_stencil)
+{
+  Command *command = push_command(buffer, COMMAND_SET_RENDER_TARGET);
+  command->handle = render_target;
+  command->second_handle = depth_stencil;
+}
+
+void clear_command_buffer(CommandBuffer *buffer)
+{
+  buffer->commands.clear();
+  buffer->data.clear();
+}
+
+void record_update_buffer(CommandBuffer *buffer, void *target, const void *data, unsigned size)
+{
+  Command *command = push_command(buffer, COMMAND_UPDATE_BUFFER);
+  command->handle = target;
+  command->args[0] = buffer->data.size();
+  command->args[1] = size;
+  buffer->data.resize(buffer->data.size() + size);
+  memcpy(&buffer->data[command->args[0]], data, size);
+}
+
+void record_draw(CommandBuffer *buffer, unsigned index_count, unsigned instance_count, unsigned first_index, unsigned base_vertex,
+                 unsigned first_instance)
+{
+  Command *command = push_command(buffer, COMMAND_DRAW_INDEXED);
+  command->args[0] = index_count;
+  command->args[1] = instance_count;
+  command->args[2] = first_index;
+  command->args[3] = base_vertex;
+  command->args[4] = first_instance;
+}
+
+void append_command_buffer(CommandBuffer *destination, const CommandBuffer *source, unsigned instance_offset)
+{
+  unsigned start = destination->commands.size();
+  unsigned data_offset = destination->data.size();
+  destination->commands.insert(destination->commands.end(), source->commands.begin(), source->commands.end());
+  destination->data.insert(destination->data.end(), source->data.begin(), source->data.end());
+
+  for(unsigned i = start; i < destination->commands.size(); i++)
+  {
+    Command *command = &destination->commands[i];
+    if(command->type == COMMAND_DRAW_INDEXED)
+    {
+      command->args[4] += instance_offset;
+    }
+    else if(command->type == COMMAND_UPDATE_BUFFER)
+    {
+      command->args[0] += data_offset;
+    }
+  }
+}
+
+unsigned replay_command_buffer(const CommandBuffer *buffer, StateCache *state, CommandBackend *backend, unsigned first_instance)
+{
+  assert(state->backend == backend);
+
+  unsigned draws = 0;
+  for(unsigned i = 0; i < buffer->commands.size(); i++)
+  {
+    const Command *command = &buffer->commands[i];
+    switch(command->type)
+    {
+      case COMMAND_SET_VERTEX_BUFFER:       state_set_vertex_buffer(state, command->slot, command->handle, command->args[0]); break;
+      case COMMAND_SET_INDEX_BUFFER:        state_set_index_buffer(state, command->handle); break;
+      case COMMAND_SET_TOPOLOGY:            state_set_topology(state, command->args[0]); break;
+      case COMMAND_SET_INPUT_LAYOUT:        state_set_input_layout(state, command->handle); break;
+      case COMMAND_SET_VERTEX_SHADER:       state_set_vertex_shader(state, command->handle); break;
+      case COMMAND_SET_PIXEL_SHADER:        state_set_pixel_shader(state, command->handle); break;
+      case COMMAND_SET_VS_CONSTANT_BUFFER:  state_set_vs_constant_buffer(state, command->slot, command->handle); break;
+      case COMMAND_SET_PS_CONSTANT_BUFFER:  state_set_ps_constant_buffer(state, command->slot, command->handle); break;
+      case COMMAND_SET_PS_RESOURCE:         state_set_ps_resource(state, command->slot, command->handle); break;
+      case COMMAND_SET_PS_SAMPLER:          state_set_ps_sampler(state, command->slot, command->handle); break;
+      case COMMAND_SET_DEPTH_STENCIL_STATE: state_set_depth_stencil_state(state, command->handle); break;
+      case COMMAND_SET_RENDER_TARGET:       state_set_render_target(state, command->handle, command->second_handle); break;
+
+      // Contents aren't state, nothing to filter
+      case COMMAND_UPDATE_BUFFER: backend->update_buffer(command->handle, &buffer->data[command->args[0]], command->args[1]); break;
+
+      case COMMAND_DRAW_INDEXED:
+      {
+        backend->draw_indexed(command->args[0], command->args[1], command->args[2], command->args[3], command->args[4] + first_instance);
+        draws++;
+        break;
+      }
+
+      default: assert(false && "Unknown command");
+    }
+  }
+
+  return draws;
+}
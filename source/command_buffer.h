@@ -0,0 +1,125 @@
+#pragma once
+
+#include "state_cache.h" // StateBackend, StateCache
+
+#include <vector>
+
+// Draws and binds recorded as plain data so they can be built on any thread and
+// replayed later into whichever backend is in use. Handles are opaque, like in
+// the state cache.
+
+enum CommandType
+{
+  COMMAND_SET_VERTEX_BUFFER,
+  COMMAND_SET_INDEX_BUFFER,
+  COMMAND_SET_TOPOLOGY,
+  COMMAND_SET_INPUT_LAYOUT,
+  COMMAND_SET_VERTEX_SHADER,
+  COMMAND_SET_PIXEL_SHADER,
+  COMMAND_SET_VS_CONSTANT_BUFFER,
+  COMMAND_SET_PS_CONSTANT_BUFFER,
+  COMMAND_SET_PS_RESOURCE,
+  COMMAND_SET_PS_SAMPLER,
+  COMMAND_SET_DEPTH_STENCIL_STATE,
+  COMMAND_SET_RENDER_TARGET,
+  COMMAND_UPDATE_BUFFER,
+  COMMAND_DRAW_INDEXED,
+};
+
+struct Command
+{
+  unsigned type;
+  unsigned slot;
+
+  // Buffer, shader, view or state for binds. Render target binds put the
+  // depth stencil in second_handle.
+  void *handle;
+  void *second_handle;
+
+  // Binds: args[0] is the vertex stride or topology.
+  // Updates: offset of the new contents in the buffer's data, and their size.
+  // Draws: index count, instance count, first index, base vertex, first instance.
+  unsigned args[5];
+};
+
+struct CommandBuffer
+{
+  std::vector<Command> commands;
+  std::vector<unsigned char> data; // What update commands write
+};
+
+// What recorded commands replay into
+struct CommandBackend : StateBackend
+{
+  // Replaces the whole contents of a dynamic buffer, like constants. Draws
+  // already made keep what they read before.
+  virtual void update_buffer(void *buffer, const void *data, unsigned size) = 0;
+
+  virtual void draw_indexed(unsigned index_count, unsigned instance_count, unsigned first_index, unsigned base_vertex,
+                            unsigned first_instance) = 0;
+};
+
+// Records binds into a command buffer. Put a StateCache in front of it so the
+// recording only keeps binds that change something.
+struct CommandRecorder : StateBackend
+{
+  CommandBuffer *buffer = 0;
+
+  void set_vertex_buffer(unsigned slot, void *buffer, unsigned stride);
+  void set_index_buffer(void *buffer);
+  void set_topology(unsigned topology);
+  void set_input_layout(void *layout);
+  void set_vertex_shader(void *shader);
+  void set_pixel_shader(void *shader);
+  void set_vs_constant_buffer(unsigned slot, void *buffer);
+  void set_ps_constant_buffer(unsigned slot, void *buffer);
+  void set_ps_resource(unsigned slot, void *resource);
+  void set_ps_sampler(unsigned slot, void *sampler);
+  void set_depth_stencil_state(void *state);
+  void set_render_target(void *render_target, void *depth_stencil);
+};
+
+// Counts what reaches it and drops it. Lets recording and replay run and be
+// timed without a graphics API.
+struct NullCommandBackend : CommandBackend
+{
+  unsigned binds = 0;
+  unsigned updates = 0;
+  unsigned draws = 0;
+  unsigned long long indices = 0;
+
+  void set_vertex_buffer(unsigned, void *, unsigned) { binds++; }
+  void set_index_buffer(void *) { binds++; }
+  void set_topology(unsigned) { binds++; }
+  void set_input_layout(void *) { binds++; }
+  void set_vertex_shader(void *) { binds++; }
+  void set_pixel_shader(void *) { binds++; }
+  void set_vs_constant_buffer(unsigned, void *) { binds++; }
+  void set_ps_constant_buffer(unsigned, void *) { binds++; }
+  void set_ps_resource(unsigned, void *) { binds++; }
+  void set_ps_sampler(unsigned, void *) { binds++; }
+  void set_depth_stencil_state(void *) { binds++; }
+  void set_render_target(void *, void *) { binds++; }
+  void update_buffer(void *, const void *, unsigned) { updates++; }
+  void draw_indexed(unsigned index_count, unsigned instance_count, unsigned, unsigned, unsigned)
+  {
+    draws++;
+    indices += (unsigned long long)index_count * instance_count;
+  }
+};
+
+void clear_command_buffer(CommandBuffer *buffer);
+
+// The data is copied into the buffer, so it can go once this returns
+void record_update_buffer(CommandBuffer *buffer, void *target, const void *data, unsigned size);
+
+void record_draw(CommandBuffer *buffer, unsigned index_count, unsigned instance_count, unsigned first_index, unsigned base_vertex,
+                 unsigned first_instance);
+
+// Appends source to destination with instance_offset added to every draw's
+// first instance, for merging buffers whose instance data gets concatenated.
+void append_command_buffer(CommandBuffer *destination, const CommandBuffer *source, unsigned instance_offset);
+
+// Binds go through state so they are filtered against what is already bound.
+// first_instance is added to every draw. Returns the number of draws.
+unsigned replay_command_buffer(const CommandBuffer *buffer, StateCache *state, CommandBackend *backend, unsigned first_instance);
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string.h> // strcmp
+
+// Finds "name value" anywhere in the arguments and takes both out, so the
+// positional arguments stay where they are. 0 if it isn't there.
+static const char *take_option(int *argc, char **argv, const char *name)
+{
+  for(int i = 1; i + 1 < *argc; i++)
+  {
+    if(strcmp(argv[i], name)) continue;
+
+    const char *value = argv[i + 1];
+    for(int j = i; j + 2 < *argc; j++)
+    {
+      argv[j] = argv[j + 2];
+    }
+    *argc -= 2;
+    return value;
+  }
+  return 0;
+}
@@ -0,0 +1,164 @@
+#include "culling.h"
+
+#include <xmmintrin.h> // SSE
+
+Frustum make_frustum(const mat4 &clip_m_world)
+{
+  v4 row0 = v4(clip_m_world[0][0], clip_m_world[0][1], clip_m_world[0][2], clip_m_world[0][3]);
+  v4 row1 = v4(clip_m_world[1][0], clip_m_world[1][1], clip_m_world[1][2], clip_m_world[1][3]);
+  v4 row2 = v4(clip_m_world[2][0], clip_m_world[2][1], clip_m_world[2][2], clip_m_world[2][3]);
+  v4 row3 = v4(clip_m_world[3][0], clip_m_world[3][1], clip_m_world[3][2], clip_m_world[3][3]);
+
+  Frustum frustum;
+  frustum.planes[0] = row3 + row0; // Left
+  frustum.planes[1] = row3 - row0; // Right
+  frustum.planes[2] = row3 + row1; // Bottom
+  frustum.planes[3] = row3 - row1; // Top
+  frustum.planes[4] = row2;        // Near (depth is [0, w])
+  frustum.planes[5] = row3 - row2; // Far
+
+  for(unsigned i = 0; i < 6; i++)
+  {
+    v4 *plane = &frustum.planes[i];
+    float len = length(v3(plane->x, plane->y, plane->z));
+
+    // An infinite far plane comes out as (0, 0, 0, +n) which never rejects anything
+    if(len > 0.0f)
+    {
+      *plane = *plane / len;
+    }
+  }
+
+  return frustum;
+}
+
+BoundingBox transform_bounds(const BoundingBox &box, const mat4 &world_m_model)
+{
+  BoundingBox result;
+  v4 center = world_m_model * v4(box.center, 1.0f);
+  result.center = v3(center.x, center.y, center.z);
+
+  // Each new extent is the sum of the old extents projected onto that axis
+  const float *e = &box.extents.x;
+  float *out = &result.extents.x;
+  for(unsigned row = 0; row < 3; row++)
+  {
+    out[row] = absf(world_m_model[row][0]) * e[0] + absf(world_m_model[row][1]) * e[1] + absf(world_m_model[row][2]) * e[2];
+  }
+
+  return result;
+}
+
+BoundingSphere transform_bounds(const BoundingSphere &sphere, const mat4 &world_m_model)
+{
+  BoundingSphere result;
+  v4 center = world_m_model * v4(sphere.center, 1.0f);
+  result.center = v3(center.x, center.y, center.z);
+
+  // Scale by the longest basis vector so non-uniform scales stay enclosed
+  float scale_squared = 0.0f;
+  for(unsigned col = 0; col < 3; col++)
+  {
+    v3 axis = v3(world_m_model[0][col], world_m_model[1][col], world_m_model[2][col]);
+    float len_squared = length_squared(axis);
+    if(len_squared > scale_squared) scale_squared = len_squared;
+  }
+  result.radius = sphere.radius * (float)sqrt(scale_squared);
+
+  return result;
+}
+
+bool frustum_test_box(const Frustum *frustum, const BoundingBox &box)
+{
+  for(unsigned i = 0; i < 6; i++)
+  {
+    v4 plane = frustum->planes[i];
+    float distance = plane.x * box.center.x + plane.y * box.center.y + plane.z * box.center.z + plane.w;
+    float radius = absf(plane.x) * box.extents.x + absf(plane.y) * box.extents.y + absf(plane.z) * box.extents.z;
+    if(distance + radius < 0.0f) return false;
+  }
+
+  return true;
+}
+
+int frustum_classify_box(const Frustum *frustum, const BoundingBox &box, unsigned plane_mask)
+{
+  unsigned straddling = 0;
+  for(unsigned i = 0; i < 6; i++)
+  {
+    if(!(plane_mask & (1u << i))) continue;
+
+    v4 plane = frustum->planes[i];
+    float distance = plane.x * box.center.x + plane.y * box.center.y + plane.z * box.center.z + plane.w;
+    float radius = absf(plane.x) * box.extents.x + absf(plane.y) * box.extents.y + absf(plane.z) * box.extents.z;
+    if(distance + radius < 0.0f) return -1;
+    if(distance - radius < 0.0f) straddling |= 1u << i;
+  }
+
+  return (int)straddling;
+}
+
+unsigned frustum_test_boxes(const Frustum *frustum,
+                            const float *center_x, const float *center_y, const float *center_z,
+                            const float *extent_x, const float *extent_y, const float *extent_z,
+                            unsigned count, unsigned *visible_indices)
+{
+  // Splat every plane once up front
+  __m128 plane_x[6], plane_y[6], plane_z[6], plane_w[6];
+  __m128 abs_x[6], abs_y[6], abs_z[6];
+  for(unsigned p = 0; p < 6; p++)
+  {
+    v4 plane = frustum->planes[p];
+    plane_x[p] = _mm_set1_ps(plane.x);
+    plane_y[p] = _mm_set1_ps(plane.y);
+    plane_z[p] = _mm_set1_ps(plane.z);
+    plane_w[p] = _mm_set1_ps(plane.w);
+    abs_x[p] = _mm_set1_ps(absf(plane.x));
+    abs_y[p] = _mm_set1_ps(absf(plane.y));
+    abs_z[p] = _mm_set1_ps(absf(plane.z));
+  }
+
+  unsigned num_visible = 0;
+  unsigned i = 0;
+  for(; i + 4 <= count; i += 4)
+  {
+    __m128 cx = _mm_loadu_ps(center_x + i);
+    __m128 cy = _mm_loadu_ps(center_y + i);
+    __m128 cz = _mm_loadu_ps(center_z + i);
+    __m128 ex = _mm_loadu_ps(extent_x + i);
+    __m128 ey = _mm_loadu_ps(extent_y + i);
+    __m128 ez = _mm_loadu_ps(extent_z + i);
+
+    __m128 outside = _mm_setzero_ps();
+    for(unsigned p = 0; p < 6; p++)
+    {
+      __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(plane_x[p], cx), _mm_mul_ps(plane_y[p], cy)),
+                                   _mm_add_ps(_mm_mul_ps(plane_z[p], cz), plane_w[p]));
+      __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(abs_x[p], ex), _mm_mul_ps(abs_y[p], ey)), _mm_mul_ps(abs_z[p], ez));
+      outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+    }
+
+    unsigned visible_mask = ~_mm_movemask_ps(outside) & 0xF;
+    while(visible_mask)
+    {
+      unsigned lane = 0;
+      while(!(visible_mask & (1u << lane))) lane++;
+      visible_mask &= ~(1u << lane);
+      visible_indices[num_visible++] = i + lane;
+    }
+  }
+
+  // Leftovers that don't fill a group of four
+  for(; i < count; i++)
+  {
+    BoundingBox box;
+    box.center = v3(center_x[i], center_y[i], center_z[i]);
+    box.extents = v3(extent_x[i], extent_y[i], extent_z[i]);
+    if(frustum_test_box(frustum, box))
+    {
+      visible_indices[num_visible++] = i;
+    }
+  }
+
+  return num_visible;
+}
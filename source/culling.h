@@ -0,0 +1,46 @@
+#pragma once
+
+#include "my_math.h" // v3, v4, mat4
+
+// Axis aligned box stored as center and half extents
+struct BoundingBox
+{
+  v3 center;
+  v3 extents;
+};
+
+struct BoundingSphere
+{
+  v3 center;
+  float radius = 0.0f;
+};
+
+// Planes point inward. A point p is inside when dot(plane.xyz, p) + plane.w >= 0.
+struct Frustum
+{
+  v4 planes[6];
+};
+
+// Extracts the clip volume planes from a projection * view matrix. Works for
+// perspective and orthographic projections with D3D style [0, 1] depth.
+Frustum make_frustum(const mat4 &clip_m_world);
+
+// Box that encloses the given box after it is transformed by the matrix
+BoundingBox transform_bounds(const BoundingBox &box, const mat4 &world_m_model);
+
+BoundingSphere transform_bounds(const BoundingSphere &sphere, const mat4 &world_m_model);
+
+bool frustum_test_box(const Frustum *frustum, const BoundingBox &box);
+
+// Tests the box against the planes set in plane_mask (bit i for planes[i]).
+// Returns -1 if the box is outside, otherwise the mask of planes the box
+// still straddles. 0 means it is fully inside.
+int frustum_classify_box(const Frustum *frustum, const BoundingBox &box, unsigned plane_mask);
+
+// Tests boxes stored as separate arrays, four at a time with SSE. Writes the
+// indices of the boxes that touch the frustum to visible_indices and returns
+// how many were written.
+unsigned frustum_test_boxes(const Frustum *frustum,
+                            const float *center_x, const float *center_y, const float *center_z,
+                            const float *extent_x, const float *extent_y, const float *extent_z,
+                            unsigned count, unsigned *visible_indices);
@@ -0,0 +1,289 @@
+#include "frame_pipeline.h"
+
+#include <assert.h>
+#include <chrono>
+
+static thread_local SceneSnapshot *thread_simulation_scene;
+static thread_local std::vector<Model> *thread_simulation_free_models;
+
+// Keys and buttons are as of the latest input, mouse movement adds up
+static void merge_input(TraceInput *into, const TraceInput *input)
+{
+  v2 mouse_delta = into->mouse_delta + input->mouse_delta;
+  *into = *input;
+  into->mouse_delta = mouse_delta;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Queue
+////////////////////////////////////////////////////////////////////////////////
+
+SceneSnapshot *begin_snapshot(SnapshotQueue *queue)
+{
+  unsigned published = queue->published.load(std::memory_order_relaxed);
+  while(published - queue->released.load(std::memory_order_acquire) >= 2)
+  {
+    if(queue->closed.load()) return 0;
+    std::this_thread::yield();
+  }
+
+  return &queue->slots[published % 2];
+}
+
+bool publish_snapshot(SnapshotQueue *queue)
+{
+  unsigned published = queue->published.load(std::memory_order_relaxed);
+  assert(published - queue->released.load(std::memory_order_relaxed) < 2 && "Published without a free slot");
+  queue->published.store(published + 1, std::memory_order_release);
+  return !queue->closed.load();
+}
+
+const SceneSnapshot *acquire_snapshot(SnapshotQueue *queue)
+{
+  unsigned released = queue->released.load(std::memory_order_relaxed);
+  while(queue->published.load(std::memory_order_acquire) == released)
+  {
+    if(queue->closed.load()) return 0;
+    std::this_thread::yield();
+  }
+
+  return &queue->slots[released % 2];
+}
+
+void release_snapshot(SnapshotQueue *queue)
+{
+  queue->released.store(queue->released.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+std::vector<Model> *acquired_free_models(SnapshotQueue *queue)
+{
+  return &queue->free_models[queue->released.load(std::memory_order_relaxed) % 2];
+}
+
+std::vector<Model> *begun_free_models(SnapshotQueue *queue)
+{
+  return &queue->free_models[queue->published.load(std::memory_order_relaxed) % 2];
+}
+
+void close_snapshot_queue(SnapshotQueue *queue)
+{
+  queue->closed = true;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Simulation
+////////////////////////////////////////////////////////////////////////////////
+
+void set_simulation_scene(SceneSnapshot *scene, std::vector<Model> *free_models)
+{
+  thread_simulation_scene = scene;
+  thread_simulation_free_models = free_models;
+}
+
+SceneSnapshot *simulation_scene()
+{
+  return thread_simulation_scene;
+}
+
+std::vector<Model> *simulation_free_models()
+{
+  return thread_simulation_free_models;
+}
+
+SceneModel *simulated_model(Model model, bool moving)
+{
+  SceneSnapshot *scene = thread_simulation_scene;
+  if(!scene) return 0;
+
+  // Stale handles only assert, release builds get a scratch model nothing reads
+  SceneModel *simulated = model.index < scene->models.size() ? &scene->models[model.index] : 0;
+  if(!simulated || !simulated->live || simulated->generation != model.generation)
+  {
+    assert(!"Stale model handle");
+    static thread_local SceneModel scratch;
+    scratch = SceneModel();
+    return &scratch;
+  }
+  assert((!moving || simulated->movable) && "Static models can't move");
+  return simulated;
+}
+
+void blend_scene_snapshots(const SceneSnapshot *a, const SceneSnapshot *b, float t, SceneSnapshot *result)
+{
+  // One pass over the models, and vectors keep their capacity so reused
+  // snapshots stop allocating after the first frames
+  result->models.resize(b->models.size());
+  result->commands = b->commands;
+  result->steps = b->steps;
+  result->requests = b->requests;
+  for(unsigned i = 0; i < b->models.size(); i++)
+  {
+    const SceneModel *to = &b->models[i];
+    SceneModel *model = &result->models[i];
+    *model = *to;
+    if(i >= a->models.size()) continue;
+
+    const SceneModel *from = &a->models[i];
+    if(!from->live || !to->live || from->generation != to->generation || !to->movable) continue;
+
+    model->position = from->position + (to->position - from->position) * t;
+    model->scale = from->scale + (to->scale - from->scale) * t;
+    model->orientation = slerp(from->orientation, to->orientation, t);
+  }
+
+  result->camera_position = a->camera_position + (b->camera_position - a->camera_position) * t;
+  v3 looking = a->camera_looking_direction + (b->camera_looking_direction - a->camera_looking_direction) * t;
+  result->camera_looking_direction = length(looking) > 0.0f ? unit(looking) : b->camera_looking_direction;
+}
+
+void init_fixed_timestep(FixedTimestep *timestep, float steps_per_second)
+{
+  assert(steps_per_second > 0.0f);
+  timestep->step = 1.0 / steps_per_second;
+  timestep->accumulator = 0.0;
+}
+
+unsigned advance_fixed_timestep(FixedTimestep *timestep, double seconds)
+{
+  timestep->accumulator += seconds;
+  unsigned steps = (unsigned)(timestep->accumulator / timestep->step);
+  if(steps > MAX_STEPS_PER_FRAME)
+  {
+    steps = MAX_STEPS_PER_FRAME;
+    timestep->accumulator = timestep->step * steps;
+  }
+  timestep->accumulator -= timestep->step * steps;
+  return steps;
+}
+
+float fixed_timestep_alpha(const FixedTimestep *timestep)
+{
+  float alpha = (float)(timestep->accumulator / timestep->step);
+  return alpha < 1.0f ? alpha : 1.0f;
+}
+
+void init_simulation(Simulation *simulation, WorldUpdate update, float steps_per_second)
+{
+  simulation->update = update;
+  simulation->input = TraceInput();
+  init_fixed_timestep(&simulation->timestep, steps_per_second);
+  capture_scene_snapshot(&simulation->scene);
+  simulation->scene.steps = 0;
+  simulation->previous = simulation->scene;
+}
+
+void set_simulation_input(Simulation *simulation, const TraceInput *input)
+{
+  merge_input(&simulation->input, input);
+}
+
+// Runs the world steps times. When it's simulating into its scene, previous
+// gets the scene before the last step.
+static void run_steps(Simulation *simulation, unsigned steps)
+{
+  bool simulating = simulation_scene() == &simulation->scene;
+  for(unsigned i = 0; i < steps; i++)
+  {
+    // Only the state before the last step is blended from, and only the
+    // models and camera of it
+    if(simulating && i + 1 == steps)
+    {
+      simulation->previous.models = simulation->scene.models;
+      simulation->previous.camera_position = simulation->scene.camera_position;
+      simulation->previous.camera_looking_direction = simulation->scene.camera_looking_direction;
+    }
+
+    simulation->update(&simulation->input, &simulation->scene.requests, (float)simulation->timestep.step);
+    simulation->input.mouse_delta = v2();
+    simulation->scene.steps++;
+  }
+}
+
+void simulate_frame(Simulation *simulation, double seconds, SceneSnapshot *blended)
+{
+  unsigned steps = advance_fixed_timestep(&simulation->timestep, seconds);
+  simulation->scene.commands.clear();
+
+  SceneSnapshot *caller_scene = simulation_scene();
+  std::vector<Model> *caller_free_models = simulation_free_models();
+  set_simulation_scene(&simulation->scene, &simulation->free_models);
+  run_steps(simulation, steps);
+  set_simulation_scene(caller_scene, caller_free_models);
+
+  blend_scene_snapshots(&simulation->previous, &simulation->scene, fixed_timestep_alpha(&simulation->timestep), blended);
+}
+
+unsigned step_simulation_directly(Simulation *simulation, double seconds)
+{
+  assert(!simulation_scene() && "Stepped directly from a simulating thread");
+  unsigned steps = advance_fixed_timestep(&simulation->timestep, seconds);
+  run_steps(simulation, steps);
+  return steps;
+}
+
+static void run_simulation(FramePipeline *pipeline)
+{
+  std::chrono::steady_clock::time_point last_frame = std::chrono::steady_clock::now();
+  for(;;)
+  {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = now - last_frame;
+    last_frame = now;
+
+    double seconds = pipeline->frame_seconds > 0.0 ? pipeline->frame_seconds : elapsed.count();
+
+    {
+      std::lock_guard<std::mutex> lock(pipeline->input_mutex);
+      set_simulation_input(&pipeline->simulation, &pipeline->input);
+      pipeline->input.mouse_delta = v2();
+    }
+
+    // Blended straight into the slot the renderer will read
+    SceneSnapshot *blended = begin_snapshot(&pipeline->queue);
+    if(!blended) break;
+
+    // Models made take the freed slots that came back with the slot, and the
+    // ones left go back with it for the renderer to top up, so the world never
+    // holds more than the two batches
+    std::vector<Model> *free_models = begun_free_models(&pipeline->queue);
+    pipeline->simulation.free_models.swap(*free_models);
+    simulate_frame(&pipeline->simulation, seconds, blended);
+    pipeline->simulation.free_models.swap(*free_models);
+    if(!publish_snapshot(&pipeline->queue)) break;
+  }
+}
+
+void start_frame_pipeline(FramePipeline *pipeline, WorldUpdate update, float steps_per_second)
+{
+  init_simulation(&pipeline->simulation, update, steps_per_second);
+  pipeline->thread = std::thread(run_simulation, pipeline);
+}
+
+void set_pipeline_input(FramePipeline *pipeline, const TraceInput *input)
+{
+  std::lock_guard<std::mutex> lock(pipeline->input_mutex);
+  merge_input(&pipeline->input, input);
+}
+
+void apply_next_snapshot(FramePipeline *pipeline, WorldRequests *requests)
+{
+  const SceneSnapshot *snapshot = acquire_snapshot(&pipeline->queue);
+  if(!snapshot) return;
+
+  apply_scene_snapshot(snapshot, acquired_free_models(&pipeline->queue));
+  if(requests) *requests = snapshot->requests;
+  release_snapshot(&pipeline->queue);
+}
+
+void stop_frame_pipeline(FramePipeline *pipeline)
+{
+  close_snapshot_queue(&pipeline->queue);
+  pipeline->thread.join();
+
+  return_free_models(&pipeline->simulation.free_models);
+  for(unsigned i = 0; i < 2; i++) return_free_models(&pipeline->queue.free_models[i]);
+}
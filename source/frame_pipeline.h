@@ -0,0 +1,191 @@
+#pragma once
+
+#include "my_math.h" // v3, v4, quat
+#include "graphics.h" // Model
+#include "scene_commands.h" // Made models and settings
+#include "frame_trace.h" // TraceInput
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Steps the world at a fixed rate and hands the renderer what to draw.
+//
+// The world's graphics.h calls land in the simulation's own copy of the scene
+// instead of the renderer. Each frame runs however many fixed steps the time
+// since the last frame adds up to, then blends the scene before and after the
+// last step by how far into the next step the frame is. The blend is what the
+// renderer gets, so motion stays smooth when there are more frames than steps.
+//
+// Pipelined, the simulation runs on its own thread a frame ahead of the
+// renderer. Each blend is written straight into a slot of a two slot, lock
+// free, single producer queue and published from there. Published snapshots
+// are never written, the render thread applies each one before render() and
+// hands its slot back.
+//
+// Models made or destroyed and settings changed while simulating go with the
+// snapshot as commands, run before it's applied. Slots freed by the renderer
+// come back the other way, handed back with each queue slot the renderer
+// releases, so the world's new models reuse them.
+//
+// The world never reads the platform's input state. The platform samples the
+// input once a frame and hands the simulation a copy, and what the world wants
+// back from the platform, like the cursor locked, goes with the snapshot.
+
+// Most steps one frame runs. Time past that is dropped so after a long hitch
+// the world slows down instead of every following frame getting longer.
+static const unsigned MAX_STEPS_PER_FRAME = 8;
+
+struct SceneModel
+{
+  unsigned generation;
+  bool live;
+  bool movable; // Static models can't move
+  v3 position;
+  v3 scale;
+  quat orientation;
+  v4 color;
+};
+
+// What the world asks of the platform
+struct WorldRequests
+{
+  bool cursor_locked = true; // Hide the cursor and keep it in the window
+};
+
+// Steps the world by the given seconds with the input the platform sampled
+typedef void (*WorldUpdate)(const TraceInput *input, WorldRequests *requests, float seconds);
+
+struct SceneSnapshot
+{
+  std::vector<SceneModel> models; // By handle index
+  v3 camera_position;
+  v3 camera_looking_direction;
+  unsigned long long steps = 0; // Run before this one was taken
+  WorldRequests requests;
+
+  // Calls made since the last snapshot that don't fit in the models
+  std::vector<SceneCommand> commands;
+};
+
+// One producer and one consumer
+struct SnapshotQueue
+{
+  SceneSnapshot slots[2];
+  std::vector<Model> free_models[2]; // Freed model slots handed back with each slot
+  std::atomic<unsigned> published{0};
+  std::atomic<unsigned> released{0};
+  std::atomic<bool> closed{false};
+};
+
+// Producer. Waits for a free slot and returns it to be written, 0 once the
+// queue is closed. The slot holds whatever was last published from it.
+SceneSnapshot *begin_snapshot(SnapshotQueue *queue);
+
+// Producer. Hands the slot begin_snapshot returned to the consumer. False once
+// the queue is closed.
+bool publish_snapshot(SnapshotQueue *queue);
+
+// Consumer. Waits for the oldest snapshot not released yet. 0 once the queue
+// is closed.
+const SceneSnapshot *acquire_snapshot(SnapshotQueue *queue);
+void release_snapshot(SnapshotQueue *queue);
+
+// The freed slots that go back with the slot acquire_snapshot returned, for the
+// consumer to top up before releasing it
+std::vector<Model> *acquired_free_models(SnapshotQueue *queue);
+
+// The freed slots that came back with the slot begin_snapshot returned, for
+// the producer to make models in before publishing it
+std::vector<Model> *begun_free_models(SnapshotQueue *queue);
+
+// Either side. Wakes up whichever one is waiting.
+void close_snapshot_queue(SnapshotQueue *queue);
+
+// The scene graphics.h calls on this thread update instead of the renderer's,
+// 0 for the renderer's, and the freed slots models made in it take first
+void set_simulation_scene(SceneSnapshot *scene, std::vector<Model> *free_models = 0);
+SceneSnapshot *simulation_scene();
+std::vector<Model> *simulation_free_models();
+
+// The simulation's copy of a model, or 0 on threads that aren't simulating.
+// Asserts on stale handles, and on static models when moving.
+SceneModel *simulated_model(Model model, bool moving = false);
+
+// Blends each model and the camera from a to b. Models only alive in b are
+// copied. Every field of result is written, so it can be a reused snapshot.
+void blend_scene_snapshots(const SceneSnapshot *a, const SceneSnapshot *b, float t, SceneSnapshot *result);
+
+struct FixedTimestep
+{
+  double step; // Seconds
+  double accumulator; // Seconds not simulated yet
+};
+
+void init_fixed_timestep(FixedTimestep *timestep, float steps_per_second);
+
+// Adds the seconds since the last frame and returns how many steps to run now
+unsigned advance_fixed_timestep(FixedTimestep *timestep, double seconds);
+
+// How far into the next step the leftover time is, from 0 to 1
+float fixed_timestep_alpha(const FixedTimestep *timestep);
+
+struct Simulation
+{
+  WorldUpdate update;
+  FixedTimestep timestep;
+  TraceInput input; // For the next step. Only the first step of a frame gets the mouse movement.
+
+  SceneSnapshot scene; // What the world sees
+  SceneSnapshot previous; // scene's models and camera before the last step
+
+  // Freed slots the renderer handed back for making models in
+  std::vector<Model> free_models;
+};
+
+// Copies the scene as the renderer has it. The steps can be slower than the frame rate.
+void init_simulation(Simulation *simulation, WorldUpdate update, float steps_per_second);
+
+// The input for the next frame. Mouse movement adds up until a step runs.
+void set_simulation_input(Simulation *simulation, const TraceInput *input);
+
+// Runs the steps that are due on this thread and writes the blend for
+// rendering into blended. Apply it with simulation->free_models so freed
+// slots come back.
+void simulate_frame(Simulation *simulation, double seconds, SceneSnapshot *blended);
+
+// Runs the steps that are due straight against the renderer, on its thread,
+// instead of in the simulation's scene. Nothing is blended, so frames show the
+// last step, but every graphics.h call the world makes is the renderer's own
+// and gets captured. What the world asks of the platform is in
+// simulation->scene.requests. Returns how many steps ran.
+unsigned step_simulation_directly(Simulation *simulation, double seconds);
+
+struct FramePipeline
+{
+  Simulation simulation; // Only touched by the simulation thread once started
+  SnapshotQueue queue;
+  std::thread thread;
+
+  // How far each frame moves the simulation, 0 for the time the frame took
+  double frame_seconds = 0.0;
+
+  // The platform's latest input, taken by the simulation thread each frame
+  std::mutex input_mutex;
+  TraceInput input = {};
+};
+
+// Copies the scene as the renderer has it and starts simulating on a new
+// thread, as far as two snapshots ahead of the renderer
+void start_frame_pipeline(FramePipeline *pipeline, WorldUpdate update, float steps_per_second);
+
+// Hands the simulation thread the input sampled this frame
+void set_pipeline_input(FramePipeline *pipeline, const TraceInput *input);
+
+// Waits for the next update and applies its snapshot to the renderer, and
+// copies out what the world asked of the platform. Call before render().
+void apply_next_snapshot(FramePipeline *pipeline, WorldRequests *requests = 0);
+
+// Frees the slots the simulation was handed and didn't use
+void stop_frame_pipeline(FramePipeline *pipeline);
@@ -0,0 +1,373 @@
+#include "frame_trace.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h> // memcpy, memcmp, memchr, memset, strlen
+
+static const unsigned TRACE_FILE_MAGIC = 0x43525446; // "FTRC"
+static const unsigned TRACE_FILE_VERSION = 1;
+
+static FrameTrace *capturing_trace;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Capture
+////////////////////////////////////////////////////////////////////////////////
+
+// Arguments are stored in native byte order
+static void push_bytes(const void *data, unsigned size)
+{
+  const unsigned char *bytes = (const unsigned char *)data;
+  capturing_trace->data.insert(capturing_trace->data.end(), bytes, bytes + size);
+}
+
+static void push_command(unsigned command)
+{
+  capturing_trace->data.push_back((unsigned char)command);
+}
+
+static void push_model(Model model)
+{
+  push_bytes(&model.index, sizeof(model.index));
+  push_bytes(&model.generation, sizeof(model.generation));
+}
+
+void start_trace_capture(FrameTrace *trace)
+{
+  assert(!capturing_trace);
+  capturing_trace = trace;
+}
+
+void stop_trace_capture()
+{
+  capturing_trace = 0;
+}
+
+void trace_input(const TraceInput *input)
+{
+  if(!capturing_trace) return;
+  if(!memcmp(input, &capturing_trace->last_input, sizeof(TraceInput))) return;
+
+  push_command(TRACE_INPUT);
+  push_bytes(input, sizeof(TraceInput));
+  capturing_trace->last_input = *input;
+}
+
+void trace_end_frame()
+{
+  if(!capturing_trace) return;
+  push_command(TRACE_END_FRAME);
+  capturing_trace->frame_count++;
+}
+
+void trace_create_model(unsigned command, Model handle, const char *model_name, v3 position, v3 scale, v3 rotation)
+{
+  if(!capturing_trace) return;
+  push_command(command);
+  push_model(handle);
+
+  // Stored with the terminator so replays can point straight at it
+  push_bytes(model_name, strlen(model_name) + 1);
+
+  push_bytes(&position, sizeof(v3));
+  push_bytes(&scale, sizeof(v3));
+  push_bytes(&rotation, sizeof(v3));
+}
+
+void trace_destroy_model(Model model)
+{
+  if(!capturing_trace) return;
+  push_command(TRACE_DESTROY_MODEL);
+  push_model(model);
+}
+
+void trace_model_call(unsigned command, Model model, v3 value)
+{
+  if(!capturing_trace) return;
+  push_command(command);
+  push_model(model);
+  push_bytes(&value, sizeof(v3));
+}
+
+void trace_model_call(unsigned command, Model model, v4 value)
+{
+  if(!capturing_trace) return;
+  push_command(command);
+  push_model(model);
+  push_bytes(&value, sizeof(v4));
+}
+
+void trace_setting(unsigned command, unsigned value)
+{
+  if(!capturing_trace) return;
+  push_command(command);
+  push_bytes(&value, sizeof(value));
+}
+
+void trace_camera_call(unsigned command, v3 value)
+{
+  if(!capturing_trace) return;
+  push_command(command);
+  push_bytes(&value, sizeof(v3));
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Files
+////////////////////////////////////////////////////////////////////////////////
+
+bool write_trace_file(const FrameTrace *trace, const char *file_name)
+{
+  FILE *file = fopen(file_name, "wb");
+  if(!file) return false;
+
+  unsigned header[4] = {TRACE_FILE_MAGIC, TRACE_FILE_VERSION, trace->frame_count, (unsigned)trace->data.size()};
+  bool written = fwrite(header, sizeof(header), 1, file) == 1;
+  if(written && !trace->data.empty()) written = fwrite(trace->data.data(), trace->data.size(), 1, file) == 1;
+
+  fclose(file);
+  return written;
+}
+
+bool read_trace_file(FrameTrace *trace, const char *file_name)
+{
+  FILE *file = fopen(file_name, "rb");
+  if(!file) return false;
+
+  // The header's size has to match what's left of the file before anything is
+  // allocated for it, and every frame takes at least its end byte
+  unsigned header[4];
+  bool read = fread(header, sizeof(header), 1, file) == 1 && header[0] == TRACE_FILE_MAGIC && header[1] == TRACE_FILE_VERSION;
+  if(read)
+  {
+    long start = ftell(file);
+    read = fseek(file, 0, SEEK_END) == 0;
+    long end = ftell(file);
+    read = read && start >= 0 && end >= start && (unsigned long)(end - start) == header[3] && header[2] <= header[3];
+    read = read && fseek(file, start, SEEK_SET) == 0;
+  }
+  if(read)
+  {
+    trace->frame_count = header[2];
+    trace->data.resize(header[3]);
+    if(header[3]) read = fread(trace->data.data(), header[3], 1, file) == 1;
+  }
+
+  fclose(file);
+  return read;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Replay
+////////////////////////////////////////////////////////////////////////////////
+
+// The first problem found stops the replay. Reads past it come back zeroed.
+static void fail_replay(TraceReplay *replay, const char *error)
+{
+  if(!replay->error) replay->error = error;
+}
+
+static void read_bytes(TraceReplay *replay, void *data, unsigned size)
+{
+  if(replay->error || size > replay->trace->data.size() - replay->offset)
+  {
+    fail_replay(replay, "trace is cut short");
+    memset(data, 0, size);
+    return;
+  }
+  memcpy(data, &replay->trace->data[replay->offset], size);
+  replay->offset += size;
+}
+
+static v3 read_v3(TraceReplay *replay)
+{
+  v3 value;
+  read_bytes(replay, &value, sizeof(v3));
+  return value;
+}
+
+static v4 read_v4(TraceReplay *replay)
+{
+  v4 value;
+  read_bytes(replay, &value, sizeof(v4));
+  return value;
+}
+
+// The live model a recorded handle stands for
+static Model read_model(TraceReplay *replay)
+{
+  Model recorded;
+  read_bytes(replay, &recorded.index, sizeof(recorded.index));
+  read_bytes(replay, &recorded.generation, sizeof(recorded.generation));
+  if(replay->error) return Model();
+  if(recorded.index >= replay->models.size())
+  {
+    fail_replay(replay, "model used before it was made");
+    return Model();
+  }
+  return replay->models[recorded.index];
+}
+
+// Points into the trace, so the terminator has to be in it
+static const char *read_model_name(TraceReplay *replay)
+{
+  const std::vector<unsigned char> *data = &replay->trace->data;
+  if(replay->error) return 0;
+
+  const void *end = memchr(data->data() + replay->offset, 0, data->size() - replay->offset);
+  if(!end)
+  {
+    fail_replay(replay, "model name runs past the end of the trace");
+    return 0;
+  }
+
+  const char *model_name = (const char *)&(*data)[replay->offset];
+  replay->offset = (unsigned)((const unsigned char *)end - data->data()) + 1;
+  return model_name;
+}
+
+void start_trace_replay(TraceReplay *replay, const FrameTrace *trace)
+{
+  replay->trace = trace;
+  replay->offset = 0;
+  replay->frame = 0;
+  replay->models.clear();
+  replay->input = TraceInput();
+  replay->error = 0;
+}
+
+bool replay_trace_frame(TraceReplay *replay)
+{
+  const std::vector<unsigned char> *data = &replay->trace->data;
+  if(replay->error || replay->frame >= replay->trace->frame_count) return false;
+
+  // Each command's arguments are all read and checked before it's called
+  while(replay->offset < data->size())
+  {
+    unsigned command = (*data)[replay->offset++];
+    switch(command)
+    {
+      case TRACE_END_FRAME:
+      {
+        replay->frame++;
+        return true;
+      }
+
+      case TRACE_INPUT:
+      {
+        TraceInput input;
+        read_bytes(replay, &input, sizeof(TraceInput));
+        if(replay->error) return false;
+        replay->input = input;
+        break;
+      }
+
+      case TRACE_CREATE_MODEL:
+      case TRACE_CREATE_STATIC_MODEL:
+      {
+        Model recorded;
+        read_bytes(replay, &recorded.index, sizeof(recorded.index));
+        read_bytes(replay, &recorded.generation, sizeof(recorded.generation));
+        const char *model_name = read_model_name(replay);
+        v3 position = read_v3(replay);
+        v3 scale = read_v3(replay);
+        v3 rotation = read_v3(replay);
+
+        // Every model made takes more than a byte of the trace, which bounds
+        // the indices a real one can have
+        if(!replay->error && recorded.index >= data->size()) fail_replay(replay, "model index out of range");
+        if(replay->error) return false;
+
+        if(recorded.index >= replay->models.size()) replay->models.resize(recorded.index + 1);
+        replay->models[recorded.index] = command == TRACE_CREATE_STATIC_MODEL ?
+          create_static_model(model_name, position, scale, rotation) : create_model(model_name, position, scale, rotation);
+        break;
+      }
+
+      case TRACE_DESTROY_MODEL:
+      {
+        Model model = read_model(replay);
+        if(replay->error) return false;
+        destroy_model(model);
+        break;
+      }
+
+      case TRACE_SET_MODEL_POSITION:
+      case TRACE_CHANGE_MODEL_POSITION:
+      case TRACE_SET_MODEL_SCALE:
+      case TRACE_CHANGE_MODEL_SCALE:
+      case TRACE_SET_MODEL_ROTATION:
+      case TRACE_CHANGE_MODEL_ROTATION:
+      {
+        Model model = read_model(replay);
+        v3 value = read_v3(replay);
+        if(replay->error) return false;
+
+        switch(command)
+        {
+          case TRACE_SET_MODEL_POSITION:    set_model_position(model, value);    break;
+          case TRACE_CHANGE_MODEL_POSITION: change_model_position(model, value); break;
+          case TRACE_SET_MODEL_SCALE:       set_model_scale(model, value);       break;
+          case TRACE_CHANGE_MODEL_SCALE:    change_model_scale(model, value);    break;
+          case TRACE_SET_MODEL_ROTATION:    set_model_rotation(model, value);    break;
+          case TRACE_CHANGE_MODEL_ROTATION: change_model_rotation(model, value); break;
+        }
+        break;
+      }
+
+      case TRACE_SET_MODEL_ORIENTATION:
+      {
+        Model model = read_model(replay);
+        v4 orientation = read_v4(replay);
+        if(replay->error) return false;
+        set_model_orientation(model, quat(orientation.x, orientation.y, orientation.z, orientation.w));
+        break;
+      }
+
+      case TRACE_SET_MODEL_COLOR:
+      {
+        Model model = read_model(replay);
+        v4 color = read_v4(replay);
+        if(replay->error) return false;
+        set_model_color(model, Color(color.x, color.y, color.z, color.w));
+        break;
+      }
+
+      case TRACE_SHOW_SHADOW_MAP_PREVIEW:
+      case TRACE_SET_SHADOW_MAP_RESOLUTION:
+      case TRACE_SET_OCCLUSION_CULLING:
+      {
+        unsigned value;
+        read_bytes(replay, &value, sizeof(value));
+        if(replay->error) return false;
+        if(command == TRACE_SHOW_SHADOW_MAP_PREVIEW) show_shadow_map_preview(value != 0);
+        else if(command == TRACE_SET_SHADOW_MAP_RESOLUTION) set_shadow_map_resolution(value);
+        else set_occlusion_culling(value != 0);
+        break;
+      }
+
+      case TRACE_SET_CAMERA_POSITION:
+      case TRACE_SET_CAMERA_LOOKING_DIRECTION:
+      {
+        v3 value = read_v3(replay);
+        if(replay->error) return false;
+        if(command == TRACE_SET_CAMERA_POSITION) set_camera_position(value);
+        else set_camera_looking_direction(value);
+        break;
+      }
+
+      default:
+      {
+        fail_replay(replay, "unknown trace command");
+        return false;
+      }
+    }
+  }
+
+  fail_replay(replay, "trace ended in the middle of a frame");
+  return false;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "my_math.h" // v2, v3, v4
+#include "graphics.h" // Model
+
+#include <vector>
+
+// Records everything the game tells graphics.h plus the input it saw, frame by
+// frame, so the same workload can be replayed without the game for measuring
+// the renderer.
+//
+// The trace is a byte stream of commands, each a one byte id followed by its
+// arguments. Getters aren't recorded since replaying the setters gives the
+// same answers. Input is only written on frames it changed.
+
+static const unsigned TRACE_MAX_KEYS = 192; // Virtual key codes
+static const unsigned TRACE_KEY_WORDS = TRACE_MAX_KEYS / 32;
+
+enum TraceCommand
+{
+  TRACE_END_FRAME,
+  TRACE_INPUT,
+
+  TRACE_CREATE_MODEL,
+  TRACE_CREATE_STATIC_MODEL,
+  TRACE_DESTROY_MODEL,
+
+  TRACE_SET_MODEL_POSITION,
+  TRACE_CHANGE_MODEL_POSITION,
+  TRACE_SET_MODEL_SCALE,
+  TRACE_CHANGE_MODEL_SCALE,
+  TRACE_SET_MODEL_ROTATION,
+  TRACE_CHANGE_MODEL_ROTATION,
+  TRACE_SET_MODEL_ORIENTATION,
+  TRACE_SET_MODEL_COLOR,
+
+  TRACE_SHOW_SHADOW_MAP_PREVIEW,
+  TRACE_SET_SHADOW_MAP_RESOLUTION,
+  TRACE_SET_OCCLUSION_CULLING,
+
+  TRACE_SET_CAMERA_POSITION,
+  TRACE_SET_CAMERA_LOOKING_DIRECTION,
+};
+
+struct TraceInput
+{
+  unsigned keys[TRACE_KEY_WORDS]; // Bit per key that's down
+  unsigned mouse_buttons; // Bit per button that's down
+  v2 mouse_delta;
+};
+
+struct FrameTrace
+{
+  std::vector<unsigned char> data;
+  unsigned frame_count = 0;
+
+  TraceInput last_input = {}; // What the input was as of the last frame written
+};
+
+// Every graphics.h call after this is written into trace until the capture
+// stops. Only one trace captures at a time.
+void start_trace_capture(FrameTrace *trace);
+void stop_trace_capture();
+
+// Called by the platform once per frame, before updating the world
+void trace_input(const TraceInput *input);
+
+// Called by the platform after render()
+void trace_end_frame();
+
+// Called by the renderers from the graphics.h calls that change anything, as
+// the calls run on the render thread. They do nothing unless capturing.
+void trace_create_model(unsigned command, Model handle, const char *model_name, v3 position, v3 scale, v3 rotation);
+void trace_destroy_model(Model model);
+void trace_model_call(unsigned command, Model model, v3 value);
+void trace_model_call(unsigned command, Model model, v4 value);
+void trace_setting(unsigned command, unsigned value);
+void trace_camera_call(unsigned command, v3 value);
+
+bool write_trace_file(const FrameTrace *trace, const char *file_name);
+
+// False when the file can't be read or its header doesn't match what follows.
+// The commands themselves are checked as they're replayed.
+bool read_trace_file(FrameTrace *trace, const char *file_name);
+
+struct TraceReplay
+{
+  const FrameTrace *trace;
+  unsigned offset = 0;
+  unsigned frame = 0;
+
+  // Live handle for each model index in the trace. Models made by the replay
+  // keep pointing at their names in the trace, so it has to outlive them.
+  std::vector<Model> models;
+
+  TraceInput input = {}; // As of the last replayed frame
+
+  // Set when the trace turned out to be cut short or corrupt. Commands before
+  // the bad one in that frame were already made.
+  const char *error = 0;
+};
+
+void start_trace_replay(TraceReplay *replay, const FrameTrace *trace);
+
+// Makes one frame's graphics.h calls and updates replay->input. Returns false
+// when there are no frames left, or with replay->error set when the trace is
+// broken.
+bool replay_trace_frame(TraceReplay *replay);
@@ -1,11 +1,26 @@
 
 #pragma once
 
-#include "my_math.h" // v3, Color
+#include "my_math.h" // v3, quat, Color
 
-typedef int Model;
+#include <vector>
+
+// Any thread can call these. Calls off the render thread are queued until
+// the next render(), see scene_commands.h.
+
+// Handle to a model. The generation is bumped every time a slot is reused so
+// handles to destroyed models are detected instead of aliasing a new model.
+struct Model
+{
+  unsigned index = 0xFFFFFFFF;
+  unsigned generation = 0;
+};
 
 Model create_model(const char *model_name, v3 position = v3(), v3 scale = v3(1.0f, 1.0f, 1.0f), v3 rotation = v3());
+// Static models are merged into shared buffers and can't be moved afterwards
+Model create_static_model(const char *model_name, v3 position = v3(), v3 scale = v3(1.0f, 1.0f, 1.0f), v3 rotation = v3());
+void destroy_model(Model model);
+bool is_model_valid(Model model);
 
 void set_model_position(Model model, v3 pos);
 v3   get_model_position(Model model);
@@ -15,12 +30,25 @@ void set_model_scale(Model model, v3 scale);
 v3   get_model_scale(Model model);
 void change_model_scale(Model model, v3 scale);
 
+// Euler angles in degrees, applied as z, then x, then y
 void set_model_rotation(Model model, v3 rotation);
 v3   get_model_rotation(Model model);
 void change_model_rotation(Model model, v3 rotation);
 
+void set_model_orientation(Model model, quat orientation);
+quat get_model_orientation(Model model);
+
 void set_model_color(Model model, Color color);
 
+// Draws the shadow maps along the top of the screen. On by default.
+void show_shadow_map_preview(bool show);
+
+// Texels along each side of every shadow cascade's map. 512 by default.
+void set_shadow_map_resolution(unsigned resolution);
+
+// Skips models hidden behind the biggest things on screen. On by default.
+void set_occlusion_culling(bool enabled);
+
 
 
 void set_camera_position(v3 position);
@@ -29,3 +57,77 @@ v3 get_camera_position();
 void set_camera_looking_direction(v3 direction);
 v3 get_camera_looking_direction();
 
+
+
+// For running the world on another thread, see frame_pipeline.h
+struct SceneSnapshot;
+
+// Copies the models' transforms and colors and the camera into snapshot
+void capture_scene_snapshot(SceneSnapshot *snapshot);
+
+// Moves and recolors the models that changed to match snapshot, and sets the
+// camera. Tops up free_models with freed slots for the world to make models in.
+void apply_scene_snapshot(const SceneSnapshot *snapshot, std::vector<Model> *free_models);
+
+// Frees the slots apply_scene_snapshot handed out that won't be used
+void return_free_models(std::vector<Model> *free_models);
+
+
+
+// Per frame counters from the last call to render()
+struct RenderStats
+{
+  unsigned main_drawn;
+  unsigned main_culled;
+  unsigned main_occluded; // Part of main_culled
+
+  // Triangles drawn into the occlusion buffer
+  unsigned occluder_triangles;
+
+  // Shadow counts are summed over the shadow cascades
+  unsigned shadow_drawn;
+  unsigned shadow_culled;
+
+  // BVH nodes tested while culling each pass
+  unsigned main_nodes_visited;
+  unsigned shadow_nodes_visited;
+
+  unsigned draw_calls;
+
+  // Bytes written to constant and object buffers
+  unsigned uploaded_bytes;
+
+  // Binds that reached the device and binds the state cache filtered out
+  unsigned state_changes;
+  unsigned redundant_state_changes;
+
+  // Shared buffers meshes are suballocated from, with bytes handed out and
+  // bytes allocated on the GPU
+  unsigned mesh_arenas;
+  unsigned mesh_bytes_used;
+  unsigned mesh_bytes_reserved;
+
+  // Worst of any arena. 0 when free space is in one piece, toward 1 as it splinters.
+  float mesh_fragmentation;
+
+  // Transient render targets in use and the textures they share
+  unsigned render_targets;
+  unsigned render_target_textures;
+
+  // Memory of the shared textures plus the renderer's own shadow caches. The
+  // back buffer and main depth buffer aren't counted.
+  unsigned long long render_target_bytes;
+};
+
+RenderStats get_render_stats();
+
+struct RenderPassTiming
+{
+  const char *name;
+  float milliseconds; // CPU time spent recording and submitting the pass
+  bool culled;
+};
+
+// Fills timings with up to max_timings render passes from the last call to
+// render(), in the order they ran. Returns how many passes there are.
+unsigned get_render_pass_timings(RenderPassTiming *timings, unsigned max_timings);
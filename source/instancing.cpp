@@ -0,0 +1,50 @@
+#include "instancing.h"
+#include "model_storage.h"
+
+void pack_instance(const mat4 &world_m_model, v4 color, InstanceData *out)
+{
+  for(unsigned row = 0; row < 3; row++)
+  {
+    out->world_m_model[row] = v4(world_m_model[row][0], world_m_model[row][1], world_m_model[row][2], world_m_model[row][3]);
+  }
+  out->color = color;
+}
+
+void build_instance_batches(const ModelStorage *models, const unsigned *items, unsigned count, bool match_material,
+                            InstanceBatches *out)
+{
+  out->instances.resize(count);
+  out->batches.clear();
+
+  for(unsigned i = 0; i < count; i++)
+  {
+    unsigned index = items[i];
+    const ModelDrawData *draw = &models->draw_data[index];
+
+    bool same_batch = false;
+    if(out->batches.size())
+    {
+      const ModelDrawData *batch_draw = &models->draw_data[out->batches.back().model_index];
+      same_batch = draw->mesh == batch_draw->mesh;
+      if(match_material)
+      {
+        same_batch = same_batch && draw->shader == batch_draw->shader && draw->texture == batch_draw->texture;
+      }
+    }
+
+    if(same_batch)
+    {
+      out->batches.back().instance_count++;
+    }
+    else
+    {
+      InstanceBatch batch;
+      batch.model_index = index;
+      batch.first_instance = i;
+      batch.instance_count = 1;
+      out->batches.push_back(batch);
+    }
+
+    pack_instance(models->world_matrices[index], models->blend_colors[index], &out->instances[i]);
+  }
+}
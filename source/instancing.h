@@ -0,0 +1,39 @@
+#pragma once
+
+#include "my_math.h" // v4, mat4
+
+#include <vector>
+
+struct ModelStorage;
+
+// Per object data, read by the shaders as a per instance vertex stream. The
+// world matrix is affine so only the top three rows are stored.
+struct InstanceData
+{
+  v4 world_m_model[3];
+  v4 color;
+};
+
+// A run of instances drawn with one call. Everything in the run shares the
+// draw data of model_index.
+struct InstanceBatch
+{
+  unsigned model_index;
+  unsigned first_instance;
+  unsigned instance_count;
+};
+
+struct InstanceBatches
+{
+  std::vector<InstanceData> instances;
+  std::vector<InstanceBatch> batches;
+};
+
+void pack_instance(const mat4 &world_m_model, v4 color, InstanceData *out);
+
+// Splits model indices into runs that share a mesh, and also a shader and
+// texture when match_material is set, and packs their instance data in order.
+// Only neighbouring models are merged so items should already be sorted by
+// state (see render_queue.h).
+void build_instance_batches(const ModelStorage *models, const unsigned *items, unsigned count, bool match_material,
+                            InstanceBatches *out);
@@ -0,0 +1,360 @@
+#include "job_system.h"
+
+#include <assert.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Spins before a worker with nothing to do goes to sleep
+static const unsigned JOB_IDLE_SPINS = 64;
+
+// Slots are atomics so a thief reading one the owner is rewriting only wastes
+// the read, its claim on the slot fails afterwards
+struct JobSlot
+{
+  std::atomic<JobFunction> function;
+  std::atomic<void *> data;
+  std::atomic<JobCounter *> counter;
+};
+
+// Chase-Lev deque. The owner works at the bottom, thieves take from the top.
+struct JobDeque
+{
+  std::atomic<long long> top{0};
+  std::atomic<long long> bottom{0};
+  JobSlot slots[JOB_DEQUE_SIZE];
+};
+
+struct JobSystem
+{
+  unsigned worker_count = 0;
+  JobDeque *deques = 0;
+  std::thread threads[JOB_MAX_WORKERS];
+
+  // Jobs from threads that aren't workers
+  std::mutex shared_mutex;
+  std::vector<Job> shared_jobs;
+  unsigned shared_first = 0; // Taken from the front, reset when drained
+  std::atomic<unsigned> shared_count{0};
+
+  // Idle workers sleep until something is queued
+  std::mutex sleep_mutex;
+  std::condition_variable wake;
+  std::atomic<unsigned> sleeping{0};
+  std::atomic<int> queued{0}; // Queued and not taken yet, briefly negative while a push is finishing
+  std::atomic<bool> quitting{false};
+};
+
+static JobSystem job_system;
+static thread_local int job_worker_index = -1;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Deques
+////////////////////////////////////////////////////////////////////////////////
+
+static void read_slot(JobDeque *deque, long long index, Job *job)
+{
+  JobSlot *slot = &deque->slots[index & (JOB_DEQUE_SIZE - 1)];
+  job->function = slot->function.load(std::memory_order_relaxed);
+  job->data = slot->data.load(std::memory_order_relaxed);
+  job->counter = slot->counter.load(std::memory_order_relaxed);
+}
+
+// Owner only. False when the deque is full.
+static bool push_job(JobDeque *deque, const Job &job)
+{
+  long long bottom = deque->bottom.load(std::memory_order_relaxed);
+  long long top = deque->top.load(std::memory_order_acquire);
+  if(bottom - top >= (long long)JOB_DEQUE_SIZE) return false;
+
+  JobSlot *slot = &deque->slots[bottom & (JOB_DEQUE_SIZE - 1)];
+  slot->function.store(job.function, std::memory_order_relaxed);
+  slot->data.store(job.data, std::memory_order_relaxed);
+  slot->counter.store(job.counter, std::memory_order_relaxed);
+  deque->bottom.store(bottom + 1, std::memory_order_release);
+  return true;
+}
+
+// Owner only, newest first
+static bool pop_job(JobDeque *deque, Job *job)
+{
+  long long bottom = deque->bottom.load(std::memory_order_relaxed) - 1;
+  deque->bottom.store(bottom, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  long long top = deque->top.load(std::memory_order_relaxed);
+
+  if(top > bottom)
+  {
+    deque->bottom.store(bottom + 1, std::memory_order_relaxed);
+    return false;
+  }
+
+  read_slot(deque, bottom, job);
+  if(top < bottom) return true;
+
+  // The last job, thieves could be after it too
+  bool won = deque->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+  deque->bottom.store(bottom + 1, std::memory_order_relaxed);
+  return won;
+}
+
+// Any thread, oldest first
+static bool steal_job(JobDeque *deque, Job *job)
+{
+  long long top = deque->top.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  long long bottom = deque->bottom.load(std::memory_order_acquire);
+  if(top >= bottom) return false;
+
+  read_slot(deque, top, job);
+  return deque->top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Scheduling
+////////////////////////////////////////////////////////////////////////////////
+
+static void execute_job(const Job &job);
+
+static void queue_job(const Job &job)
+{
+  if(!job_system.worker_count)
+  {
+    execute_job(job);
+    return;
+  }
+
+  int worker = job_worker_index;
+  if(worker >= 0)
+  {
+    // A full deque means there's plenty queued already, doing it now is as good
+    if(!push_job(&job_system.deques[worker], job))
+    {
+      execute_job(job);
+      return;
+    }
+  }
+  else
+  {
+    std::lock_guard<std::mutex> lock(job_system.shared_mutex);
+    job_system.shared_jobs.push_back(job);
+    job_system.shared_count++;
+  }
+
+  job_system.queued++;
+  if(job_system.sleeping.load())
+  {
+    // Taking the lock makes sure a worker about to sleep sees the job first
+    { std::lock_guard<std::mutex> lock(job_system.sleep_mutex); }
+    job_system.wake.notify_one();
+  }
+}
+
+static void execute_job(const Job &job)
+{
+  job.function(job.data);
+
+  JobCounter *counter = job.counter;
+  if(!counter) return;
+
+  // Copied first, whoever waits on the counter can free it once it hits zero
+  Job continuation = counter->continuation;
+  if(counter->remaining.fetch_sub(1) == 1 && continuation.function)
+  {
+    queue_job(continuation);
+  }
+}
+
+// Own jobs first, then ones from other threads, then stealing
+static bool find_job(int worker, Job *job)
+{
+  bool found = worker >= 0 && pop_job(&job_system.deques[worker], job);
+
+  if(!found && job_system.shared_count.load())
+  {
+    std::lock_guard<std::mutex> lock(job_system.shared_mutex);
+    if(job_system.shared_first < job_system.shared_jobs.size())
+    {
+      *job = job_system.shared_jobs[job_system.shared_first++];
+      if(job_system.shared_first == job_system.shared_jobs.size())
+      {
+        job_system.shared_jobs.clear();
+        job_system.shared_first = 0;
+      }
+      job_system.shared_count--;
+      found = true;
+    }
+  }
+
+  // Starting after this worker so thieves spread over the victims
+  unsigned count = job_system.worker_count;
+  for(unsigned i = 1; i <= count && !found; i++)
+  {
+    unsigned victim = (unsigned)(worker + i) % count;
+    if((int)victim != worker) found = steal_job(&job_system.deques[victim], job);
+  }
+
+  if(found) job_system.queued--;
+  return found;
+}
+
+static void worker_main(unsigned index)
+{
+  job_worker_index = index;
+
+  unsigned idle = 0;
+  while(!job_system.quitting.load())
+  {
+    Job job;
+    if(find_job(index, &job))
+    {
+      execute_job(job);
+      idle = 0;
+      continue;
+    }
+
+    if(++idle < JOB_IDLE_SPINS)
+    {
+      std::this_thread::yield();
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(job_system.sleep_mutex);
+    job_system.sleeping++;
+    job_system.wake.wait(lock, []{ return job_system.queued.load() > 0 || job_system.quitting.load(); });
+    job_system.sleeping--;
+    idle = 0;
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Interface
+////////////////////////////////////////////////////////////////////////////////
+
+void init_job_system(unsigned worker_count)
+{
+  assert(!job_system.worker_count);
+
+  if(!worker_count) worker_count = std::thread::hardware_concurrency();
+  if(worker_count > JOB_MAX_WORKERS) worker_count = JOB_MAX_WORKERS;
+  if(worker_count < 1) worker_count = 1;
+
+  job_system.deques = new JobDeque[worker_count];
+  job_system.queued = 0;
+  job_system.quitting = false;
+  job_system.worker_count = worker_count;
+  job_worker_index = 0;
+
+  for(unsigned i = 1; i < worker_count; i++)
+  {
+    job_system.threads[i] = std::thread(worker_main, i);
+  }
+}
+
+void shutdown_job_system()
+{
+  assert(job_worker_index == 0 && "Shut down from the thread that started it");
+
+  {
+    std::lock_guard<std::mutex> lock(job_system.sleep_mutex);
+    job_system.quitting = true;
+  }
+  job_system.wake.notify_all();
+
+  for(unsigned i = 1; i < job_system.worker_count; i++)
+  {
+    job_system.threads[i].join();
+  }
+
+  delete[] job_system.deques;
+  job_system.deques = 0;
+  job_system.worker_count = 0;
+  job_worker_index = -1;
+}
+
+unsigned job_worker_count()
+{
+  return job_system.worker_count ? job_system.worker_count : 1;
+}
+
+void run_jobs(const Job *jobs, unsigned count, JobCounter *counter)
+{
+  counter->remaining += count;
+  for(unsigned i = 0; i < count; i++)
+  {
+    Job job = jobs[i];
+    job.counter = counter;
+    queue_job(job);
+  }
+}
+
+void set_continuation(JobCounter *counter, Job job)
+{
+  assert(!counter->remaining.load() && "Set before the counter's jobs are run");
+  if(job.counter) job.counter->remaining++;
+  counter->continuation = job;
+}
+
+void wait_for_counter(JobCounter *counter)
+{
+  int worker = job_worker_index;
+  while(counter->remaining.load())
+  {
+    Job job;
+    if(job_system.worker_count && find_job(worker, &job)) execute_job(job);
+    else std::this_thread::yield();
+  }
+}
+
+struct ParallelRange
+{
+  ParallelForFunction function;
+  void *data;
+  unsigned first;
+  unsigned end;
+};
+
+static void run_parallel_range(void *data)
+{
+  ParallelRange *range = (ParallelRange *)data;
+  range->function(range->data, range->first, range->end);
+}
+
+void parallel_for(unsigned count, unsigned grain, ParallelForFunction function, void *data)
+{
+  if(!count) return;
+  if(grain < 1) grain = 1;
+
+  unsigned range_count = (count + grain - 1) / grain;
+  if(range_count > JOB_MAX_RANGES) range_count = JOB_MAX_RANGES;
+  if(range_count == 1 || job_worker_count() == 1)
+  {
+    function(data, 0, count);
+    return;
+  }
+
+  ParallelRange ranges[JOB_MAX_RANGES];
+  Job jobs[JOB_MAX_RANGES];
+  for(unsigned i = 0; i < range_count; i++)
+  {
+    ranges[i].function = function;
+    ranges[i].data = data;
+    ranges[i].first = (unsigned)((unsigned long long)count * i / range_count);
+    ranges[i].end = (unsigned)((unsigned long long)count * (i + 1) / range_count);
+    jobs[i].function = run_parallel_range;
+    jobs[i].data = &ranges[i];
+  }
+
+  // The first range is done here while the others get picked up
+  JobCounter counter;
+  run_jobs(jobs + 1, range_count - 1, &counter);
+  run_parallel_range(&ranges[0]);
+  wait_for_counter(&counter);
+}
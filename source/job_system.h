@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+
+// Worker threads for spreading work across cores. Each worker owns a work
+// stealing deque: it pushes and pops its own jobs at the bottom, LIFO for
+// locality, and idle workers steal the oldest jobs from the top of the others.
+// Threads that aren't workers hand their jobs over through a locked queue.
+//
+// The thread that calls init_job_system is worker 0 and only runs jobs while
+// it waits on a counter. Everything still works before init, with jobs run
+// right away on the calling thread.
+
+static const unsigned JOB_MAX_WORKERS = 16;
+static const unsigned JOB_DEQUE_SIZE = 4096; // Per worker, a power of two
+
+// Most jobs one parallel_for splits into
+static const unsigned JOB_MAX_RANGES = 256;
+
+struct JobCounter;
+
+typedef void (*JobFunction)(void *data);
+
+struct Job
+{
+  JobFunction function;
+  void *data;
+  JobCounter *counter; // Counted down when the job finishes, can be 0
+};
+
+// How many jobs are still to finish. The jobs' data has to stay alive until
+// it reaches zero.
+struct JobCounter
+{
+  std::atomic<unsigned> remaining{0};
+
+  // Run when remaining drops to zero, if it has a function
+  Job continuation = {};
+};
+
+// worker_count includes the calling thread. 0 for one per core.
+void init_job_system(unsigned worker_count = 0);
+void shutdown_job_system();
+
+// 1 before init
+unsigned job_worker_count();
+
+// Counts the jobs on counter and queues them. Jobs given a counter here
+// replace their own.
+void run_jobs(const Job *jobs, unsigned count, JobCounter *counter);
+
+// Queues job once every job on counter is done. The continuation's own
+// counter is counted now, so waiting on it covers the whole chain.
+void set_continuation(JobCounter *counter, Job job);
+
+// Runs queued jobs on this thread until counter reaches zero
+void wait_for_counter(JobCounter *counter);
+
+// Calls function on [first, end) ranges covering [0, count) across the workers
+// and returns when they're all done. Ranges are at least grain long, longer
+// when that would be more than JOB_MAX_RANGES.
+typedef void (*ParallelForFunction)(void *data, unsigned first, unsigned end);
+void parallel_for(unsigned count, unsigned grain, ParallelForFunction function, void *data);
@@ -0,0 +1,106 @@
+#include "mesh_processing.h"
+
+#include <math.h> // INFINITY, sqrt
+#include <vector>
+
+void normalize_vertices(StaticVertex *vertices, unsigned vertex_count, BoundingBox *box, BoundingSphere *sphere)
+{
+  // Get the min and max values for each axis
+  float min_x = INFINITY;
+  float max_x = -INFINITY;
+  float min_y = INFINITY;
+  float max_y = -INFINITY;
+  float min_z = INFINITY;
+  float max_z = -INFINITY;
+  v3 sum_points = {0.0f, 0.0f, 0.0f};
+  for(unsigned i = 0; i < vertex_count; i++)
+  {
+    min_x = minf(min_x, vertices[i].position.x);
+    max_x = maxf(max_x, vertices[i].position.x);
+    min_y = minf(min_y, vertices[i].position.y);
+    max_y = maxf(max_y, vertices[i].position.y);
+    min_z = minf(min_z, vertices[i].position.z);
+    max_z = maxf(max_z, vertices[i].position.z);
+
+    sum_points += vertices[i].position;
+  }
+
+  // Find center of model
+  sum_points /= (float)vertex_count;
+
+  // Get the max difference in an axis
+  float diff_x = max_x - min_x;
+  float diff_y = max_y - min_y;
+  float diff_z = max_z - min_z;
+
+  float max_diff = maxf(diff_x, maxf(diff_y, diff_z));
+
+  // Bounds after the move and scale below
+  v3 box_center = v3((min_x + max_x) / 2.0f, (min_y + max_y) / 2.0f, (min_z + max_z) / 2.0f);
+  box->center = ((box_center - sum_points) / max_diff) * 2.0f;
+  box->extents = v3(diff_x, diff_y, diff_z) / max_diff;
+  sphere->center = box->center;
+  float max_distance_squared = 0.0f;
+
+  // Move vertices to center and scale down
+  for(unsigned i = 0; i < vertex_count; i++)
+  {
+    // Move centroid to origin
+    vertices[i].position -= sum_points;
+
+    // Scale down to between -1 and 1
+    vertices[i].position = (vertices[i].position / max_diff) * 2.0f;
+
+    max_distance_squared = maxf(max_distance_squared, length_squared(vertices[i].position - sphere->center));
+  }
+
+  sphere->radius = (float)sqrt(max_distance_squared);
+}
+
+void compute_smooth_normals(StaticVertex *vertices, unsigned vertex_count, const unsigned *indices, unsigned index_count)
+{
+  if(vertex_count == 0) return;
+
+  std::vector<float> sums(vertex_count, 0.0f);
+  for(unsigned i = 0; i < vertex_count; i++)
+  {
+    vertices[i].normal = v3(0.0f, 0.0f, 0.0f);
+  }
+
+  // Find the sum of all normals per vertex
+  for(unsigned i = 0; i + 2 < index_count; i += 3)
+  {
+    unsigned p0_index = indices[i];
+    unsigned p1_index = indices[i + 1];
+    unsigned p2_index = indices[i + 2];
+
+    v3 p0 = vertices[p0_index].position;
+    v3 p1 = vertices[p1_index].position;
+    v3 p2 = vertices[p2_index].position;
+
+    v3 normal = cross(p1 - p0, p2 - p0);
+    if(length_squared(normal) == 0.0f)
+    {
+      normal = v3(0.0f, 0.0f, 0.0f);
+    }
+    else
+    {
+      normal = unit(normal);
+    }
+
+    vertices[p0_index].normal += normal;
+    vertices[p1_index].normal += normal;
+    vertices[p2_index].normal += normal;
+
+    sums[p0_index] += 1.0f;
+    sums[p1_index] += 1.0f;
+    sums[p2_index] += 1.0f;
+  }
+
+  // Divide to find average normal per vertex
+  for(unsigned i = 0; i < vertex_count; i++)
+  {
+    if(sums[i] == 0.0f) continue;
+    vertices[i].normal /= sums[i];
+  }
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "static_geometry.h" // StaticVertex
+#include "culling.h" // BoundingBox, BoundingSphere
+
+// Loaded mesh cleanup shared by the renderers. Works on StaticVertex, which
+// has the same layout as every renderer's mesh vertex.
+
+// Moves the vertices' centroid to the origin and scales them so the longest
+// side of their bounds is 2. Fills in the bounds after the move.
+void normalize_vertices(StaticVertex *vertices, unsigned vertex_count, BoundingBox *box, BoundingSphere *sphere);
+
+// Each vertex's normal becomes the average of the triangles using it
+void compute_smooth_normals(StaticVertex *vertices, unsigned vertex_count, const unsigned *indices, unsigned index_count);
@@ -0,0 +1,177 @@
+#include "model_storage.h"
+
+#include <assert.h>
+
+Model reserve_model(ModelStorage *storage)
+{
+  Model model;
+  model.index = storage->reserved_slots++;
+  model.generation = 0;
+  return model;
+}
+
+Model add_model(ModelStorage *storage, Model reserved)
+{
+  unsigned dense = storage->count++;
+
+  storage->positions.push_back(v3());
+  storage->scales.push_back(v3(1.0f, 1.0f, 1.0f));
+  storage->orientations.push_back(quat());
+  storage->world_matrices.push_back(mat4());
+  storage->dirty_flags.push_back(0);
+  storage->flags.push_back(MODEL_FLAG_SHOW);
+  storage->blend_colors.push_back(v4(1.0f, 1.0f, 1.0f, 1.0f));
+  storage->draw_data.push_back(ModelDrawData());
+  storage->local_bounds.push_back(BoundingBox());
+  storage->bounds_center_x.push_back(0.0f);
+  storage->bounds_center_y.push_back(0.0f);
+  storage->bounds_center_z.push_back(0.0f);
+  storage->bounds_extent_x.push_back(0.0f);
+  storage->bounds_extent_y.push_back(0.0f);
+  storage->bounds_extent_z.push_back(0.0f);
+  storage->cold.push_back(ModelColdData());
+
+  // The reserved slot, else a freed one, else a new one
+  unsigned slot_index;
+  if(reserved.index != INVALID_MODEL_INDEX)
+  {
+    slot_index = reserved.index;
+  }
+  else if(storage->free_slots.size())
+  {
+    slot_index = storage->free_slots.back();
+    storage->free_slots.pop_back();
+  }
+  else
+  {
+    slot_index = reserve_model(storage).index;
+  }
+
+  // Slots reserved by other threads and not added yet stay empty
+  if(slot_index >= storage->slots.size())
+  {
+    ModelSlot empty;
+    empty.dense_index = INVALID_MODEL_INDEX;
+    empty.generation = 0;
+    storage->slots.resize(slot_index + 1, empty);
+  }
+  assert(storage->slots[slot_index].dense_index == INVALID_MODEL_INDEX && "Slot already has a model");
+
+  ModelSlot *slot = &storage->slots[slot_index];
+  slot->dense_index = dense;
+  storage->dense_to_slot.push_back(slot_index);
+
+  mark_transform_dirty(storage, dense);
+
+  Model model;
+  model.index = slot_index;
+  model.generation = slot->generation;
+  return model;
+}
+
+void remove_model(ModelStorage *storage, Model model)
+{
+  unsigned dense = model_index(storage, model);
+  assert(dense != INVALID_MODEL_INDEX);
+  if(dense == INVALID_MODEL_INDEX) return;
+
+  // Move the last model into the hole
+  unsigned last = storage->count - 1;
+  if(dense != last)
+  {
+    storage->positions[dense] = storage->positions[last];
+    storage->scales[dense] = storage->scales[last];
+    storage->orientations[dense] = storage->orientations[last];
+    storage->world_matrices[dense] = storage->world_matrices[last];
+    storage->dirty_flags[dense] = storage->dirty_flags[last];
+    storage->flags[dense] = storage->flags[last];
+    storage->blend_colors[dense] = storage->blend_colors[last];
+    storage->draw_data[dense] = storage->draw_data[last];
+    storage->local_bounds[dense] = storage->local_bounds[last];
+    storage->bounds_center_x[dense] = storage->bounds_center_x[last];
+    storage->bounds_center_y[dense] = storage->bounds_center_y[last];
+    storage->bounds_center_z[dense] = storage->bounds_center_z[last];
+    storage->bounds_extent_x[dense] = storage->bounds_extent_x[last];
+    storage->bounds_extent_y[dense] = storage->bounds_extent_y[last];
+    storage->bounds_extent_z[dense] = storage->bounds_extent_z[last];
+    storage->cold[dense] = storage->cold[last];
+
+    unsigned moved_slot = storage->dense_to_slot[last];
+    storage->dense_to_slot[dense] = moved_slot;
+    storage->slots[moved_slot].dense_index = dense;
+  }
+
+  storage->positions.pop_back();
+  storage->scales.pop_back();
+  storage->orientations.pop_back();
+  storage->world_matrices.pop_back();
+  storage->dirty_flags.pop_back();
+  storage->flags.pop_back();
+  storage->blend_colors.pop_back();
+  storage->draw_data.pop_back();
+  storage->local_bounds.pop_back();
+  storage->bounds_center_x.pop_back();
+  storage->bounds_center_y.pop_back();
+  storage->bounds_center_z.pop_back();
+  storage->bounds_extent_x.pop_back();
+  storage->bounds_extent_y.pop_back();
+  storage->bounds_extent_z.pop_back();
+  storage->cold.pop_back();
+  storage->dense_to_slot.pop_back();
+  storage->count--;
+
+  // Bumping the generation invalidates every outstanding handle to this slot
+  ModelSlot *slot = &storage->slots[model.index];
+  slot->generation++;
+  slot->dense_index = INVALID_MODEL_INDEX;
+  storage->free_slots.push_back(model.index);
+}
+
+unsigned model_index(const ModelStorage *storage, Model model)
+{
+  if(model.index >= storage->slots.size()) return INVALID_MODEL_INDEX;
+
+  const ModelSlot *slot = &storage->slots[model.index];
+  if(slot->generation != model.generation) return INVALID_MODEL_INDEX;
+
+  return slot->dense_index;
+}
+
+void mark_transform_dirty(ModelStorage *storage, unsigned index)
+{
+  if(!(storage->dirty_flags[index] & MODEL_DIRTY_WORLD_MATRIX))
+  {
+    storage->dirty_flags[index] |= MODEL_DIRTY_WORLD_MATRIX;
+    storage->dirty_slots.push_back(storage->dense_to_slot[index]);
+  }
+}
+
+void update_world_transforms(ModelStorage *storage)
+{
+  for(unsigned j = 0; j < storage->dirty_slots.size(); j++)
+  {
+    unsigned slot = storage->dirty_slots[j];
+
+    // The model might have been destroyed after it was marked
+    unsigned i = storage->slots[slot].dense_index;
+    if(i == INVALID_MODEL_INDEX) continue;
+
+    if(storage->dirty_flags[i] & MODEL_DIRTY_WORLD_MATRIX)
+    {
+      storage->world_matrices[i] = make_transform_matrix(storage->positions[i], storage->scales[i], storage->orientations[i]);
+
+      BoundingBox world_bounds = transform_bounds(storage->local_bounds[i], storage->world_matrices[i]);
+      storage->bounds_center_x[i] = world_bounds.center.x;
+      storage->bounds_center_y[i] = world_bounds.center.y;
+      storage->bounds_center_z[i] = world_bounds.center.z;
+      storage->bounds_extent_x[i] = world_bounds.extents.x;
+      storage->bounds_extent_y[i] = world_bounds.extents.y;
+      storage->bounds_extent_z[i] = world_bounds.extents.z;
+
+      storage->dirty_flags[i] &= ~MODEL_DIRTY_WORLD_MATRIX;
+      storage->moved_slots.push_back(slot);
+    }
+  }
+
+  storage->dirty_slots.clear();
+}
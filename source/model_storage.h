@@ -0,0 +1,117 @@
+#pragma once
+
+#include "my_math.h" // v3, v4, quat, mat4
+#include "graphics.h" // Model
+#include "culling.h" // BoundingBox
+
+#include <atomic>
+#include <vector>
+
+// Owned by the platform renderer
+struct Mesh;
+struct Shader;
+struct Texture;
+
+enum ModelFlags
+{
+  MODEL_FLAG_SHOW           = 1 << 0,
+  MODEL_FLAG_RENDER_NORMALS = 1 << 1,
+  MODEL_FLAG_STATIC         = 1 << 2, // Drawn from the merged static geometry, never moves
+};
+
+enum ModelDirtyFlags
+{
+  MODEL_DIRTY_WORLD_MATRIX = 1 << 0,
+};
+
+// Everything a pass needs to issue the draw
+struct ModelDrawData
+{
+  Mesh *mesh = 0;
+  Shader *shader = 0;
+  Texture *texture = 0;
+};
+
+// Rarely touched, kept out of the arrays the passes walk
+struct ModelColdData
+{
+  const char *debug_name = "";
+  Mesh *debug_normals_mesh = 0;
+};
+
+struct ModelSlot
+{
+  unsigned dense_index;
+  unsigned generation;
+};
+
+// All models stored as parallel arrays. Every array is packed so indices
+// [0, count) are live models. Destroying a model moves the last model into the
+// hole, so handles go through the slot table instead of pointing at an index.
+struct ModelStorage
+{
+  unsigned count = 0;
+
+  // Hot data
+  std::vector<v3> positions;
+  std::vector<v3> scales;
+  std::vector<quat> orientations;
+  std::vector<mat4> world_matrices;
+  std::vector<unsigned char> dirty_flags;
+  std::vector<unsigned char> flags;
+  std::vector<v4> blend_colors;
+  std::vector<ModelDrawData> draw_data;
+
+  // Model space bounds of the mesh
+  std::vector<BoundingBox> local_bounds;
+
+  // World space bounds, split by component so culling can test several at once
+  std::vector<float> bounds_center_x;
+  std::vector<float> bounds_center_y;
+  std::vector<float> bounds_center_z;
+  std::vector<float> bounds_extent_x;
+  std::vector<float> bounds_extent_y;
+  std::vector<float> bounds_extent_z;
+
+  // Cold data
+  std::vector<ModelColdData> cold;
+
+  // Handle lookup
+  std::vector<unsigned> dense_to_slot;
+  std::vector<ModelSlot> slots;
+  std::vector<unsigned> free_slots;
+
+  // Slots handed out so far. Can be ahead of slots while models reserved on
+  // other threads wait to be added.
+  std::atomic<unsigned> reserved_slots{0};
+
+  // Slots waiting for update_world_transforms. Slots can be stale or repeated.
+  std::vector<unsigned> dirty_slots;
+
+  // Slots whose world bounds changed. Appended by update_world_transforms and
+  // cleared by whoever consumes it (the BVH).
+  std::vector<unsigned> moved_slots;
+};
+
+static const unsigned INVALID_MODEL_INDEX = 0xFFFFFFFF;
+
+// Hands out a slot nothing else will get, so a model can have its handle
+// before it's added. Safe from any thread, the slot is never a reused one.
+Model reserve_model(ModelStorage *storage);
+
+// Adds a model with default values and returns its handle. Uses the reserved
+// handle if there is one.
+Model add_model(ModelStorage *storage, Model reserved = Model());
+
+// Frees the model's slot. The handle and any copies of it become stale.
+void remove_model(ModelStorage *storage, Model model);
+
+// Returns the packed index of the model, or INVALID_MODEL_INDEX if the handle is stale
+unsigned model_index(const ModelStorage *storage, Model model);
+
+// Flags the model's world matrix and bounds to be rebuilt by the next update_world_transforms
+void mark_transform_dirty(ModelStorage *storage, unsigned index);
+
+// Rebuilds the world matrices and world bounds of models that moved since the
+// last call. Only touches models that were marked dirty.
+void update_world_transforms(ModelStorage *storage);
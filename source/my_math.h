@@ -26,6 +26,8 @@ static int clamp(int a, int min, int max) { if(a < min) return min; if(a > max)
 static float clamp(float a, float min, float max) { if(a < min) return min; if(a > max) return max; return a; }
 
 static float absf(float a) { return (a < 0.0f) ? -a : a; } 
+static float minf(float a, float b) { return (a < b) ? a : b; }
+static float maxf(float a, float b) { return (a > b) ? a : b; }
 static float deg_to_rad(float a) { return a * (PI / 180.0f); }
 
 static float rad_to_deg(float a) { return a * (180.0f / PI); }
@@ -271,6 +273,10 @@ static v3 cross(v3 a, v3 b)
   return v;
 }
 
+// Per component min and max
+static v3 component_min(v3 a, v3 b) { return v3(minf(a.x, b.x), minf(a.y, b.y), minf(a.z, b.z)); }
+static v3 component_max(v3 a, v3 b) { return v3(maxf(a.x, b.x), maxf(a.y, b.y), maxf(a.z, b.z)); }
+
 
 
 
@@ -423,6 +429,179 @@ static mat4 make_z_axis_rotation_matrix(float radians)
 
 
 
+///////////////////////////////////////////////////////////////////////////////
+// quaternion struct
+///////////////////////////////////////////////////////////////////////////////
+
+// Unit quaternions are used to store orientations. The vector part is (x, y, z)
+// and the scalar part is w.
+struct quat
+{
+  float x;
+  float y;
+  float z;
+  float w;
+
+  // Default constructor (identity rotation)
+  quat() : x(0.0f), y(0.0f), z(0.0f), w(1.0f) { }
+
+  // Non default constructor
+  quat(float in_x, float in_y, float in_z, float in_w) : x(in_x), y(in_y), z(in_z), w(in_w) { }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// quaternion operations
+///////////////////////////////////////////////////////////////////////////////
+
+// Hamilton product. Rotating by (a * b) rotates by b first, then by a.
+static quat operator*(quat a, quat b)
+{
+  return quat(a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+              a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+              a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+              a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z);
+}
+
+static float dot(quat a, quat b) { return (a.x * b.x) + (a.y * b.y) + (a.z * b.z) + (a.w * b.w); }
+
+static quat conjugate(quat q) { return quat(-q.x, -q.y, -q.z, q.w); }
+
+static quat unit(quat q)
+{
+  float inv_len = 1.0f / (float)sqrt(dot(q, q));
+  return quat(q.x * inv_len, q.y * inv_len, q.z * inv_len, q.w * inv_len);
+}
+
+// Axis must be unit length
+static quat make_axis_angle_quat(v3 axis, float radians)
+{
+  float s = (float)sin(radians * 0.5f);
+  float c = (float)cos(radians * 0.5f);
+  return quat(axis.x * s, axis.y * s, axis.z * s, c);
+}
+
+// Euler angles in radians. Applied as z (roll), then x (pitch), then y (yaw)
+// which matches make_y_axis_rotation_matrix * make_x_axis_rotation_matrix * make_z_axis_rotation_matrix.
+static quat make_euler_quat(v3 radians)
+{
+  float sx = (float)sin(radians.x * 0.5f);
+  float cx = (float)cos(radians.x * 0.5f);
+  float sy = (float)sin(radians.y * 0.5f);
+  float cy = (float)cos(radians.y * 0.5f);
+  float sz = (float)sin(radians.z * 0.5f);
+  float cz = (float)cos(radians.z * 0.5f);
+
+  // Expanded form of quat(0, sy, 0, cy) * quat(sx, 0, 0, cx) * quat(0, 0, sz, cz)
+  return quat(cy * sx * cz + sy * cx * sz,
+              sy * cx * cz - cy * sx * sz,
+              cy * cx * sz - sy * sx * cz,
+              cy * cx * cz + sy * sx * sz);
+}
+
+// Inverse of make_euler_quat. Returns euler angles in radians.
+static v3 quat_to_euler(quat q)
+{
+  float m02 = 2.0f * (q.x * q.z + q.w * q.y);
+  float m10 = 2.0f * (q.x * q.y + q.w * q.z);
+  float m11 = 1.0f - 2.0f * (q.x * q.x + q.z * q.z);
+  float m12 = 2.0f * (q.y * q.z - q.w * q.x);
+  float m22 = 1.0f - 2.0f * (q.x * q.x + q.y * q.y);
+
+  float pitch = (float)asin(clamp(-m12, -1.0f, 1.0f));
+  if(absf(m12) > 0.999999f)
+  {
+    // Gimbal lock, put all of the rotation into yaw
+    float m00 = 1.0f - 2.0f * (q.y * q.y + q.z * q.z);
+    float m20 = 2.0f * (q.x * q.z - q.w * q.y);
+    return v3(pitch, atan2f(-m20, m00), 0.0f);
+  }
+
+  return v3(pitch, atan2f(m02, m22), atan2f(m10, m11));
+}
+
+// Rotates a vector by a unit quaternion
+static v3 rotate(quat q, v3 v)
+{
+  // v + 2w(u x v) + 2(u x (u x v)) where u is the vector part
+  v3 u = v3(q.x, q.y, q.z);
+  v3 t = cross(u, v) * 2.0f;
+  return v + t * q.w + cross(u, t);
+}
+
+// Spherical interpolation along the shortest arc between two unit quaternions
+static quat slerp(quat a, quat b, float t)
+{
+  float cos_theta = dot(a, b);
+
+  // q and -q are the same rotation, flip to take the short way around
+  if(cos_theta < 0.0f)
+  {
+    b = quat(-b.x, -b.y, -b.z, -b.w);
+    cos_theta = -cos_theta;
+  }
+
+  float wa;
+  float wb;
+  if(cos_theta > 0.9995f)
+  {
+    // Nearly parallel, sin(theta) goes to zero so fall back to a normalized lerp
+    wa = 1.0f - t;
+    wb = t;
+  }
+  else
+  {
+    float theta = (float)acos(cos_theta);
+    float inv_sin_theta = 1.0f / (float)sin(theta);
+    wa = (float)sin((1.0f - t) * theta) * inv_sin_theta;
+    wb = (float)sin(t * theta) * inv_sin_theta;
+  }
+
+  quat result = quat(a.x * wa + b.x * wb,
+                     a.y * wa + b.y * wb,
+                     a.z * wa + b.z * wb,
+                     a.w * wa + b.w * wb);
+  return unit(result);
+}
+
+// Builds a rotation matrix from a unit quaternion. No trig and no branches.
+static mat4 make_rotation_matrix(quat q)
+{
+  float xx = q.x * q.x; float yy = q.y * q.y; float zz = q.z * q.z;
+  float xy = q.x * q.y; float xz = q.x * q.z; float yz = q.y * q.z;
+  float wx = q.w * q.x; float wy = q.w * q.y; float wz = q.w * q.z;
+
+  mat4 result =
+  {
+    1.0f - 2.0f * (yy + zz), 2.0f * (xy - wz),        2.0f * (xz + wy),        0.0f,
+    2.0f * (xy + wz),        1.0f - 2.0f * (xx + zz), 2.0f * (yz - wx),        0.0f,
+    2.0f * (xz - wy),        2.0f * (yz + wx),        1.0f - 2.0f * (xx + yy), 0.0f,
+    0.0f, 0.0f, 0.0f, 1.0f
+  };
+
+  return result;
+}
+
+// Builds translation * rotation * scale directly instead of multiplying three
+// matrices together.
+static mat4 make_transform_matrix(v3 position, v3 scale, quat q)
+{
+  mat4 result = make_rotation_matrix(q);
+  for(unsigned row = 0; row < 3; row++)
+  {
+    result[row][0] *= scale.x;
+    result[row][1] *= scale.y;
+    result[row][2] *= scale.z;
+  }
+  result[0][3] = position.x;
+  result[1][3] = position.y;
+  result[2][3] = position.z;
+
+  return result;
+}
+
+
+
+
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,342 @@
+#include "occlusion.h"
+#include "model_storage.h"
+
+#include <assert.h>
+#include <algorithm> // sort
+#include <float.h> // FLT_MAX
+#include <emmintrin.h> // SSE2
+
+static const unsigned SUBTILES_X = OCCLUSION_WIDTH / OCCLUSION_SUBTILE_WIDTH;
+static const unsigned SUBTILES_Y = OCCLUSION_HEIGHT / OCCLUSION_SUBTILE_HEIGHT;
+static const unsigned FULL_COVERAGE = 0xFFFFFFFF;
+
+void clear_occlusion_buffer(OcclusionBuffer *buffer, const mat4 &clip_m_world)
+{
+  buffer->clip_m_world = clip_m_world;
+  buffer->coverage.assign(SUBTILES_X * SUBTILES_Y, 0);
+  buffer->far_depth.assign(SUBTILES_X * SUBTILES_Y, 1.0f);
+  buffer->working_depth.assign(SUBTILES_X * SUBTILES_Y, 0.0f);
+  buffer->triangles_drawn = 0;
+}
+
+// Screen covered per triangle drawn. A detailed mesh hides no more than a
+// simple one of the same size and costs far more to draw.
+static float occluder_value(const Occluder &occluder)
+{
+  return occluder.screen_size * occluder.screen_size / (float)(occluder.triangle_count + 1);
+}
+
+static bool better_occluder(const Occluder &a, const Occluder &b)
+{
+  return occluder_value(a) > occluder_value(b);
+}
+
+void select_occluders(const mat4 &clip_m_world, std::vector<Occluder> *candidates)
+{
+  // The view rotation keeps the projection's y scale as the length of row 1,
+  // and row 3 gives the view depth
+  float y_scale = length(v3(clip_m_world[1][0], clip_m_world[1][1], clip_m_world[1][2]));
+  v4 depth_row = v4(clip_m_world[3][0], clip_m_world[3][1], clip_m_world[3][2], clip_m_world[3][3]);
+
+  unsigned kept = 0;
+  for(unsigned i = 0; i < candidates->size(); i++)
+  {
+    Occluder *occluder = &(*candidates)[i];
+    float radius = length(occluder->bounds.extents);
+    float depth = dot(depth_row, v4(occluder->bounds.center, 1.0f));
+
+    // Close enough to be around the camera fills the screen
+    occluder->screen_size = depth > radius ? minf(radius * y_scale / depth, 1.0f) : 1.0f;
+    if(occluder->screen_size >= OCCLUDER_MIN_SCREEN_SIZE) (*candidates)[kept++] = *occluder;
+  }
+  candidates->resize(kept);
+  std::sort(candidates->begin(), candidates->end(), better_occluder);
+
+  // Cheaper occluders can still fit after one that doesn't
+  unsigned triangles = 0;
+  kept = 0;
+  for(unsigned i = 0; i < candidates->size(); i++)
+  {
+    Occluder *occluder = &(*candidates)[i];
+    if(triangles + occluder->triangle_count > OCCLUDER_TRIANGLE_BUDGET) continue;
+    triangles += occluder->triangle_count;
+    (*candidates)[kept++] = *occluder;
+  }
+  candidates->resize(kept);
+}
+
+// Merges a triangle's coverage into the subtile's working layer, and commits
+// the layer once every pixel is covered
+static void update_subtile(OcclusionBuffer *buffer, unsigned subtile, unsigned mask, float depth)
+{
+  float far_depth = buffer->far_depth[subtile];
+  if(depth >= far_depth) return;
+
+  unsigned coverage = buffer->coverage[subtile];
+  float working_depth = buffer->working_depth[subtile];
+
+  // A triangle much nearer than the working layer starts a new one rather than
+  // being merged into a layer that would never get near enough to matter
+  if(!coverage || working_depth - depth > far_depth - working_depth)
+  {
+    coverage = mask;
+    working_depth = depth;
+  }
+  else
+  {
+    coverage |= mask;
+    working_depth = maxf(working_depth, depth);
+  }
+
+  if(coverage == FULL_COVERAGE)
+  {
+    buffer->far_depth[subtile] = working_depth;
+    coverage = 0;
+    working_depth = 0.0f;
+  }
+
+  buffer->coverage[subtile] = coverage;
+  buffer->working_depth[subtile] = working_depth;
+}
+
+static void draw_occluder_triangle(OcclusionBuffer *buffer, const v4 *clip)
+{
+  // Clipping could only add occlusion, so triangles reaching past the near
+  // plane are left out
+  if(clip[0].z < 0.0f || clip[1].z < 0.0f || clip[2].z < 0.0f) return;
+
+  // Off to one side of the screen, which is most of a big occluder
+  if(clip[0].x > clip[0].w && clip[1].x > clip[1].w && clip[2].x > clip[2].w) return;
+  if(clip[0].x < -clip[0].w && clip[1].x < -clip[1].w && clip[2].x < -clip[2].w) return;
+  if(clip[0].y > clip[0].w && clip[1].y > clip[1].w && clip[2].y > clip[2].w) return;
+  if(clip[0].y < -clip[0].w && clip[1].y < -clip[1].w && clip[2].y < -clip[2].w) return;
+
+  float x[3], y[3], z[3];
+  for(unsigned i = 0; i < 3; i++)
+  {
+    float inv_w = 1.0f / clip[i].w;
+    x[i] = (clip[i].x * inv_w * 0.5f + 0.5f) * (float)OCCLUSION_WIDTH;
+    y[i] = (0.5f - clip[i].y * inv_w * 0.5f) * (float)OCCLUSION_HEIGHT;
+    z[i] = clip[i].z * inv_w;
+  }
+
+  // Counter clockwise front faces come out negative with y pointing down
+  float area = -((x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]));
+  if(area <= 0.0f) return;
+
+  int min_x = (int)ceil(minf(x[0], minf(x[1], x[2])) - 0.5f);
+  int min_y = (int)ceil(minf(y[0], minf(y[1], y[2])) - 0.5f);
+  int max_x = (int)floor(maxf(x[0], maxf(x[1], x[2])) - 0.5f);
+  int max_y = (int)floor(maxf(y[0], maxf(y[1], y[2])) - 0.5f);
+  if(min_x < 0) min_x = 0;
+  if(min_y < 0) min_y = 0;
+  if(max_x > (int)OCCLUSION_WIDTH - 1) max_x = OCCLUSION_WIDTH - 1;
+  if(max_y > (int)OCCLUSION_HEIGHT - 1) max_y = OCCLUSION_HEIGHT - 1;
+  if(min_x > max_x || min_y > max_y) return;
+
+  // Edge i is opposite vertex i, positive inside
+  float edge_a[3], edge_b[3], edge_x[3], edge_y[3];
+  for(unsigned i = 0; i < 3; i++)
+  {
+    unsigned j = (i + 1) % 3;
+    unsigned k = (i + 2) % 3;
+    edge_a[i] = y[k] - y[j];
+    edge_b[i] = x[j] - x[k];
+    edge_x[i] = x[j];
+    edge_y[i] = y[j];
+  }
+
+  float inv_area = 1.0f / area;
+  float z_dx = (z[0] * edge_a[0] + z[1] * edge_a[1] + z[2] * edge_a[2]) * inv_area;
+  float z_dy = (z[0] * edge_b[0] + z[1] * edge_b[1] + z[2] * edge_b[2]) * inv_area;
+  float min_z = minf(z[0], minf(z[1], z[2]));
+  float max_z = maxf(z[0], maxf(z[1], z[2]));
+
+  const float step_x = (float)(OCCLUSION_SUBTILE_WIDTH - 1);
+  const float step_y = (float)(OCCLUSION_SUBTILE_HEIGHT - 1);
+  const __m128 lane = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+  const __m128 zero = _mm_setzero_ps();
+  __m128 a[3], b[3];
+  for(unsigned i = 0; i < 3; i++)
+  {
+    a[i] = _mm_set1_ps(edge_a[i]);
+    b[i] = _mm_set1_ps(edge_b[i]);
+  }
+
+  for(int subtile_y = min_y / (int)OCCLUSION_SUBTILE_HEIGHT; subtile_y <= max_y / (int)OCCLUSION_SUBTILE_HEIGHT; subtile_y++)
+  {
+    for(int subtile_x = min_x / (int)OCCLUSION_SUBTILE_WIDTH; subtile_x <= max_x / (int)OCCLUSION_SUBTILE_WIDTH; subtile_x++)
+    {
+      float center_x = (float)(subtile_x * OCCLUSION_SUBTILE_WIDTH) + 0.5f;
+      float center_y = (float)(subtile_y * OCCLUSION_SUBTILE_HEIGHT) + 0.5f;
+
+      // Nearest the triangle's plane gets over the subtile's pixel centers.
+      // Nothing changes where it's already behind everything.
+      float depth = z[0] + z_dx * (center_x - x[0]) + z_dy * (center_y - y[0]);
+      float nearest = maxf(min_z, depth + minf(z_dx * step_x, 0.0f) + minf(z_dy * step_y, 0.0f));
+      unsigned subtile = subtile_y * SUBTILES_X + subtile_x;
+      if(nearest >= buffer->far_depth[subtile]) continue;
+
+      // Edges at the subtile's first pixel, skipping subtiles outside one
+      __m128 edge[3];
+      bool outside = false;
+      for(unsigned i = 0; i < 3; i++)
+      {
+        float first = edge_a[i] * (center_x - edge_x[i]) + edge_b[i] * (center_y - edge_y[i]);
+        outside |= first + maxf(edge_a[i] * step_x, 0.0f) + maxf(edge_b[i] * step_y, 0.0f) < 0.0f;
+        edge[i] = _mm_set1_ps(first);
+      }
+      if(outside) continue;
+
+      unsigned mask = 0;
+      for(unsigned row = 0; row < OCCLUSION_SUBTILE_HEIGHT; row++)
+      {
+        __m128 py = _mm_set1_ps((float)row);
+        for(unsigned half = 0; half < OCCLUSION_SUBTILE_WIDTH; half += 4)
+        {
+          __m128 px = _mm_add_ps(lane, _mm_set1_ps((float)half));
+          __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+          for(unsigned i = 0; i < 3; i++)
+          {
+            __m128 e = _mm_add_ps(edge[i], _mm_add_ps(_mm_mul_ps(a[i], px), _mm_mul_ps(b[i], py)));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(e, zero));
+          }
+          mask |= (unsigned)_mm_movemask_ps(inside) << (row * OCCLUSION_SUBTILE_WIDTH + half);
+        }
+      }
+      if(!mask) continue;
+
+      // Farthest the plane gets over the pixel centers
+      float farthest = minf(max_z, depth + maxf(z_dx * step_x, 0.0f) + maxf(z_dy * step_y, 0.0f));
+      update_subtile(buffer, subtile, mask, farthest);
+    }
+  }
+
+  buffer->triangles_drawn++;
+}
+
+void draw_occluder(OcclusionBuffer *buffer, const mat4 &world_m_model, const v3 *positions, unsigned stride,
+                   const unsigned *indices, unsigned index_count)
+{
+  if(index_count < 3) return;
+
+  // Vertices are shared by several triangles, so each one used is transformed
+  // the first time a triangle needs it. Indices can span far more vertices
+  // than the triangles use, like a batch of merged static geometry.
+  unsigned first_vertex = indices[0];
+  unsigned last_vertex = indices[0];
+  for(unsigned i = 1; i < index_count; i++)
+  {
+    if(indices[i] < first_vertex) first_vertex = indices[i];
+    if(indices[i] > last_vertex) last_vertex = indices[i];
+  }
+
+  mat4 clip_m_model = buffer->clip_m_world * world_m_model;
+  __m128 columns[4];
+  for(unsigned i = 0; i < 4; i++)
+  {
+    columns[i] = _mm_set_ps(clip_m_model[3][i], clip_m_model[2][i], clip_m_model[1][i], clip_m_model[0][i]);
+  }
+
+  // A new generation marks every cached vertex stale without touching them
+  unsigned vertex_count = last_vertex - first_vertex + 1;
+  if(buffer->clip_vertices.size() < vertex_count)
+  {
+    buffer->clip_vertices.resize(vertex_count);
+    buffer->clip_generations.resize(vertex_count, 0);
+  }
+  unsigned generation = ++buffer->clip_generation;
+  v4 *clip = buffer->clip_vertices.data();
+  unsigned *generations = buffer->clip_generations.data();
+
+  const char *position_bytes = (const char *)positions + first_vertex * stride;
+  for(unsigned i = 0; i + 2 < index_count; i += 3)
+  {
+    v4 triangle[3];
+    for(unsigned j = 0; j < 3; j++)
+    {
+      unsigned vertex = indices[i + j] - first_vertex;
+      if(generations[vertex] != generation)
+      {
+        const v3 *position = (const v3 *)(position_bytes + vertex * stride);
+        __m128 result = _mm_add_ps(_mm_mul_ps(columns[0], _mm_set1_ps(position->x)), columns[3]);
+        result = _mm_add_ps(result, _mm_mul_ps(columns[1], _mm_set1_ps(position->y)));
+        result = _mm_add_ps(result, _mm_mul_ps(columns[2], _mm_set1_ps(position->z)));
+        _mm_storeu_ps(&clip[vertex].x, result);
+        generations[vertex] = generation;
+      }
+      triangle[j] = clip[vertex];
+    }
+    draw_occluder_triangle(buffer, triangle);
+  }
+}
+
+bool occlusion_test_box(const OcclusionBuffer *buffer, const BoundingBox &box)
+{
+  float min_x = FLT_MAX;
+  float min_y = FLT_MAX;
+  float max_x = -FLT_MAX;
+  float max_y = -FLT_MAX;
+  float nearest = FLT_MAX;
+  for(unsigned i = 0; i < 8; i++)
+  {
+    v3 corner = box.center + v3(i & 1 ? box.extents.x : -box.extents.x,
+                                i & 2 ? box.extents.y : -box.extents.y,
+                                i & 4 ? box.extents.z : -box.extents.z);
+    v4 clip = buffer->clip_m_world * v4(corner, 1.0f);
+
+    // Nothing is in front of a box that reaches the camera
+    if(clip.z < 0.0f) return true;
+
+    float inv_w = 1.0f / clip.w;
+    float x = (clip.x * inv_w * 0.5f + 0.5f) * (float)OCCLUSION_WIDTH;
+    float y = (0.5f - clip.y * inv_w * 0.5f) * (float)OCCLUSION_HEIGHT;
+    min_x = minf(min_x, x);
+    min_y = minf(min_y, y);
+    max_x = maxf(max_x, x);
+    max_y = maxf(max_y, y);
+    nearest = minf(nearest, clip.z * inv_w);
+  }
+
+  // Frustum culling already threw away boxes that are off screen
+  int first_x = (int)floor(maxf(min_x, 0.0f)) / (int)OCCLUSION_SUBTILE_WIDTH;
+  int first_y = (int)floor(maxf(min_y, 0.0f)) / (int)OCCLUSION_SUBTILE_HEIGHT;
+  int last_x = (int)floor(minf(max_x, (float)(OCCLUSION_WIDTH - 1))) / (int)OCCLUSION_SUBTILE_WIDTH;
+  int last_y = (int)floor(minf(max_y, (float)(OCCLUSION_HEIGHT - 1))) / (int)OCCLUSION_SUBTILE_HEIGHT;
+  if(first_x > last_x || first_y > last_y) return true;
+
+  for(int subtile_y = first_y; subtile_y <= last_y; subtile_y++)
+  {
+    const float *far_depth = &buffer->far_depth[subtile_y * SUBTILES_X];
+    for(int subtile_x = first_x; subtile_x <= last_x; subtile_x++)
+    {
+      if(nearest < far_depth[subtile_x]) return true;
+    }
+  }
+
+  return false;
+}
+
+unsigned occlusion_cull_models(const OcclusionBuffer *buffer, const ModelStorage *models, const std::vector<unsigned char> *skip,
+                               std::vector<unsigned> *visible)
+{
+  unsigned kept = 0;
+  for(unsigned i = 0; i < visible->size(); i++)
+  {
+    unsigned index = (*visible)[i];
+    assert(index < skip->size());
+    if(!(*skip)[index])
+    {
+      BoundingBox box;
+      box.center = v3(models->bounds_center_x[index], models->bounds_center_y[index], models->bounds_center_z[index]);
+      box.extents = v3(models->bounds_extent_x[index], models->bounds_extent_y[index], models->bounds_extent_z[index]);
+      if(!occlusion_test_box(buffer, box)) continue;
+    }
+
+    (*visible)[kept++] = index;
+  }
+
+  unsigned removed = visible->size() - kept;
+  visible->resize(kept);
+  return removed;
+}
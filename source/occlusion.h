@@ -0,0 +1,84 @@
+#pragma once
+
+#include "my_math.h" // v3, mat4
+#include "culling.h" // BoundingBox
+
+#include <vector>
+
+struct ModelStorage;
+
+// Small CPU depth buffer of the biggest things on screen, for throwing away
+// models hidden behind them before anything is recorded for them.
+//
+// The buffer is split into 8x4 pixel subtiles. Each keeps a depth every pixel
+// in it is known to be nearer than, plus a working layer: a coverage mask and
+// the farthest depth of the triangles in the mask. When the mask fills the
+// working layer becomes the subtile's depth. No per pixel depth is stored.
+//
+// Depths are the camera's clip z / w, bigger is farther.
+
+static const unsigned OCCLUSION_WIDTH = 256;
+static const unsigned OCCLUSION_HEIGHT = 128;
+static const unsigned OCCLUSION_SUBTILE_WIDTH = 8;
+static const unsigned OCCLUSION_SUBTILE_HEIGHT = 4;
+
+// Models and static batches smaller than this on screen aren't worth drawing
+// as occluders. Projected bounding radius over half the screen height.
+static const float OCCLUDER_MIN_SCREEN_SIZE = 0.2f;
+
+// Most occluder triangles drawn in a frame. The ones covering the most screen
+// per triangle go first.
+static const unsigned OCCLUDER_TRIANGLE_BUDGET = 16384;
+
+struct OcclusionBuffer
+{
+  mat4 clip_m_world;
+
+  // Per subtile
+  std::vector<unsigned> coverage; // Bit per pixel, row by row
+  std::vector<float> far_depth; // Everything in the subtile is nearer
+  std::vector<float> working_depth; // Farthest depth of the covered pixels
+
+  // Vertices draw_occluder transformed, valid while their generation matches
+  std::vector<v4> clip_vertices;
+  std::vector<unsigned> clip_generations;
+  unsigned clip_generation = 0;
+
+  // Since the last clear
+  unsigned triangles_drawn = 0;
+};
+
+// Something the renderer could draw into the buffer
+struct Occluder
+{
+  BoundingBox bounds; // World space
+  unsigned triangle_count;
+
+  // The renderer's own, like a model index
+  unsigned id;
+
+  // Filled in by select_occluders, up to 1 for filling the screen
+  float screen_size = 0.0f;
+};
+
+// Empties the buffer for a new camera
+void clear_occlusion_buffer(OcclusionBuffer *buffer, const mat4 &clip_m_world);
+
+// Keeps the candidates big enough on screen to be worth drawing, best first,
+// until the triangle budget runs out
+void select_occluders(const mat4 &clip_m_world, std::vector<Occluder> *candidates);
+
+// Draws an indexed triangle list. Positions are read stride bytes apart. Back
+// faces and triangles crossing the near plane are skipped.
+void draw_occluder(OcclusionBuffer *buffer, const mat4 &world_m_model, const v3 *positions, unsigned stride,
+                   const unsigned *indices, unsigned index_count);
+
+// False when the box is behind the occluders everywhere it covers
+bool occlusion_test_box(const OcclusionBuffer *buffer, const BoundingBox &box);
+
+// Removes the models in visible that are hidden. Models whose flag in skip is
+// set are kept without testing, for occluders that would hide themselves.
+// skip is by model index and covers every index in visible. Returns how many
+// were removed.
+unsigned occlusion_cull_models(const OcclusionBuffer *buffer, const ModelStorage *models, const std::vector<unsigned char> *skip,
+                               std::vector<unsigned> *visible);
@@ -0,0 +1,28 @@
+#include "main.cpp"
+#include "renderer.cpp"
+#include "../renderer_common.cpp"
+#include "../asset_loading.cpp"
+
+#include "../model_storage.cpp"
+#include "../culling.cpp"
+#include "../bvh.cpp"
+#include "../render_queue.cpp"
+#include "../state_cache.cpp"
+#include "../instancing.cpp"
+#include "../ring_allocator.cpp"
+#include "../static_geometry.cpp"
+#include "../tlsf_allocator.cpp"
+#include "../command_buffer.cpp"
+#include "../render_graph.cpp"
+#include "../shadow_cascades.cpp"
+#include "../mesh_processing.cpp"
+#include "../occlusion.cpp"
+#include "../frame_trace.cpp"
+#include "../job_system.cpp"
+#include "../frame_pipeline.cpp"
+#include "../scene_commands.cpp"
+#include "../texture_sampling.cpp"
+#include "../software_rasterizer.cpp"
+#include "../png_writer.cpp"
+
+#include "../world.cpp"
@@ -0,0 +1,379 @@
+#include "../my_math.h"
+#include "renderer.h"
+
+#include "../world.h"
+#include "../graphics.h" // Render stats
+#include "../frame_trace.h" // Capture and replay
+#include "../job_system.h" // Worker threads
+#include "../frame_pipeline.h" // Updating while rendering
+#include "../culling.h" // Job benchmark workload
+#include "../command_line.h" // take_option
+
+
+#include <stdio.h> // printf, sscanf
+#include <stdlib.h> // atoi
+#include <string.h> // strcmp
+#include <algorithm> // std::sort
+#include <atomic>
+#include <chrono>
+#include <thread> // hardware_concurrency
+#include <vector>
+
+
+static double milliseconds_since(std::chrono::steady_clock::time_point start)
+{
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+// Mean, median, 99th percentile and worst of one phase's frame times
+static void print_phase(const char *name, std::vector<float> *samples)
+{
+  if(samples->empty()) return;
+
+  double total = 0.0;
+  for(float sample : *samples) total += sample;
+  std::sort(samples->begin(), samples->end());
+  unsigned count = samples->size();
+
+  printf("  %-20s %8.3f %8.3f %8.3f %8.3f\n", name, total / count, (*samples)[count / 2], (*samples)[count * 99 / 100],
+         (*samples)[count - 1]);
+}
+
+// Runs a trace's graphics calls with no game and breaks each frame's CPU time
+// down into replaying the calls, the render passes and the rest of render()
+static int replay(const char *trace_file, const char *png_file, unsigned width, unsigned height)
+{
+  FrameTrace trace;
+  if(!read_trace_file(&trace, trace_file))
+  {
+    printf("couldn't read %s\n", trace_file);
+    return 1;
+  }
+
+  init_renderer(width, height, png_file != 0);
+
+  static const unsigned MAX_PASSES = 8;
+  std::vector<float> call_times;
+  std::vector<float> render_times;
+  std::vector<float> other_times; // render() outside the passes
+  std::vector<float> pass_times[MAX_PASSES];
+  RenderPassTiming timings[MAX_PASSES] = {};
+  unsigned pass_count = 0;
+
+  TraceReplay replay;
+  start_trace_replay(&replay, &trace);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for(;;)
+  {
+    std::chrono::steady_clock::time_point frame_start = std::chrono::steady_clock::now();
+    if(!replay_trace_frame(&replay)) break;
+    call_times.push_back((float)milliseconds_since(frame_start));
+
+    std::chrono::steady_clock::time_point render_start = std::chrono::steady_clock::now();
+    render();
+    float render_time = (float)milliseconds_since(render_start);
+    render_times.push_back(render_time);
+
+    pass_count = get_render_pass_timings(timings, MAX_PASSES);
+    if(pass_count > MAX_PASSES) pass_count = MAX_PASSES;
+    float passes_time = 0.0f;
+    for(unsigned i = 0; i < pass_count; i++)
+    {
+      pass_times[i].push_back(timings[i].milliseconds);
+      passes_time += timings[i].milliseconds;
+    }
+    other_times.push_back(render_time - passes_time);
+  }
+  double elapsed = milliseconds_since(start);
+
+  if(replay.error)
+  {
+    printf("couldn't replay %s, frame %u: %s\n", trace_file, replay.frame, replay.error);
+    shutdown_renderer();
+    return 1;
+  }
+
+  printf("replayed %u frames of %s, %.3f ms per frame\n", replay.frame, trace_file,
+         replay.frame ? elapsed / replay.frame : 0.0);
+  printf("  %-20s %8s %8s %8s %8s\n", "ms", "mean", "median", "99th", "worst");
+  print_phase("graphics calls", &call_times);
+  print_phase("render", &render_times);
+  for(unsigned i = 0; i < pass_count; i++)
+  {
+    char name[32];
+    snprintf(name, sizeof(name), "  %s", timings[i].name);
+    print_phase(name, &pass_times[i]);
+  }
+  print_phase("  outside passes", &other_times);
+
+  if(png_file && !write_frame_png(png_file))
+  {
+    printf("couldn't write %s\n", png_file);
+  }
+
+  shutdown_renderer();
+
+  return 0;
+}
+
+// Boxes split by component, the same layout as ModelStorage's world bounds
+struct BoxBenchmark
+{
+  Frustum frustum;
+  std::vector<float> center_x, center_y, center_z;
+  std::vector<float> extent_x, extent_y, extent_z;
+  std::atomic<unsigned> visible;
+};
+
+static void test_boxes(void *data, unsigned first, unsigned end)
+{
+  BoxBenchmark *benchmark = (BoxBenchmark *)data;
+  unsigned visible = 0;
+  unsigned indices[256];
+  for(unsigned i = first; i < end; i += 256)
+  {
+    unsigned count = end - i < 256 ? end - i : 256;
+    visible += frustum_test_boxes(&benchmark->frustum,
+                                  &benchmark->center_x[i], &benchmark->center_y[i], &benchmark->center_z[i],
+                                  &benchmark->extent_x[i], &benchmark->extent_y[i], &benchmark->extent_z[i],
+                                  count, indices);
+  }
+  benchmark->visible += visible;
+}
+
+// Frustum tests a million boxes through parallel_for with 1, 2, 4... workers
+// up to one per core, at a fine and a coarse grain
+static int benchmark_jobs()
+{
+  static const unsigned BOX_COUNT = 1 << 20;
+  static const unsigned PASSES = 20;
+
+  BoxBenchmark benchmark;
+  benchmark.frustum = make_frustum(mat4());
+  std::vector<float> *components[6] = {&benchmark.center_x, &benchmark.center_y, &benchmark.center_z,
+                                       &benchmark.extent_x, &benchmark.extent_y, &benchmark.extent_z};
+  unsigned random = 12345;
+  for(unsigned i = 0; i < BOX_COUNT; i++)
+  {
+    for(unsigned j = 0; j < 6; j++)
+    {
+      random = random * 1664525 + 1013904223;
+      float value = (float)(random >> 8) / (float)(1 << 24);
+      components[j]->push_back(j < 3 ? value * 4.0f - 2.0f : value * 0.1f);
+    }
+  }
+
+  unsigned cores = std::thread::hardware_concurrency();
+  if(cores > JOB_MAX_WORKERS) cores = JOB_MAX_WORKERS;
+  if(cores < 1) cores = 1;
+
+  printf("%u boxes x %u passes, %u cores\n", BOX_COUNT, PASSES, cores);
+  printf("  %8s %8s %10s %8s\n", "workers", "grain", "ms", "speedup");
+  static const unsigned grains[] = {256, 16384};
+  for(unsigned grain : grains)
+  {
+    double single_worker = 0.0;
+    for(unsigned workers = 1; workers <= cores; workers = workers * 2 > cores && workers < cores ? cores : workers * 2)
+    {
+      init_job_system(workers);
+
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      for(unsigned pass = 0; pass < PASSES; pass++)
+      {
+        benchmark.visible = 0;
+        parallel_for(BOX_COUNT, grain, test_boxes, &benchmark);
+      }
+      double elapsed = milliseconds_since(start);
+      if(workers == 1) single_worker = elapsed;
+
+      shutdown_job_system();
+      printf("  %8u %8u %10.3f %7.2fx\n", workers, grain, elapsed / PASSES, single_worker / elapsed);
+    }
+  }
+
+  return 0;
+}
+
+// Runs the world for a number of frames with no window and prints what the
+// renderer did. The frame count is the first argument, 1000 by default. With a
+// png file as the second argument the frames are drawn on the CPU and the last
+// one is saved there.
+//
+//   go_null capture <frames> <trace>  records the frames' graphics calls
+//   go_null replay <trace> [png]      plays them back and times each phase
+//   go_null jobs                      measures how the job system scales
+//   go_null pipeline <frames> [png]   updates the world on its own thread
+//
+// Any of them take -resolution <width>x<height>, 1280x720 by default, and the
+// ones running the world -steps-per-second <rate>, 60 by default.
+//
+// Every frame is a 60th of a second apart so runs are repeatable. Frames are
+// drawn from the world blended between its fixed steps, except while capturing
+// where the steps run straight against the renderer so the trace has their
+// calls.
+int main(int argc, char **argv)
+{
+  if(argc > 1 && !strcmp(argv[1], "jobs"))
+  {
+    return benchmark_jobs();
+  }
+
+  unsigned width = 1280;
+  unsigned height = 720;
+  if(const char *resolution = take_option(&argc, argv, "-resolution"))
+  {
+    if(sscanf(resolution, "%ux%u", &width, &height) != 2 || !width || !height)
+    {
+      printf("resolution should look like 1920x1080, not %s\n", resolution);
+      return 1;
+    }
+  }
+
+  float steps_per_second = DEFAULT_WORLD_STEPS_PER_SECOND;
+  if(const char *rate = take_option(&argc, argv, "-steps-per-second"))
+  {
+    if(sscanf(rate, "%f", &steps_per_second) != 1 || !(steps_per_second > 0.0f))
+    {
+      printf("steps per second should be a positive number, not %s\n", rate);
+      return 1;
+    }
+  }
+
+  init_job_system();
+
+  if(argc > 2 && !strcmp(argv[1], "replay"))
+  {
+    int result = replay(argv[2], argc > 3 ? argv[3] : 0, width, height);
+    shutdown_job_system();
+    return result;
+  }
+
+  bool pipelined = false;
+  if(argc > 1 && !strcmp(argv[1], "pipeline"))
+  {
+    pipelined = true;
+    argv++;
+    argc--;
+  }
+
+  FrameTrace trace;
+  const char *trace_file = 0;
+  if(argc > 3 && !strcmp(argv[1], "capture"))
+  {
+    trace_file = argv[3];
+    argv++;
+    argc = 2;
+  }
+
+  unsigned frames = 1000;
+  if(argc > 1)
+  {
+    int count = atoi(argv[1]);
+    if(count > 0) frames = count;
+  }
+  const char *png_file = argc > 2 ? argv[2] : 0;
+
+  // Initialize
+  init_renderer(width, height, png_file != 0);
+  if(trace_file) start_trace_capture(&trace);
+  init_world();
+
+  static const double FRAME_SECONDS = 1.0 / 60.0;
+
+  FramePipeline pipeline;
+  Simulation simulation;
+  SceneSnapshot blended;
+  if(pipelined)
+  {
+    pipeline.frame_seconds = FRAME_SECONDS;
+    start_frame_pipeline(&pipeline, update_world, steps_per_second);
+  }
+  else
+  {
+    init_simulation(&simulation, update_world, steps_per_second);
+  }
+
+  unsigned long long draw_calls = 0;
+  unsigned long long uploaded_bytes = 0;
+  unsigned long long state_changes = 0;
+  unsigned long long redundant_state_changes = 0;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for(unsigned frame = 0; frame < frames; frame++)
+  {
+    // No input without a window
+    TraceInput input = {};
+    trace_input(&input);
+
+    // Updating
+    if(pipelined)
+    {
+      set_pipeline_input(&pipeline, &input);
+      apply_next_snapshot(&pipeline);
+    }
+    else
+    {
+      set_simulation_input(&simulation, &input);
+      if(trace_file) step_simulation_directly(&simulation, FRAME_SECONDS);
+      else
+      {
+        simulate_frame(&simulation, FRAME_SECONDS, &blended);
+        apply_scene_snapshot(&blended, &simulation.free_models);
+      }
+    }
+
+    // Rendering
+    render();
+    trace_end_frame();
+
+    RenderStats stats = get_render_stats();
+    draw_calls += stats.draw_calls;
+    uploaded_bytes += stats.uploaded_bytes;
+    state_changes += stats.state_changes;
+    redundant_state_changes += stats.redundant_state_changes;
+  }
+  double elapsed = milliseconds_since(start);
+
+  if(pipelined) stop_frame_pipeline(&pipeline);
+
+  RenderStats stats = get_render_stats();
+  printf("%u frames, %.3f ms per frame\n", frames, elapsed / frames);
+  printf("per frame: %.1f draw calls, %.0f bytes uploaded, %.1f state changes, %.1f redundant\n",
+         (double)draw_calls / frames, (double)uploaded_bytes / frames, (double)state_changes / frames,
+         (double)redundant_state_changes / frames);
+  printf("last frame: main %u drawn %u culled (%u occluded), shadow %u drawn %u culled, %u occluder triangles\n",
+         stats.main_drawn, stats.main_culled, stats.main_occluded, stats.shadow_drawn, stats.shadow_culled,
+         stats.occluder_triangles);
+
+  RenderPassTiming timings[8];
+  unsigned passes = get_render_pass_timings(timings, 8);
+  for(unsigned i = 0; i < passes && i < 8; i++)
+  {
+    printf("  %-16s %.3f ms%s\n", timings[i].name, timings[i].milliseconds, timings[i].culled ? " (culled)" : "");
+  }
+
+  if(png_file && !write_frame_png(png_file))
+  {
+    printf("couldn't write %s\n", png_file);
+  }
+
+  if(trace_file)
+  {
+    stop_trace_capture();
+    if(write_trace_file(&trace, trace_file))
+    {
+      printf("wrote %u frames to %s, %u bytes of calls\n", trace.frame_count, trace_file, (unsigned)trace.data.size());
+    }
+    else
+    {
+      printf("couldn't write %s\n", trace_file);
+    }
+  }
+
+  shutdown_renderer();
+  shutdown_job_system();
+
+  return 0;
+}
@@ -0,0 +1,189 @@
+#include "renderer.h" // Platform specific interface
+#include "../graphics.h" // Platform independent interface
+
+#include "../renderer_common.h" // RendererData, backends
+#include "../software_rasterizer.h" // Drawing frames on the CPU
+#include "../png_writer.h" // Saving frames
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <assert.h>
+#include <string.h> // memcpy
+
+// The shared constant buffers are what the software shaders read
+static_assert(sizeof(FrameConstants) == sizeof(SoftFrameConstants), "Frame constants don't match the software shaders");
+static_assert(sizeof(DepthConstants) == sizeof(SoftDepthConstants), "Depth constants don't match the software shaders");
+static_assert(sizeof(SkyboxConstants) == sizeof(SoftSkyboxConstants), "Skybox constants don't match the software shaders");
+static_assert(sizeof(QuadConstants) == sizeof(SoftQuadConstants), "Quad constants don't match the software shaders");
+
+// Transient render targets are depth textures, the only kind the graph makes
+struct SoftGraphBackend : RenderGraphBackend
+{
+  void *create_texture(const RenderGraphTextureDesc &desc)
+  {
+    SoftTexture *texture = new SoftTexture();
+    init_soft_texture(texture, desc.format, desc.width, desc.height);
+    return texture;
+  }
+
+  void destroy_texture(void *texture) { delete (SoftTexture *)texture; }
+};
+
+// Handles are the software rasterizer's. A texture is its own view for every
+// use. Commands go to the rasterizer when frames are drawn, otherwise they're
+// counted and dropped.
+struct NullRenderer : RendererBackend
+{
+  bool rasterize;
+  SoftwareRasterizer rasterizer;
+  NullCommandBackend null_backend;
+  SoftGraphBackend graph_backend;
+
+  SoftShader programs[4]; // By SoftProgram
+  SoftBuffer frame_constants;
+  SoftBuffer depth_constants;
+  SoftBuffer skybox_constants;
+  SoftBuffer quad_constants;
+  SoftDepthState depth_stencil_state = {true, true};
+  SoftDepthState no_depth_stencil_state = {false, false};
+
+  SoftTexture back_buffer;
+  SoftTexture depth_buffer;
+  SoftTexture skybox_cube;
+
+  void *create_mesh_buffer(unsigned bytes, bool)
+  {
+    SoftBuffer *buffer = new SoftBuffer();
+    buffer->data.resize(bytes);
+    return buffer;
+  }
+  void write_mesh_buffer(void *buffer, unsigned offset, const void *data, unsigned bytes)
+  {
+    memcpy(&((SoftBuffer *)buffer)->data[offset], data, bytes);
+  }
+  void *create_object_buffer(unsigned bytes) { return create_mesh_buffer(bytes, false); }
+  void write_object_buffer(void *buffer, unsigned offset, const void *data, unsigned bytes, bool)
+  {
+    write_mesh_buffer(buffer, offset, data, bytes);
+  }
+  void destroy_buffer(void *buffer) { delete (SoftBuffer *)buffer; }
+
+  void *target_view(void *texture) { return texture; }
+  void *depth_view(void *texture) { return texture; }
+  void *resource_view(void *texture) { return texture; }
+
+  void set_viewport(unsigned, unsigned) {} // Always the whole target
+  void clear_color(void *texture)
+  {
+    if(rasterize) soft_clear_color(&rasterizer, (SoftTexture *)texture, v4());
+  }
+  void clear_depth(void *texture)
+  {
+    if(rasterize) soft_clear_depth(&rasterizer, (SoftTexture *)texture, 1.0f);
+  }
+  void copy_texture(void *destination, void *source)
+  {
+    if(rasterize) soft_copy_texture(&rasterizer, (SoftTexture *)destination, (SoftTexture *)source);
+  }
+
+  // Binned work can point at textures and buffers
+  void flush()
+  {
+    if(rasterize) soft_flush(&rasterizer);
+  }
+  void present() { flush(); }
+};
+
+static NullRenderer *null_renderer;
+
+static void init_shader(Shader *shader, unsigned program, SoftBuffer *constants)
+{
+  SoftShader *soft_shader = &null_renderer->programs[program];
+  soft_shader->program = program;
+  shader->vertex_shader = soft_shader;
+  shader->pixel_shader = program == SOFT_PROGRAM_DEPTH ? 0 : soft_shader;
+  shader->input_layout = soft_shader;
+  shader->constants = constants;
+  shader->sort_id = ++renderer_data->num_shader_sort_ids;
+}
+
+// The cube map is the cross laid out in skybox_sky.png, cut the same way the
+// D3D11 renderer does it
+static void load_skybox(SoftTexture *cube)
+{
+  int width;
+  int height;
+  int channels;
+  unsigned *image = (unsigned *)stbi_load("assets/skybox_sky.png", &width, &height, &channels, 4);
+  if(!image)
+  {
+    init_soft_texture(cube, SOFT_FORMAT_RGBA8, 1, 1, 6);
+    return;
+  }
+
+  unsigned chunk = width / 4;
+  init_soft_texture(cube, SOFT_FORMAT_RGBA8, chunk, chunk, 6);
+
+  // Chunk coordinates of +x -x +y -y +z -z
+  static const unsigned face_x[6] = {2, 0, 1, 1, 1, 3};
+  static const unsigned face_y[6] = {1, 1, 0, 2, 1, 1};
+  for(unsigned face = 0; face < 6; face++)
+  {
+    unsigned *texels = &cube->color[face * cube->stride * cube->rows];
+    for(unsigned y = 0; y < chunk; y++)
+    {
+      memcpy(texels + y * cube->stride, image + (face_y[face] * chunk + y) * width + face_x[face] * chunk, chunk * sizeof(unsigned));
+    }
+  }
+
+  stbi_image_free(image);
+}
+
+void init_renderer(unsigned framebuffer_width, unsigned framebuffer_height, bool rasterize)
+{
+  null_renderer = new NullRenderer();
+  null_renderer->rasterize = rasterize;
+
+  renderer_data = new RendererData();
+  renderer_data->framebuffer_width = framebuffer_width;
+  renderer_data->framebuffer_height = framebuffer_height;
+  renderer_data->device = null_renderer;
+  if(rasterize) renderer_data->backend = &null_renderer->rasterizer;
+  else          renderer_data->backend = &null_renderer->null_backend;
+
+  init_shader(&renderer_data->diffuse_shader, SOFT_PROGRAM_DIFFUSE, &null_renderer->frame_constants);
+  init_shader(&renderer_data->depth_shader, SOFT_PROGRAM_DEPTH, &null_renderer->depth_constants);
+  init_shader(&renderer_data->skybox_shader, SOFT_PROGRAM_SKYBOX, &null_renderer->skybox_constants);
+  init_shader(&renderer_data->quad_shader, SOFT_PROGRAM_QUAD, &null_renderer->quad_constants);
+  renderer_data->frame_constants = &null_renderer->frame_constants;
+  renderer_data->depth_state = &null_renderer->depth_stencil_state;
+  renderer_data->no_depth_state = &null_renderer->no_depth_stencil_state;
+
+  // Same passes and resources as the D3D11 renderer
+  init_soft_texture(&null_renderer->back_buffer, SOFT_FORMAT_RGBA8, framebuffer_width, framebuffer_height);
+  init_soft_texture(&null_renderer->depth_buffer, SOFT_FORMAT_DEPTH, framebuffer_width, framebuffer_height);
+  renderer_data->graph_backend = &null_renderer->graph_backend;
+  renderer_data->depth_texture_format = SOFT_FORMAT_DEPTH;
+  renderer_data->back_buffer = &null_renderer->back_buffer;
+  renderer_data->depth_buffer = &null_renderer->depth_buffer;
+
+  if(rasterize) load_skybox(&null_renderer->skybox_cube);
+  renderer_data->skybox_texture.resource = &null_renderer->skybox_cube;
+
+  init_renderer_data();
+}
+
+bool write_frame_png(const char *file_name)
+{
+  assert(null_renderer->rasterize && "Frames are only drawn when rasterizing");
+  SoftTexture *frame = &null_renderer->back_buffer;
+  return write_png(file_name, frame->color.data(), frame->width, frame->height, frame->stride);
+}
+
+void shutdown_renderer()
+{
+  shutdown_renderer_data();
+  delete null_renderer;
+  null_renderer = 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+// Renderer with no GPU behind it. Does all of the CPU side of a frame, culling,
+// sorting, batching, recording and state filtering, then either drops the
+// commands and keeps counts in the render stats, or draws them with the
+// software rasterizer. For running and profiling the engine where there is no
+// D3D11, like Linux build machines.
+
+void init_renderer(unsigned framebuffer_width, unsigned framebuffer_height, bool rasterize);
+void render();
+void shutdown_renderer();
+
+// Saves the last frame drawn. Only when rasterizing.
+bool write_frame_png(const char *file_name);
@@ -2,9 +2,16 @@
 #include "renderer.h"
 
 #include "../world.h"
+#include "../frame_trace.h" // Capturing
+#include "../job_system.h" // Worker threads
+#include "../frame_pipeline.h" // Updating while rendering
+#include "../command_line.h" // take_option
 
 
 #include <windows.h>
+#include <stdlib.h> // __argc, __argv, atof
+#include <chrono>
+#include <vector>
 
 
 
@@ -17,6 +24,7 @@ static bool mouse_states[8] = {};
 
 static v2 mouse_position;
 static v2 delta_mouse_position;
+static bool window_focused = true;
 
 
 bool key_state(unsigned button)
@@ -104,10 +112,13 @@ LRESULT CALLBACK WindowProc(HWND window, UINT message, WPARAM wParam, LPARAM lPa
     break;
     
     case WM_KILLFOCUS:
+    case WM_SETFOCUS:
     {
-      extern bool cursor_locked;
-      cursor_locked = false;
+      window_focused = message == WM_SETFOCUS;
+      result = DefWindowProc(window, message, wParam, lParam);
     }
+    break;
+
     default:
     {
       result = DefWindowProc(window, message, wParam, lParam);
@@ -177,10 +188,39 @@ int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
   RECT cursor_region = {0, 0, monitor_width, monitor_height};
   ClipCursor(&cursor_region);
 
+  // "-capture file" records every frame's graphics calls and input there, for
+  // replaying with the null renderer. "-steps-per-second rate" changes how
+  // often the world updates.
+  std::vector<char *> arguments(__argv, __argv + __argc);
+  int argument_count = __argc;
+  FrameTrace trace;
+  const char *trace_file = take_option(&argument_count, arguments.data(), "-capture");
+
+  float steps_per_second = DEFAULT_WORLD_STEPS_PER_SECOND;
+  if(const char *rate = take_option(&argument_count, arguments.data(), "-steps-per-second"))
+  {
+    float parsed = (float)atof(rate);
+    if(parsed > 0.0f) steps_per_second = parsed;
+  }
+
   // Initialize
+  init_job_system();
   init_renderer(window_handle, monitor_width, monitor_height, false, false);
+  if(trace_file) start_trace_capture(&trace);
   init_world();
 
+  // The world steps at a fixed rate a frame ahead on its own thread, with the
+  // frames in between blended. While capturing the steps that are due run on
+  // this one instead, straight against the renderer, so the trace gets the
+  // calls and the input in order.
+  FramePipeline pipeline;
+  Simulation simulation;
+  WorldRequests requests;
+  bool pipelined = !trace_file;
+  if(pipelined) start_frame_pipeline(&pipeline, update_world, steps_per_second);
+  else init_simulation(&simulation, update_world, steps_per_second);
+  std::chrono::steady_clock::time_point last_frame = std::chrono::steady_clock::now();
+
   // Main loop
   running = true;
   while(running)
@@ -208,9 +248,10 @@ int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
       ScreenToClient(window_handle, &p);
     }
     mouse_position = v2((float)p.x, (float)p.y);
-    delta_mouse_position = mouse_position - v2(monitor_width / 2.0f, monitor_height / 2.0f);
 
-    extern bool cursor_locked;
+    // Locked as of the last snapshot, and only while the window has focus
+    bool cursor_locked = requests.cursor_locked && window_focused;
+    delta_mouse_position = cursor_locked ? mouse_position - v2(monitor_width / 2.0f, monitor_height / 2.0f) : v2();
 
     static bool last_check_cursor_locked = false;
     if(cursor_locked != last_check_cursor_locked)
@@ -234,16 +275,56 @@ int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLi
 
     last_check_cursor_locked = cursor_locked;
 
+    // Sampled once a frame here, the world only sees this copy
+    TraceInput input = {};
+    if(window_focused)
+    {
+      for(unsigned i = 0; i < MAX_BUTTONS && i < TRACE_MAX_KEYS; i++)
+      {
+        if(key_states[i]) input.keys[i / 32] |= 1u << (i % 32);
+      }
+      for(unsigned i = 0; i < 8; i++)
+      {
+        if(mouse_states[i]) input.mouse_buttons |= 1u << i;
+      }
+      input.mouse_delta = delta_mouse_position;
+    }
+    trace_input(&input);
+
     // Updating
-    update_world();
+    if(pipelined)
+    {
+      set_pipeline_input(&pipeline, &input);
+      apply_next_snapshot(&pipeline, &requests);
+    }
+    else
+    {
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      std::chrono::duration<double> elapsed = now - last_frame;
+      last_frame = now;
+
+      set_simulation_input(&simulation, &input);
+      step_simulation_directly(&simulation, elapsed.count());
+      requests = simulation.scene.requests;
+    }
 
 
     
     // Rendering
     render();
+    trace_end_frame();
+  }
+
+  if(pipelined) stop_frame_pipeline(&pipeline);
+
+  if(trace_file)
+  {
+    stop_trace_capture();
+    write_trace_file(&trace, trace_file);
   }
 
   shutdown_renderer();
+  shutdown_job_system();
 
   return 0;
 }
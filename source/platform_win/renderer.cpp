@@ -1,24 +1,15 @@
 #include "renderer.h" // Platform specific interface
 #include "../graphics.h" // Platform independent interface
 
-#include "../my_math.h" // v2
-#include "asset_loading.h" // Loading models
+#include "../renderer_common.h" // RendererData, backends
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 
-#include <assert.h>
-
-// Handle to game
-#if 0
-struct Model
-{
-  int index;
 
-  Model(int i) : index(i) {}
-};
-#endif
+#include <assert.h>
+#include <string.h> // memcpy
 
 // Renderer target info
 struct Window
@@ -46,93 +37,83 @@ struct D3DResources
   ID3D11DepthStencilState *no_depth_stencil_state;
   ID3D11DepthStencilView *depth_stencil_view;
   ID3D11RasterizerState *raster_state;
-
-  ID3D11Texture2D *render_target_texture;
-  ID3D11RenderTargetView *render_to_texture_target_view;
-  ID3D11ShaderResourceView *render_target_shader_resource_view;
-};
-
-// Shaders
-struct Shader
-{
-  ID3D11VertexShader *vertex_shader;
-  ID3D11PixelShader *pixel_shader;
-  ID3D11InputLayout *layout;
-
-  ID3D11Buffer *global_buffer;
-};
-
-struct FirstShaderBuffer
-{
-  mat4 world_m_model;
-  mat4 view_m_world;
-  mat4 clip_m_view;
-
-  mat4 light_clip_m_model;
-
-  v4 color;
-  v4 light_vector;
-};
-
-struct SkyboxShaderBuffer
-{
-  mat4 world_m_model;
-  mat4 view_m_world;
-  mat4 clip_m_view;
 };
 
-struct DepthShaderBuffer
+// What render graph texture handles point to. Views the texture wasn't
+// created for are null.
+struct GraphTexture
 {
-  mat4 clip_m_model;
+  ID3D11Texture2D *texture;
+  ID3D11RenderTargetView *target_view;
+  ID3D11ShaderResourceView *resource_view;
+  ID3D11DepthStencilView *depth_view;
 };
 
-// Textures
-struct Texture
-{
-  ID3D11ShaderResourceView *resource;
-  ID3D11SamplerState *sample_state;
-};
+// Depth targets that shaders can read are created typeless and viewed as
+// depth for drawing and as a float for reading
+static const DXGI_FORMAT READABLE_DEPTH_FORMAT = DXGI_FORMAT_R32_TYPELESS;
 
-struct Camera
+// Creates the render graph's transient targets, readable by shaders
+struct D3D11GraphBackend : RenderGraphBackend
 {
-  v3 position = v3(0.0f, 1.0f, 5.0f);
+  ID3D11Device *device = 0;
 
-  v3 looking_direction = v3(0.0f, 0.0f, 1.0f);
-
-  float field_of_view = 60.0f;
-};
-
-struct Mesh
-{
-  struct Vertex
+  void *create_texture(const RenderGraphTextureDesc &desc)
   {
-    v3 position;
-    v3 normal;
-    v2 uv;
+    GraphTexture *result = new GraphTexture();
+    bool depth = desc.format == READABLE_DEPTH_FORMAT;
 
-    Vertex() : position(v3()), normal(v3()), uv(v2()) {}
-    Vertex(v3 a, v3 b, v2 c) : position(a), normal(b), uv(c) {}
-  };
-
-  std::vector<Vertex> vertices;
-  //std::vector<v3> vertices;
-  //std::vector<v3> normals;
-  //std::vector<v3> materials;
-  //std::vector<v2> uvs;
-  std::vector<unsigned> indices;
-
-
-  ID3D11Buffer *vertex_buffer;
-  ID3D11Buffer *index_buffer;
+    D3D11_TEXTURE2D_DESC texture_desc = {};
+    texture_desc.Width = desc.width;
+    texture_desc.Height = desc.height;
+    texture_desc.MipLevels = 1;
+    texture_desc.ArraySize = 1;
+    texture_desc.Format = (DXGI_FORMAT)desc.format;
+    texture_desc.SampleDesc.Count = 1;
+    texture_desc.Usage = D3D11_USAGE_DEFAULT;
+    texture_desc.BindFlags = (depth ? D3D11_BIND_DEPTH_STENCIL : D3D11_BIND_RENDER_TARGET) | D3D11_BIND_SHADER_RESOURCE;
+    HRESULT result_code = device->CreateTexture2D(&texture_desc, NULL, &result->texture);
+    assert(!FAILED(result_code));
 
+    if(depth)
+    {
+      D3D11_DEPTH_STENCIL_VIEW_DESC view_desc = {};
+      view_desc.Format = DXGI_FORMAT_D32_FLOAT;
+      view_desc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
+      view_desc.Texture2D.MipSlice = 0;
+      result_code = device->CreateDepthStencilView(result->texture, &view_desc, &result->depth_view);
+      assert(!FAILED(result_code));
+    }
+    else
+    {
+      D3D11_RENDER_TARGET_VIEW_DESC view_desc = {};
+      view_desc.Format = texture_desc.Format;
+      view_desc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2D;
+      view_desc.Texture2D.MipSlice = 0;
+      result_code = device->CreateRenderTargetView(result->texture, &view_desc, &result->target_view);
+      assert(!FAILED(result_code));
+    }
 
-  unsigned draw_mode = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
+    D3D11_SHADER_RESOURCE_VIEW_DESC resource_view_desc = {};
+    resource_view_desc.Format = depth ? DXGI_FORMAT_R32_FLOAT : texture_desc.Format;
+    resource_view_desc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+    resource_view_desc.Texture2D.MostDetailedMip = 0;
+    resource_view_desc.Texture2D.MipLevels = 1;
+    result_code = device->CreateShaderResourceView(result->texture, &resource_view_desc, &result->resource_view);
+    assert(!FAILED(result_code));
 
+    return result;
+  }
 
-  void normalize();
-  void compute_vertex_normals();
-  void fill_buffers(ID3D11Device *device);
-  void clear_buffers();
+  void destroy_texture(void *handle)
+  {
+    GraphTexture *texture = (GraphTexture *)handle;
+    texture->resource_view->Release();
+    if(texture->target_view) texture->target_view->Release();
+    if(texture->depth_view) texture->depth_view->Release();
+    texture->texture->Release();
+    delete texture;
+  }
 };
 
 enum PrimitiveType
@@ -140,60 +121,190 @@ enum PrimitiveType
   PRIMITIVE_QUAD,
 };
 
-struct ModelData
+// Forwards whatever gets past the state cache to the device context
+struct D3D11Backend : CommandBackend
 {
-  const char *debug_name = "";
-  bool show = true;
-  bool render_normals = false;
-
-  v3 position = v3();
-  v3 scale = v3(1.0f, 1.0f, 1.0f);
-  float y_axis_rotation = 0.0f; // In degrees
-
-  v4 blend_color = v4(1.0f, 1.0f, 1.0f, 1.0f);
+  ID3D11DeviceContext *device_context = 0;
 
-
-  Mesh *mesh = 0;
-  Mesh *debug_normals_mesh = 0;
-  Shader *shader = 0;
-  Texture *texture = 0;
+  void set_vertex_buffer(unsigned slot, void *buffer, unsigned stride)
+  {
+    ID3D11Buffer *buffers[] = {(ID3D11Buffer *)buffer};
+    unsigned strides[] = {stride};
+    unsigned offsets[] = {0};
+    device_context->IASetVertexBuffers(slot, 1, buffers, strides, offsets);
+  }
+  void set_index_buffer(void *buffer) { device_context->IASetIndexBuffer((ID3D11Buffer *)buffer, DXGI_FORMAT_R32_UINT, 0); }
+  void set_topology(unsigned topology) { device_context->IASetPrimitiveTopology((D3D_PRIMITIVE_TOPOLOGY)topology); }
+  void set_input_layout(void *layout) { device_context->IASetInputLayout((ID3D11InputLayout *)layout); }
+  void set_vertex_shader(void *shader) { device_context->VSSetShader((ID3D11VertexShader *)shader, NULL, 0); }
+  void set_pixel_shader(void *shader) { device_context->PSSetShader((ID3D11PixelShader *)shader, NULL, 0); }
+  void set_vs_constant_buffer(unsigned slot, void *buffer)
+  {
+    ID3D11Buffer *b = (ID3D11Buffer *)buffer;
+    device_context->VSSetConstantBuffers(slot, 1, &b);
+  }
+  void set_ps_constant_buffer(unsigned slot, void *buffer)
+  {
+    ID3D11Buffer *b = (ID3D11Buffer *)buffer;
+    device_context->PSSetConstantBuffers(slot, 1, &b);
+  }
+  void set_ps_resource(unsigned slot, void *resource)
+  {
+    ID3D11ShaderResourceView *r = (ID3D11ShaderResourceView *)resource;
+    device_context->PSSetShaderResources(slot, 1, &r);
+  }
+  void set_ps_sampler(unsigned slot, void *sampler)
+  {
+    ID3D11SamplerState *s = (ID3D11SamplerState *)sampler;
+    device_context->PSSetSamplers(slot, 1, &s);
+  }
+  void set_depth_stencil_state(void *state) { device_context->OMSetDepthStencilState((ID3D11DepthStencilState *)state, 0); }
+  void set_render_target(void *render_target, void *depth_stencil)
+  {
+    ID3D11RenderTargetView *target = (ID3D11RenderTargetView *)render_target;
+    device_context->OMSetRenderTargets(target ? 1 : 0, target ? &target : NULL, (ID3D11DepthStencilView *)depth_stencil);
+  }
+  void update_buffer(void *buffer, const void *data, unsigned size)
+  {
+    D3D11_MAPPED_SUBRESOURCE mapped_resource;
+    HRESULT result = device_context->Map((ID3D11Buffer *)buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped_resource);
+    assert(!FAILED(result));
+    memcpy(mapped_resource.pData, data, size);
+    device_context->Unmap((ID3D11Buffer *)buffer, 0);
+  }
+  void draw_indexed(unsigned index_count, unsigned instance_count, unsigned first_index, unsigned base_vertex, unsigned first_instance)
+  {
+    device_context->DrawIndexedInstanced(index_count, instance_count, first_index, base_vertex, first_instance);
+  }
 };
 
-struct RendererData
+// Everything the shared renderer asks of the device, plus the device itself
+struct D3D11Renderer : RendererBackend
 {
   Window window;
   D3DResources resources;
 
   FILE *shader_errors_file = 0;
-  Shader flat_color_shader;
-  Shader diffuse_shader;
-  Shader quad_shader;
-  Shader depth_shader;
 
-  Mesh skybox_mesh;
-  Shader skybox_shader;
-  Texture skybox_texture;
+  // What the state cache forwards to, and what the render graph's handles are
+  D3D11Backend state_backend;
+  D3D11GraphBackend graph_backend;
+  GraphTexture back_buffer;
+  GraphTexture depth_buffer;
 
-  Mesh quad_mesh;
-  Texture quad_texture;
-  
   // Gobal matrix buffer for now. See TODO about this in the shader creation code.
   ID3D11Buffer *first_shader_buffer;
+  ID3D11Buffer *frame_shader_buffer;
   ID3D11Buffer *skybox_shader_buffer;
   ID3D11Buffer *depth_shader_buffer;
 
-  std::vector<ModelData> models_to_render;
-  
-  Camera camera;
+  void *create_mesh_buffer(unsigned bytes, bool indices)
+  {
+    D3D11_BUFFER_DESC buffer_desc;
+    buffer_desc.Usage = D3D11_USAGE_DEFAULT;
+    buffer_desc.ByteWidth = bytes;
+    buffer_desc.BindFlags = indices ? D3D11_BIND_INDEX_BUFFER : D3D11_BIND_VERTEX_BUFFER;
+    buffer_desc.CPUAccessFlags = 0;
+    buffer_desc.MiscFlags = 0;
+    buffer_desc.StructureByteStride = 0;
+
+    ID3D11Buffer *buffer;
+    HRESULT result = resources.device->CreateBuffer(&buffer_desc, NULL, &buffer);
+    assert(!FAILED(result));
+    return buffer;
+  }
+
+  void write_mesh_buffer(void *buffer, unsigned offset, const void *data, unsigned bytes)
+  {
+    D3D11_BOX box;
+    box.left = offset;
+    box.right = offset + bytes;
+    box.top = 0;
+    box.bottom = 1;
+    box.front = 0;
+    box.back = 1;
+    resources.device_context->UpdateSubresource((ID3D11Buffer *)buffer, 0, &box, data, 0, 0);
+  }
+
+  // A dynamic vertex buffer, read as the per instance stream
+  void *create_object_buffer(unsigned bytes)
+  {
+    D3D11_BUFFER_DESC object_buffer_desc;
+    object_buffer_desc.Usage = D3D11_USAGE_DYNAMIC;
+    object_buffer_desc.ByteWidth = bytes;
+    object_buffer_desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    object_buffer_desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    object_buffer_desc.MiscFlags = 0;
+    object_buffer_desc.StructureByteStride = 0;
+
+    ID3D11Buffer *buffer;
+    HRESULT result = resources.device->CreateBuffer(&object_buffer_desc, NULL, &buffer);
+    assert(!FAILED(result));
+    return buffer;
+  }
+
+  void write_object_buffer(void *buffer, unsigned offset, const void *data, unsigned bytes, bool discard)
+  {
+    D3D11_MAP map_type = discard ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE;
+    D3D11_MAPPED_SUBRESOURCE mapped_resource;
+    HRESULT result = resources.device_context->Map((ID3D11Buffer *)buffer, 0, map_type, 0, &mapped_resource);
+    assert(!FAILED(result));
+    memcpy((unsigned char *)mapped_resource.pData + offset, data, bytes);
+    resources.device_context->Unmap((ID3D11Buffer *)buffer, 0);
+  }
+
+  void destroy_buffer(void *buffer) { ((ID3D11Buffer *)buffer)->Release(); }
+
+  void *target_view(void *texture) { return ((GraphTexture *)texture)->target_view; }
+  void *depth_view(void *texture) { return ((GraphTexture *)texture)->depth_view; }
+  void *resource_view(void *texture) { return ((GraphTexture *)texture)->resource_view; }
 
-  v3 light_vector = v3(1.0f, 1.0f, 1.0f);
-  Camera light_camera;
+  void set_viewport(unsigned width, unsigned height)
+  {
+    D3D11_VIEWPORT viewport = {};
+    viewport.Width = (float)width;
+    viewport.Height = (float)height;
+    viewport.MinDepth = 0.0f;
+    viewport.MaxDepth = 1.0f;
+    resources.device_context->RSSetViewports(1, &viewport);
+  }
+
+  void clear_color(void *texture)
+  {
+    resources.device_context->ClearRenderTargetView(((GraphTexture *)texture)->target_view, window.background_color);
+  }
+
+  void clear_depth(void *texture)
+  {
+    resources.device_context->ClearDepthStencilView(((GraphTexture *)texture)->depth_view, D3D11_CLEAR_DEPTH, 1.0f, 0);
+  }
+
+  void copy_texture(void *destination, void *source)
+  {
+    resources.device_context->CopyResource(((GraphTexture *)destination)->texture, ((GraphTexture *)source)->texture);
+  }
+
+  // The device keeps what queued work uses alive until it's done
+  void flush() {}
+
+  // Present the back buffer to the screen since rendering is complete.
+  void present()
+  {
+    if(window.vsync)
+    {
+      // Lock to screen refresh rate.
+      resources.swap_chain->Present(1, 0);
+    }
+    else
+    {
+      // Present as fast as possible.
+      resources.swap_chain->Present(0, 0);
+    }
+  }
 };
 
 // TODO: This is global. Move it somewhere nice.
-static RendererData *renderer_data;
-
-static const v3 WORLD_UP_VECTOR = {0.0f, 1.0f, 0.0f};
+static D3D11Renderer *d3d11_renderer;
 
 
 
@@ -215,7 +326,7 @@ static void output_shader_errors(ID3D10Blob *error_message, const char *shader_f
   // Write out the error message.
   compile_errors[buffer_size - 1] = '\0';
 
-  fprintf(renderer_data->shader_errors_file, compile_errors);
+  fprintf(d3d11_renderer->shader_errors_file, compile_errors);
 
   // Stop program when there's an error
   assert(0);
@@ -233,7 +344,7 @@ static void output_shader_errors(ID3D10Blob *error_message, const char *shader_f
 static void create_shader(const char *vs_path, const char *vs_name, const char *ps_path, const char *ps_name, D3D11_INPUT_ELEMENT_DESC *common_input_vertex_layout, unsigned num_elements, Shader *output_shader, ID3D11Buffer *in_buffer)
 {
 
-  ID3D11Device *device = renderer_data->resources.device;
+  ID3D11Device *device = d3d11_renderer->resources.device;
 
   ID3D10Blob *error_message = 0;
   ID3D10Blob *vertex_shader_buffer = 0;
@@ -249,108 +360,50 @@ static void create_shader(const char *vs_path, const char *vs_name, const char *
     return;
   }
 
-  // Compile the pixel shader code.
-  result = D3DX11CompileFromFile(ps_path, NULL, NULL, ps_name, "ps_5_0", D3D10_SHADER_ENABLE_STRICTNESS, 0, NULL, 
-    &pixel_shader_buffer, &error_message, NULL);
-  if(FAILED(result))
+  // Compile the pixel shader code. Passes that only write depth have none.
+  if(ps_path)
   {
-    if(error_message) output_shader_errors(error_message, ps_path);
-    else assert(0); // Could not find shader file
-    return;
+    result = D3DX11CompileFromFile(ps_path, NULL, NULL, ps_name, "ps_5_0", D3D10_SHADER_ENABLE_STRICTNESS, 0, NULL, 
+      &pixel_shader_buffer, &error_message, NULL);
+    if(FAILED(result))
+    {
+      if(error_message) output_shader_errors(error_message, ps_path);
+      else assert(0); // Could not find shader file
+      return;
+    }
   }
 
   // Create the vertex shader from the buffer.
-  result = device->CreateVertexShader(vertex_shader_buffer->GetBufferPointer(), vertex_shader_buffer->GetBufferSize(), NULL, &output_shader->vertex_shader);
+  ID3D11VertexShader *vertex_shader;
+  result = device->CreateVertexShader(vertex_shader_buffer->GetBufferPointer(), vertex_shader_buffer->GetBufferSize(), NULL, &vertex_shader);
   assert(!FAILED(result));
 
   // Create the pixel shader from the buffer.
-  result = device->CreatePixelShader(pixel_shader_buffer->GetBufferPointer(), pixel_shader_buffer->GetBufferSize(), NULL, &output_shader->pixel_shader);
-  assert(!FAILED(result));
+  ID3D11PixelShader *pixel_shader = 0;
+  if(pixel_shader_buffer)
+  {
+    result = device->CreatePixelShader(pixel_shader_buffer->GetBufferPointer(), pixel_shader_buffer->GetBufferSize(), NULL, &pixel_shader);
+    assert(!FAILED(result));
+  }
 
 
   // Create the vertex input layout.
+  ID3D11InputLayout *input_layout;
   result = device->CreateInputLayout(common_input_vertex_layout, num_elements, vertex_shader_buffer->GetBufferPointer(), 
-    vertex_shader_buffer->GetBufferSize(), &output_shader->layout);
+    vertex_shader_buffer->GetBufferSize(), &input_layout);
   assert(!FAILED(result));
 
   // Release the vertex shader buffer and pixel shader buffer since they are no longer needed.
   vertex_shader_buffer->Release();
-  pixel_shader_buffer->Release();
-
-
+  if(pixel_shader_buffer) pixel_shader_buffer->Release();
 
-  output_shader->global_buffer = in_buffer;
-}
-
-static mat4 make_world_matrix(v3 position, v3 scale, float y_axis_rotation)
-{
-  mat4 scale_matrix = make_scale_matrix(scale);
-  mat4 rotation_matrix = make_y_axis_rotation_matrix(deg_to_rad(y_axis_rotation));
-  mat4 translation_matrix = make_translation_matrix(position);
-  return translation_matrix * rotation_matrix * scale_matrix;
-}
 
-static mat4 make_view_matrix(v3 camera_position, v3 camera_looking_direction)
-{
-  // w
-  // This is looking away from the target
-  v3 camera_to_target = unit(camera_looking_direction);
-  v3 target_axis = -camera_to_target;
-  // u
-  v3 right_axis = cross(WORLD_UP_VECTOR, target_axis);
-  if(length(right_axis) == 0.0f) right_axis = v3(1.0f, 0.0f, 0.0f);
-  right_axis = unit(right_axis);
-  // v
-  v3 up_axis = cross(target_axis, right_axis);
-  up_axis = unit(up_axis);
-  mat4 view_mat =
-  {
-    right_axis.x,  right_axis.y,  right_axis.z,  -dot(right_axis, camera_position),
-    up_axis.x,     up_axis.y,     up_axis.z,     -dot(up_axis, camera_position),
-    target_axis.x, target_axis.y, target_axis.z, -dot(target_axis, camera_position),
-    0.0f, 0.0f, 0.0f, 1.0f,
-  };
-
-  return view_mat;
-}
-
-// fov in radians
-static mat4 make_perspective_projection_matrix(float fov, float aspect_ratio, float near_plane, float far_plane)
-{
-  // Distance from the near plane (must be positive)
-  float n = near_plane;
-  // Distance from the far plane (must be positive)
-  float f = far_plane;
-  float r = f / (n - f);
-  float s = r * n;
-  mat4 persp = 
-  {
-    (float)(1.0f / tan(fov / 2.0f)) / aspect_ratio, 0.0f, 0.0f, 0.0f,
-    0.0f, 1.0f / tan(fov / 2.0f), 0.0f, 0.0f,
-    0.0f, 0.0f, r, s,
-    0.0f, 0.0f, -1.0f, 0.0f
-  };
-
-  return persp;
-}
-
-// infinite far plane
-// fov in radians
-static mat4 make_perspective_projection_matrix(float fov, float aspect_ratio, float near_plane)
-{
-  // Distance from the near plane (must be positive)
-  float n = near_plane;
-  float r = -1.0f;
-  float s = r * n;
-  mat4 persp = 
-  {
-    (float)(1.0f / tan(fov / 2.0f)) / aspect_ratio, 0.0f, 0.0f, 0.0f,
-    0.0f, 1.0f / tan(fov / 2.0f), 0.0f, 0.0f,
-    0.0f, 0.0f, r, s,
-    0.0f, 0.0f, -1.0f, 0.0f
-  };
 
-  return persp;
+  output_shader->vertex_shader = vertex_shader;
+  output_shader->pixel_shader = pixel_shader;
+  output_shader->input_layout = input_layout;
+  output_shader->constants = in_buffer;
+  output_shader->sort_id = ++renderer_data->num_shader_sort_ids;
 }
 
 static mat4 make_ortho_projection_matrix(float width, float aspect_ratio, float near_plane, float far_plane)
@@ -373,230 +426,6 @@ static mat4 make_ortho_projection_matrix(float width, float aspect_ratio, float
   return ortho;
 }
 
-static void make_quad(Mesh::Vertex *vertices, unsigned *indices)
-{
-  vertices[0] = Mesh::Vertex(v3(-1.0f, -1.0f, 0.0f), v3(0.0f, 0.0f, 1.0f), v2(0.0f, 1.0f)); // Left lower
-  vertices[1] = Mesh::Vertex(v3( 1.0f, -1.0f, 0.0f), v3(0.0f, 0.0f, 1.0f), v2(1.0f, 1.0f)); // Right lower
-  vertices[2] = Mesh::Vertex(v3( 1.0f,  1.0f, 0.0f), v3(0.0f, 0.0f, 1.0f), v2(1.0f, 0.0f)); // Right upper
-  vertices[3] = Mesh::Vertex(v3(-1.0f,  1.0f, 0.0f), v3(0.0f, 0.0f, 1.0f), v2(0.0f, 0.0f)); // Left upper
-
-  indices[0] = 0;
-  indices[1] = 1;
-  indices[2] = 2;
-  indices[3] = 2;
-  indices[4] = 3;
-  indices[5] = 0;
-}
-
-static void make_inward_cube_mesh(Mesh::Vertex *vertices, unsigned *indices)
-{
-  vertices[0] = Mesh::Vertex(v3(-1.0f, -1.0f,  1.0f), v3(), v2()); // Left lower front
-  vertices[1] = Mesh::Vertex(v3( 1.0f, -1.0f,  1.0f), v3(), v2()); // Right lower front
-  vertices[2] = Mesh::Vertex(v3( 1.0f, -1.0f, -1.0f), v3(), v2()); // Right lower back
-  vertices[3] = Mesh::Vertex(v3(-1.0f, -1.0f, -1.0f), v3(), v2()); // Left lower back
-
-  vertices[4] = Mesh::Vertex(v3(-1.0f,  1.0f,  1.0f), v3(), v2()); // Left upper front
-  vertices[5] = Mesh::Vertex(v3( 1.0f,  1.0f,  1.0f), v3(), v2()); // Right upper front
-  vertices[6] = Mesh::Vertex(v3( 1.0f,  1.0f, -1.0f), v3(), v2()); // Right upper back
-  vertices[7] = Mesh::Vertex(v3(-1.0f,  1.0f, -1.0f), v3(), v2()); // Left upper back
-
-
-  // Counter        Clockwise
-  // clockwise
-
-  // Bottom         // Top
-  indices[0] = 0;   indices[6] = 6;
-  indices[1] = 1;   indices[7] = 5;
-  indices[2] = 2;   indices[8] = 4;
-  indices[3] = 2;   indices[9] = 4;
-  indices[4] = 3;   indices[10] = 7;
-  indices[5] = 0;   indices[11] = 6;
-
-  // Left           // Right
-  indices[12] = 0;  indices[18] = 2;
-  indices[13] = 3;  indices[19] = 1;
-  indices[14] = 7;  indices[20] = 5;
-  indices[15] = 7;  indices[21] = 5;
-  indices[16] = 4;  indices[22] = 6;
-  indices[17] = 0;  indices[23] = 2;
-
-  // Front          // Back
-  indices[24] = 3;  indices[30] = 5;
-  indices[25] = 2;  indices[31] = 1;
-  indices[26] = 6;  indices[32] = 0;
-  indices[27] = 6;  indices[33] = 0;
-  indices[28] = 7;  indices[34] = 4;
-  indices[29] = 3;  indices[35] = 5;
-}
-
-
-
-
-
-
-
-
-void Mesh::normalize()
-{
-  // Get the min and max values for each axis
-  float min_x = INFINITY;
-  float max_x = -INFINITY;
-  float min_y = INFINITY;
-  float max_y = -INFINITY;
-  float min_z = INFINITY;
-  float max_z = -INFINITY;
-  v3 sum_points = {0.0f, 0.0f, 0.0f};
-  for(unsigned i = 0; i < vertices.size(); i++)
-  {
-    min_x = min(min_x, vertices[i].position.x);
-    max_x = max(max_x, vertices[i].position.x);
-    min_y = min(min_y, vertices[i].position.y);
-    max_y = max(max_y, vertices[i].position.y);
-    min_z = min(min_z, vertices[i].position.z);
-    max_z = max(max_z, vertices[i].position.z);
-
-    sum_points += vertices[i].position;
-  }
-
-  // Find center of model
-  sum_points /= (float)vertices.size();
-
-  // Get the max difference in an axis
-  float diff_x = max_x - min_x;
-  float diff_y = max_y - min_y;
-  float diff_z = max_z - min_z;
-
-  float max_diff = max(diff_x, max(diff_y, diff_z));
-
-  // Move vertices to center and scale down
-  for(unsigned i = 0; i < vertices.size(); i++)
-  {
-    // Move centroid to origin
-    vertices[i].position -= sum_points;
-
-    // Scale down to between -1 and 1
-    vertices[i].position = (vertices[i].position / max_diff) * 2.0f;
-  }
-}
-
-void Mesh::compute_vertex_normals()
-{
-  if(vertices.size() == 0) return;
-
-  // Allocate buffers
-  //normals.reserve(vertices.size());
-  //normals.resize(vertices.size());
-
-  std::vector<float> sums;
-  sums.reserve(vertices.size());
-  sums.resize(vertices.size());
-
-  // Initalize to zero
-  for(unsigned i = 0; i < vertices.size(); i++)
-  {
-    vertices[i].normal = v3(0.0f, 0.0f, 0.0f);
-  }
-  for(unsigned i = 0; i < sums.size(); i++)
-  {
-    sums[i] = 0.0f;
-  }
-
-  // Find the sum of all normals per vertex
-  for(unsigned i = 0; i < indices.size(); )
-  {
-    unsigned p0_index = indices[i++];
-    unsigned p1_index = indices[i++];
-    unsigned p2_index = indices[i++];
-
-    v3 p0 = vertices[p0_index].position;
-    v3 p1 = vertices[p1_index].position;
-    v3 p2 = vertices[p2_index].position;
-
-    v3 normal = cross(p1 - p0, p2 - p0);
-    if(length_squared(normal) == 0.0f)
-    {
-      normal = v3(0.0f, 0.0f, 0.0f);
-    }
-    else
-    {
-      normal = unit(normal);
-    }
-
-
-    vertices[p0_index].normal += normal;
-    vertices[p1_index].normal += normal;
-    vertices[p2_index].normal += normal;
-
-    sums[p0_index] += 1.0f;
-    sums[p1_index] += 1.0f;
-    sums[p2_index] += 1.0f;
-  }
-
-  // Divide to find average normal per vertex
-  for(unsigned i = 0; i < vertices.size(); i++)
-  {
-    if(sums[i] == 0.0f) continue;
-    vertices[i].normal /= sums[i];
-  }
-}
-
-void Mesh::fill_buffers(ID3D11Device *device)
-{
-  // Vertices
-  {
-    // Set up the description of the static vertex buffer.
-    D3D11_BUFFER_DESC vertex_buffer_desc;
-    vertex_buffer_desc.Usage = D3D11_USAGE_DEFAULT;
-    vertex_buffer_desc.ByteWidth = sizeof(Vertex) * vertices.size();
-    vertex_buffer_desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-    vertex_buffer_desc.CPUAccessFlags = 0;
-    vertex_buffer_desc.MiscFlags = 0;
-    vertex_buffer_desc.StructureByteStride = 0;
-
-    // Give the subresource structure a pointer to the vertex data.
-    D3D11_SUBRESOURCE_DATA vertex_data;
-    vertex_data.pSysMem = vertices.data();
-    vertex_data.SysMemPitch = 0;
-    vertex_data.SysMemSlicePitch = 0;
-
-    // Now create the vertex buffer.
-    HRESULT result = device->CreateBuffer(&vertex_buffer_desc, &vertex_data, &vertex_buffer);
-    assert(!FAILED(result));
-  }
-
-  // Indices
-  {
-    D3D11_BUFFER_DESC index_buffer_desc;
-    index_buffer_desc.Usage = D3D11_USAGE_DEFAULT;
-    index_buffer_desc.ByteWidth = sizeof(unsigned) * indices.size();
-    index_buffer_desc.BindFlags = D3D11_BIND_INDEX_BUFFER;
-    index_buffer_desc.CPUAccessFlags = 0;
-    index_buffer_desc.MiscFlags = 0;
-    index_buffer_desc.StructureByteStride = 0;
-
-    D3D11_SUBRESOURCE_DATA index_data;
-    index_data.pSysMem = indices.data();
-    index_data.SysMemPitch = 0;
-    index_data.SysMemSlicePitch = 0;
-
-    HRESULT result = device->CreateBuffer(&index_buffer_desc, &index_data, &index_buffer);
-    assert(!FAILED(result));
-  }
-}
-
-
-void Mesh::clear_buffers()
-{
-  if(index_buffer) index_buffer->Release();
-  if(vertex_buffer) vertex_buffer->Release();
-}
-
-
-
-
-
-
-
 
 
 
@@ -612,38 +441,35 @@ void Mesh::clear_buffers()
 
 void init_renderer(HWND window, unsigned in_framebuffer_width, unsigned in_framebuffer_height, bool is_fullscreen, bool is_vsync)
 {
+  d3d11_renderer = new D3D11Renderer();
   renderer_data = new RendererData();
 
-  renderer_data->shader_errors_file = fopen("shader_errors.txt", "wt");
+  d3d11_renderer->shader_errors_file = fopen("shader_errors.txt", "wt");
 
-  renderer_data->window.fullscreen = is_fullscreen;
-  renderer_data->window.vsync = is_vsync;
-  renderer_data->window.framebuffer_width = in_framebuffer_width;
-  renderer_data->window.framebuffer_height = in_framebuffer_height;
+  d3d11_renderer->window.fullscreen = is_fullscreen;
+  d3d11_renderer->window.vsync = is_vsync;
+  d3d11_renderer->window.framebuffer_width = in_framebuffer_width;
+  d3d11_renderer->window.framebuffer_height = in_framebuffer_height;
 
   HRESULT result;
 
   // All references to the renderer data's memory for easier coding :)))
-  unsigned &video_card_memory_bytes = renderer_data->resources.video_card_memory_bytes;
-  unsigned &framebuffer_width = renderer_data->window.framebuffer_width;
-  unsigned &framebuffer_height = renderer_data->window.framebuffer_height;
-  bool &vsync = renderer_data->window.vsync;
-  bool &fullscreen = renderer_data->window.fullscreen;
-  float &aspect_ratio = renderer_data->window.aspect_ratio;
-
-  IDXGISwapChain *&swap_chain = renderer_data->resources.swap_chain;
-  ID3D11Device *&device = renderer_data->resources.device;
-  ID3D11DeviceContext *&device_context = renderer_data->resources.device_context;
-  ID3D11RenderTargetView *&render_target_view = renderer_data->resources.render_target_view;
-  ID3D11Texture2D *&depth_stencil_buffer = renderer_data->resources.depth_stencil_buffer;
-  ID3D11DepthStencilState *&depth_stencil_state = renderer_data->resources.depth_stencil_state;
-  ID3D11DepthStencilState *&no_depth_stencil_state = renderer_data->resources.no_depth_stencil_state;
-  ID3D11DepthStencilView *&depth_stencil_view = renderer_data->resources.depth_stencil_view;
-  ID3D11RasterizerState *&raster_state = renderer_data->resources.raster_state;
-
-  ID3D11Texture2D *&render_target_texture = renderer_data->resources.render_target_texture;
-  ID3D11RenderTargetView *&render_to_texture_target_view = renderer_data->resources.render_to_texture_target_view;
-  ID3D11ShaderResourceView *&render_target_shader_resource_view = renderer_data->resources.render_target_shader_resource_view;
+  unsigned &video_card_memory_bytes = d3d11_renderer->resources.video_card_memory_bytes;
+  unsigned &framebuffer_width = d3d11_renderer->window.framebuffer_width;
+  unsigned &framebuffer_height = d3d11_renderer->window.framebuffer_height;
+  bool &vsync = d3d11_renderer->window.vsync;
+  bool &fullscreen = d3d11_renderer->window.fullscreen;
+  float &aspect_ratio = d3d11_renderer->window.aspect_ratio;
+
+  IDXGISwapChain *&swap_chain = d3d11_renderer->resources.swap_chain;
+  ID3D11Device *&device = d3d11_renderer->resources.device;
+  ID3D11DeviceContext *&device_context = d3d11_renderer->resources.device_context;
+  ID3D11RenderTargetView *&render_target_view = d3d11_renderer->resources.render_target_view;
+  ID3D11Texture2D *&depth_stencil_buffer = d3d11_renderer->resources.depth_stencil_buffer;
+  ID3D11DepthStencilState *&depth_stencil_state = d3d11_renderer->resources.depth_stencil_state;
+  ID3D11DepthStencilState *&no_depth_stencil_state = d3d11_renderer->resources.no_depth_stencil_state;
+  ID3D11DepthStencilView *&depth_stencil_view = d3d11_renderer->resources.depth_stencil_view;
+  ID3D11RasterizerState *&raster_state = d3d11_renderer->resources.raster_state;
 
 
   // Create a DirectX graphics interface factory.
@@ -792,6 +618,8 @@ void init_renderer(HWND window, unsigned in_framebuffer_width, unsigned in_frame
                                         );
   assert(!FAILED(result));
 
+  d3d11_renderer->state_backend.device_context = device_context;
+
   // Get the pointer to the back buffer.
   ID3D11Texture2D *back_buffer;
   result = swap_chain->GetBuffer(0, __uuidof(ID3D11Texture2D), (LPVOID *)&back_buffer);
@@ -975,60 +803,82 @@ void init_renderer(HWND window, unsigned in_framebuffer_width, unsigned in_frame
   // For now I'll just have the new shaders use the first matrix buffer.
   D3D11_BUFFER_DESC matrix_buffer_desc;
   matrix_buffer_desc.Usage = D3D11_USAGE_DYNAMIC;
-  matrix_buffer_desc.ByteWidth = sizeof(FirstShaderBuffer);
+  matrix_buffer_desc.ByteWidth = sizeof(QuadConstants);
+  matrix_buffer_desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+  matrix_buffer_desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+  matrix_buffer_desc.MiscFlags = 0;
+  matrix_buffer_desc.StructureByteStride = 0;
+  result = device->CreateBuffer(&matrix_buffer_desc, NULL, &d3d11_renderer->first_shader_buffer);
+  assert(!FAILED(result));
+
+
+  matrix_buffer_desc.Usage = D3D11_USAGE_DYNAMIC;
+  matrix_buffer_desc.ByteWidth = sizeof(FrameConstants);
   matrix_buffer_desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
   matrix_buffer_desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
   matrix_buffer_desc.MiscFlags = 0;
   matrix_buffer_desc.StructureByteStride = 0;
-  result = device->CreateBuffer(&matrix_buffer_desc, NULL, &renderer_data->first_shader_buffer);
+  result = device->CreateBuffer(&matrix_buffer_desc, NULL, &d3d11_renderer->frame_shader_buffer);
   assert(!FAILED(result));
 
 
   matrix_buffer_desc.Usage = D3D11_USAGE_DYNAMIC;
-  matrix_buffer_desc.ByteWidth = sizeof(SkyboxShaderBuffer);
+  matrix_buffer_desc.ByteWidth = sizeof(SkyboxConstants);
   matrix_buffer_desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
   matrix_buffer_desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
   matrix_buffer_desc.MiscFlags = 0;
   matrix_buffer_desc.StructureByteStride = 0;
-  result = device->CreateBuffer(&matrix_buffer_desc, NULL, &renderer_data->skybox_shader_buffer);
+  result = device->CreateBuffer(&matrix_buffer_desc, NULL, &d3d11_renderer->skybox_shader_buffer);
   assert(!FAILED(result));
 
 
   matrix_buffer_desc.Usage = D3D11_USAGE_DYNAMIC;
-  matrix_buffer_desc.ByteWidth = sizeof(DepthShaderBuffer);
+  matrix_buffer_desc.ByteWidth = sizeof(DepthConstants);
   matrix_buffer_desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
   matrix_buffer_desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
   matrix_buffer_desc.MiscFlags = 0;
   matrix_buffer_desc.StructureByteStride = 0;
-  result = device->CreateBuffer(&matrix_buffer_desc, NULL, &renderer_data->depth_shader_buffer);
+  result = device->CreateBuffer(&matrix_buffer_desc, NULL, &d3d11_renderer->depth_shader_buffer);
   assert(!FAILED(result));
 
 
 
   unsigned num_elements = sizeof(common_input_vertex_layout) / sizeof(common_input_vertex_layout[0]);
-  create_shader("shaders/diffuse.vs", "diffuse_vertex_shader", "shaders/diffuse.ps", "diffuse_pixel_shader", common_input_vertex_layout,
-                num_elements, &renderer_data->diffuse_shader, renderer_data->first_shader_buffer);
-  create_shader("shaders/flat_color.vs", "flat_vertex_shader", "shaders/flat_color.ps", "flat_pixel_shader", common_input_vertex_layout,
-                num_elements, &renderer_data->flat_color_shader, renderer_data->first_shader_buffer);
+
+  // Object shaders read a second vertex stream stepped once per instance
+  D3D11_INPUT_ELEMENT_DESC object_input_vertex_layout[7];
+  for(unsigned i = 0; i < num_elements; i++)
+  {
+    object_input_vertex_layout[i] = common_input_vertex_layout[i];
+  }
+  for(unsigned i = 0; i < 4; i++)
+  {
+    D3D11_INPUT_ELEMENT_DESC *element = &object_input_vertex_layout[num_elements + i];
+    element->SemanticName = (i < 3) ? "INSTANCE_WORLD" : "INSTANCE_COLOR";
+    element->SemanticIndex = (i < 3) ? i : 0;
+    element->Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
+    element->InputSlot = 1;
+    element->AlignedByteOffset = (i == 0) ? 0 : D3D11_APPEND_ALIGNED_ELEMENT;
+    element->InputSlotClass = D3D11_INPUT_PER_INSTANCE_DATA;
+    element->InstanceDataStepRate = 1;
+  }
+  unsigned num_object_elements = sizeof(object_input_vertex_layout) / sizeof(object_input_vertex_layout[0]);
+
+  create_shader("shaders/diffuse.vs", "diffuse_vertex_shader", "shaders/diffuse.ps", "diffuse_pixel_shader", object_input_vertex_layout,
+                num_object_elements, &renderer_data->diffuse_shader, d3d11_renderer->frame_shader_buffer);
+  create_shader("shaders/flat_color.vs", "flat_vertex_shader", "shaders/flat_color.ps", "flat_pixel_shader", object_input_vertex_layout,
+                num_object_elements, &renderer_data->flat_color_shader, d3d11_renderer->frame_shader_buffer);
   create_shader("shaders/quad.vs", "quad_vertex_shader", "shaders/quad.ps", "quad_pixel_shader", common_input_vertex_layout,
-                num_elements, &renderer_data->quad_shader, renderer_data->first_shader_buffer);
+                num_elements, &renderer_data->quad_shader, d3d11_renderer->first_shader_buffer);
   create_shader("shaders/skybox.vs", "skybox_vertex_shader", "shaders/skybox.ps", "skybox_pixel_shader", common_input_vertex_layout,
-                num_elements, &renderer_data->skybox_shader, renderer_data->skybox_shader_buffer);
-  create_shader("shaders/depth.vs", "depth_vertex_shader", "shaders/depth.ps", "depth_pixel_shader", common_input_vertex_layout,
-                num_elements, &renderer_data->depth_shader, renderer_data->depth_shader_buffer);
+                num_elements, &renderer_data->skybox_shader, d3d11_renderer->skybox_shader_buffer);
+  create_shader("shaders/depth.vs", "depth_vertex_shader", 0, 0, object_input_vertex_layout,
+                num_object_elements, &renderer_data->depth_shader, d3d11_renderer->depth_shader_buffer);
 
 
 
   // Skybox
   {
-    Mesh *mesh = &renderer_data->skybox_mesh;
-    mesh->vertices.resize(8);
-    mesh->indices.resize(36);
-    make_inward_cube_mesh(mesh->vertices.data(), mesh->indices.data());
-    //make_quad(mesh->vertices.data(), mesh->indices.data());
-    mesh->fill_buffers(renderer_data->resources.device);
-
-
     D3D11_SAMPLER_DESC samplerDesc;
     // Create a texture sampler state description.
     samplerDesc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
@@ -1046,8 +896,13 @@ void init_renderer(HWND window, unsigned in_framebuffer_width, unsigned in_frame
     samplerDesc.MinLOD = 0;
     samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
     // Create the texture sampler state.
-    HRESULT result = renderer_data->resources.device->CreateSamplerState(&samplerDesc, &renderer_data->skybox_texture.sample_state);
+    ID3D11SamplerState *sampler;
+    HRESULT result = d3d11_renderer->resources.device->CreateSamplerState(&samplerDesc, &sampler);
     assert(!FAILED(result));
+    renderer_data->skybox_texture.sampler = sampler;
+
+    // The screen quad and the shadow maps share it
+    renderer_data->quad_texture.sampler = sampler;
 
     ID3D11Texture2D *texture_array = 0;
 
@@ -1140,11 +995,13 @@ void init_renderer(HWND window, unsigned in_framebuffer_width, unsigned in_frame
 
 
 
-    result = renderer_data->resources.device->CreateTexture2D(&tex_desc, resource_data, &texture_array);
+    result = d3d11_renderer->resources.device->CreateTexture2D(&tex_desc, resource_data, &texture_array);
     assert(result == S_OK);
 
-    result = renderer_data->resources.device->CreateShaderResourceView(texture_array, &view_desc, &renderer_data->skybox_texture.resource);
+    ID3D11ShaderResourceView *skybox_view;
+    result = d3d11_renderer->resources.device->CreateShaderResourceView(texture_array, &view_desc, &skybox_view);
     assert(result == S_OK);
+    renderer_data->skybox_texture.resource = skybox_view;
 
     // Should this be here?
     texture_array->Release();
@@ -1152,436 +1009,83 @@ void init_renderer(HWND window, unsigned in_framebuffer_width, unsigned in_frame
 
 
 
-  // Render to texture setup
-  {
-    // Setup the render target texture description.
-    D3D11_TEXTURE2D_DESC texture_desc = {};
-    texture_desc.Width = renderer_data->window.framebuffer_width;
-    texture_desc.Height = renderer_data->window.framebuffer_height;
-    texture_desc.MipLevels = 1;
-    texture_desc.ArraySize = 1;
-    texture_desc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT; // Why is this float??
-    texture_desc.SampleDesc.Count = 1;
-    texture_desc.Usage = D3D11_USAGE_DEFAULT;
-    texture_desc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
-    texture_desc.CPUAccessFlags = 0;
-    texture_desc.MiscFlags = 0;
-
-    // Create the render target texture.
-    result = device->CreateTexture2D(&texture_desc, NULL, &render_target_texture);
-    assert(!FAILED(result));
-
-    // Setup the description of the render target view.
-    D3D11_RENDER_TARGET_VIEW_DESC view_desc = {};
-    view_desc.Format = texture_desc.Format;
-    view_desc.ViewDimension = D3D11_RTV_DIMENSION_TEXTURE2D;
-    view_desc.Texture2D.MipSlice = 0;
-
-    // Create the render target view.
-    result = device->CreateRenderTargetView(render_target_texture, &view_desc, &render_to_texture_target_view);
-    assert(!FAILED(result));
-
-    // Setup the description of the shader resource view.
-    D3D11_SHADER_RESOURCE_VIEW_DESC shader_resource_viewDesc = {};
-    shader_resource_viewDesc.Format = texture_desc.Format;
-    shader_resource_viewDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-    shader_resource_viewDesc.Texture2D.MostDetailedMip = 0;
-    shader_resource_viewDesc.Texture2D.MipLevels = 1;
-
-    // Create the shader resource view.
-    result = device->CreateShaderResourceView(render_target_texture, &shader_resource_viewDesc, &render_target_shader_resource_view);
-    assert(!FAILED(result));
+  // Everything else the shared renderer draws with
+  renderer_data->framebuffer_width = framebuffer_width;
+  renderer_data->framebuffer_height = framebuffer_height;
+  renderer_data->device = d3d11_renderer;
+  renderer_data->backend = &d3d11_renderer->state_backend;
+  renderer_data->draws_lines = true;
+  renderer_data->frame_constants = d3d11_renderer->frame_shader_buffer;
+  renderer_data->depth_state = depth_stencil_state;
+  renderer_data->no_depth_state = no_depth_stencil_state;
 
-    renderer_data->quad_mesh.vertices.resize(4);
-    renderer_data->quad_mesh.indices.resize(6);
-    make_quad(renderer_data->quad_mesh.vertices.data(), renderer_data->quad_mesh.indices.data());
-    renderer_data->quad_mesh.fill_buffers(device);
+  d3d11_renderer->graph_backend.device = device;
+  d3d11_renderer->back_buffer.target_view = render_target_view;
+  d3d11_renderer->depth_buffer.texture = depth_stencil_buffer;
+  d3d11_renderer->depth_buffer.depth_view = depth_stencil_view;
+  renderer_data->graph_backend = &d3d11_renderer->graph_backend;
+  renderer_data->depth_texture_format = READABLE_DEPTH_FORMAT;
+  renderer_data->back_buffer = &d3d11_renderer->back_buffer;
+  renderer_data->depth_buffer = &d3d11_renderer->depth_buffer;
 
-    renderer_data->quad_texture.resource = render_target_shader_resource_view;
-    renderer_data->quad_texture.sample_state = renderer_data->skybox_texture.sample_state;
-  }
-
-  renderer_data->light_camera.position = v3(1, 1, 1);
-  renderer_data->light_camera.looking_direction = -renderer_data->light_camera.position;
-}
-
-void render_skybox(Camera *camera)
-{
-  D3D11_DEPTH_STENCIL_DESC depth_stencil_desc = {};
-  depth_stencil_desc.DepthEnable = false;
-  depth_stencil_desc.StencilEnable = false;
-  renderer_data->resources.device_context->OMSetDepthStencilState(renderer_data->resources.no_depth_stencil_state, 0);
-
-
-  ID3D11DeviceContext *device_context = renderer_data->resources.device_context;
-  Window *window = &renderer_data->window;
-
-  Mesh *mesh = &renderer_data->skybox_mesh;
-  Shader *shader = &renderer_data->skybox_shader;
-  Texture *texture = &renderer_data->skybox_texture;
-
-
-  // Vertex buffers
-  ID3D11Buffer *buffers[] = {mesh->vertex_buffer};
-  unsigned strides[] = {sizeof(Mesh::Vertex)};
-  unsigned offsets[] = {0};
-  unsigned num_buffers = sizeof(buffers) / sizeof(buffers[0]);
-  device_context->IASetVertexBuffers(0, num_buffers, buffers, strides, offsets);
-  device_context->IASetIndexBuffer(mesh->index_buffer, DXGI_FORMAT_R32_UINT, 0);
-  device_context->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-
-
-  // Matrices
-  mat4 world_m_model = make_world_matrix(camera->position, v3(10.0f, 10.0f, 10.0f), 0.0f);
-  //mat4 world_m_model = make_world_matrix(v3(), v3(1.0f, 1.0f, 1.0f), 0.0f);
-  mat4 view_m_world = make_view_matrix(camera->position, camera->looking_direction);
-  mat4 clip_m_view = make_perspective_projection_matrix(deg_to_rad(camera->field_of_view), window->aspect_ratio, 0.1f, 100.0f);
-
-
-  // Shaders
-  device_context->IASetInputLayout(shader->layout);
-  device_context->VSSetShader(shader->vertex_shader, NULL, 0);
-  device_context->PSSetShader(shader->pixel_shader, NULL, 0);
-
-
-  // Global shader buffers
-  D3D11_MAPPED_SUBRESOURCE mapped_resource;
-  HRESULT result = device_context->Map(shader->global_buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped_resource);
-  assert(!FAILED(result));
-
-  SkyboxShaderBuffer *data = (SkyboxShaderBuffer *)mapped_resource.pData;
-  data->world_m_model = world_m_model;
-  data->view_m_world = view_m_world;
-  data->clip_m_view = clip_m_view;
-  device_context->Unmap(shader->global_buffer, 0);
-
-  device_context->VSSetConstantBuffers(0, 1, &shader->global_buffer);
-
-  // Textures
-  if(texture)
-  {
-    device_context->PSSetShaderResources(0, 1, &texture->resource);
-    device_context->PSSetSamplers(0, 1, &texture->sample_state);
-  }
-
-
-
-
-  // Render the triangle.
-  device_context->DrawIndexed(mesh->indices.size(), 0, 0);
-
-  renderer_data->resources.device_context->OMSetDepthStencilState(renderer_data->resources.depth_stencil_state, 0);
-}
-
-void render_mesh(Mesh *mesh, Camera *camera, Shader *shader, v3 position, v3 scale, float y_axis_rotation, v4 color,
-                 Texture *texture, D3D_PRIMITIVE_TOPOLOGY topology)
-{
-  ID3D11DeviceContext *device_context = renderer_data->resources.device_context;
-  Window *window = &renderer_data->window;
-
-  Camera *light_camera = &renderer_data->light_camera;
-
-  Texture *shadow_map = &renderer_data->quad_texture;
-  v3 light_vector = renderer_data->light_vector;
-
-  // Vertex buffers
-  ID3D11Buffer *buffers[] = {mesh->vertex_buffer};
-  unsigned strides[] = {sizeof(Mesh::Vertex)};
-  unsigned offsets[] = {0};
-  unsigned num_buffers = sizeof(buffers) / sizeof(buffers[0]);
-  device_context->IASetVertexBuffers(0, num_buffers, buffers, strides, offsets);
-  device_context->IASetIndexBuffer(mesh->index_buffer, DXGI_FORMAT_R32_UINT, 0);
-  device_context->IASetPrimitiveTopology(topology);
-
-
-  // Matrices
-  mat4 world_m_model = make_world_matrix(position, scale, y_axis_rotation);
-  mat4 view_m_world = make_view_matrix(camera->position, camera->looking_direction);
-  mat4 clip_m_view = make_perspective_projection_matrix(deg_to_rad(camera->field_of_view), window->aspect_ratio, 0.5f); // infinite far plane
-
-  mat4 light_view_m_world = make_view_matrix(light_camera->position, light_camera->looking_direction);
-  //mat4 light_clip_m_view = make_perspective_projection_matrix(deg_to_rad(light_camera->field_of_view), window->aspect_ratio, 0.5f); // infinite far plane
-  mat4 light_clip_m_view = make_ortho_projection_matrix(30.0f, window->aspect_ratio, 0.5f, 100.0f);
-
-  mat4 light_clip_m_model = light_clip_m_view * light_view_m_world * world_m_model;
-
-
-  // Shaders
-  device_context->IASetInputLayout(shader->layout);
-  device_context->VSSetShader(shader->vertex_shader, NULL, 0);
-  device_context->PSSetShader(shader->pixel_shader, NULL, 0);
-
-
-  // Global shader buffers
-  D3D11_MAPPED_SUBRESOURCE mapped_resource;
-  HRESULT result = device_context->Map(shader->global_buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped_resource);
-  assert(!FAILED(result));
-
-  FirstShaderBuffer *data = (FirstShaderBuffer *)mapped_resource.pData;
-  data->world_m_model = world_m_model;
-  data->view_m_world = view_m_world;
-  data->clip_m_view = clip_m_view;
-  data->light_clip_m_model = light_clip_m_model;
-  data->color = color;
-  data->light_vector = v4(light_vector, 1.0f);
-  device_context->Unmap(shader->global_buffer, 0);
-
-  device_context->VSSetConstantBuffers(0, 1, &shader->global_buffer);
-
-  // Textures
-  if(texture)
-  {
-    device_context->PSSetShaderResources(0, 1, &texture->resource);
-
-    device_context->PSSetSamplers(0, 1, &texture->sample_state);
-  }
-  device_context->PSSetShaderResources(1, 1, &shadow_map->resource);
-  // TODO: Make own shadow map sampler
-  device_context->PSSetSamplers(1, 1, &renderer_data->quad_texture.sample_state);
-
-
-
-  // Render
-  device_context->DrawIndexed(mesh->indices.size(), 0, 0);
-}
-
-void render_mesh_depth(Mesh *mesh, Camera *camera, Shader *shader, v3 position, v3 scale, float y_axis_rotation)
-{
-  ID3D11DeviceContext *device_context = renderer_data->resources.device_context;
-  Window *window = &renderer_data->window;
-
-  // Vertex buffers
-  ID3D11Buffer *buffers[] = {mesh->vertex_buffer};
-  unsigned strides[] = {sizeof(Mesh::Vertex)};
-  unsigned offsets[] = {0};
-  unsigned num_buffers = sizeof(buffers) / sizeof(buffers[0]);
-  device_context->IASetVertexBuffers(0, num_buffers, buffers, strides, offsets);
-  device_context->IASetIndexBuffer(mesh->index_buffer, DXGI_FORMAT_R32_UINT, 0);
-  device_context->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-
-
-  // Matrices
-  mat4 world_m_model = make_world_matrix(position, scale, y_axis_rotation);
-  mat4 view_m_world = make_view_matrix(camera->position, camera->looking_direction);
-
-
-
-  // TODO: Make orthographic for directional lights
-  //mat4 clip_m_view = make_perspective_projection_matrix(deg_to_rad(camera->field_of_view), window->aspect_ratio, 0.5f); // infinite far plane
-  mat4 clip_m_view = make_ortho_projection_matrix(30.0f, window->aspect_ratio, 0.5f, 100.0f);
-
-  mat4 clip_m_model = clip_m_view * view_m_world * world_m_model;
-
-
-  // Shaders
-  device_context->IASetInputLayout(shader->layout);
-  device_context->VSSetShader(shader->vertex_shader, NULL, 0);
-  device_context->PSSetShader(shader->pixel_shader, NULL, 0);
-
-
-  // Global shader buffers
-  D3D11_MAPPED_SUBRESOURCE mapped_resource;
-  HRESULT result = device_context->Map(shader->global_buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped_resource);
-  assert(!FAILED(result));
-
-  DepthShaderBuffer *data = (DepthShaderBuffer *)mapped_resource.pData;
-  data->clip_m_model = clip_m_model;
-  device_context->Unmap(shader->global_buffer, 0);
-
-  device_context->VSSetConstantBuffers(0, 1, &shader->global_buffer);
-
-  // Render
-  device_context->DrawIndexed(mesh->indices.size(), 0, 0);
-}
-
-void render_2d_screen_mesh(Mesh *mesh, Shader *shader, v3 position, v2 scale, float rotation, v4 color, Texture *texture,
-                           D3D_PRIMITIVE_TOPOLOGY topology)
-{
-  ID3D11DeviceContext *device_context = renderer_data->resources.device_context;
-  Window *window = &renderer_data->window;
-
-  // Vertex buffers
-  ID3D11Buffer *buffers[] = {mesh->vertex_buffer};
-  unsigned strides[] = {sizeof(Mesh::Vertex)};
-  unsigned offsets[] = {0};
-  unsigned num_buffers = sizeof(buffers) / sizeof(buffers[0]);
-  device_context->IASetVertexBuffers(0, num_buffers, buffers, strides, offsets);
-  device_context->IASetIndexBuffer(mesh->index_buffer, DXGI_FORMAT_R32_UINT, 0);
-  device_context->IASetPrimitiveTopology(topology);
-
-
-  // Matrices
-  mat4 world_m_model = make_world_matrix(position, v3(scale, 1.0f), 0.0f);
-
-
-  // Shaders
-  device_context->IASetInputLayout(shader->layout);
-  device_context->VSSetShader(shader->vertex_shader, NULL, 0);
-  device_context->PSSetShader(shader->pixel_shader, NULL, 0);
-
-
-  // Global shader buffers
-  D3D11_MAPPED_SUBRESOURCE mapped_resource;
-  HRESULT result = device_context->Map(shader->global_buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped_resource);
-  assert(!FAILED(result));
-
-  FirstShaderBuffer *data = (FirstShaderBuffer *)mapped_resource.pData;
-  data->world_m_model = world_m_model;
-  data->view_m_world = mat4();//view_m_world;
-  data->clip_m_view = mat4();//clip_m_view;
-  data->light_clip_m_model = mat4();
-  data->color = color;
-  data->light_vector = v4();
-  device_context->Unmap(shader->global_buffer, 0);
-
-  device_context->VSSetConstantBuffers(0, 1, &shader->global_buffer);
-
-  // Textures
-  if(texture)
-  {
-    device_context->PSSetShaderResources(0, 1, &texture->resource);
-    device_context->PSSetSamplers(0, 1, &texture->sample_state);
-  }
-
-
-
-
-  // Render
-  device_context->DrawIndexed(mesh->indices.size(), 0, 0);
-}
-
-void render_scene_depth(Camera *camera)
-{
-  for(unsigned i = 0; i < renderer_data->models_to_render.size(); i++)
-  {
-    ModelData *model = &renderer_data->models_to_render[i];
-    Shader *depth_shader = &renderer_data->depth_shader;
-    if(model->show)
-    {
-      render_mesh_depth(model->mesh, camera, depth_shader, model->position, model->scale, model->y_axis_rotation);
-    }
-  }
-}
-
-void render_scene(Camera *camera)
-{
-  render_skybox(camera);
-
-
-  for(unsigned i = 0; i < renderer_data->models_to_render.size(); i++)
-  {
-    ModelData *model = &renderer_data->models_to_render[i];
-    if(model->show)
-    {
-      render_mesh(model->mesh, camera, model->shader, model->position, model->scale, model->y_axis_rotation,
-                  model->blend_color, model->texture, D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-      if(model->render_normals)
-      {
-        render_mesh(model->debug_normals_mesh, camera, &renderer_data->flat_color_shader, model->position, model->scale,
-                    model->y_axis_rotation, v4(1.0f, 1.0f, 0.0f, 1.0f), 0, D3D_PRIMITIVE_TOPOLOGY_LINELIST);
-      }
-    }
-  }
-}
-
-void render()
-{
-  D3DResources *resources = &renderer_data->resources;
-
-  //renderer_data->light_vector = renderer_data->camera.position;
-  //renderer_data->camera.field_of_view = 80.0f;
-
-#if 1
-  // Render to texture
-  resources->device_context->OMSetRenderTargets(1, &resources->render_to_texture_target_view, resources->depth_stencil_view);
-  resources->device_context->ClearRenderTargetView(resources->render_to_texture_target_view, renderer_data->window.background_color);
-  resources->device_context->ClearDepthStencilView(resources->depth_stencil_view, D3D11_CLEAR_DEPTH, 1.0f, 0);
-
-
-  Camera *light_camera = &renderer_data->light_camera;
-  render_scene_depth(light_camera);
-#endif
-
-
-
-  // Clear the back and depth buffer.
-  resources->device_context->OMSetRenderTargets(1, &resources->render_target_view, resources->depth_stencil_view);
-  resources->device_context->ClearRenderTargetView(resources->render_target_view, renderer_data->window.background_color);
-  resources->device_context->ClearDepthStencilView(resources->depth_stencil_view, D3D11_CLEAR_DEPTH, 1.0f, 0);
-
-
-  // Render the scene using the player camera
-  render_scene(&renderer_data->camera);
-
-#if 1
-  // Render the quad with scene texture
-  render_2d_screen_mesh(&renderer_data->quad_mesh, &renderer_data->quad_shader, v3(-0.5f, 0.5f, 0.0f), v2(0.2f, 0.2f), 0.0f,
-                        v4(1.0f, 1.0f, 1.0f, 1.0f), &renderer_data->quad_texture, D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-#endif
-
-  // Present the back buffer to the screen since rendering is complete.
-  if(renderer_data->window.vsync)
-  {
-    // Lock to screen refresh rate.
-    resources->swap_chain->Present(1, 0);
-  }
-  else
-  {
-    // Present as fast as possible.
-    resources->swap_chain->Present(0, 0);
-  }
+  init_renderer_data();
 }
 
 void shutdown_renderer()
 {
-  fclose(renderer_data->shader_errors_file);
+  shutdown_renderer_data();
+
+  fclose(d3d11_renderer->shader_errors_file);
 
   // Before shutting down set to windowed mode or when you release the swap chain it will throw an exception.
-  if(renderer_data->resources.swap_chain)
+  if(d3d11_renderer->resources.swap_chain)
   {
-    renderer_data->resources.swap_chain->SetFullscreenState(false, NULL);
+    d3d11_renderer->resources.swap_chain->SetFullscreenState(false, NULL);
   }
 
-  if(renderer_data->resources.raster_state)
+  if(d3d11_renderer->resources.raster_state)
   {
-    renderer_data->resources.raster_state->Release();
+    d3d11_renderer->resources.raster_state->Release();
   }
 
-  if(renderer_data->resources.depth_stencil_view)
+  if(d3d11_renderer->resources.depth_stencil_view)
   {
-    renderer_data->resources.depth_stencil_view->Release();
+    d3d11_renderer->resources.depth_stencil_view->Release();
   }
 
-  if(renderer_data->resources.depth_stencil_state)
+  if(d3d11_renderer->resources.depth_stencil_state)
   {
-    renderer_data->resources.depth_stencil_state->Release();
+    d3d11_renderer->resources.depth_stencil_state->Release();
   }
 
-  if(renderer_data->resources.depth_stencil_buffer)
+  if(d3d11_renderer->resources.depth_stencil_buffer)
   {
-    renderer_data->resources.depth_stencil_buffer->Release();
+    d3d11_renderer->resources.depth_stencil_buffer->Release();
   }
 
-  if(renderer_data->resources.render_target_view)
+  if(d3d11_renderer->resources.render_target_view)
   {
-    renderer_data->resources.render_target_view->Release();
+    d3d11_renderer->resources.render_target_view->Release();
   }
 
-  if(renderer_data->resources.device_context)
+  if(d3d11_renderer->resources.device_context)
   {
-    renderer_data->resources.device_context->Release();
+    d3d11_renderer->resources.device_context->Release();
   }
 
-  if(renderer_data->resources.device)
+  if(d3d11_renderer->resources.device)
   {
-    renderer_data->resources.device->Release();
+    d3d11_renderer->resources.device->Release();
   }
 
-  if(renderer_data->resources.swap_chain)
+  if(d3d11_renderer->resources.swap_chain)
   {
-    renderer_data->resources.swap_chain->Release();
+    d3d11_renderer->resources.swap_chain->Release();
   }
 
+  delete d3d11_renderer;
+  d3d11_renderer = 0;
+
 #if 0
 
   // Release the matrix constant buffer.
@@ -1621,60 +1125,6 @@ void shutdown_renderer()
 
 
 
-
-
-
-
-
-////////////////////////////////////////////////////////////////////////////////
-// Platform independent implementation
-////////////////////////////////////////////////////////////////////////////////
-
-
-
-
-Model create_model(const char *model_name, v3 position, v3 scale, v3 rotation)
-{
-  ModelData model;
-
-  model.mesh = new Mesh();
-  std::vector<v3> vertices;
-
-  
-
-  load_obj(model_name, &vertices, 0, 0, &model.mesh->indices);
-  for(v3 vertex : vertices)
-  {
-    model.mesh->vertices.push_back(Mesh::Vertex(vertex, v3(), v2()));
-  }
-  model.mesh->normalize();
-  model.mesh->compute_vertex_normals();
-  model.mesh->fill_buffers(renderer_data->resources.device);
-
-
-  model.debug_normals_mesh = new Mesh();
-  unsigned i = 0;
-  for(Mesh::Vertex vertex : model.mesh->vertices)
-  {
-    model.debug_normals_mesh->vertices.push_back(Mesh::Vertex(vertex.position, v3(), v2()));
-    model.debug_normals_mesh->vertices.push_back(Mesh::Vertex(vertex.position + model.mesh->vertices[i].normal * 0.1f, v3(), v2()));
-
-    model.debug_normals_mesh->indices.push_back(model.debug_normals_mesh->vertices.size() - 2);
-    model.debug_normals_mesh->indices.push_back(model.debug_normals_mesh->vertices.size() - 1);
-
-    i++;
-  }
-  model.debug_normals_mesh->fill_buffers(renderer_data->resources.device);
-
-
-  model.shader = &renderer_data->diffuse_shader;
-
-
-  renderer_data->models_to_render.push_back(model);
-
-  return Model(renderer_data->models_to_render.size() - 1);
-}
-
 #if 0
 ModelHandle create_model(PrimitiveType primitive, const char *texture_path)
 {
@@ -1688,7 +1138,7 @@ ModelHandle create_model(PrimitiveType primitive, const char *texture_path)
     make_quad(model.mesh->vertices.data(), model.mesh->indices.data());
     model.shader = &renderer_data->quad_shader;
   }
-  model.mesh->fill_buffers(renderer_data->resources.device);
+  model.mesh->fill_buffers();
 
 
 
@@ -1713,11 +1163,11 @@ ModelHandle create_model(PrimitiveType primitive, const char *texture_path)
   samplerDesc.MinLOD = 0;
   samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
   // Create the texture sampler state.
-  HRESULT result = renderer_data->resources.device->CreateSamplerState(&samplerDesc, &model.texture->sample_state);
+  HRESULT result = d3d11_renderer->resources.device->CreateSamplerState(&samplerDesc, &model.texture->sample_state);
   assert(!FAILED(result));
 
 #if 1
-  result = D3DX11CreateShaderResourceViewFromFile(renderer_data->resources.device, "assets/Vivi.png", NULL, NULL, &model.texture->resource, NULL);
+  result = D3DX11CreateShaderResourceViewFromFile(d3d11_renderer->resources.device, "assets/Vivi.png", NULL, NULL, &model.texture->resource, NULL);
   //result = D3DX11CreateShaderResourceViewFromFile(device, "assets/Vivi.png", NULL, NULL, &textures[1], NULL);
   assert(!FAILED(result));
 #endif
@@ -1727,40 +1177,3 @@ ModelHandle create_model(PrimitiveType primitive, const char *texture_path)
   return renderer_data->models_to_render.size() - 1;
 }
 #endif
-
-
-void set_model_position(Model model, v3 pos)       { renderer_data->models_to_render[model].position = pos;     }
-v3   get_model_position(Model model)               { return renderer_data->models_to_render[model].position;    }
-void change_model_position(Model model, v3 offset) { renderer_data->models_to_render[model].position += offset; }
-
-void set_model_scale(Model model, v3 scale)    { renderer_data->models_to_render[model].scale = scale;  }
-v3   get_model_scale(Model model)              { return renderer_data->models_to_render[model].scale;   }
-void change_model_scale(Model model, v3 scale) { renderer_data->models_to_render[model].scale += scale; }
-
-// TODO: Make this work for all axes
-void set_model_rotation(Model model, v3 rotation)    { renderer_data->models_to_render[model].y_axis_rotation = rotation.y;           }
-v3   get_model_rotation(Model model)                 { return v3(0.0f, renderer_data->models_to_render[model].y_axis_rotation, 0.0f); }
-void change_model_rotation(Model model, v3 rotation) { renderer_data->models_to_render[model].y_axis_rotation += rotation.y;            }
-
-void set_model_color(Model model, Color color) { renderer_data->models_to_render[model].blend_color = v4(color.r, color.g, color.b, color.a); }
-
-void set_camera_position(v3 position)
-{
-}
-
-v3 get_camera_position()
-{
-  return v3();
-}
-
-
-void set_camera_looking_direction(v3 direction)
-{
-}
-
-v3 get_camera_looking_direction()
-{
-  return v3();
-}
-
- 
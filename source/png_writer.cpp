@@ -0,0 +1,104 @@
+#include "png_writer.h"
+
+#include <stdio.h>
+#include <vector>
+
+static unsigned crc_table[256];
+
+static unsigned crc32(unsigned crc, const unsigned char *data, unsigned size)
+{
+  if(!crc_table[1])
+  {
+    for(unsigned i = 0; i < 256; i++)
+    {
+      unsigned c = i;
+      for(unsigned k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+      crc_table[i] = c;
+    }
+  }
+
+  crc = ~crc;
+  for(unsigned i = 0; i < size; i++) crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+static void push_u32(std::vector<unsigned char> *out, unsigned value)
+{
+  out->push_back((unsigned char)(value >> 24));
+  out->push_back((unsigned char)(value >> 16));
+  out->push_back((unsigned char)(value >> 8));
+  out->push_back((unsigned char)value);
+}
+
+static void write_chunk(FILE *file, const char *type, const std::vector<unsigned char> &data)
+{
+  std::vector<unsigned char> chunk;
+  push_u32(&chunk, data.size());
+  chunk.insert(chunk.end(), type, type + 4);
+  chunk.insert(chunk.end(), data.begin(), data.end());
+  push_u32(&chunk, crc32(0, chunk.data() + 4, data.size() + 4));
+  fwrite(chunk.data(), 1, chunk.size(), file);
+}
+
+bool write_png(const char *file_name, const unsigned *pixels, unsigned width, unsigned height, unsigned stride)
+{
+  FILE *file = fopen(file_name, "wb");
+  if(!file) return false;
+
+  static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  fwrite(signature, 1, sizeof(signature), file);
+
+  std::vector<unsigned char> header;
+  push_u32(&header, width);
+  push_u32(&header, height);
+  header.push_back(8); // Bits per channel
+  header.push_back(6); // RGBA
+  header.push_back(0); // Deflate
+  header.push_back(0); // Adaptive filtering
+  header.push_back(0); // Not interlaced
+  write_chunk(file, "IHDR", header);
+
+  // Each row starts with filter type 0, none
+  std::vector<unsigned char> raw;
+  raw.reserve((width * 4 + 1) * height);
+  for(unsigned y = 0; y < height; y++)
+  {
+    raw.push_back(0);
+    const unsigned char *row = (const unsigned char *)(pixels + y * stride);
+    raw.insert(raw.end(), row, row + width * 4);
+  }
+
+  // Zlib stream of stored deflate blocks
+  std::vector<unsigned char> data;
+  data.push_back(0x78);
+  data.push_back(0x01);
+  unsigned a = 1, b = 0;
+  for(unsigned offset = 0; offset < raw.size() || offset == 0;)
+  {
+    unsigned size = raw.size() - offset;
+    if(size > 65535) size = 65535;
+    bool last = offset + size == raw.size();
+    data.push_back(last ? 1 : 0);
+    data.push_back((unsigned char)size);
+    data.push_back((unsigned char)(size >> 8));
+    data.push_back((unsigned char)~size);
+    data.push_back((unsigned char)(~size >> 8));
+    data.insert(data.end(), raw.begin() + offset, raw.begin() + offset + size);
+
+    for(unsigned i = offset; i < offset + size; i++)
+    {
+      a = (a + raw[i]) % 65521;
+      b = (b + a) % 65521;
+    }
+    offset += size;
+    if(last) break;
+  }
+  push_u32(&data, (b << 16) | a);
+  write_chunk(file, "IDAT", data);
+
+  write_chunk(file, "IEND", std::vector<unsigned char>());
+
+  bool ok = !ferror(file);
+  fclose(file);
+  return ok;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+// Writes RGBA8 pixels, in the byte order stb_image loads them, as a PNG. The
+// image data is stored without compression so there are no dependencies.
+// stride is in pixels. Returns false if the file couldn't be written.
+bool write_png(const char *file_name, const unsigned *pixels, unsigned width, unsigned height, unsigned stride);
@@ -0,0 +1,271 @@
+#include "render_graph.h"
+
+#include <assert.h>
+#include <chrono> // Pass timings
+
+void init_render_graph(RenderGraph *graph, RenderGraphBackend *backend)
+{
+  graph->backend = backend;
+  graph->resources.clear();
+  graph->passes.clear();
+  graph->physical_textures.clear();
+  graph->dirty = true;
+}
+
+static void destroy_physical_textures(RenderGraph *graph)
+{
+  for(unsigned i = 0; i < graph->physical_textures.size(); i++)
+  {
+    graph->backend->destroy_texture(graph->physical_textures[i].handle);
+  }
+  graph->physical_textures.clear();
+}
+
+void destroy_render_graph(RenderGraph *graph)
+{
+  destroy_physical_textures(graph);
+}
+
+static unsigned add_resource(RenderGraph *graph, const char *name)
+{
+  RenderGraphResource resource = {};
+  resource.name = name;
+  resource.first_pass = RENDER_GRAPH_INVALID;
+  resource.last_pass = RENDER_GRAPH_INVALID;
+  resource.physical = RENDER_GRAPH_INVALID;
+  graph->resources.push_back(resource);
+  graph->dirty = true;
+  return graph->resources.size() - 1;
+}
+
+unsigned graph_import_texture(RenderGraph *graph, const char *name, void *handle, bool output)
+{
+  unsigned index = add_resource(graph, name);
+  graph->resources[index].imported = true;
+  graph->resources[index].output = output;
+  graph->resources[index].handle = handle;
+  return index;
+}
+
+unsigned graph_create_texture(RenderGraph *graph, const char *name, RenderGraphTextureDesc desc)
+{
+  unsigned index = add_resource(graph, name);
+  graph->resources[index].desc = desc;
+  return index;
+}
+
+unsigned graph_add_pass(RenderGraph *graph, const char *name, RenderGraphExecute execute, void *user_data)
+{
+  RenderGraphPass pass;
+  pass.name = name;
+  pass.execute = execute;
+  pass.user_data = user_data;
+  pass.enabled = true;
+  pass.culled = false;
+  pass.milliseconds = 0.0f;
+  graph->passes.push_back(pass);
+  graph->dirty = true;
+  return graph->passes.size() - 1;
+}
+
+void graph_read(RenderGraph *graph, unsigned pass, unsigned resource)
+{
+  assert(pass < graph->passes.size() && resource < graph->resources.size());
+  graph->passes[pass].reads.push_back(resource);
+  graph->dirty = true;
+}
+
+void graph_write(RenderGraph *graph, unsigned pass, unsigned resource)
+{
+  assert(pass < graph->passes.size() && resource < graph->resources.size());
+  graph->passes[pass].writes.push_back(resource);
+  graph->dirty = true;
+}
+
+void graph_enable_pass(RenderGraph *graph, unsigned pass, bool enabled)
+{
+  if(graph->passes[pass].enabled == enabled) return;
+  graph->passes[pass].enabled = enabled;
+  graph->dirty = true;
+}
+
+static bool same_desc(const RenderGraphTextureDesc &a, const RenderGraphTextureDesc &b)
+{
+  return a.width == b.width && a.height == b.height && a.format == b.format && a.texel_bytes == b.texel_bytes;
+}
+
+static void touch_resource(RenderGraphResource *resource, unsigned pass)
+{
+  if(resource->first_pass == RENDER_GRAPH_INVALID) resource->first_pass = pass;
+  resource->last_pass = pass;
+}
+
+void compile_render_graph(RenderGraph *graph)
+{
+  std::vector<RenderGraphResource> *resources = &graph->resources;
+  std::vector<RenderGraphPass> *passes = &graph->passes;
+
+  // Walk back from the outputs. A pass lives if it writes something a live
+  // pass after it reads, or an output.
+  std::vector<bool> needed(resources->size());
+  for(unsigned i = 0; i < resources->size(); i++)
+  {
+    needed[i] = (*resources)[i].output;
+  }
+
+  for(unsigned p = passes->size(); p-- > 0;)
+  {
+    RenderGraphPass *pass = &(*passes)[p];
+    pass->culled = true;
+    if(!pass->enabled) continue;
+
+    for(unsigned i = 0; i < pass->writes.size(); i++)
+    {
+      if(needed[pass->writes[i]]) pass->culled = false;
+    }
+    if(pass->culled) continue;
+
+    for(unsigned i = 0; i < pass->reads.size(); i++)
+    {
+      needed[pass->reads[i]] = true;
+    }
+  }
+
+  // Lifetimes over the passes that are left
+  for(unsigned i = 0; i < resources->size(); i++)
+  {
+    (*resources)[i].first_pass = RENDER_GRAPH_INVALID;
+    (*resources)[i].last_pass = RENDER_GRAPH_INVALID;
+    (*resources)[i].physical = RENDER_GRAPH_INVALID;
+  }
+
+  for(unsigned p = 0; p < passes->size(); p++)
+  {
+    RenderGraphPass *pass = &(*passes)[p];
+    if(pass->culled) continue;
+
+    for(unsigned i = 0; i < pass->reads.size(); i++)
+    {
+      RenderGraphResource *resource = &(*resources)[pass->reads[i]];
+      assert((resource->imported || resource->first_pass != RENDER_GRAPH_INVALID) && "Transient read before anything wrote it");
+      touch_resource(resource, p);
+    }
+    for(unsigned i = 0; i < pass->writes.size(); i++)
+    {
+      touch_resource(&(*resources)[pass->writes[i]], p);
+    }
+  }
+
+  // Place transients in order of first use. A physical texture can be reused
+  // once the last transient in it is done, if the description matches.
+  std::vector<RenderGraphPhysicalTexture> previous;
+  previous.swap(graph->physical_textures);
+  for(unsigned p = 0; p < passes->size(); p++)
+  {
+    for(unsigned i = 0; i < resources->size(); i++)
+    {
+      RenderGraphResource *resource = &(*resources)[i];
+      if(resource->imported || resource->first_pass != p) continue;
+
+      for(unsigned j = 0; j < graph->physical_textures.size(); j++)
+      {
+        RenderGraphPhysicalTexture *physical = &graph->physical_textures[j];
+        if(physical->last_pass < p && same_desc(physical->desc, resource->desc))
+        {
+          resource->physical = j;
+          physical->last_pass = resource->last_pass;
+          break;
+        }
+      }
+
+      if(resource->physical == RENDER_GRAPH_INVALID)
+      {
+        RenderGraphPhysicalTexture physical;
+        physical.desc = resource->desc;
+        physical.handle = 0;
+        physical.last_pass = resource->last_pass;
+        graph->physical_textures.push_back(physical);
+        resource->physical = graph->physical_textures.size() - 1;
+      }
+    }
+  }
+
+  // Textures from the last compile are handed back out by description before
+  // anything new is created, so toggling a pass doesn't recreate them. Only
+  // the ones nothing needs anymore are freed.
+  for(unsigned i = 0; i < graph->physical_textures.size(); i++)
+  {
+    RenderGraphPhysicalTexture *physical = &graph->physical_textures[i];
+    for(unsigned j = 0; j < previous.size(); j++)
+    {
+      if(same_desc(previous[j].desc, physical->desc))
+      {
+        physical->handle = previous[j].handle;
+        previous[j] = previous.back();
+        previous.pop_back();
+        break;
+      }
+    }
+
+    if(!physical->handle)
+    {
+      physical->handle = graph->backend->create_texture(physical->desc);
+    }
+  }
+
+  for(unsigned i = 0; i < previous.size(); i++)
+  {
+    graph->backend->destroy_texture(previous[i].handle);
+  }
+
+  for(unsigned i = 0; i < resources->size(); i++)
+  {
+    RenderGraphResource *resource = &(*resources)[i];
+    if(!resource->imported)
+    {
+      resource->handle = resource->physical == RENDER_GRAPH_INVALID ? 0 : graph->physical_textures[resource->physical].handle;
+    }
+  }
+
+  graph->dirty = false;
+}
+
+void execute_render_graph(RenderGraph *graph)
+{
+  if(graph->dirty)
+  {
+    compile_render_graph(graph);
+  }
+
+  for(unsigned p = 0; p < graph->passes.size(); p++)
+  {
+    RenderGraphPass *pass = &graph->passes[p];
+    if(pass->culled)
+    {
+      pass->milliseconds = 0.0f;
+      continue;
+    }
+
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    pass->execute(pass->user_data);
+    std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+    pass->milliseconds = elapsed.count();
+  }
+}
+
+unsigned long long render_graph_texture_bytes(const RenderGraph *graph)
+{
+  unsigned long long bytes = 0;
+  for(unsigned i = 0; i < graph->physical_textures.size(); i++)
+  {
+    const RenderGraphTextureDesc *desc = &graph->physical_textures[i].desc;
+    bytes += (unsigned long long)desc->width * desc->height * desc->texel_bytes;
+  }
+  return bytes;
+}
+
+void *graph_texture(const RenderGraph *graph, unsigned resource)
+{
+  assert(resource < graph->resources.size());
+  return graph->resources[resource].handle;
+}
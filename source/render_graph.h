@@ -0,0 +1,122 @@
+#pragma once
+
+#include <vector>
+
+// Frame passes declared with the textures they read and write. Compiling the
+// graph drops passes nothing uses, works out how long each transient texture
+// lives, and reuses one physical texture for transients that are never alive
+// at the same time. Recompiling keeps the physical textures that still fit
+// what the graph needs. Executing runs the remaining passes in declaration
+// order and times them.
+//
+// Like the state cache, handles are opaque so this doesn't depend on any
+// graphics API.
+
+static const unsigned RENDER_GRAPH_INVALID = 0xFFFFFFFF;
+
+struct RenderGraphTextureDesc
+{
+  unsigned width;
+  unsigned height;
+  unsigned format; // DXGI_FORMAT for the D3D11 renderer
+
+  // Size of one texel in format, so memory can be counted without knowing formats
+  unsigned texel_bytes;
+};
+
+// Creates the physical textures transients are placed in. A null backend that
+// hands out dummy handles is enough to test compiling, see
+// tests/render_graph_test.cpp.
+struct RenderGraphBackend
+{
+  virtual ~RenderGraphBackend() {}
+
+  virtual void *create_texture(const RenderGraphTextureDesc &desc) = 0;
+  virtual void destroy_texture(void *texture) = 0;
+};
+
+typedef void (*RenderGraphExecute)(void *user_data);
+
+struct RenderGraphResource
+{
+  const char *name;
+  RenderGraphTextureDesc desc;
+
+  // Imported resources are owned outside the graph, like the back buffer.
+  // Outputs are what the frame is for and keep the passes writing them alive.
+  bool imported;
+  bool output;
+
+  // Filled in by compiling. Passes that were culled don't count.
+  unsigned first_pass;
+  unsigned last_pass;
+  unsigned physical; // Index into physical_textures, transients only
+
+  void *handle;
+};
+
+struct RenderGraphPass
+{
+  const char *name;
+  RenderGraphExecute execute;
+  void *user_data;
+
+  std::vector<unsigned> reads;
+  std::vector<unsigned> writes;
+
+  bool enabled;
+  bool culled;
+
+  // CPU time spent in execute during the last execute_render_graph
+  float milliseconds;
+};
+
+struct RenderGraphPhysicalTexture
+{
+  RenderGraphTextureDesc desc;
+  void *handle;
+  unsigned last_pass; // Only used while compiling
+};
+
+struct RenderGraph
+{
+  RenderGraphBackend *backend = 0;
+
+  std::vector<RenderGraphResource> resources;
+  std::vector<RenderGraphPass> passes;
+  std::vector<RenderGraphPhysicalTexture> physical_textures;
+
+  // Set when passes or resources change so the next execute recompiles
+  bool dirty = true;
+};
+
+void init_render_graph(RenderGraph *graph, RenderGraphBackend *backend);
+
+// Frees the physical textures
+void destroy_render_graph(RenderGraph *graph);
+
+unsigned graph_import_texture(RenderGraph *graph, const char *name, void *handle, bool output);
+unsigned graph_create_texture(RenderGraph *graph, const char *name, RenderGraphTextureDesc desc);
+
+// Passes run in the order they are added. A pass can only read what an
+// earlier pass wrote, or what was imported.
+unsigned graph_add_pass(RenderGraph *graph, const char *name, RenderGraphExecute execute, void *user_data);
+void graph_read(RenderGraph *graph, unsigned pass, unsigned resource);
+void graph_write(RenderGraph *graph, unsigned pass, unsigned resource);
+
+// Disabled passes are culled, along with whatever only they needed
+void graph_enable_pass(RenderGraph *graph, unsigned pass, bool enabled);
+
+// Culls passes and assigns transients to physical textures, reusing the last
+// compile's textures with the same description and creating the rest.
+// Called by execute_render_graph when the graph changed.
+void compile_render_graph(RenderGraph *graph);
+
+void execute_render_graph(RenderGraph *graph);
+
+// Memory of the physical textures the graph owns. Imported textures aren't counted.
+unsigned long long render_graph_texture_bytes(const RenderGraph *graph);
+
+// Handle of an imported texture or the physical texture a transient was
+// placed in. Only valid inside a pass that reads or writes it.
+void *graph_texture(const RenderGraph *graph, unsigned resource);
@@ -0,0 +1,98 @@
+#include "render_queue.h"
+
+#include <string.h> // memcpy
+
+SortKey make_sort_key(unsigned pass, unsigned shader, unsigned texture, unsigned mesh, float depth)
+{
+  SortKey key = pass & ((1u << SORT_KEY_PASS_BITS) - 1);
+  key = (key << SORT_KEY_SHADER_BITS) | (shader & ((1u << SORT_KEY_SHADER_BITS) - 1));
+  key = (key << SORT_KEY_TEXTURE_BITS) | (texture & ((1u << SORT_KEY_TEXTURE_BITS) - 1));
+  key = (key << SORT_KEY_MESH_BITS) | (mesh & ((1u << SORT_KEY_MESH_BITS) - 1));
+  key = (key << SORT_KEY_DEPTH_BITS) | quantize_depth(depth);
+  return key;
+}
+
+unsigned quantize_depth(float depth)
+{
+  // Positive floats already sort correctly as integers, so keep the top bits
+  // of the exponent and mantissa. Everything behind the camera goes to 0.
+  if(!(depth > 0.0f)) return 0;
+
+  unsigned bits;
+  memcpy(&bits, &depth, sizeof(bits));
+  return bits >> (31 - SORT_KEY_DEPTH_BITS);
+}
+
+void clear_render_queue(RenderQueue *queue)
+{
+  queue->keys.clear();
+  queue->items.clear();
+}
+
+void push_render_item(RenderQueue *queue, SortKey key, unsigned item)
+{
+  queue->keys.push_back(key);
+  queue->items.push_back(item);
+}
+
+void sort_render_queue(RenderQueue *queue)
+{
+  unsigned count = queue->keys.size();
+  if(count < 2) return;
+
+  queue->scratch_keys.resize(count);
+  queue->scratch_items.resize(count);
+
+  // Count every byte of every key in one pass
+  unsigned histograms[8][256] = {};
+  const SortKey *keys = queue->keys.data();
+  for(unsigned i = 0; i < count; i++)
+  {
+    SortKey key = keys[i];
+    for(unsigned b = 0; b < 8; b++)
+    {
+      histograms[b][(key >> (b * 8)) & 0xFF]++;
+    }
+  }
+
+  SortKey *src_keys = queue->keys.data();
+  unsigned *src_items = queue->items.data();
+  SortKey *dst_keys = queue->scratch_keys.data();
+  unsigned *dst_items = queue->scratch_items.data();
+  for(unsigned b = 0; b < 8; b++)
+  {
+    unsigned *histogram = histograms[b];
+
+    // Every key has the same byte here, the order wouldn't change
+    if(histogram[(src_keys[0] >> (b * 8)) & 0xFF] == count) continue;
+
+    unsigned offset = 0;
+    for(unsigned i = 0; i < 256; i++)
+    {
+      unsigned bucket_count = histogram[i];
+      histogram[i] = offset;
+      offset += bucket_count;
+    }
+
+    for(unsigned i = 0; i < count; i++)
+    {
+      unsigned dst = histogram[(src_keys[i] >> (b * 8)) & 0xFF]++;
+      dst_keys[dst] = src_keys[i];
+      dst_items[dst] = src_items[i];
+    }
+
+    SortKey *temp_keys = src_keys;
+    src_keys = dst_keys;
+    dst_keys = temp_keys;
+    unsigned *temp_items = src_items;
+    src_items = dst_items;
+    dst_items = temp_items;
+  }
+
+  // Odd number of passes leaves the result in the scratch buffers
+  if(src_keys != queue->keys.data())
+  {
+    queue->keys.swap(queue->scratch_keys);
+    queue->items.swap(queue->scratch_items);
+  }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+
+// Draws are sorted by a 64 bit key so that draws sharing state end up next to
+// each other. Fields from most to least significant:
+//
+//   pass (4) | shader (10) | texture (12) | mesh (14) | depth (24)
+//
+// Ids wider than their field are wrapped, which only costs sort quality.
+static const unsigned SORT_KEY_PASS_BITS = 4;
+static const unsigned SORT_KEY_SHADER_BITS = 10;
+static const unsigned SORT_KEY_TEXTURE_BITS = 12;
+static const unsigned SORT_KEY_MESH_BITS = 14;
+static const unsigned SORT_KEY_DEPTH_BITS = 24;
+
+typedef unsigned long long SortKey;
+
+// Depth is the view space distance in front of the camera. Negative depths
+// sort first.
+SortKey make_sort_key(unsigned pass, unsigned shader, unsigned texture, unsigned mesh, float depth);
+
+// Order preserving depth quantization into SORT_KEY_DEPTH_BITS
+unsigned quantize_depth(float depth);
+
+struct RenderQueue
+{
+  std::vector<SortKey> keys;
+  std::vector<unsigned> items; // What to draw, meaning is up to the caller
+
+  // Ping pong buffers for the radix sort
+  std::vector<SortKey> scratch_keys;
+  std::vector<unsigned> scratch_items;
+};
+
+void clear_render_queue(RenderQueue *queue);
+
+void push_render_item(RenderQueue *queue, SortKey key, unsigned item);
+
+// Stable LSD radix sort on the keys, a byte at a time. Bytes that are the same
+// for every key are skipped.
+void sort_render_queue(RenderQueue *queue);
@@ -0,0 +1,1558 @@
+// The frame both renderers share: culling, occlusion, the render queue,
+// recording and submitting passes, the render graph, meshes, the graphics.h
+// calls and scene snapshots. Each platform's unity build includes this right
+// after its renderer.cpp. See renderer_common.h for what the platforms provide.
+
+#include "renderer_common.h" // RendererData, backends
+#include "graphics.h" // Platform independent interface
+#include "mesh_processing.h" // Normalizing loaded meshes
+#include "frame_trace.h" // Recording graphics calls
+#include "frame_pipeline.h" // Simulated scene
+#include "scene_commands.h" // Calls from other threads
+#include "job_system.h" // Parallel recording
+#include "asset_loading.h" // Loading models
+
+#include <assert.h>
+#include <string.h> // memcmp
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Matrices
+////////////////////////////////////////////////////////////////////////////////
+
+static const v3 WORLD_UP_VECTOR = {0.0f, 1.0f, 0.0f};
+
+static mat4 make_world_matrix(v3 position, v3 scale, quat orientation)
+{
+  return make_transform_matrix(position, scale, orientation);
+}
+
+static mat4 make_view_matrix(v3 camera_position, v3 camera_looking_direction)
+{
+  // This is looking away from the target
+  v3 target_axis = -unit(camera_looking_direction);
+  v3 right_axis = cross(WORLD_UP_VECTOR, target_axis);
+  if(length(right_axis) == 0.0f) right_axis = v3(1.0f, 0.0f, 0.0f);
+  right_axis = unit(right_axis);
+  v3 up_axis = unit(cross(target_axis, right_axis));
+  mat4 view_mat =
+  {
+    right_axis.x,  right_axis.y,  right_axis.z,  -dot(right_axis, camera_position),
+    up_axis.x,     up_axis.y,     up_axis.z,     -dot(up_axis, camera_position),
+    target_axis.x, target_axis.y, target_axis.z, -dot(target_axis, camera_position),
+    0.0f, 0.0f, 0.0f, 1.0f,
+  };
+
+  return view_mat;
+}
+
+// fov in radians
+static mat4 make_perspective_projection_matrix(float fov, float aspect_ratio, float near_plane, float far_plane)
+{
+  float r = far_plane / (near_plane - far_plane);
+  float s = r * near_plane;
+  mat4 persp =
+  {
+    (float)(1.0f / tan(fov / 2.0f)) / aspect_ratio, 0.0f, 0.0f, 0.0f,
+    0.0f, (float)(1.0f / tan(fov / 2.0f)), 0.0f, 0.0f,
+    0.0f, 0.0f, r, s,
+    0.0f, 0.0f, -1.0f, 0.0f
+  };
+
+  return persp;
+}
+
+// infinite far plane
+// fov in radians
+static mat4 make_perspective_projection_matrix(float fov, float aspect_ratio, float near_plane)
+{
+  float r = -1.0f;
+  float s = r * near_plane;
+  mat4 persp =
+  {
+    (float)(1.0f / tan(fov / 2.0f)) / aspect_ratio, 0.0f, 0.0f, 0.0f,
+    0.0f, (float)(1.0f / tan(fov / 2.0f)), 0.0f, 0.0f,
+    0.0f, 0.0f, r, s,
+    0.0f, 0.0f, -1.0f, 0.0f
+  };
+
+  return persp;
+}
+
+static PassMatrices make_camera_pass_matrices(Camera *camera, float aspect_ratio)
+{
+  PassMatrices pass;
+  pass.view_m_world = make_view_matrix(camera->position, camera->looking_direction);
+  pass.clip_m_view = make_perspective_projection_matrix(deg_to_rad(camera->field_of_view), aspect_ratio, CAMERA_NEAR_PLANE);
+  pass.clip_m_world = pass.clip_m_view * pass.view_m_world;
+  return pass;
+}
+
+static PassMatrices make_cascade_pass_matrices(const ShadowCascade *cascade)
+{
+  PassMatrices pass;
+  pass.view_m_world = cascade->view_m_world;
+  pass.clip_m_view = cascade->clip_m_view;
+  pass.clip_m_world = cascade->clip_m_world;
+  return pass;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Binds and uploads
+////////////////////////////////////////////////////////////////////////////////
+
+// Binds go through a state cache so draws that share state skip the bind. The
+// renderer's cache sends them to the backend, a record chunk's to its commands.
+static void bind_mesh(StateCache *state, Mesh *mesh, unsigned topology)
+{
+  MeshArena *arena = &renderer_data->mesh_arenas[mesh->arena];
+  state_set_vertex_buffer(state, 0, arena->vertex_buffer, sizeof(Mesh::Vertex));
+  state_set_index_buffer(state, arena->index_buffer);
+  state_set_topology(state, topology);
+}
+
+static void bind_shader(StateCache *state, Shader *shader)
+{
+  state_set_input_layout(state, shader->input_layout);
+  state_set_vertex_shader(state, shader->vertex_shader);
+  state_set_pixel_shader(state, shader->pixel_shader);
+  state_set_vs_constant_buffer(state, 0, shader->constants);
+}
+
+static void bind_texture(StateCache *state, unsigned slot, Texture *texture)
+{
+  state_set_ps_resource(state, slot, texture->resource);
+  state_set_ps_sampler(state, slot, texture->sampler);
+}
+
+// Writes a shader's whole constant buffer right away
+static void upload_constants(void *buffer, const void *data, unsigned size)
+{
+  renderer_data->backend->update_buffer(buffer, data, size);
+  renderer_data->stats.uploaded_bytes += size;
+}
+
+// Copies object data into the object ring and returns the index of the first
+// one, which is what draws pass as the start instance
+static unsigned push_objects(const InstanceData *objects, unsigned count)
+{
+  RendererBackend *device = renderer_data->device;
+  RingAllocator *ring = &renderer_data->object_ring;
+  if(count > ring->capacity)
+  {
+    if(renderer_data->object_buffer) device->destroy_buffer(renderer_data->object_buffer);
+
+    unsigned capacity = ring->capacity ? ring->capacity : 4096;
+    while(capacity < count) capacity *= 2;
+
+    renderer_data->object_buffer = device->create_object_buffer(sizeof(InstanceData) * capacity);
+    init_ring_allocator(ring, capacity);
+  }
+
+  // Appending never touches data a queued draw might still read, so only the
+  // first write after wrapping has to discard
+  bool restarted;
+  unsigned first = ring_allocate(ring, count, &restarted);
+  device->write_object_buffer(renderer_data->object_buffer, sizeof(InstanceData) * first, objects, sizeof(InstanceData) * count, restarted);
+  renderer_data->stats.uploaded_bytes += sizeof(InstanceData) * count;
+
+  state_set_vertex_buffer(&renderer_data->state, 1, renderer_data->object_buffer, sizeof(InstanceData));
+  return first;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Recording
+////////////////////////////////////////////////////////////////////////////////
+
+// first_object is relative to the object data recorded with the commands
+static void record_objects(CommandBuffer *commands, const Mesh *mesh, unsigned index_count, unsigned first_index,
+                           unsigned first_object, unsigned object_count)
+{
+  record_draw(commands, index_count, object_count, mesh->index_range.offset + first_index, mesh->vertex_range.offset, first_object);
+}
+
+static void begin_recording(RecordChunk *chunk)
+{
+  clear_command_buffer(&chunk->commands);
+  chunk->batches.instances.clear();
+  chunk->batches.batches.clear();
+  chunk->recorder.buffer = &chunk->commands;
+  init_state_cache(&chunk->state, &chunk->recorder);
+}
+
+// Records the visible static batches with one object per material. The shadow
+// pass leaves the depth shader bound and only draws.
+static void record_static_geometry(RecordChunk *chunk, RenderPass pass, const std::vector<unsigned> *visible_batches)
+{
+  begin_recording(chunk);
+  if(visible_batches->empty()) return;
+
+  StaticGeometry *geometry = &renderer_data->static_geometry;
+  std::vector<StaticMaterial> *materials = &renderer_data->static_materials;
+  chunk->batches.instances = renderer_data->static_objects;
+
+  Mesh *mesh = &renderer_data->static_mesh;
+  bind_mesh(&chunk->state, mesh, TOPOLOGY_TRIANGLE_LIST);
+  for(unsigned i = 0; i < visible_batches->size(); i++)
+  {
+    StaticBatch *batch = &geometry->batches[(*visible_batches)[i]];
+    StaticMaterial *material = &(*materials)[batch->material];
+    if(pass == RENDER_PASS_MAIN)
+    {
+      bind_shader(&chunk->state, material->shader);
+      if(material->texture)
+      {
+        bind_texture(&chunk->state, 0, material->texture);
+      }
+    }
+
+    record_objects(&chunk->commands, mesh, batch->index_count, batch->first_index, batch->material, 1);
+  }
+}
+
+// Records a run of sorted queue items. Runs on worker threads so it only reads
+// shared renderer data.
+static void record_items(RecordChunk *chunk, RenderPass pass, const unsigned *items, unsigned count)
+{
+  ModelStorage *models = &renderer_data->models;
+
+  // Material doesn't matter for depth, only the mesh
+  build_instance_batches(models, items, count, pass == RENDER_PASS_MAIN, &chunk->batches);
+
+  for(unsigned i = 0; i < chunk->batches.batches.size(); i++)
+  {
+    InstanceBatch *batch = &chunk->batches.batches[i];
+    ModelDrawData *draw = &models->draw_data[batch->model_index];
+
+    bind_mesh(&chunk->state, draw->mesh, TOPOLOGY_TRIANGLE_LIST);
+    if(pass == RENDER_PASS_MAIN)
+    {
+      bind_shader(&chunk->state, draw->shader);
+      if(draw->texture)
+      {
+        bind_texture(&chunk->state, 0, draw->texture);
+      }
+    }
+
+    record_objects(&chunk->commands, draw->mesh, draw->mesh->indices.size(), 0, batch->first_instance, batch->instance_count);
+  }
+}
+
+static void merge_chunk(const RecordChunk *chunk)
+{
+  std::vector<InstanceData> *objects = &renderer_data->pass_objects;
+  append_command_buffer(&renderer_data->pass_commands, &chunk->commands, objects->size());
+  objects->insert(objects->end(), chunk->batches.instances.begin(), chunk->batches.instances.end());
+}
+
+static void record_chunk_job(void *data)
+{
+  RecordChunk *chunk = (RecordChunk *)data;
+  record_items(chunk, chunk->pass, chunk->items, chunk->count);
+}
+
+// Records the static geometry, then the queue split across worker jobs.
+// Chunks are merged in queue order so the commands don't depend on timing.
+// Leaves the result in pass_commands and pass_objects.
+static void record_pass(RenderPass pass, const std::vector<unsigned> *visible_static_batches, const unsigned *items, unsigned count)
+{
+  unsigned chunk_count = count / RECORD_CHUNK_MIN_ITEMS;
+  if(chunk_count > job_worker_count()) chunk_count = job_worker_count();
+  if(chunk_count > MAX_RECORD_CHUNKS) chunk_count = MAX_RECORD_CHUNKS;
+  if(chunk_count < 1) chunk_count = 1;
+
+  // The first chunk is recorded on this thread along with the static geometry
+  Job jobs[MAX_RECORD_CHUNKS];
+  for(unsigned i = 0; i < chunk_count; i++)
+  {
+    RecordChunk *chunk = &renderer_data->record_chunks[i];
+    begin_recording(chunk);
+
+    unsigned begin = (unsigned)((unsigned long long)count * i / chunk_count);
+    unsigned end = (unsigned)((unsigned long long)count * (i + 1) / chunk_count);
+    chunk->pass = pass;
+    chunk->items = items + begin;
+    chunk->count = end - begin;
+    jobs[i].function = record_chunk_job;
+    jobs[i].data = chunk;
+  }
+
+  JobCounter recorded;
+  run_jobs(jobs + 1, chunk_count - 1, &recorded);
+
+  record_static_geometry(&renderer_data->static_chunk, pass, visible_static_batches);
+  record_chunk_job(&renderer_data->record_chunks[0]);
+
+  wait_for_counter(&recorded);
+
+  clear_command_buffer(&renderer_data->pass_commands);
+  renderer_data->pass_objects.clear();
+  merge_chunk(&renderer_data->static_chunk);
+  for(unsigned i = 0; i < chunk_count; i++)
+  {
+    merge_chunk(&renderer_data->record_chunks[i]);
+  }
+}
+
+// Uploads the pass's object data and replays its commands into the backend
+static void submit_pass()
+{
+  if(renderer_data->pass_objects.empty()) return;
+
+  unsigned first_object = push_objects(renderer_data->pass_objects.data(), renderer_data->pass_objects.size());
+  renderer_data->stats.draw_calls += replay_command_buffer(&renderer_data->pass_commands, &renderer_data->state,
+                                                           renderer_data->backend, first_object);
+}
+
+// Draws one mesh that isn't in the render queue, like the skybox or a screen
+// quad, with its own constants. Recorded and replayed like a pass so the
+// constants go with the draw in the same command stream.
+static void draw_mesh(Mesh *mesh, Shader *shader, Texture *texture, const void *constants, unsigned constants_size)
+{
+  RecordChunk *chunk = &renderer_data->mesh_chunk;
+  begin_recording(chunk);
+
+  bind_mesh(&chunk->state, mesh, TOPOLOGY_TRIANGLE_LIST);
+  bind_shader(&chunk->state, shader);
+  if(texture)
+  {
+    bind_texture(&chunk->state, 0, texture);
+  }
+  record_update_buffer(&chunk->commands, shader->constants, constants, constants_size);
+  record_objects(&chunk->commands, mesh, mesh->indices.size(), 0, 0, 1);
+
+  renderer_data->stats.uploaded_bytes += constants_size;
+  renderer_data->stats.draw_calls += replay_command_buffer(&chunk->commands, &renderer_data->state, renderer_data->backend, 0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Frame
+////////////////////////////////////////////////////////////////////////////////
+
+// Distance of the model's bounds in front of the pass camera
+static float view_depth(const PassMatrices *pass, const ModelStorage *models, unsigned index)
+{
+  // The view matrix looks down -z
+  const mat4 &view = pass->view_m_world;
+  float x = models->bounds_center_x[index];
+  float y = models->bounds_center_y[index];
+  float z = models->bounds_center_z[index];
+  return -(view[2][0] * x + view[2][1] * y + view[2][2] * z + view[2][3]);
+}
+
+// Fills the render queue with the visible models sorted by state, then front to back
+static void build_render_queue(RenderPass render_pass, const PassMatrices *pass, const std::vector<unsigned> *visible,
+                               Shader *override_shader)
+{
+  ModelStorage *models = &renderer_data->models;
+  RenderQueue *queue = &renderer_data->render_queue;
+  clear_render_queue(queue);
+  for(unsigned i = 0; i < visible->size(); i++)
+  {
+    unsigned index = (*visible)[i];
+    ModelDrawData *draw = &models->draw_data[index];
+    Shader *shader = override_shader ? override_shader : draw->shader;
+    unsigned texture_id = (draw->texture && !override_shader) ? draw->texture->sort_id : 0;
+    SortKey key = make_sort_key(render_pass, shader->sort_id, texture_id, draw->mesh->sort_id, view_depth(pass, models, index));
+    push_render_item(queue, key, index);
+  }
+  sort_render_queue(queue);
+}
+
+// Merges every static model into static_geometry and refills the static mesh
+static void rebuild_static_geometry()
+{
+  ModelStorage *models = &renderer_data->models;
+  std::vector<StaticMaterial> *materials = &renderer_data->static_materials;
+  materials->clear();
+
+  std::vector<StaticInstance> instances;
+  for(unsigned i = 0; i < models->count; i++)
+  {
+    if(!(models->flags[i] & MODEL_FLAG_STATIC)) continue;
+    if(!(models->flags[i] & MODEL_FLAG_SHOW)) continue;
+
+    ModelDrawData *draw = &models->draw_data[i];
+    v4 color = models->blend_colors[i];
+    unsigned material = 0;
+    for(; material < materials->size(); material++)
+    {
+      StaticMaterial *m = &(*materials)[material];
+      if(m->shader == draw->shader && m->texture == draw->texture &&
+         m->color.x == color.x && m->color.y == color.y && m->color.z == color.z && m->color.w == color.w)
+      {
+        break;
+      }
+    }
+    if(material == materials->size())
+    {
+      StaticMaterial m;
+      m.shader = draw->shader;
+      m.texture = draw->texture;
+      m.color = color;
+      materials->push_back(m);
+    }
+
+    StaticInstance instance;
+    instance.vertices = draw->mesh->vertices.data();
+    instance.vertex_count = draw->mesh->vertices.size();
+    instance.indices = draw->mesh->indices.data();
+    instance.index_count = draw->mesh->indices.size();
+    instance.world_m_model = models->world_matrices[i];
+    instance.material = material;
+    instances.push_back(instance);
+  }
+
+  StaticGeometry *geometry = &renderer_data->static_geometry;
+  build_static_geometry(instances.data(), instances.size(), STATIC_CELL_SIZE, geometry);
+
+  Mesh *mesh = &renderer_data->static_mesh;
+  mesh->clear_buffers();
+  mesh->vertices = geometry->vertices;
+  mesh->indices = geometry->indices;
+  if(mesh->indices.size())
+  {
+    mesh->fill_buffers();
+  }
+
+  // Geometry is already in world space so the objects only carry the color
+  renderer_data->static_objects.resize(materials->size());
+  for(unsigned i = 0; i < materials->size(); i++)
+  {
+    pack_instance(mat4(), (*materials)[i].color, &renderer_data->static_objects[i]);
+  }
+
+  renderer_data->static_geometry_dirty = false;
+  renderer_data->static_shadows_dirty = true;
+}
+
+// Occluder ids with this bit set are static batches
+static const unsigned STATIC_OCCLUDER = 0x80000000;
+
+// Draws the visible models and static batches that make good occluders into
+// the occlusion buffer, then drops the visible models hidden behind them
+static void cull_occluded_models(const PassMatrices *pass)
+{
+  ModelStorage *models = &renderer_data->models;
+  StaticGeometry *static_geometry = &renderer_data->static_geometry;
+
+  std::vector<Occluder> *occluders = &renderer_data->occluders;
+  occluders->clear();
+  for(unsigned i = 0; i < renderer_data->visible_models.size(); i++)
+  {
+    unsigned index = renderer_data->visible_models[i];
+    Occluder occluder;
+    occluder.bounds.center = v3(models->bounds_center_x[index], models->bounds_center_y[index], models->bounds_center_z[index]);
+    occluder.bounds.extents = v3(models->bounds_extent_x[index], models->bounds_extent_y[index], models->bounds_extent_z[index]);
+    occluder.triangle_count = models->draw_data[index].mesh->indices.size() / 3;
+    occluder.id = index;
+    occluders->push_back(occluder);
+  }
+
+  // Static batches only know their cell
+  for(unsigned i = 0; i < static_geometry->cells.size(); i++)
+  {
+    StaticCell *cell = &static_geometry->cells[i];
+    for(unsigned j = 0; j < renderer_data->visible_static_batches.size(); j++)
+    {
+      unsigned batch = renderer_data->visible_static_batches[j];
+      if(batch < cell->first_batch || batch >= cell->first_batch + cell->batch_count) continue;
+
+      Occluder occluder;
+      occluder.bounds = cell->bounds;
+      occluder.triangle_count = static_geometry->batches[batch].index_count / 3;
+      occluder.id = STATIC_OCCLUDER | batch;
+      occluders->push_back(occluder);
+    }
+  }
+
+  select_occluders(pass->clip_m_world, occluders);
+
+  OcclusionBuffer *buffer = &renderer_data->occlusion_buffer;
+  clear_occlusion_buffer(buffer, pass->clip_m_world);
+  std::vector<unsigned> *occluder_models = &renderer_data->occluder_models;
+  occluder_models->clear();
+  for(unsigned i = 0; i < occluders->size(); i++)
+  {
+    unsigned id = (*occluders)[i].id;
+    if(id & STATIC_OCCLUDER)
+    {
+      StaticBatch *batch = &static_geometry->batches[id & ~STATIC_OCCLUDER];
+      draw_occluder(buffer, mat4(), &static_geometry->vertices[0].position, sizeof(StaticVertex),
+                    &static_geometry->indices[batch->first_index], batch->index_count);
+    }
+    else
+    {
+      Mesh *mesh = models->draw_data[id].mesh;
+      draw_occluder(buffer, models->world_matrices[id], &mesh->vertices[0].position, sizeof(mesh->vertices[0]),
+                    mesh->indices.data(), mesh->indices.size());
+      occluder_models->push_back(id);
+    }
+  }
+
+  // The flags are cleared again right after, so only the occluders are touched
+  std::vector<unsigned char> *occluder_flags = &renderer_data->occluder_flags;
+  occluder_flags->resize(models->count, 0);
+  for(unsigned i = 0; i < occluder_models->size(); i++) (*occluder_flags)[(*occluder_models)[i]] = 1;
+  renderer_data->stats.main_occluded = occlusion_cull_models(buffer, models, occluder_flags, &renderer_data->visible_models);
+  for(unsigned i = 0; i < occluder_models->size(); i++) (*occluder_flags)[(*occluder_models)[i]] = 0;
+  renderer_data->stats.occluder_triangles = buffer->triangles_drawn;
+}
+
+// Runs the calls other threads made since the last frame, fits the shadow
+// cascades, brings the culling structures up to date and culls every pass.
+// Leaves the visible lists, pass matrices and culling stats for the render
+// graph's passes.
+static void prepare_frame(float aspect_ratio)
+{
+  sync_scene_commands(&renderer_data->models);
+
+  Camera *camera = &renderer_data->camera;
+  PassMatrices camera_pass = make_camera_pass_matrices(camera, aspect_ratio);
+
+  const ShadowCascadeSettings *shadow_settings = &renderer_data->shadow_settings;
+  fit_shadow_cascades(shadow_settings, camera->position, camera->looking_direction, deg_to_rad(camera->field_of_view), aspect_ratio,
+                      CAMERA_NEAR_PLANE, renderer_data->light_camera.looking_direction, renderer_data->cascades);
+  for(unsigned i = 0; i < shadow_settings->count; i++)
+  {
+    renderer_data->cascade_passes[i] = make_cascade_pass_matrices(&renderer_data->cascades[i]);
+  }
+
+  ModelStorage *models = &renderer_data->models;
+  update_world_transforms(models);
+  bvh_update(&renderer_data->bvh, models);
+  if(renderer_data->static_geometry_dirty)
+  {
+    rebuild_static_geometry();
+  }
+
+  // Culling
+  RenderStats *stats = &renderer_data->stats;
+  Frustum camera_frustum = make_frustum(camera_pass.clip_m_world);
+  stats->main_nodes_visited = bvh_cull(&renderer_data->bvh, models, &camera_frustum, &renderer_data->cull_stacks[0],
+                                       &renderer_data->visible_models);
+  cull_static_geometry(&renderer_data->static_geometry, &camera_frustum, &renderer_data->visible_static_batches);
+
+  stats->main_occluded = 0;
+  stats->occluder_triangles = 0;
+  if(renderer_data->occlusion_culling)
+  {
+    cull_occluded_models(&camera_pass);
+  }
+
+  // Each cascade only draws the casters in its own projection
+  stats->shadow_nodes_visited = 0;
+  stats->shadow_drawn = 0;
+  for(unsigned i = 0; i < shadow_settings->count; i++)
+  {
+    Frustum cascade_frustum = make_frustum(renderer_data->cascades[i].clip_m_world);
+    stats->shadow_nodes_visited += bvh_cull(&renderer_data->bvh, models, &cascade_frustum, &renderer_data->cull_stacks[i + 1],
+                                            &renderer_data->visible_shadow_casters[i]);
+    cull_static_geometry(&renderer_data->static_geometry, &cascade_frustum, &renderer_data->visible_static_shadow_batches[i]);
+    stats->shadow_drawn += renderer_data->visible_shadow_casters[i].size();
+  }
+
+  // Drawn and culled only count dynamic models
+  unsigned num_shown = 0;
+  for(unsigned i = 0; i < models->count; i++)
+  {
+    if((models->flags[i] & MODEL_FLAG_SHOW) && !(models->flags[i] & MODEL_FLAG_STATIC)) num_shown++;
+  }
+  stats->main_drawn = renderer_data->visible_models.size();
+  stats->shadow_culled = num_shown * shadow_settings->count - stats->shadow_drawn;
+  stats->main_culled = num_shown - stats->main_drawn;
+
+  stats->draw_calls = 0;
+  stats->uploaded_bytes = 0;
+
+  renderer_data->camera_pass = camera_pass;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Passes
+////////////////////////////////////////////////////////////////////////////////
+
+// Draws one object with its own world matrix and color. The shader's frame
+// constants have to be set for the pass.
+static void render_mesh(Mesh *mesh, Shader *shader, const mat4 &world_m_model, v4 color, Texture *texture, unsigned topology)
+{
+  InstanceData object;
+  pack_instance(world_m_model, color, &object);
+  unsigned first_object = push_objects(&object, 1);
+
+  bind_mesh(&renderer_data->state, mesh, topology);
+  bind_shader(&renderer_data->state, shader);
+  if(texture)
+  {
+    bind_texture(&renderer_data->state, 0, texture);
+  }
+
+  renderer_data->backend->draw_indexed(mesh->indices.size(), 1, mesh->index_range.offset, mesh->vertex_range.offset, first_object);
+  renderer_data->stats.draw_calls++;
+}
+
+static void render_skybox(Camera *camera, const PassMatrices *pass)
+{
+  // Drawn first with depth off, render_scene turns it back on for the models
+  state_set_depth_stencil_state(&renderer_data->state, renderer_data->no_depth_state);
+
+  SkyboxConstants constants;
+  constants.world_m_model = make_world_matrix(camera->position, v3(10.0f, 10.0f, 10.0f), quat());
+  constants.view_m_world = pass->view_m_world;
+  constants.clip_m_view = make_perspective_projection_matrix(deg_to_rad(camera->field_of_view), renderer_data->aspect_ratio, 0.1f, 100.0f);
+  draw_mesh(&renderer_data->skybox_mesh, &renderer_data->skybox_shader, &renderer_data->skybox_texture, &constants, sizeof(constants));
+}
+
+static void render_2d_screen_mesh(Mesh *mesh, Shader *shader, v3 position, v2 scale, v4 color, Texture *texture)
+{
+  QuadConstants constants;
+  constants.world_m_model = make_world_matrix(position, v3(scale, 1.0f), quat());
+  constants.view_m_world = mat4();
+  constants.clip_m_view = mat4();
+  constants.light_clip_m_world = mat4();
+  constants.color = color;
+  constants.light_vector = v4();
+  draw_mesh(mesh, shader, texture, &constants, sizeof(constants));
+}
+
+// Camera and light constants for the diffuse and flat color shaders
+static void set_frame_constants(const PassMatrices *pass)
+{
+  FrameConstants constants;
+  constants.view_m_world = pass->view_m_world;
+  constants.clip_m_view = pass->clip_m_view;
+  constants.light_vector = v4(renderer_data->light_vector, 1.0f);
+
+  unsigned cascade_count = renderer_data->shadow_settings.count;
+  for(unsigned i = 0; i < MAX_SHADOW_CASCADES; i++)
+  {
+    // Unused cascades repeat the last one
+    const ShadowCascade *cascade = &renderer_data->cascades[i < cascade_count ? i : cascade_count - 1];
+    constants.light_clip_m_world[i] = cascade->clip_m_world;
+    constants.cascade_params[i] = v4(cascade->far_distance, cascade->depth_bias, 0.0f, 0.0f);
+  }
+  constants.cascade_count = cascade_count;
+  upload_constants(renderer_data->frame_constants, &constants, sizeof(constants));
+}
+
+// visible is the list of model indices that passed culling for this pass
+static void render_scene_depth(const PassMatrices *pass, const std::vector<unsigned> *visible,
+                               const std::vector<unsigned> *visible_static_batches)
+{
+  Shader *shader = &renderer_data->depth_shader;
+  state_set_depth_stencil_state(&renderer_data->state, renderer_data->depth_state);
+
+  // Everything in the pass uses the depth shader so it's bound once up front
+  bind_shader(&renderer_data->state, shader);
+  DepthConstants constants;
+  constants.clip_m_world = pass->clip_m_world;
+  upload_constants(shader->constants, &constants, sizeof(constants));
+
+  build_render_queue(RENDER_PASS_SHADOW, pass, visible, shader);
+  RenderQueue *queue = &renderer_data->render_queue;
+  record_pass(RENDER_PASS_SHADOW, visible_static_batches, queue->items.data(), queue->items.size());
+  submit_pass();
+}
+
+static void render_scene(Camera *camera, const PassMatrices *pass, const std::vector<unsigned> *visible,
+                         const std::vector<unsigned> *visible_static_batches)
+{
+  render_skybox(camera, pass);
+  state_set_depth_stencil_state(&renderer_data->state, renderer_data->depth_state);
+  set_frame_constants(pass);
+
+  // The pixel shader picks a cascade so it needs the frame constants and every
+  // shadow map. Draws don't touch these slots so they're bound once.
+  state_set_ps_constant_buffer(&renderer_data->state, 0, renderer_data->frame_constants);
+  for(unsigned i = 0; i < renderer_data->shadow_settings.count; i++)
+  {
+    bind_texture(&renderer_data->state, 1 + i, &renderer_data->shadow_map_textures[i]);
+  }
+
+  ModelStorage *models = &renderer_data->models;
+  build_render_queue(RENDER_PASS_MAIN, pass, visible, 0);
+  RenderQueue *queue = &renderer_data->render_queue;
+  record_pass(RENDER_PASS_MAIN, visible_static_batches, queue->items.data(), queue->items.size());
+  submit_pass();
+
+  // Debug normals all share a shader so draw them after the sorted models
+  for(unsigned i = 0; i < queue->items.size(); i++)
+  {
+    unsigned index = queue->items[i];
+    Mesh *debug_normals_mesh = models->cold[index].debug_normals_mesh;
+    if((models->flags[index] & MODEL_FLAG_RENDER_NORMALS) && debug_normals_mesh)
+    {
+      render_mesh(debug_normals_mesh, &renderer_data->flat_color_shader, models->world_matrices[index],
+                  v4(1.0f, 1.0f, 0.0f, 1.0f), 0, TOPOLOGY_LINE_LIST);
+    }
+  }
+}
+
+static void *get_graph_texture(unsigned resource)
+{
+  return graph_texture(&renderer_data->graph, resource);
+}
+
+// Redraws the cached static casters of cascades that are out of date
+static void static_shadow_pass(void *)
+{
+  RendererBackend *device = renderer_data->device;
+  unsigned resolution = renderer_data->shadow_settings.resolution;
+  device->set_viewport(resolution, resolution);
+
+  for(unsigned i = 0; i < renderer_data->shadow_settings.count; i++)
+  {
+    const PassMatrices *cascade_pass = &renderer_data->cascade_passes[i];
+    if(!renderer_data->static_shadows_dirty &&
+       memcmp(&cascade_pass->clip_m_world, &renderer_data->static_shadow_clip_m_world[i], sizeof(mat4)) == 0)
+    {
+      continue;
+    }
+
+    void *target = get_graph_texture(renderer_data->static_shadow_target_resources[i]);
+    state_set_render_target(&renderer_data->state, 0, device->depth_view(target));
+    device->clear_depth(target);
+
+    std::vector<unsigned> no_models;
+    render_scene_depth(cascade_pass, &no_models, &renderer_data->visible_static_shadow_batches[i]);
+
+    renderer_data->static_shadow_clip_m_world[i] = cascade_pass->clip_m_world;
+  }
+  renderer_data->static_shadows_dirty = false;
+}
+
+// Light's view of the scene for each cascade. Starts from the cached static
+// casters so only the dynamic ones are drawn.
+static void shadow_pass(void *)
+{
+  RendererBackend *device = renderer_data->device;
+  unsigned resolution = renderer_data->shadow_settings.resolution;
+  device->set_viewport(resolution, resolution);
+
+  for(unsigned i = 0; i < renderer_data->shadow_settings.count; i++)
+  {
+    void *shadow_map = get_graph_texture(renderer_data->shadow_map_resources[i]);
+    device->copy_texture(shadow_map, get_graph_texture(renderer_data->static_shadow_target_resources[i]));
+    state_set_render_target(&renderer_data->state, 0, device->depth_view(shadow_map));
+
+    std::vector<unsigned> no_static_batches;
+    render_scene_depth(&renderer_data->cascade_passes[i], &renderer_data->visible_shadow_casters[i], &no_static_batches);
+  }
+}
+
+// The scene from the player camera
+static void main_pass(void *)
+{
+  RendererBackend *device = renderer_data->device;
+  void *back_buffer = get_graph_texture(renderer_data->back_buffer_resource);
+  void *depth_buffer = get_graph_texture(renderer_data->depth_buffer_resource);
+  for(unsigned i = 0; i < renderer_data->shadow_settings.count; i++)
+  {
+    renderer_data->shadow_map_textures[i].resource = device->resource_view(get_graph_texture(renderer_data->shadow_map_resources[i]));
+  }
+
+  device->set_viewport(renderer_data->framebuffer_width, renderer_data->framebuffer_height);
+  state_set_render_target(&renderer_data->state, device->target_view(back_buffer), device->depth_view(depth_buffer));
+  device->clear_color(back_buffer);
+  device->clear_depth(depth_buffer);
+
+  render_scene(&renderer_data->camera, &renderer_data->camera_pass, &renderer_data->visible_models, &renderer_data->visible_static_batches);
+}
+
+// Shadow maps drawn in a row along the top of the screen, nearest cascade first
+static void shadow_map_preview_pass(void *)
+{
+  for(unsigned i = 0; i < renderer_data->shadow_settings.count; i++)
+  {
+    renderer_data->quad_texture.resource = renderer_data->device->resource_view(get_graph_texture(renderer_data->shadow_map_resources[i]));
+    render_2d_screen_mesh(&renderer_data->quad_mesh, &renderer_data->quad_shader, v3(-0.75f + 0.42f * i, 0.75f, 0.0f), v2(0.2f, 0.2f),
+                          v4(1.0f, 1.0f, 1.0f, 1.0f), &renderer_data->quad_texture);
+  }
+}
+
+static void build_render_graph()
+{
+  RenderGraph *graph = &renderer_data->graph;
+  RenderGraphBackend *graph_backend = renderer_data->graph_backend;
+  init_render_graph(graph, graph_backend);
+
+  renderer_data->back_buffer_resource = graph_import_texture(graph, "back buffer", renderer_data->back_buffer, true);
+  renderer_data->depth_buffer_resource = graph_import_texture(graph, "depth buffer", renderer_data->depth_buffer, false);
+
+  static const char *shadow_map_names[MAX_SHADOW_CASCADES] = {"shadow map 0", "shadow map 1", "shadow map 2", "shadow map 3"};
+  static const char *static_target_names[MAX_SHADOW_CASCADES] = {"static shadow 0", "static shadow 1", "static shadow 2",
+                                                                 "static shadow 3"};
+
+  const ShadowCascadeSettings *settings = &renderer_data->shadow_settings;
+  RenderGraphTextureDesc shadow_map_desc;
+  shadow_map_desc.width = settings->resolution;
+  shadow_map_desc.height = settings->resolution;
+  shadow_map_desc.format = renderer_data->depth_texture_format;
+  shadow_map_desc.texel_bytes = 4;
+
+  // The static shadow caches live across frames so they're owned here, not by
+  // the graph. They're copied into the shadow maps so they have to match them.
+  for(unsigned i = 0; i < settings->count; i++)
+  {
+    renderer_data->shadow_map_resources[i] = graph_create_texture(graph, shadow_map_names[i], shadow_map_desc);
+    renderer_data->shadow_map_textures[i].sampler = renderer_data->quad_texture.sampler;
+    if(!renderer_data->shadow_map_textures[i].sort_id)
+    {
+      renderer_data->shadow_map_textures[i].sort_id = ++renderer_data->num_texture_sort_ids;
+    }
+
+    renderer_data->static_shadow_targets[i] = graph_backend->create_texture(shadow_map_desc);
+    renderer_data->static_shadow_target_resources[i] = graph_import_texture(graph, static_target_names[i], renderer_data->static_shadow_targets[i], false);
+  }
+  renderer_data->static_shadow_bytes = (unsigned long long)settings->count * settings->resolution * settings->resolution *
+                                       shadow_map_desc.texel_bytes;
+  renderer_data->static_shadows_dirty = true;
+
+  unsigned static_shadow = graph_add_pass(graph, "static shadow", static_shadow_pass, 0);
+  unsigned shadow = graph_add_pass(graph, "shadow", shadow_pass, 0);
+  unsigned main = graph_add_pass(graph, "main", main_pass, 0);
+  unsigned preview = graph_add_pass(graph, "shadow map preview", shadow_map_preview_pass, 0);
+  for(unsigned i = 0; i < settings->count; i++)
+  {
+    graph_write(graph, static_shadow, renderer_data->static_shadow_target_resources[i]);
+    graph_read(graph, shadow, renderer_data->static_shadow_target_resources[i]);
+    graph_write(graph, shadow, renderer_data->shadow_map_resources[i]);
+    graph_read(graph, main, renderer_data->shadow_map_resources[i]);
+    graph_read(graph, preview, renderer_data->shadow_map_resources[i]);
+  }
+
+  graph_write(graph, main, renderer_data->back_buffer_resource);
+  graph_write(graph, main, renderer_data->depth_buffer_resource);
+
+  graph_write(graph, preview, renderer_data->back_buffer_resource);
+  renderer_data->shadow_map_preview_pass = preview;
+}
+
+// Everything build_render_graph created
+static void destroy_frame_textures()
+{
+  // Queued work can still point at the textures
+  renderer_data->device->flush();
+
+  destroy_render_graph(&renderer_data->graph);
+  for(unsigned i = 0; i < renderer_data->shadow_settings.count; i++)
+  {
+    renderer_data->graph_backend->destroy_texture(renderer_data->static_shadow_targets[i]);
+  }
+}
+
+void render()
+{
+  StateCache *state = &renderer_data->state;
+  prepare_frame(renderer_data->aspect_ratio);
+
+  // Nothing is trusted to still be bound from last frame
+  reset_state_cache(state);
+  state->stats = StateCacheStats();
+
+  execute_render_graph(&renderer_data->graph);
+  renderer_data->device->present();
+
+  renderer_data->stats.state_changes = state->stats.forwarded;
+  renderer_data->stats.redundant_state_changes = state->stats.redundant;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Meshes
+////////////////////////////////////////////////////////////////////////////////
+
+static void make_quad(Mesh::Vertex *vertices, unsigned *indices)
+{
+  vertices[0] = {v3(-1.0f, -1.0f, 0.0f), v3(0.0f, 0.0f, 1.0f), v2(0.0f, 1.0f)}; // Left lower
+  vertices[1] = {v3( 1.0f, -1.0f, 0.0f), v3(0.0f, 0.0f, 1.0f), v2(1.0f, 1.0f)}; // Right lower
+  vertices[2] = {v3( 1.0f,  1.0f, 0.0f), v3(0.0f, 0.0f, 1.0f), v2(1.0f, 0.0f)}; // Right upper
+  vertices[3] = {v3(-1.0f,  1.0f, 0.0f), v3(0.0f, 0.0f, 1.0f), v2(0.0f, 0.0f)}; // Left upper
+
+  static const unsigned quad_indices[6] = {0, 1, 2, 2, 3, 0};
+  memcpy(indices, quad_indices, sizeof(quad_indices));
+}
+
+static void make_inward_cube_mesh(Mesh::Vertex *vertices, unsigned *indices)
+{
+  vertices[0] = {v3(-1.0f, -1.0f,  1.0f), v3(), v2()}; // Left lower front
+  vertices[1] = {v3( 1.0f, -1.0f,  1.0f), v3(), v2()}; // Right lower front
+  vertices[2] = {v3( 1.0f, -1.0f, -1.0f), v3(), v2()}; // Right lower back
+  vertices[3] = {v3(-1.0f, -1.0f, -1.0f), v3(), v2()}; // Left lower back
+
+  vertices[4] = {v3(-1.0f,  1.0f,  1.0f), v3(), v2()}; // Left upper front
+  vertices[5] = {v3( 1.0f,  1.0f,  1.0f), v3(), v2()}; // Right upper front
+  vertices[6] = {v3( 1.0f,  1.0f, -1.0f), v3(), v2()}; // Right upper back
+  vertices[7] = {v3(-1.0f,  1.0f, -1.0f), v3(), v2()}; // Left upper back
+
+  // Counter clockwise from inside
+  static const unsigned cube_indices[36] =
+  {
+    0, 1, 2, 2, 3, 0, // Bottom
+    6, 5, 4, 4, 7, 6, // Top
+    0, 3, 7, 7, 4, 0, // Left
+    2, 1, 5, 5, 6, 2, // Right
+    3, 2, 6, 6, 7, 3, // Front
+    5, 1, 0, 0, 4, 5, // Back
+  };
+  memcpy(indices, cube_indices, sizeof(cube_indices));
+}
+
+void Mesh::normalize()
+{
+  normalize_vertices(vertices.data(), vertices.size(), &bounding_box, &bounding_sphere);
+}
+
+void Mesh::compute_vertex_normals()
+{
+  compute_smooth_normals(vertices.data(), vertices.size(), indices.data(), indices.size());
+}
+
+void Mesh::fill_buffers()
+{
+  assert(arena == TLSF_INVALID && vertices.size() && indices.size());
+  RendererBackend *device = renderer_data->device;
+  std::vector<MeshArena> *arenas = &renderer_data->mesh_arenas;
+  unsigned vertex_count = vertices.size();
+  unsigned index_count = indices.size();
+
+  // First arena with room for both
+  for(unsigned i = 0; i < arenas->size(); i++)
+  {
+    MeshArena *candidate = &(*arenas)[i];
+    vertex_range = tlsf_allocate(&candidate->vertices, vertex_count);
+    if(vertex_range.offset == TLSF_INVALID) continue;
+
+    index_range = tlsf_allocate(&candidate->indices, index_count);
+    if(index_range.offset == TLSF_INVALID)
+    {
+      tlsf_free(&candidate->vertices, vertex_range);
+      continue;
+    }
+
+    arena = i;
+    break;
+  }
+
+  if(arena == TLSF_INVALID)
+  {
+    // Size classes round requests up by up to 1/16th, leave room for that
+    unsigned arena_vertices = vertex_count + vertex_count / 8;
+    unsigned arena_indices = index_count + index_count / 8;
+    if(arena_vertices < MESH_ARENA_VERTICES) arena_vertices = MESH_ARENA_VERTICES;
+    if(arena_indices < MESH_ARENA_INDICES) arena_indices = MESH_ARENA_INDICES;
+
+    MeshArena new_arena;
+    new_arena.vertex_buffer = device->create_mesh_buffer(sizeof(Vertex) * arena_vertices, false);
+    new_arena.index_buffer = device->create_mesh_buffer(sizeof(unsigned) * arena_indices, true);
+    init_tlsf_allocator(&new_arena.vertices, arena_vertices);
+    init_tlsf_allocator(&new_arena.indices, arena_indices);
+    arenas->push_back(new_arena);
+
+    arena = arenas->size() - 1;
+    MeshArena *added = &arenas->back();
+    vertex_range = tlsf_allocate(&added->vertices, vertex_count);
+    index_range = tlsf_allocate(&added->indices, index_count);
+    assert(vertex_range.offset != TLSF_INVALID && index_range.offset != TLSF_INVALID);
+  }
+
+  MeshArena *mesh_arena = &(*arenas)[arena];
+  device->write_mesh_buffer(mesh_arena->vertex_buffer, sizeof(Vertex) * vertex_range.offset, vertices.data(), sizeof(Vertex) * vertex_count);
+  device->write_mesh_buffer(mesh_arena->index_buffer, sizeof(unsigned) * index_range.offset, indices.data(), sizeof(unsigned) * index_count);
+
+  sort_id = ++renderer_data->num_mesh_sort_ids;
+}
+
+void Mesh::clear_buffers()
+{
+  if(arena == TLSF_INVALID) return;
+
+  MeshArena *mesh_arena = &renderer_data->mesh_arenas[arena];
+  tlsf_free(&mesh_arena->vertices, vertex_range);
+  tlsf_free(&mesh_arena->indices, index_range);
+  arena = TLSF_INVALID;
+  vertex_range = TlsfAllocation();
+  index_range = TlsfAllocation();
+}
+
+// Lines along each vertex normal, for debugging loaded meshes. 0 where the
+// backend can't draw them.
+static Mesh *make_debug_normals_mesh(const Mesh *mesh)
+{
+  if(!renderer_data->draws_lines) return 0;
+
+  Mesh *debug_normals_mesh = new Mesh();
+  for(Mesh::Vertex vertex : mesh->vertices)
+  {
+    debug_normals_mesh->vertices.push_back({vertex.position, v3(), v2()});
+    debug_normals_mesh->vertices.push_back({vertex.position + vertex.normal * 0.1f, v3(), v2()});
+
+    debug_normals_mesh->indices.push_back(debug_normals_mesh->vertices.size() - 2);
+    debug_normals_mesh->indices.push_back(debug_normals_mesh->vertices.size() - 1);
+  }
+  debug_normals_mesh->fill_buffers();
+  return debug_normals_mesh;
+}
+
+
+// Returns the shared mesh for a model file, loading it the first time
+static LoadedMesh *load_mesh(const char *model_name)
+{
+  std::vector<LoadedMesh> *loaded_meshes = &renderer_data->loaded_meshes;
+  for(unsigned i = 0; i < loaded_meshes->size(); i++)
+  {
+    if((*loaded_meshes)[i].file_name == model_name) return &(*loaded_meshes)[i];
+  }
+
+  Mesh *mesh = new Mesh();
+  std::vector<v3> vertices;
+  load_obj(model_name, &vertices, 0, 0, &mesh->indices);
+  assert(vertices.size() && "Couldn't load model");
+  for(v3 vertex : vertices)
+  {
+    Mesh::Vertex mesh_vertex = {vertex, v3(), v2()};
+    mesh->vertices.push_back(mesh_vertex);
+  }
+  mesh->normalize();
+  mesh->compute_vertex_normals();
+  mesh->fill_buffers();
+
+  LoadedMesh loaded;
+  loaded.file_name = model_name;
+  loaded.mesh = mesh;
+  loaded.debug_normals_mesh = make_debug_normals_mesh(mesh);
+  loaded.ref_count = 0;
+  loaded_meshes->push_back(loaded);
+  return &loaded_meshes->back();
+}
+
+// Drops a reference to a shared mesh and frees it once nothing uses it
+static void release_mesh(Mesh *mesh)
+{
+  std::vector<LoadedMesh> *loaded_meshes = &renderer_data->loaded_meshes;
+  for(unsigned i = 0; i < loaded_meshes->size(); i++)
+  {
+    LoadedMesh *loaded = &(*loaded_meshes)[i];
+    if(loaded->mesh != mesh) continue;
+
+    assert(loaded->ref_count > 0);
+    if(--loaded->ref_count) return;
+
+    loaded->mesh->clear_buffers();
+    delete loaded->mesh;
+    if(loaded->debug_normals_mesh)
+    {
+      loaded->debug_normals_mesh->clear_buffers();
+      delete loaded->debug_normals_mesh;
+    }
+
+    (*loaded_meshes)[i] = loaded_meshes->back();
+    loaded_meshes->pop_back();
+    return;
+  }
+
+  assert(0); // Mesh wasn't loaded through load_mesh
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Stats
+////////////////////////////////////////////////////////////////////////////////
+
+RenderStats get_render_stats()
+{
+  RenderStats stats = renderer_data->stats;
+
+  // Walks the arenas' free lists so it's only gathered when asked for
+  stats.mesh_arenas = renderer_data->mesh_arenas.size();
+  stats.mesh_bytes_used = 0;
+  stats.mesh_bytes_reserved = 0;
+  stats.mesh_fragmentation = 0.0f;
+
+  RenderGraph *graph = &renderer_data->graph;
+  stats.render_targets = 0;
+  for(unsigned i = 0; i < graph->resources.size(); i++)
+  {
+    if(!graph->resources[i].imported && graph->resources[i].physical != RENDER_GRAPH_INVALID) stats.render_targets++;
+  }
+  stats.render_target_textures = graph->physical_textures.size();
+  stats.render_target_bytes = render_graph_texture_bytes(graph) + renderer_data->static_shadow_bytes;
+  for(unsigned i = 0; i < renderer_data->mesh_arenas.size(); i++)
+  {
+    TlsfStats vertex_stats = tlsf_stats(&renderer_data->mesh_arenas[i].vertices);
+    TlsfStats index_stats = tlsf_stats(&renderer_data->mesh_arenas[i].indices);
+    stats.mesh_bytes_used += sizeof(Mesh::Vertex) * vertex_stats.used + sizeof(unsigned) * index_stats.used;
+    stats.mesh_bytes_reserved += sizeof(Mesh::Vertex) * vertex_stats.capacity + sizeof(unsigned) * index_stats.capacity;
+    stats.mesh_fragmentation = maxf(stats.mesh_fragmentation, maxf(vertex_stats.fragmentation, index_stats.fragmentation));
+  }
+
+  return stats;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// graphics.h
+////////////////////////////////////////////////////////////////////////////////
+
+// Rotations in degrees
+static quat degrees_to_quat(v3 rotation) { return make_euler_quat(v3(deg_to_rad(rotation.x), deg_to_rad(rotation.y), deg_to_rad(rotation.z))); }
+static v3 quat_to_degrees(quat q) { v3 r = quat_to_euler(q); return v3(rad_to_deg(r.x), rad_to_deg(r.y), rad_to_deg(r.z)); }
+
+// Adds the model in the reserved slot if there is one, else in a new one
+static Model make_model(unsigned command, Model reserved, const char *model_name, v3 position, v3 scale, v3 rotation)
+{
+  ModelStorage *models = &renderer_data->models;
+  Model handle = add_model(models, reserved);
+  unsigned index = model_index(models, handle);
+
+  models->positions[index] = position;
+  models->scales[index] = scale;
+  models->orientations[index] = degrees_to_quat(rotation);
+
+  LoadedMesh *loaded = load_mesh(model_name);
+  loaded->ref_count++;
+
+  models->draw_data[index].mesh = loaded->mesh;
+  models->draw_data[index].shader = &renderer_data->diffuse_shader;
+  models->local_bounds[index] = loaded->mesh->bounding_box;
+  models->cold[index].debug_name = model_name;
+  models->cold[index].debug_normals_mesh = loaded->debug_normals_mesh;
+
+  if(command == TRACE_CREATE_STATIC_MODEL)
+  {
+    models->flags[index] |= MODEL_FLAG_STATIC;
+    renderer_data->static_geometry_dirty = true;
+  }
+
+  trace_create_model(command, handle, model_name, position, scale, rotation);
+  return handle;
+}
+
+Model create_model(const char *model_name, v3 position, v3 scale, v3 rotation)
+{
+  Model handle;
+  if(queue_create_model(TRACE_CREATE_MODEL, &renderer_data->models, &handle, model_name, position, scale, rotation)) return handle;
+  return make_model(TRACE_CREATE_MODEL, Model(), model_name, position, scale, rotation);
+}
+
+Model create_static_model(const char *model_name, v3 position, v3 scale, v3 rotation)
+{
+  Model handle;
+  if(queue_create_model(TRACE_CREATE_STATIC_MODEL, &renderer_data->models, &handle, model_name, position, scale, rotation)) return handle;
+  return make_model(TRACE_CREATE_STATIC_MODEL, Model(), model_name, position, scale, rotation);
+}
+
+void create_reserved_model(const SceneCommand *command)
+{
+  v3 position = v3(command->value.x, command->value.y, command->value.z);
+  make_model(command->type, command->model, command->model_name, position, command->scale, command->rotation);
+}
+
+void destroy_model(Model model)
+{
+  if(queue_destroy_model(model)) return;
+  trace_destroy_model(model);
+
+  ModelStorage *models = &renderer_data->models;
+  unsigned index = model_index(models, model);
+  assert(index != INVALID_MODEL_INDEX);
+  if(index == INVALID_MODEL_INDEX) return;
+
+  if(models->flags[index] & MODEL_FLAG_STATIC)
+  {
+    renderer_data->static_geometry_dirty = true;
+  }
+
+  release_mesh(models->draw_data[index].mesh);
+
+  bvh_remove(&renderer_data->bvh, models, model.index);
+  remove_model(models, model);
+}
+
+bool is_model_valid(Model model)
+{
+  if(SceneSnapshot *scene = simulation_scene())
+  {
+    return model.index < scene->models.size() && scene->models[model.index].live &&
+           scene->models[model.index].generation == model.generation;
+  }
+
+  bool valid;
+  if(queued_model_valid(model, &valid)) return valid;
+
+  return model_index(&renderer_data->models, model) != INVALID_MODEL_INDEX;
+}
+
+// False for stale handles, which only assert, so release builds skip the call
+// instead of indexing with INVALID_MODEL_INDEX
+static bool lookup_model(Model model, unsigned *index)
+{
+  *index = model_index(&renderer_data->models, model);
+  assert(*index != INVALID_MODEL_INDEX && "Stale model handle");
+  return *index != INVALID_MODEL_INDEX;
+}
+
+// Every transform setter goes through here so the cached world matrix gets rebuilt
+static bool modify_model_transform(Model model, unsigned *index)
+{
+  if(!lookup_model(model, index)) return false;
+  assert(!(renderer_data->models.flags[*index] & MODEL_FLAG_STATIC) && "Static models can't move");
+  mark_transform_dirty(&renderer_data->models, *index);
+  return true;
+}
+
+void set_model_position(Model model, v3 pos)
+{
+  if(SceneModel *simulated = simulated_model(model, true)) { simulated->position = pos; return; }
+  if(queue_model_call(TRACE_SET_MODEL_POSITION, model, pos)) return;
+  trace_model_call(TRACE_SET_MODEL_POSITION, model, pos);
+  unsigned index;
+  if(!modify_model_transform(model, &index)) return;
+  renderer_data->models.positions[index] = pos;
+}
+
+void change_model_position(Model model, v3 offset)
+{
+  if(SceneModel *simulated = simulated_model(model, true)) { simulated->position += offset; return; }
+  if(queue_model_call(TRACE_CHANGE_MODEL_POSITION, model, offset)) return;
+  trace_model_call(TRACE_CHANGE_MODEL_POSITION, model, offset);
+  unsigned index;
+  if(!modify_model_transform(model, &index)) return;
+  renderer_data->models.positions[index] += offset;
+}
+
+void set_model_scale(Model model, v3 scale)
+{
+  if(SceneModel *simulated = simulated_model(model, true)) { simulated->scale = scale; return; }
+  if(queue_model_call(TRACE_SET_MODEL_SCALE, model, scale)) return;
+  trace_model_call(TRACE_SET_MODEL_SCALE, model, scale);
+  unsigned index;
+  if(!modify_model_transform(model, &index)) return;
+  renderer_data->models.scales[index] = scale;
+}
+
+void change_model_scale(Model model, v3 scale)
+{
+  if(SceneModel *simulated = simulated_model(model, true)) { simulated->scale += scale; return; }
+  if(queue_model_call(TRACE_CHANGE_MODEL_SCALE, model, scale)) return;
+  trace_model_call(TRACE_CHANGE_MODEL_SCALE, model, scale);
+  unsigned index;
+  if(!modify_model_transform(model, &index)) return;
+  renderer_data->models.scales[index] += scale;
+}
+
+void set_model_rotation(Model model, v3 rotation)
+{
+  if(SceneModel *simulated = simulated_model(model, true)) { simulated->orientation = degrees_to_quat(rotation); return; }
+  if(queue_model_call(TRACE_SET_MODEL_ROTATION, model, rotation)) return;
+  trace_model_call(TRACE_SET_MODEL_ROTATION, model, rotation);
+  unsigned index;
+  if(!modify_model_transform(model, &index)) return;
+  renderer_data->models.orientations[index] = degrees_to_quat(rotation);
+}
+
+void change_model_rotation(Model model, v3 rotation)
+{
+  quat turn = degrees_to_quat(rotation);
+  if(SceneModel *simulated = simulated_model(model, true)) { simulated->orientation = unit(turn * simulated->orientation); return; }
+  if(queue_model_call(TRACE_CHANGE_MODEL_ROTATION, model, rotation)) return;
+  trace_model_call(TRACE_CHANGE_MODEL_ROTATION, model, rotation);
+  unsigned index;
+  if(!modify_model_transform(model, &index)) return;
+  quat *orientation = &renderer_data->models.orientations[index];
+  *orientation = unit(turn * *orientation);
+}
+
+void set_model_orientation(Model model, quat orientation)
+{
+  if(SceneModel *simulated = simulated_model(model, true)) { simulated->orientation = unit(orientation); return; }
+  if(queue_model_call(TRACE_SET_MODEL_ORIENTATION, model, v4(orientation.x, orientation.y, orientation.z, orientation.w))) return;
+  trace_model_call(TRACE_SET_MODEL_ORIENTATION, model, v4(orientation.x, orientation.y, orientation.z, orientation.w));
+  unsigned index;
+  if(!modify_model_transform(model, &index)) return;
+  renderer_data->models.orientations[index] = unit(orientation);
+}
+
+v3 get_model_position(Model model)
+{
+  if(SceneModel *simulated = simulated_model(model)) return simulated->position;
+  SceneModel queued;
+  if(queued_model(model, &queued)) return queued.position;
+  unsigned index;
+  if(!lookup_model(model, &index)) return v3();
+  return renderer_data->models.positions[index];
+}
+
+v3 get_model_scale(Model model)
+{
+  if(SceneModel *simulated = simulated_model(model)) return simulated->scale;
+  SceneModel queued;
+  if(queued_model(model, &queued)) return queued.scale;
+  unsigned index;
+  if(!lookup_model(model, &index)) return v3();
+  return renderer_data->models.scales[index];
+}
+
+v3 get_model_rotation(Model model)
+{
+  if(SceneModel *simulated = simulated_model(model)) return quat_to_degrees(simulated->orientation);
+  SceneModel queued;
+  if(queued_model(model, &queued)) return quat_to_degrees(queued.orientation);
+  unsigned index;
+  if(!lookup_model(model, &index)) return v3();
+  return quat_to_degrees(renderer_data->models.orientations[index]);
+}
+
+quat get_model_orientation(Model model)
+{
+  if(SceneModel *simulated = simulated_model(model)) return simulated->orientation;
+  SceneModel queued;
+  if(queued_model(model, &queued)) return queued.orientation;
+  unsigned index;
+  if(!lookup_model(model, &index)) return quat();
+  return renderer_data->models.orientations[index];
+}
+
+void set_model_color(Model model, Color color)
+{
+  if(SceneModel *simulated = simulated_model(model)) { simulated->color = v4(color.r, color.g, color.b, color.a); return; }
+  if(queue_model_call(TRACE_SET_MODEL_COLOR, model, v4(color.r, color.g, color.b, color.a))) return;
+  trace_model_call(TRACE_SET_MODEL_COLOR, model, v4(color.r, color.g, color.b, color.a));
+  unsigned index;
+  if(!lookup_model(model, &index)) return;
+  renderer_data->models.blend_colors[index] = v4(color.r, color.g, color.b, color.a);
+  if(renderer_data->models.flags[index] & MODEL_FLAG_STATIC)
+  {
+    renderer_data->static_geometry_dirty = true;
+  }
+}
+
+void show_shadow_map_preview(bool show)
+{
+  if(queue_setting(TRACE_SHOW_SHADOW_MAP_PREVIEW, show)) return;
+  trace_setting(TRACE_SHOW_SHADOW_MAP_PREVIEW, show);
+  graph_enable_pass(&renderer_data->graph, renderer_data->shadow_map_preview_pass, show);
+}
+
+void set_shadow_map_resolution(unsigned resolution)
+{
+  assert(resolution > 0);
+  if(queue_setting(TRACE_SET_SHADOW_MAP_RESOLUTION, resolution)) return;
+  trace_setting(TRACE_SET_SHADOW_MAP_RESOLUTION, resolution);
+  if(renderer_data->shadow_settings.resolution == resolution) return;
+
+  // The shadow maps and their caches are made by build_render_graph
+  bool show_preview = renderer_data->graph.passes[renderer_data->shadow_map_preview_pass].enabled;
+  destroy_frame_textures();
+  renderer_data->shadow_settings.resolution = resolution;
+  build_render_graph();
+  graph_enable_pass(&renderer_data->graph, renderer_data->shadow_map_preview_pass, show_preview);
+}
+
+void set_occlusion_culling(bool enabled)
+{
+  if(queue_setting(TRACE_SET_OCCLUSION_CULLING, enabled)) return;
+  trace_setting(TRACE_SET_OCCLUSION_CULLING, enabled);
+  renderer_data->occlusion_culling = enabled;
+}
+
+unsigned get_render_pass_timings(RenderPassTiming *timings, unsigned max_timings)
+{
+  RenderGraph *graph = &renderer_data->graph;
+  unsigned count = graph->passes.size() < max_timings ? graph->passes.size() : max_timings;
+  for(unsigned i = 0; i < count; i++)
+  {
+    timings[i].name = graph->passes[i].name;
+    timings[i].milliseconds = graph->passes[i].milliseconds;
+    timings[i].culled = graph->passes[i].culled;
+  }
+  return graph->passes.size();
+}
+
+void set_camera_position(v3 position)
+{
+  if(SceneSnapshot *scene = simulation_scene()) { scene->camera_position = position; return; }
+  if(queue_camera_call(TRACE_SET_CAMERA_POSITION, position)) return;
+  trace_camera_call(TRACE_SET_CAMERA_POSITION, position);
+  renderer_data->camera.position = position;
+}
+
+v3 get_camera_position()
+{
+  if(SceneSnapshot *scene = simulation_scene()) return scene->camera_position;
+  v3 position, looking_direction;
+  if(queued_camera(&position, &looking_direction)) return position;
+  return renderer_data->camera.position;
+}
+
+
+void set_camera_looking_direction(v3 direction)
+{
+  if(SceneSnapshot *scene = simulation_scene()) { scene->camera_looking_direction = direction; return; }
+  if(queue_camera_call(TRACE_SET_CAMERA_LOOKING_DIRECTION, direction)) return;
+  trace_camera_call(TRACE_SET_CAMERA_LOOKING_DIRECTION, direction);
+  renderer_data->camera.looking_direction = direction;
+}
+
+v3 get_camera_looking_direction()
+{
+  if(SceneSnapshot *scene = simulation_scene()) return scene->camera_looking_direction;
+  v3 position, looking_direction;
+  if(queued_camera(&position, &looking_direction)) return looking_direction;
+  return renderer_data->camera.looking_direction;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Scene snapshots
+////////////////////////////////////////////////////////////////////////////////
+
+void capture_scene_snapshot(SceneSnapshot *snapshot)
+{
+  ModelStorage *models = &renderer_data->models;
+  snapshot->commands.clear();
+  snapshot->models.resize(models->slots.size());
+  for(unsigned slot = 0; slot < models->slots.size(); slot++)
+  {
+    SceneModel *model = &snapshot->models[slot];
+    Model handle;
+    handle.index = slot;
+    handle.generation = models->slots[slot].generation;
+    unsigned index = model_index(models, handle);
+
+    model->generation = handle.generation;
+    model->live = index != INVALID_MODEL_INDEX;
+    if(!model->live) continue;
+
+    model->movable = !(models->flags[index] & MODEL_FLAG_STATIC);
+    model->position = models->positions[index];
+    model->scale = models->scales[index];
+    model->orientation = models->orientations[index];
+    model->color = models->blend_colors[index];
+  }
+
+  snapshot->camera_position = renderer_data->camera.position;
+  snapshot->camera_looking_direction = renderer_data->camera.looking_direction;
+}
+
+void apply_scene_snapshot(const SceneSnapshot *snapshot, std::vector<Model> *free_models)
+{
+  // Made and destroyed models first, the snapshot already has them
+  run_scene_commands(snapshot->commands.data(), snapshot->commands.size());
+
+  ModelStorage *models = &renderer_data->models;
+  hand_out_free_models(models, snapshot, free_models);
+  for(unsigned slot = 0; slot < snapshot->models.size(); slot++)
+  {
+    const SceneModel *model = &snapshot->models[slot];
+    if(!model->live) continue;
+
+    Model handle;
+    handle.index = slot;
+    handle.generation = model->generation;
+    unsigned index = model_index(models, handle);
+    assert(index != INVALID_MODEL_INDEX && "Snapshot has a model the renderer doesn't");
+    if(index == INVALID_MODEL_INDEX) continue;
+
+    // Compared bitwise so only models that really moved rebuild their matrices
+    if(memcmp(&models->positions[index], &model->position, sizeof(v3)) ||
+       memcmp(&models->scales[index], &model->scale, sizeof(v3)) ||
+       memcmp(&models->orientations[index], &model->orientation, sizeof(quat)))
+    {
+      models->positions[index] = model->position;
+      models->scales[index] = model->scale;
+      models->orientations[index] = model->orientation;
+      mark_transform_dirty(models, index);
+    }
+
+    if(memcmp(&models->blend_colors[index], &model->color, sizeof(v4)))
+    {
+      models->blend_colors[index] = model->color;
+      if(models->flags[index] & MODEL_FLAG_STATIC) renderer_data->static_geometry_dirty = true;
+    }
+  }
+
+  renderer_data->camera.position = snapshot->camera_position;
+  renderer_data->camera.looking_direction = snapshot->camera_looking_direction;
+}
+
+void return_free_models(std::vector<Model> *free_models)
+{
+  take_back_free_models(&renderer_data->models, free_models);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Setup
+////////////////////////////////////////////////////////////////////////////////
+
+static void init_renderer_data()
+{
+  init_scene_commands();
+  renderer_data->aspect_ratio = (float)renderer_data->framebuffer_width / (float)renderer_data->framebuffer_height;
+  init_state_cache(&renderer_data->state, renderer_data->backend);
+
+  // Skybox
+  {
+    Mesh *mesh = &renderer_data->skybox_mesh;
+    mesh->vertices.resize(8);
+    mesh->indices.resize(36);
+    make_inward_cube_mesh(mesh->vertices.data(), mesh->indices.data());
+    mesh->fill_buffers();
+
+    renderer_data->skybox_texture.sort_id = ++renderer_data->num_texture_sort_ids;
+  }
+
+  // Screen quad for previewing render targets
+  {
+    Mesh *mesh = &renderer_data->quad_mesh;
+    mesh->vertices.resize(4);
+    mesh->indices.resize(6);
+    make_quad(mesh->vertices.data(), mesh->indices.data());
+    mesh->fill_buffers();
+
+    renderer_data->quad_texture.sort_id = ++renderer_data->num_texture_sort_ids;
+  }
+
+  renderer_data->light_camera.position = v3(1, 1, 1);
+  renderer_data->light_camera.looking_direction = -renderer_data->light_camera.position;
+
+  build_render_graph();
+}
+
+static void shutdown_renderer_data()
+{
+  RendererBackend *device = renderer_data->device;
+  shutdown_scene_commands();
+  destroy_frame_textures();
+
+  for(unsigned i = 0; i < renderer_data->loaded_meshes.size(); i++)
+  {
+    delete renderer_data->loaded_meshes[i].mesh;
+    delete renderer_data->loaded_meshes[i].debug_normals_mesh;
+  }
+
+  if(renderer_data->object_buffer)
+  {
+    device->destroy_buffer(renderer_data->object_buffer);
+  }
+
+  for(unsigned i = 0; i < renderer_data->mesh_arenas.size(); i++)
+  {
+    device->destroy_buffer(renderer_data->mesh_arenas[i].vertex_buffer);
+    device->destroy_buffer(renderer_data->mesh_arenas[i].index_buffer);
+  }
+
+  delete renderer_data;
+  renderer_data = 0;
+}
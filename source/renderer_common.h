@@ -0,0 +1,368 @@
+#pragma once
+
+#include "my_math.h" // v3, v4, mat4
+#include "graphics.h" // RenderStats
+#include "model_storage.h" // Model data
+#include "culling.h" // Bounds
+#include "bvh.h" // Culling hierarchy
+#include "render_queue.h" // Draw sorting
+#include "state_cache.h" // StateCache
+#include "command_buffer.h" // CommandBuffer, CommandRecorder, CommandBackend
+#include "instancing.h" // InstanceBatches
+#include "ring_allocator.h" // Per object data
+#include "static_geometry.h" // Merged static models, StaticVertex
+#include "tlsf_allocator.h" // Mesh arenas
+#include "render_graph.h" // Frame passes
+#include "shadow_cascades.h" // Shadow projections
+#include "occlusion.h" // Hidden model culling
+
+#include <string> // Loaded mesh names
+#include <vector>
+
+// The renderer both platforms share. renderer_common.cpp does the whole frame
+// on RendererData and reaches the graphics API through two interfaces: binds
+// and draws go through a CommandBackend, usually recorded first, and
+// everything else, buffers, render targets and presenting, through the
+// RendererBackend below. Each platform implements those, makes the shaders
+// and the skybox texture, and calls init_renderer_data and
+// shutdown_renderer_data around its own setup.
+//
+// Handles are opaque like the state cache's.
+
+// D3D11's values, the backends take them as they are
+static const unsigned TOPOLOGY_LINE_LIST = 2;
+static const unsigned TOPOLOGY_TRIANGLE_LIST = 4;
+
+static const float CAMERA_NEAR_PLANE = 0.5f;
+
+struct Camera
+{
+  v3 position = v3(0.0f, 1.0f, 5.0f);
+
+  v3 looking_direction = v3(0.0f, 0.0f, 1.0f);
+
+  float field_of_view = 60.0f;
+};
+
+// Matrices that are the same for every draw in a pass. Built once per pass
+// instead of once per mesh.
+struct PassMatrices
+{
+  mat4 view_m_world;
+  mat4 clip_m_view;
+  mat4 clip_m_world;
+};
+
+// What the state cache binds for a shader. The vertex shader reads its
+// constants from slot 0.
+struct Shader
+{
+  void *vertex_shader = 0;
+  void *pixel_shader = 0; // 0 for depth only
+  void *input_layout = 0;
+  void *constants = 0;
+
+  unsigned sort_id = 0;
+};
+
+struct Texture
+{
+  void *resource = 0;
+  void *sampler = 0;
+
+  unsigned sort_id = 0;
+};
+
+// Constant buffers, laid out like the cbuffers in the shaders
+
+// Camera and light data for shaders that read per object data from the
+// object ring. Uploaded once per pass.
+struct FrameConstants
+{
+  mat4 view_m_world;
+  mat4 clip_m_view;
+
+  mat4 light_clip_m_world[MAX_SHADOW_CASCADES];
+
+  v4 light_vector;
+
+  // x is the view depth the cascade ends at, y its depth bias
+  v4 cascade_params[MAX_SHADOW_CASCADES];
+  unsigned cascade_count;
+  unsigned padding[3];
+};
+
+struct DepthConstants
+{
+  mat4 clip_m_world;
+};
+
+struct SkyboxConstants
+{
+  mat4 world_m_model;
+  mat4 view_m_world;
+  mat4 clip_m_view;
+};
+
+// Everything in one buffer, only used by the screen quad now
+struct QuadConstants
+{
+  mat4 world_m_model;
+  mat4 view_m_world;
+  mat4 clip_m_view;
+
+  mat4 light_clip_m_world;
+
+  v4 color;
+  v4 light_vector;
+};
+
+struct Mesh
+{
+  typedef StaticVertex Vertex;
+  std::vector<Vertex> vertices;
+  std::vector<unsigned> indices;
+
+  // Model space bounds, filled in by normalize()
+  BoundingBox bounding_box;
+  BoundingSphere bounding_sphere;
+
+  // Where fill_buffers put the mesh in the shared mesh arenas. Draws pass the
+  // range offsets as base vertex and start index.
+  unsigned arena = TLSF_INVALID;
+  TlsfAllocation vertex_range;
+  TlsfAllocation index_range;
+
+  // Small id for render queue sort keys, assigned by fill_buffers
+  unsigned sort_id = 0;
+
+  void normalize();
+  void compute_vertex_normals();
+  void fill_buffers();
+  void clear_buffers();
+};
+
+// Default arena sizes, 8MB of vertices and 4MB of indices. Meshes that don't
+// fit anywhere get a new arena, sized up for them if they're bigger than this.
+static const unsigned MESH_ARENA_VERTICES = 1 << 18;
+static const unsigned MESH_ARENA_INDICES = 1 << 20;
+
+// One big vertex and index buffer that many meshes are suballocated from
+struct MeshArena
+{
+  void *vertex_buffer;
+  void *index_buffer;
+  TlsfAllocator vertices;
+  TlsfAllocator indices;
+};
+
+// A mesh loaded from a model file, shared by every model created from it
+struct LoadedMesh
+{
+  std::string file_name;
+  Mesh *mesh;
+  Mesh *debug_normals_mesh;
+  unsigned ref_count;
+};
+
+// What static geometry with the same material shares
+struct StaticMaterial
+{
+  Shader *shader;
+  Texture *texture;
+  v4 color;
+};
+
+// Render queue passes, drawn in this order
+enum RenderPass
+{
+  RENDER_PASS_SHADOW,
+  RENDER_PASS_MAIN,
+};
+
+// Passes are split into chunks of at least this many queue items, one per
+// worker, so small scenes don't pay for threads
+static const unsigned RECORD_CHUNK_MIN_ITEMS = 512;
+static const unsigned MAX_RECORD_CHUNKS = 8;
+
+// One worker's share of a pass. It records through its own state cache into
+// its own command buffer and instance data so workers share nothing.
+struct RecordChunk
+{
+  CommandBuffer commands;
+  CommandRecorder recorder;
+  StateCache state;
+  InstanceBatches batches;
+
+  // What the chunk's job records
+  RenderPass pass;
+  const unsigned *items;
+  unsigned count;
+};
+
+// What the frame needs from the graphics API besides binds, draws and
+// constant updates. Textures are the render graph's handles.
+struct RendererBackend
+{
+  virtual ~RendererBackend() {}
+
+  // Mesh arena buffers, written a range at a time as meshes are added
+  virtual void *create_mesh_buffer(unsigned bytes, bool indices) = 0;
+  virtual void write_mesh_buffer(void *buffer, unsigned offset, const void *data, unsigned bytes) = 0;
+
+  // The per object stream. Writes only go past what queued draws read, except
+  // the first after the ring wraps, which discards the old contents.
+  virtual void *create_object_buffer(unsigned bytes) = 0;
+  virtual void write_object_buffer(void *buffer, unsigned offset, const void *data, unsigned bytes, bool discard) = 0;
+
+  virtual void destroy_buffer(void *buffer) = 0;
+
+  // Views of a texture for binding, 0 where it wasn't made for that use
+  virtual void *target_view(void *texture) = 0;
+  virtual void *depth_view(void *texture) = 0;
+  virtual void *resource_view(void *texture) = 0;
+
+  // Right away, in order with the draws replayed so far
+  virtual void set_viewport(unsigned width, unsigned height) = 0;
+  virtual void clear_color(void *texture) = 0; // To the background color
+  virtual void clear_depth(void *texture) = 0; // To the far plane
+  virtual void copy_texture(void *destination, void *source) = 0;
+
+  // Finishes everything drawn so far, before textures it used are destroyed
+  virtual void flush() = 0;
+  virtual void present() = 0;
+};
+
+struct RendererData
+{
+  unsigned framebuffer_width;
+  unsigned framebuffer_height;
+  float aspect_ratio;
+
+  // Recorded commands are replayed into backend. Every bind goes through the
+  // state cache on the way.
+  RendererBackend *device = 0;
+  CommandBackend *backend = 0;
+  StateCache state;
+
+  // Whether the backend draws line lists, for the debug normals
+  bool draws_lines = false;
+
+  Shader diffuse_shader;
+  Shader flat_color_shader; // Debug normals
+  Shader depth_shader;
+  Shader skybox_shader;
+  Shader quad_shader;
+
+  // The diffuse and flat color shaders' constants, bound for the pixel shader too
+  void *frame_constants = 0;
+
+  // Depth tested and written for the scene, neither for the skybox
+  void *depth_state = 0;
+  void *no_depth_state = 0;
+
+  Mesh skybox_mesh;
+  Texture skybox_texture;
+
+  Mesh quad_mesh;
+  Texture quad_texture;
+
+  ModelStorage models;
+  Bvh bvh;
+  std::vector<BvhCullEntry> cull_stacks[MAX_SHADOW_CASCADES + 1]; // Camera, then each cascade
+
+  // Culling results, rebuilt every frame
+  std::vector<unsigned> visible_models;
+  std::vector<unsigned> visible_shadow_casters[MAX_SHADOW_CASCADES];
+  RenderStats stats;
+
+  RenderQueue render_queue;
+
+  // Commands and object data for the pass being drawn, merged from the chunks
+  // in order. The static chunk holds the merged static geometry's draws, the
+  // mesh chunk single draws like the skybox.
+  RecordChunk record_chunks[MAX_RECORD_CHUNKS];
+  RecordChunk static_chunk;
+  RecordChunk mesh_chunk;
+  CommandBuffer pass_commands;
+  std::vector<InstanceData> pass_objects;
+
+  // World matrix and color of every object drawn this frame. Read as the per
+  // instance stream, so a draw picks its object with the start instance.
+  void *object_buffer = 0;
+  RingAllocator object_ring;
+
+  // Static models merged into one mesh and split into cells. Rebuilt when a
+  // static model is created, destroyed or recolored.
+  StaticGeometry static_geometry;
+  Mesh static_mesh;
+  std::vector<StaticMaterial> static_materials;
+  std::vector<InstanceData> static_objects; // One per material
+  std::vector<unsigned> visible_static_batches;
+  std::vector<unsigned> visible_static_shadow_batches[MAX_SHADOW_CASCADES];
+  bool static_geometry_dirty = false;
+
+  // Camera occlusion, redrawn from the biggest visible things every frame
+  bool occlusion_culling = true;
+  OcclusionBuffer occlusion_buffer;
+  std::vector<Occluder> occluders;
+  std::vector<unsigned> occluder_models;
+  std::vector<unsigned char> occluder_flags; // By model index, only set while culling
+
+  // Models loaded from the same file share a mesh so they can be instanced
+  std::vector<LoadedMesh> loaded_meshes;
+
+  // Vertex and index buffers every mesh lives in
+  std::vector<MeshArena> mesh_arenas;
+
+  // Frame passes. The back and depth buffers are the platform's, imported.
+  // The pass matrices are filled in by prepare_frame for the passes to use.
+  RenderGraph graph;
+  RenderGraphBackend *graph_backend = 0;
+  unsigned depth_texture_format; // Shadow maps, in the graph backend's formats
+  void *back_buffer = 0;
+  void *depth_buffer = 0;
+  unsigned back_buffer_resource;
+  unsigned depth_buffer_resource;
+  unsigned shadow_map_preview_pass;
+  PassMatrices camera_pass;
+
+  // Shadow cascades, fit around the camera every frame. Each has its own
+  // depth only shadow map and caster lists.
+  ShadowCascadeSettings shadow_settings;
+  ShadowCascade cascades[MAX_SHADOW_CASCADES];
+  PassMatrices cascade_passes[MAX_SHADOW_CASCADES];
+  unsigned shadow_map_resources[MAX_SHADOW_CASCADES];
+  Texture shadow_map_textures[MAX_SHADOW_CASCADES];
+
+  // Static casters drawn from each cascade into their own depth target, only
+  // again when the cascade moves or a static caster changes. The shadow pass
+  // starts from a copy of them and adds the dynamic casters.
+  void *static_shadow_targets[MAX_SHADOW_CASCADES];
+  unsigned static_shadow_target_resources[MAX_SHADOW_CASCADES];
+  unsigned long long static_shadow_bytes;
+  mat4 static_shadow_clip_m_world[MAX_SHADOW_CASCADES];
+  bool static_shadows_dirty = true;
+
+  // Sort ids handed out so far. 0 is left for "none".
+  unsigned num_mesh_sort_ids = 0;
+  unsigned num_shader_sort_ids = 0;
+  unsigned num_texture_sort_ids = 0;
+
+  Camera camera;
+
+  v3 light_vector = v3(1.0f, 1.0f, 1.0f);
+  Camera light_camera;
+};
+
+static RendererData *renderer_data;
+
+// Called by the platform's init_renderer once the backends, framebuffer size,
+// shaders, frame constants, depth states, back and depth buffers and skybox
+// texture are set, and quad_texture's sampler, which the shadow maps share.
+// Makes the built in meshes and the render graph.
+static void init_renderer_data();
+
+// Frees what init_renderer_data and the frames made, through the backends,
+// then renderer_data itself. Call before releasing the device.
+static void shutdown_renderer_data();
@@ -0,0 +1,24 @@
+#include "ring_allocator.h"
+
+#include <assert.h>
+
+void init_ring_allocator(RingAllocator *ring, unsigned capacity)
+{
+  ring->capacity = capacity;
+  ring->head = 0;
+}
+
+unsigned ring_allocate(RingAllocator *ring, unsigned count, bool *restarted)
+{
+  assert(count <= ring->capacity);
+
+  if(ring->head + count > ring->capacity)
+  {
+    ring->head = 0;
+  }
+
+  unsigned offset = ring->head;
+  ring->head += count;
+  *restarted = offset == 0;
+  return offset;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+// Hands out space in a fixed size buffer front to back, wrapping to the start
+// when it runs out. Allocations never straddle the end. Offsets and sizes are
+// in whatever unit the caller uses (elements, bytes).
+struct RingAllocator
+{
+  unsigned capacity = 0;
+  unsigned head = 0;
+};
+
+void init_ring_allocator(RingAllocator *ring, unsigned capacity);
+
+// Returns the offset of count contiguous units. restarted is set when the
+// allocation is at the start of the buffer, meaning everything handed out
+// before can be thrown away (D3D11_MAP_WRITE_DISCARD). count must fit.
+unsigned ring_allocate(RingAllocator *ring, unsigned count, bool *restarted);
@@ -0,0 +1,554 @@
+#include "scene_commands.h"
+
+#include "frame_trace.h" // TraceCommand
+#include "frame_pipeline.h" // SceneModel, SceneSnapshot, world thread
+#include "model_storage.h" // Reserving slots
+
+#include <assert.h>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Most freed slots a thread holds on to for making models
+static const unsigned SCENE_QUEUE_FREE_SLOTS = 1024;
+
+// A model as this thread left it, until the published scene has its calls
+struct QueuedModel
+{
+  SceneModel model;
+  unsigned applied_by; // Sync that runs the last call on it
+};
+
+struct SceneCommandQueue
+{
+  // Only shared with the render thread taking the commands
+  std::mutex mutex;
+  std::vector<SceneCommand> commands;
+  unsigned taken_sync = 0; // Sync that last took the commands
+  bool abandoned = false; // Its thread is gone, dropped once the commands are taken
+
+  // Freed slots only this thread makes models in, topped up at each sync to
+  // the most it's made in a frame so slots get reused without a shared free list
+  std::vector<Model> free_models;
+  unsigned models_made = 0; // Since the last sync
+  unsigned most_models_made = 0;
+
+  // Only touched by the queue's thread
+  std::unordered_map<unsigned, QueuedModel> models; // By handle index
+  unsigned models_applied_by = 0; // Newest of the models'
+  v3 camera_position;
+  v3 camera_looking_direction;
+  unsigned camera_applied_by = 0;
+};
+
+// Lets the queue go when its thread exits
+struct ThreadCommandQueue
+{
+  std::shared_ptr<SceneCommandQueue> queue;
+
+  ~ThreadCommandQueue()
+  {
+    if(!queue) return;
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    queue->abandoned = true;
+  }
+};
+
+struct SceneCommands
+{
+  // Held to add a queue and while the render thread takes them
+  std::mutex mutex;
+  std::vector<std::shared_ptr<SceneCommandQueue>> queues;
+
+  unsigned sync = 0;
+  std::vector<SceneCommand> taken; // Render thread only
+  unsigned most_world_models_made = 0; // In one snapshot, render thread only
+
+  // The scene as of a sync, for getters on other threads. A copy is only
+  // rewritten once nothing is reading it, otherwise publishing waits a frame.
+  SceneSnapshot published[2];
+  unsigned published_sync[2] = {};
+  std::atomic<unsigned> published_index{0};
+  std::atomic<unsigned> published_readers[2];
+};
+
+static SceneCommands scene_commands;
+static thread_local bool thread_renders;
+static thread_local ThreadCommandQueue thread_command_queue;
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Render thread
+////////////////////////////////////////////////////////////////////////////////
+
+void init_scene_commands()
+{
+  thread_renders = true;
+  scene_commands.sync = 0;
+  scene_commands.published_index = 0;
+  scene_commands.most_world_models_made = 0;
+  for(unsigned i = 0; i < 2; i++)
+  {
+    scene_commands.published[i] = SceneSnapshot();
+    scene_commands.published_sync[i] = 0;
+    scene_commands.published_readers[i] = 0;
+  }
+}
+
+void shutdown_scene_commands()
+{
+  // Queues of threads still running are freed when those threads exit
+  std::lock_guard<std::mutex> lock(scene_commands.mutex);
+  scene_commands.queues.clear();
+  thread_renders = false;
+}
+
+// Moves freed slots into a thread's batch until it has wanted of them
+static void top_up_free_models(ModelStorage *storage, std::vector<Model> *free_models, unsigned wanted)
+{
+  if(wanted > SCENE_QUEUE_FREE_SLOTS) wanted = SCENE_QUEUE_FREE_SLOTS;
+  while(free_models->size() < wanted && storage->free_slots.size())
+  {
+    Model slot;
+    slot.index = storage->free_slots.back();
+    slot.generation = storage->slots[slot.index].generation;
+    free_models->push_back(slot);
+    storage->free_slots.pop_back();
+  }
+}
+
+static void publish_scene()
+{
+  unsigned next = 1 - scene_commands.published_index.load();
+  if(scene_commands.published_readers[next].load()) return;
+
+  capture_scene_snapshot(&scene_commands.published[next]);
+  scene_commands.published_sync[next] = scene_commands.sync;
+  scene_commands.published_index = next;
+}
+
+void sync_scene_commands(ModelStorage *storage)
+{
+  assert(thread_renders && !simulation_scene());
+
+  std::vector<SceneCommand> *taken = &scene_commands.taken;
+  bool other_threads;
+  {
+    std::lock_guard<std::mutex> lock(scene_commands.mutex);
+    scene_commands.sync++;
+
+    std::vector<std::shared_ptr<SceneCommandQueue>> *queues = &scene_commands.queues;
+    for(unsigned i = 0; i < queues->size();)
+    {
+      SceneCommandQueue *queue = (*queues)[i].get();
+      bool abandoned;
+      {
+        std::lock_guard<std::mutex> queue_lock(queue->mutex);
+        taken->insert(taken->end(), queue->commands.begin(), queue->commands.end());
+        queue->commands.clear();
+        queue->taken_sync = scene_commands.sync;
+        abandoned = queue->abandoned;
+
+        // Freed slots go back when the thread is gone
+        if(abandoned)
+        {
+          take_back_free_models(storage, &queue->free_models);
+        }
+        else
+        {
+          if(queue->models_made > queue->most_models_made) queue->most_models_made = queue->models_made;
+          top_up_free_models(storage, &queue->free_models, queue->most_models_made);
+        }
+        queue->models_made = 0;
+      }
+
+      if(abandoned)
+      {
+        (*queues)[i] = queues->back();
+        queues->pop_back();
+      }
+      else
+      {
+        i++;
+      }
+    }
+    other_threads = !queues->empty();
+  }
+
+  run_scene_commands(taken->data(), taken->size());
+  taken->clear();
+
+  // Only threads with a queue read the published scene, so a renderer only
+  // called from its own thread never copies it
+  if(other_threads) publish_scene();
+}
+
+void hand_out_free_models(ModelStorage *storage, const SceneSnapshot *snapshot, std::vector<Model> *free_models)
+{
+  assert(thread_renders && !simulation_scene());
+
+  unsigned made = 0;
+  for(unsigned i = 0; i < snapshot->commands.size(); i++)
+  {
+    unsigned type = snapshot->commands[i].type;
+    if(type == TRACE_CREATE_MODEL || type == TRACE_CREATE_STATIC_MODEL) made++;
+  }
+  if(made > scene_commands.most_world_models_made) scene_commands.most_world_models_made = made;
+
+  top_up_free_models(storage, free_models, scene_commands.most_world_models_made);
+}
+
+void take_back_free_models(ModelStorage *storage, std::vector<Model> *free_models)
+{
+  for(unsigned i = 0; i < free_models->size(); i++) storage->free_slots.push_back((*free_models)[i].index);
+  free_models->clear();
+}
+
+void run_scene_commands(const SceneCommand *commands, unsigned count)
+{
+  for(unsigned i = 0; i < count; i++)
+  {
+    const SceneCommand *command = &commands[i];
+    v3 value = v3(command->value.x, command->value.y, command->value.z);
+    switch(command->type)
+    {
+      case TRACE_CREATE_MODEL:
+      case TRACE_CREATE_STATIC_MODEL:   create_reserved_model(command); break;
+      case TRACE_DESTROY_MODEL:         destroy_model(command->model); break;
+
+      case TRACE_SET_MODEL_POSITION:    set_model_position(command->model, value);    break;
+      case TRACE_CHANGE_MODEL_POSITION: change_model_position(command->model, value); break;
+      case TRACE_SET_MODEL_SCALE:       set_model_scale(command->model, value);       break;
+      case TRACE_CHANGE_MODEL_SCALE:    change_model_scale(command->model, value);    break;
+      case TRACE_SET_MODEL_ROTATION:    set_model_rotation(command->model, value);    break;
+      case TRACE_CHANGE_MODEL_ROTATION: change_model_rotation(command->model, value); break;
+
+      case TRACE_SET_MODEL_ORIENTATION:
+      {
+        v4 orientation = command->value;
+        set_model_orientation(command->model, quat(orientation.x, orientation.y, orientation.z, orientation.w));
+        break;
+      }
+
+      case TRACE_SET_MODEL_COLOR:
+      {
+        v4 color = command->value;
+        set_model_color(command->model, Color(color.x, color.y, color.z, color.w));
+        break;
+      }
+
+      case TRACE_SHOW_SHADOW_MAP_PREVIEW:   show_shadow_map_preview(command->setting != 0);  break;
+      case TRACE_SET_SHADOW_MAP_RESOLUTION: set_shadow_map_resolution(command->setting);      break;
+      case TRACE_SET_OCCLUSION_CULLING:     set_occlusion_culling(command->setting != 0);    break;
+
+      case TRACE_SET_CAMERA_POSITION:          set_camera_position(value);          break;
+      case TRACE_SET_CAMERA_LOOKING_DIRECTION: set_camera_looking_direction(value); break;
+
+      default: assert(0 && "Unknown scene command"); break;
+    }
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Other threads
+////////////////////////////////////////////////////////////////////////////////
+
+// Calls on this thread are recorded instead of run. The world's thread is
+// checked first by the renderers for everything but the calls it sends along.
+static bool records_calls()
+{
+  return !thread_renders || simulation_scene();
+}
+
+static SceneCommandQueue *this_thread_queue()
+{
+  if(!thread_command_queue.queue)
+  {
+    thread_command_queue.queue = std::make_shared<SceneCommandQueue>();
+    std::lock_guard<std::mutex> lock(scene_commands.mutex);
+    scene_commands.queues.push_back(thread_command_queue.queue);
+  }
+  return thread_command_queue.queue.get();
+}
+
+// Holds the newest published scene so it isn't rewritten while read
+static unsigned lock_published_scene()
+{
+  for(;;)
+  {
+    unsigned index = scene_commands.published_index.load();
+    scene_commands.published_readers[index]++;
+    if(scene_commands.published_index.load() == index) return index;
+    scene_commands.published_readers[index]--;
+  }
+}
+
+static void unlock_published_scene(unsigned index)
+{
+  scene_commands.published_readers[index]--;
+}
+
+// The model as published, or as this thread left it if that's newer. False
+// when neither knows the slot.
+static bool find_model(SceneCommandQueue *queue, Model model, SceneModel *result)
+{
+  unsigned index = lock_published_scene();
+  const SceneSnapshot *published = &scene_commands.published[index];
+  unsigned published_sync = scene_commands.published_sync[index];
+
+  bool found = false;
+  std::unordered_map<unsigned, QueuedModel>::iterator queued = queue->models.find(model.index);
+  if(queued != queue->models.end() && queued->second.applied_by > published_sync)
+  {
+    *result = queued->second.model;
+    found = true;
+  }
+  else if(model.index < published->models.size())
+  {
+    *result = published->models[model.index];
+    found = true;
+  }
+
+  unlock_published_scene(index);
+  return found;
+}
+
+// This thread's copy of the model to change, under the queue's lock
+static SceneModel *touch_model(SceneCommandQueue *queue, Model model)
+{
+  // Once everything this thread queued is published its copies can go
+  unsigned index = lock_published_scene();
+  if(scene_commands.published_sync[index] >= queue->models_applied_by) queue->models.clear();
+  unlock_published_scene(index);
+
+  SceneModel current;
+  if(!find_model(queue, model, &current)) return 0;
+  assert(current.live && current.generation == model.generation && "Stale model handle");
+
+  QueuedModel *queued = &queue->models[model.index];
+  queued->model = current;
+  queued->applied_by = queue->taken_sync + 1;
+  queue->models_applied_by = queued->applied_by;
+  return &queued->model;
+}
+
+bool queue_create_model(unsigned command, ModelStorage *storage, Model *handle, const char *model_name, v3 position,
+                        v3 scale, v3 rotation)
+{
+  if(!records_calls()) return false;
+
+  // The world's thread has the batch the renderer handed back with its last
+  // snapshot, other threads the one in their queue
+  SceneSnapshot *scene = simulation_scene();
+  SceneCommandQueue *queue = scene ? 0 : this_thread_queue();
+  std::vector<Model> *free_models = scene ? simulation_free_models() : &queue->free_models;
+  std::unique_lock<std::mutex> lock;
+  if(queue)
+  {
+    lock = std::unique_lock<std::mutex>(queue->mutex);
+    queue->models_made++;
+  }
+
+  if(free_models && free_models->size())
+  {
+    *handle = free_models->back();
+    free_models->pop_back();
+  }
+  else
+  {
+    *handle = reserve_model(storage);
+  }
+
+  SceneCommand call = {};
+  call.type = command;
+  call.model = *handle;
+  call.value = v4(position.x, position.y, position.z, 0.0f);
+  call.model_name = model_name;
+  call.scale = scale;
+  call.rotation = rotation;
+
+  SceneModel model;
+  model.generation = handle->generation;
+  model.live = true;
+  model.movable = command == TRACE_CREATE_MODEL;
+  model.position = position;
+  model.scale = scale;
+  model.orientation = make_euler_quat(v3(deg_to_rad(rotation.x), deg_to_rad(rotation.y), deg_to_rad(rotation.z)));
+  model.color = v4(1.0f, 1.0f, 1.0f, 1.0f);
+
+  if(scene)
+  {
+    if(handle->index >= scene->models.size()) scene->models.resize(handle->index + 1);
+    scene->models[handle->index] = model;
+    scene->commands.push_back(call);
+    return true;
+  }
+
+  queue->commands.push_back(call);
+  QueuedModel *queued = &queue->models[handle->index];
+  queued->model = model;
+  queued->applied_by = queue->taken_sync + 1;
+  queue->models_applied_by = queued->applied_by;
+  return true;
+}
+
+bool queue_destroy_model(Model model)
+{
+  if(!records_calls()) return false;
+
+  SceneCommand call = {};
+  call.type = TRACE_DESTROY_MODEL;
+  call.model = model;
+
+  if(SceneSnapshot *scene = simulation_scene())
+  {
+    SceneModel *simulated = simulated_model(model);
+    simulated->live = false;
+    simulated->generation++;
+    scene->commands.push_back(call);
+    return true;
+  }
+
+  SceneCommandQueue *queue = this_thread_queue();
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  queue->commands.push_back(call);
+  if(SceneModel *touched = touch_model(queue, model))
+  {
+    touched->live = false;
+    touched->generation++;
+  }
+  return true;
+}
+
+bool queue_model_call(unsigned command, Model model, v3 value)
+{
+  return queue_model_call(command, model, v4(value.x, value.y, value.z, 0.0f));
+}
+
+bool queue_model_call(unsigned command, Model model, v4 value)
+{
+  if(!records_calls()) return false;
+  assert(!simulation_scene() && "The world's thread changes its own scene");
+
+  SceneCommand call = {};
+  call.type = command;
+  call.model = model;
+  call.value = value;
+
+  SceneCommandQueue *queue = this_thread_queue();
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  queue->commands.push_back(call);
+
+  // Models made on other threads and not added yet are left to the renderer
+  SceneModel *touched = touch_model(queue, model);
+  if(!touched) return true;
+
+  assert((command == TRACE_SET_MODEL_COLOR || touched->movable) && "Static models can't move");
+  v3 vector = v3(value.x, value.y, value.z);
+  quat *orientation = &touched->orientation;
+  switch(command)
+  {
+    case TRACE_SET_MODEL_POSITION:    touched->position = vector;  break;
+    case TRACE_CHANGE_MODEL_POSITION: touched->position += vector; break;
+    case TRACE_SET_MODEL_SCALE:       touched->scale = vector;     break;
+    case TRACE_CHANGE_MODEL_SCALE:    touched->scale += vector;    break;
+
+    case TRACE_SET_MODEL_ROTATION:
+    case TRACE_CHANGE_MODEL_ROTATION:
+    {
+      quat rotation = make_euler_quat(v3(deg_to_rad(vector.x), deg_to_rad(vector.y), deg_to_rad(vector.z)));
+      *orientation = command == TRACE_SET_MODEL_ROTATION ? rotation : unit(rotation * *orientation);
+      break;
+    }
+
+    case TRACE_SET_MODEL_ORIENTATION: *orientation = unit(quat(value.x, value.y, value.z, value.w)); break;
+    case TRACE_SET_MODEL_COLOR:       touched->color = value; break;
+  }
+  return true;
+}
+
+bool queue_setting(unsigned command, unsigned value)
+{
+  if(!records_calls()) return false;
+
+  SceneCommand call = {};
+  call.type = command;
+  call.setting = value;
+
+  if(SceneSnapshot *scene = simulation_scene())
+  {
+    scene->commands.push_back(call);
+    return true;
+  }
+
+  SceneCommandQueue *queue = this_thread_queue();
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  queue->commands.push_back(call);
+  return true;
+}
+
+bool queue_camera_call(unsigned command, v3 value)
+{
+  if(!records_calls()) return false;
+  assert(!simulation_scene() && "The world's thread changes its own scene");
+
+  SceneCommand call = {};
+  call.type = command;
+  call.value = v4(value.x, value.y, value.z, 0.0f);
+
+  SceneCommandQueue *queue = this_thread_queue();
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  queue->commands.push_back(call);
+
+  queued_camera(&queue->camera_position, &queue->camera_looking_direction);
+  queue->camera_applied_by = queue->taken_sync + 1;
+  if(command == TRACE_SET_CAMERA_POSITION) queue->camera_position = value;
+  else queue->camera_looking_direction = value;
+  return true;
+}
+
+bool queued_model(Model model, SceneModel *result)
+{
+  if(!records_calls()) return false;
+  assert(!simulation_scene() && "The world's thread reads its own scene");
+
+  bool found = find_model(this_thread_queue(), model, result);
+  assert(found && result->live && result->generation == model.generation && "Stale model handle");
+  if(!found) *result = SceneModel();
+  return true;
+}
+
+bool queued_model_valid(Model model, bool *valid)
+{
+  if(!records_calls()) return false;
+  assert(!simulation_scene() && "The world's thread reads its own scene");
+
+  SceneModel current;
+  *valid = find_model(this_thread_queue(), model, &current) && current.live && current.generation == model.generation;
+  return true;
+}
+
+bool queued_camera(v3 *position, v3 *looking_direction)
+{
+  if(!records_calls()) return false;
+  assert(!simulation_scene() && "The world's thread reads its own scene");
+
+  SceneCommandQueue *queue = this_thread_queue();
+  unsigned index = lock_published_scene();
+  if(queue->camera_applied_by > scene_commands.published_sync[index])
+  {
+    *position = queue->camera_position;
+    *looking_direction = queue->camera_looking_direction;
+  }
+  else
+  {
+    *position = scene_commands.published[index].camera_position;
+    *looking_direction = scene_commands.published[index].camera_looking_direction;
+  }
+  unlock_published_scene(index);
+  return true;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "my_math.h" // v3, v4
+#include "graphics.h" // Model
+
+#include <vector>
+
+// Makes graphics.h safe to call from any thread.
+//
+// The thread that made the renderer runs its calls right away. Every other
+// thread records its calls into a command queue of its own, and the renderer
+// runs them at the start of the next render(), in the order each thread made
+// them. A queue is only locked against the renderer taking it, so threads
+// never wait on each other. Calls from different threads are run in no
+// particular order between them.
+//
+// create_model hands out the handle straight away, from a batch of freed slots
+// the thread was given at the last render() or else a new slot. The thread
+// that made the model can use it right away, other threads after the next
+// render(). The world's thread gets its batch back with each snapshot the
+// renderer applies instead.
+//
+// Getters on other threads see the scene as of the last render(), with that
+// thread's own queued calls on top. The scene is only published while some
+// other thread has made a call, so a thread's first getters can see it as of
+// an older render() until the next one.
+//
+// The world's thread in frame_pipeline.h doesn't queue. Its changes to models
+// and the camera land in its scene, and only the calls that can't, like making
+// models or changing settings, go with the snapshot as commands.
+
+struct SceneModel;
+struct SceneSnapshot;
+struct ModelStorage;
+
+struct SceneCommand
+{
+  unsigned type; // TraceCommand of the call
+  Model model;
+  v4 value; // The v3 or v4 argument, v3s in xyz
+  unsigned setting;
+
+  // Making models. The name has to stay alive as long as the model, the same
+  // as when it's made on the render thread.
+  const char *model_name;
+  v3 scale;
+  v3 rotation;
+};
+
+// Called by the renderers on the render thread
+void init_scene_commands();
+void shutdown_scene_commands();
+
+// Called by the renderers at the start of render(). Runs every queued call,
+// hands out freed slots for making models and publishes the scene for other
+// threads' getters, when there are any.
+void sync_scene_commands(ModelStorage *storage);
+
+// Called by the renderers as they apply a snapshot from the world's thread.
+// Tops up free_models with freed slots for the world to make models in, as
+// many as it has made in one snapshot so far.
+void hand_out_free_models(ModelStorage *storage, const SceneSnapshot *snapshot, std::vector<Model> *free_models);
+
+// Frees the slots of a batch that won't be used, and empties it
+void take_back_free_models(ModelStorage *storage, std::vector<Model> *free_models);
+
+// Runs recorded calls on the render thread
+void run_scene_commands(const SceneCommand *commands, unsigned count);
+
+// Implemented by the renderers. Makes the model a create command stands for in
+// the slot it reserved.
+void create_reserved_model(const SceneCommand *command);
+
+// Called by the renderers at the top of the graphics.h calls. Off the render
+// thread they record the call and return true, and the renderer does nothing
+// else. The model and camera ones are reached after the world thread's scene
+// is checked.
+bool queue_create_model(unsigned command, ModelStorage *storage, Model *handle, const char *model_name, v3 position,
+                        v3 scale, v3 rotation);
+bool queue_destroy_model(Model model);
+bool queue_model_call(unsigned command, Model model, v3 value);
+bool queue_model_call(unsigned command, Model model, v4 value);
+bool queue_setting(unsigned command, unsigned value);
+bool queue_camera_call(unsigned command, v3 value);
+
+// What this thread sees of a model, off the render thread. Asserts on stale
+// handles.
+bool queued_model(Model model, SceneModel *result);
+bool queued_model_valid(Model model, bool *valid);
+bool queued_camera(v3 *position, v3 *looking_direction);
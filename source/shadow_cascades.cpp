@@ -0,0 +1,110 @@
+#include "shadow_cascades.h"
+
+#include <assert.h>
+#include <math.h> // tan, pow, floor
+
+void compute_cascade_splits(unsigned count, float near_distance, float far_distance, float lambda, float *splits)
+{
+  assert(count > 0 && near_distance > 0.0f && far_distance > near_distance);
+
+  for(unsigned i = 0; i <= count; i++)
+  {
+    float t = (float)i / (float)count;
+    float logarithmic = near_distance * (float)pow(far_distance / near_distance, t);
+    float uniform = near_distance + (far_distance - near_distance) * t;
+    splits[i] = lambda * logarithmic + (1.0f - lambda) * uniform;
+  }
+
+  // Exact ends so the slices cover the whole range
+  splits[0] = near_distance;
+  splits[count] = far_distance;
+}
+
+// Rotation from world space to a space looking down -z along direction, same
+// basis as the renderer's view matrix
+static mat4 make_light_rotation(v3 direction)
+{
+  v3 back = -unit(direction);
+  v3 right = cross(v3(0.0f, 1.0f, 0.0f), back);
+  if(length(right) == 0.0f) right = v3(1.0f, 0.0f, 0.0f);
+  right = unit(right);
+  v3 up = unit(cross(back, right));
+
+  return mat4(right.x, right.y, right.z, 0.0f,
+              up.x,    up.y,    up.z,    0.0f,
+              back.x,  back.y,  back.z,  0.0f,
+              0.0f,    0.0f,    0.0f,    1.0f);
+}
+
+void fit_shadow_cascades(const ShadowCascadeSettings *settings, v3 camera_position, v3 camera_direction, float fov,
+                         float aspect_ratio, float near_plane, v3 light_direction, ShadowCascade *cascades)
+{
+  assert(settings->count > 0 && settings->count <= MAX_SHADOW_CASCADES);
+
+  float splits[MAX_SHADOW_CASCADES + 1];
+  compute_cascade_splits(settings->count, near_plane, settings->max_distance, settings->split_lambda, splits);
+
+  // Squared distance of a slice corner from the view axis, per unit of depth
+  float tan_y = (float)tan(fov / 2.0f);
+  float tan_x = tan_y * aspect_ratio;
+  float spread_squared = tan_x * tan_x + tan_y * tan_y;
+
+  v3 forward = unit(camera_direction);
+  mat4 light_m_world = make_light_rotation(light_direction);
+
+  for(unsigned i = 0; i < settings->count; i++)
+  {
+    ShadowCascade *cascade = &cascades[i];
+    float n = splits[i];
+    float f = splits[i + 1];
+    cascade->near_distance = n;
+    cascade->far_distance = f;
+
+    // Smallest sphere on the view axis through the near and far corners. Its
+    // size only depends on the slice, where the camera is and points only
+    // moves its center.
+    float center_distance = 0.5f * (n + f) * (1.0f + spread_squared);
+    float radius;
+    if(center_distance >= f)
+    {
+      center_distance = f;
+      radius = f * (float)sqrt(spread_squared);
+    }
+    else
+    {
+      float to_far = f - center_distance;
+      radius = (float)sqrt(to_far * to_far + f * f * spread_squared);
+    }
+
+    float half_size = radius * (1.0f + settings->cache_margin);
+    float texel_size = 2.0f * half_size / (float)settings->resolution;
+    cascade->texel_size = texel_size;
+
+    // Snap the center to the nearest step in light space, depth included. Each
+    // step is whole texels and at most twice the margin, so the sphere is
+    // still inside.
+    float step_texels = (float)floor(2.0f * radius * settings->cache_margin / texel_size);
+    float step = (step_texels > 1.0f ? step_texels : 1.0f) * texel_size;
+    v3 center = camera_position + forward * center_distance;
+    v4 light_center = light_m_world * v4(center, 1.0f);
+    float x = (float)floor(light_center.x / step + 0.5f) * step;
+    float y = (float)floor(light_center.y / step + 0.5f) * step;
+    float z = (float)floor(light_center.z / step + 0.5f) * step + half_size + settings->caster_distance;
+
+    mat4 translate = mat4(1.0f, 0.0f, 0.0f, -x,
+                          0.0f, 1.0f, 0.0f, -y,
+                          0.0f, 0.0f, 1.0f, -z,
+                          0.0f, 0.0f, 0.0f, 1.0f);
+    cascade->view_m_world = translate * light_m_world;
+
+    // Orthographic, depth 0 at the eye to 1 past the far side of the sphere
+    float depth = 2.0f * half_size + settings->caster_distance;
+    cascade->clip_m_view = mat4(1.0f / half_size, 0.0f,             0.0f,          0.0f,
+                                0.0f,             1.0f / half_size, 0.0f,          0.0f,
+                                0.0f,             0.0f,             -1.0f / depth, 0.0f,
+                                0.0f,             0.0f,             0.0f,          1.0f);
+    cascade->depth_bias = 2.0f * texel_size / depth;
+
+    cascade->clip_m_world = cascade->clip_m_view * cascade->view_m_world;
+  }
+}
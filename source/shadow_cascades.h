@@ -0,0 +1,59 @@
+#pragma once
+
+#include "my_math.h" // v3, mat4
+
+// Cascaded shadow maps for a directional light. The camera's view is split
+// into depth slices and each slice gets its own orthographic light projection,
+// so nearby shadows get more texels than faraway ones.
+
+static const unsigned MAX_SHADOW_CASCADES = 4;
+
+struct ShadowCascadeSettings
+{
+  unsigned count = 4;
+  unsigned resolution = 512; // Texels along each side of one cascade's map
+
+  // How far from the camera shadows reach
+  float max_distance = 1000.0f;
+
+  // Blend between uniform splits (0) and logarithmic splits (1)
+  float split_lambda = 0.75f;
+
+  // How far past a cascade toward the light casters are still caught
+  float caster_distance = 500.0f;
+
+  // Extra room around each slice, as a fraction of its radius. A cascade only
+  // moves once its slice leaves that room, so the static casters cached for it
+  // stay valid while the camera moves. 0 moves it with every texel.
+  float cache_margin = 0.25f;
+};
+
+struct ShadowCascade
+{
+  // Distance along the camera's view direction this cascade covers
+  float near_distance;
+  float far_distance;
+
+  mat4 view_m_world;
+  mat4 clip_m_view;
+  mat4 clip_m_world;
+
+  // World space size of one shadow map texel
+  float texel_size;
+
+  // Offset in shadow map depth to compare against so surfaces don't shadow
+  // themselves. Two texels' worth of depth.
+  float depth_bias;
+};
+
+// Fills splits[0..count] with the distance of each slice boundary
+void compute_cascade_splits(unsigned count, float near_distance, float far_distance, float lambda, float *splits);
+
+// Fits a light projection around each slice of the camera's view. Each slice
+// is wrapped in a sphere so the projection's size doesn't change as the
+// camera turns. The projection and its depth range move in steps of whole
+// texels, as big as the cache margin allows, so shadow edges don't shimmer and
+// the projection stays the same for as long as the slice fits. fov is
+// vertical, in radians.
+void fit_shadow_cascades(const ShadowCascadeSettings *settings, v3 camera_position, v3 camera_direction, float fov,
+                         float aspect_ratio, float near_plane, v3 light_direction, ShadowCascade *cascades);
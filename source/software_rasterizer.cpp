@@ -0,0 +1,796 @@
+#include "software_rasterizer.h"
+
+#include "static_geometry.h" // StaticVertex
+#include "instancing.h" // InstanceData
+#include "job_system.h" // Parallel tiles
+
+#include <assert.h>
+#include <math.h> // floor, ceil
+#include <string.h> // memcpy
+#include <algorithm> // std::fill, std::copy
+#include <atomic>
+#include <emmintrin.h> // SSE2
+
+// Floats each program passes from its vertex shader to its pixel shader
+static const unsigned program_varyings[] =
+{
+  0,  // Depth
+  10, // Diffuse: world position, normal, color
+  3,  // Skybox: model position
+  2,  // Quad: texture coordinates
+};
+
+static unsigned round_up(unsigned value, unsigned multiple)
+{
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+void init_soft_texture(SoftTexture *texture, unsigned format, unsigned width, unsigned height, unsigned faces)
+{
+  texture->format = format;
+  texture->width = width;
+  texture->height = height;
+  texture->faces = faces;
+  texture->stride = round_up(width, SOFT_BLOCK_SIZE);
+  texture->rows = round_up(height, SOFT_BLOCK_SIZE);
+
+  unsigned texels = texture->stride * texture->rows * faces;
+  if(format == SOFT_FORMAT_DEPTH)
+  {
+    assert(faces == 1);
+    texture->color.clear();
+    texture->depth.assign(texels, 1.0f);
+    texture->block_max_depth.assign(texels / (SOFT_BLOCK_SIZE * SOFT_BLOCK_SIZE), 1.0f);
+  }
+  else
+  {
+    texture->color.assign(texels, 0);
+    texture->depth.clear();
+    texture->block_max_depth.clear();
+  }
+
+  SampleTexture *sampler = &texture->sampler;
+  *sampler = SampleTexture();
+  sampler->format = format == SOFT_FORMAT_DEPTH ? SAMPLE_FORMAT_R32F : SAMPLE_FORMAT_RGBA8;
+  sampler->faces = faces;
+  for(unsigned face = 0; face < faces; face++)
+  {
+    unsigned first = face * texture->stride * texture->rows;
+    const void *texels = format == SOFT_FORMAT_DEPTH ? (const void *)&texture->depth[first] : (const void *)&texture->color[first];
+    set_sample_image(sampler, face, 0, texels, width, height, texture->stride);
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Programs
+////////////////////////////////////////////////////////////////////////////////
+
+static v3 instance_transform(const InstanceData *instance, v4 p)
+{
+  return v3(dot(instance->world_m_model[0], p), dot(instance->world_m_model[1], p), dot(instance->world_m_model[2], p));
+}
+
+// Model, or world for instanced programs, to clip space for a draw
+static mat4 program_clip_matrix(const SoftDraw *draw)
+{
+  switch(draw->program)
+  {
+    case SOFT_PROGRAM_DEPTH: return ((const SoftDepthConstants *)draw->constants)->clip_m_world;
+    case SOFT_PROGRAM_DIFFUSE:
+    {
+      const SoftFrameConstants *constants = (const SoftFrameConstants *)draw->constants;
+      return constants->clip_m_view * constants->view_m_world;
+    }
+    case SOFT_PROGRAM_SKYBOX:
+    {
+      const SoftSkyboxConstants *constants = (const SoftSkyboxConstants *)draw->constants;
+      return constants->clip_m_view * constants->view_m_world * constants->world_m_model;
+    }
+    case SOFT_PROGRAM_QUAD:
+    {
+      const SoftQuadConstants *constants = (const SoftQuadConstants *)draw->constants;
+      return constants->clip_m_view * constants->view_m_world * constants->world_m_model;
+    }
+  }
+
+  assert(false && "Unknown program");
+  return mat4();
+}
+
+static void shade_vertex(const SoftDraw *draw, const mat4 &clip_matrix, const StaticVertex *vertex, const InstanceData *instance,
+                         SoftVertex *out)
+{
+  v4 position = v4(vertex->position, 1.0f);
+  switch(draw->program)
+  {
+    case SOFT_PROGRAM_DEPTH:
+    {
+      out->position = clip_matrix * v4(instance_transform(instance, position), 1.0f);
+      break;
+    }
+
+    case SOFT_PROGRAM_DIFFUSE:
+    {
+      v3 world = instance_transform(instance, position);
+      v3 normal = unit(instance_transform(instance, v4(vertex->normal, 0.0f)));
+      out->position = clip_matrix * v4(world, 1.0f);
+      out->varyings[0] = world.x;
+      out->varyings[1] = world.y;
+      out->varyings[2] = world.z;
+      out->varyings[3] = normal.x;
+      out->varyings[4] = normal.y;
+      out->varyings[5] = normal.z;
+      out->varyings[6] = instance->color.x;
+      out->varyings[7] = instance->color.y;
+      out->varyings[8] = instance->color.z;
+      out->varyings[9] = instance->color.w;
+      break;
+    }
+
+    case SOFT_PROGRAM_SKYBOX:
+    {
+      out->position = clip_matrix * position;
+      out->varyings[0] = vertex->position.x;
+      out->varyings[1] = vertex->position.y;
+      out->varyings[2] = vertex->position.z;
+      break;
+    }
+
+    case SOFT_PROGRAM_QUAD:
+    {
+      out->position = clip_matrix * position;
+      out->varyings[0] = vertex->uv.x;
+      out->varyings[1] = vertex->uv.y;
+      break;
+    }
+  }
+}
+
+static __m128 blend_lanes(__m128 mask, __m128 a, __m128 b)
+{
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// Row of a matrix times (x, y, z, 1) for each lane
+static __m128 transform_row(const mat4 &m, unsigned row, const __m128 *position)
+{
+  __m128 result = _mm_set1_ps(m[row][3]);
+  result = _mm_add_ps(result, _mm_mul_ps(_mm_set1_ps(m[row][0]), position[0]));
+  result = _mm_add_ps(result, _mm_mul_ps(_mm_set1_ps(m[row][1]), position[1]));
+  return _mm_add_ps(result, _mm_mul_ps(_mm_set1_ps(m[row][2]), position[2]));
+}
+
+// Pixel shader for four pixels, varyings[i] holding varying i of each lane
+static SampleColors shade_pixels(const SoftDraw *draw, const __m128 *varyings)
+{
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 half = _mm_set1_ps(0.5f);
+
+  switch(draw->program)
+  {
+    case SOFT_PROGRAM_DIFFUSE:
+    {
+      const SoftFrameConstants *constants = (const SoftFrameConstants *)draw->constants;
+      const __m128 *world = varyings;
+      const __m128 *normal = varyings + 3;
+      const __m128 *color = varyings + 6;
+
+      // Nearest cascade that reaches this far
+      __m128 view_depth = _mm_sub_ps(zero, transform_row(constants->view_m_world, 2, world));
+      __m128 cascade = zero;
+      for(unsigned i = 0; i < 3; i++)
+      {
+        if(i + 1 >= constants->cascade_count) break;
+        __m128 farther = _mm_cmpgt_ps(view_depth, _mm_set1_ps(constants->cascade_params[i].x));
+        cascade = blend_lanes(farther, _mm_set1_ps((float)(i + 1)), cascade);
+      }
+
+      // Each cascade in use is looked up for every lane and kept where it's the lane's
+      __m128 shadowed = zero;
+      for(unsigned i = 0; i < constants->cascade_count && i < 4; i++)
+      {
+        __m128 in_cascade = _mm_cmpeq_ps(cascade, _mm_set1_ps((float)i));
+        const SoftTexture *shadow_map = draw->textures[1 + i];
+        if(!shadow_map || !_mm_movemask_ps(in_cascade)) continue;
+
+        const mat4 &light_clip_m_world = constants->light_clip_m_world[i];
+        __m128 inv_w = _mm_div_ps(one, transform_row(light_clip_m_world, 3, world));
+        __m128 light_tex_x = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(transform_row(light_clip_m_world, 0, world), inv_w), half), half);
+        __m128 light_tex_y = _mm_sub_ps(half, _mm_mul_ps(_mm_mul_ps(transform_row(light_clip_m_world, 1, world), inv_w), half));
+        __m128 camera_depth = _mm_sub_ps(_mm_mul_ps(transform_row(light_clip_m_world, 2, world), inv_w),
+                                         _mm_set1_ps(constants->cascade_params[i].y));
+
+        __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(light_tex_x, zero), _mm_cmple_ps(light_tex_x, one)),
+                                   _mm_and_ps(_mm_cmpge_ps(light_tex_y, zero), _mm_cmple_ps(light_tex_y, one)));
+        __m128 light_depth = sample_2d(&shadow_map->sampler, SAMPLE_FILTER_BILINEAR, light_tex_x, light_tex_y, zero).r;
+        __m128 occluded = _mm_and_ps(_mm_and_ps(in_cascade, inside), _mm_cmplt_ps(light_depth, camera_depth));
+        shadowed = _mm_or_ps(shadowed, occluded);
+      }
+
+      v3 light_vector = unit(v3(constants->light_vector.x, constants->light_vector.y, constants->light_vector.z));
+      __m128 intensity = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(light_vector.x), normal[0]),
+                                    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(light_vector.y), normal[1]),
+                                               _mm_mul_ps(_mm_set1_ps(light_vector.z), normal[2])));
+      intensity = _mm_mul_ps(intensity, blend_lanes(shadowed, _mm_set1_ps(0.2f), one));
+
+      SampleColors result;
+      result.r = _mm_mul_ps(color[0], intensity);
+      result.g = _mm_mul_ps(color[1], intensity);
+      result.b = _mm_mul_ps(color[2], intensity);
+      result.a = color[3];
+      return result;
+    }
+
+    case SOFT_PROGRAM_SKYBOX:
+    {
+      if(!draw->textures[0]) break;
+      return sample_cube(&draw->textures[0]->sampler, SAMPLE_FILTER_BILINEAR, varyings[0], varyings[1], varyings[2], zero);
+    }
+
+    case SOFT_PROGRAM_QUAD:
+    {
+      const SoftQuadConstants *constants = (const SoftQuadConstants *)draw->constants;
+      SampleColors result;
+      result.r = _mm_set1_ps(constants->color.x);
+      result.g = _mm_set1_ps(constants->color.y);
+      result.b = _mm_set1_ps(constants->color.z);
+      result.a = _mm_set1_ps(constants->color.w);
+      if(!draw->textures[0]) return result;
+
+      SampleColors texel = sample_2d(&draw->textures[0]->sampler, SAMPLE_FILTER_BILINEAR, varyings[0], varyings[1], zero);
+      result.r = _mm_mul_ps(result.r, texel.r);
+      result.g = _mm_mul_ps(result.g, texel.g);
+      result.b = _mm_mul_ps(result.b, texel.b);
+      result.a = _mm_mul_ps(result.a, texel.a);
+      return result;
+    }
+  }
+
+  SampleColors result = {zero, zero, zero, zero};
+  return result;
+}
+
+// Clamped to 0..1 and rounded to RGBA8, one texel per lane
+static __m128i pack_colors(const SampleColors &color)
+{
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 scale = _mm_set1_ps(255.0f);
+  const __m128 half = _mm_set1_ps(0.5f);
+
+  // max first so NaN becomes 0
+  __m128i r = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(color.r, zero), one), scale), half));
+  __m128i g = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(color.g, zero), one), scale), half));
+  __m128i b = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(color.b, zero), one), scale), half));
+  __m128i a = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(color.a, zero), one), scale), half));
+  return _mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 8)), _mm_or_si128(_mm_slli_epi32(b, 16), _mm_slli_epi32(a, 24)));
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Setup and binning
+////////////////////////////////////////////////////////////////////////////////
+
+static SoftTexture *draw_target(const SoftDraw *draw)
+{
+  return draw->color_target ? draw->color_target : draw->depth_target;
+}
+
+static void bin_triangle(SoftwareRasterizer *rasterizer, unsigned draw_index, const SoftVertex *v0, const SoftVertex *v1,
+                         const SoftVertex *v2)
+{
+  const SoftDraw *draw = &rasterizer->draws[draw_index];
+  const SoftTexture *target = draw_target(draw);
+  float width = (float)target->width;
+  float height = (float)target->height;
+
+  // Screen space, snapped to 1/16 pixel so shared edges line up
+  const SoftVertex *vertices[3] = {v0, v1, v2};
+  float x[3], y[3], z[3], inv_w[3];
+  for(unsigned i = 0; i < 3; i++)
+  {
+    inv_w[i] = 1.0f / vertices[i]->position.w;
+    float sx = (vertices[i]->position.x * inv_w[i] * 0.5f + 0.5f) * width;
+    float sy = (0.5f - vertices[i]->position.y * inv_w[i] * 0.5f) * height;
+    x[i] = (float)floor(sx * 16.0f + 0.5f) / 16.0f;
+    y[i] = (float)floor(sy * 16.0f + 0.5f) / 16.0f;
+    z[i] = vertices[i]->position.z * inv_w[i];
+  }
+
+  // Front faces are counter clockwise like the D3D11 rasterizer state. With y
+  // pointing down they come out negative here. Back faces are dropped.
+  float area = -((x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]));
+  if(area <= 0.0f) return;
+
+  int min_x = (int)ceil(minf(x[0], minf(x[1], x[2])) - 0.5f);
+  int min_y = (int)ceil(minf(y[0], minf(y[1], y[2])) - 0.5f);
+  int max_x = (int)floor(maxf(x[0], maxf(x[1], x[2])) - 0.5f);
+  int max_y = (int)floor(maxf(y[0], maxf(y[1], y[2])) - 0.5f);
+  if(min_x < 0) min_x = 0;
+  if(min_y < 0) min_y = 0;
+  if(max_x > (int)target->width - 1) max_x = target->width - 1;
+  if(max_y > (int)target->height - 1) max_y = target->height - 1;
+  if(min_x > max_x || min_y > max_y) return;
+
+  rasterizer->triangles.push_back(SoftTriangle());
+  SoftTriangle *triangle = &rasterizer->triangles.back();
+  triangle->draw = draw_index;
+  triangle->min_x = min_x;
+  triangle->min_y = min_y;
+  triangle->max_x = max_x;
+  triangle->max_y = max_y;
+
+  // Edge i is opposite vertex i and its function is that vertex's barycentric
+  // weight times the area
+  triangle->top_left = 0;
+  float inv_area = 1.0f / area;
+  for(unsigned i = 0; i < 3; i++)
+  {
+    unsigned j = (i + 1) % 3;
+    unsigned k = (i + 2) % 3;
+    float a = y[k] - y[j];
+    float b = x[j] - x[k];
+    triangle->edge_a[i] = a;
+    triangle->edge_b[i] = b;
+    triangle->edge_x[i] = x[j];
+    triangle->edge_y[i] = y[j];
+
+    // Pixels exactly on an edge belong to the triangle on its right or below
+    if(a > 0.0f || (a == 0.0f && b > 0.0f)) triangle->top_left |= 1 << i;
+  }
+
+  triangle->origin_x = x[0];
+  triangle->origin_y = y[0];
+
+  const float *a = triangle->edge_a;
+  const float *b = triangle->edge_b;
+  triangle->z = z[0];
+  triangle->z_dx = (z[0] * a[0] + z[1] * a[1] + z[2] * a[2]) * inv_area;
+  triangle->z_dy = (z[0] * b[0] + z[1] * b[1] + z[2] * b[2]) * inv_area;
+  triangle->min_z = minf(z[0], minf(z[1], z[2]));
+
+  triangle->inv_w = inv_w[0];
+  triangle->inv_w_dx = (inv_w[0] * a[0] + inv_w[1] * a[1] + inv_w[2] * a[2]) * inv_area;
+  triangle->inv_w_dy = (inv_w[0] * b[0] + inv_w[1] * b[1] + inv_w[2] * b[2]) * inv_area;
+
+  for(unsigned i = 0; i < draw->varying_count; i++)
+  {
+    float f0 = v0->varyings[i] * inv_w[0];
+    float f1 = v1->varyings[i] * inv_w[1];
+    float f2 = v2->varyings[i] * inv_w[2];
+    triangle->varyings[i] = f0;
+    triangle->varyings_dx[i] = (f0 * a[0] + f1 * a[1] + f2 * a[2]) * inv_area;
+    triangle->varyings_dy[i] = (f0 * b[0] + f1 * b[1] + f2 * b[2]) * inv_area;
+  }
+
+  unsigned triangle_index = rasterizer->triangles.size() - 1;
+  for(int tile_y = min_y / (int)SOFT_TILE_SIZE; tile_y <= max_y / (int)SOFT_TILE_SIZE; tile_y++)
+  {
+    for(int tile_x = min_x / (int)SOFT_TILE_SIZE; tile_x <= max_x / (int)SOFT_TILE_SIZE; tile_x++)
+    {
+      rasterizer->bins[tile_y * rasterizer->tiles_x + tile_x].push_back(triangle_index);
+    }
+  }
+  rasterizer->triangles_binned++;
+}
+
+// Distance inside the near (z >= 0) or far (z <= w) plane
+static float clip_distance(const SoftVertex *vertex, unsigned plane)
+{
+  return plane == 0 ? vertex->position.z : vertex->position.w - vertex->position.z;
+}
+
+static unsigned clip_polygon(const SoftVertex *in, unsigned count, unsigned plane, unsigned varying_count, SoftVertex *out)
+{
+  unsigned out_count = 0;
+  for(unsigned i = 0; i < count; i++)
+  {
+    const SoftVertex *a = &in[i];
+    const SoftVertex *b = &in[(i + 1) % count];
+    float da = clip_distance(a, plane);
+    float db = clip_distance(b, plane);
+
+    if(da >= 0.0f) out[out_count++] = *a;
+    if((da >= 0.0f) != (db >= 0.0f))
+    {
+      float t = da / (da - db);
+      SoftVertex *v = &out[out_count++];
+      v->position = a->position + (b->position - a->position) * t;
+      for(unsigned j = 0; j < varying_count; j++)
+      {
+        v->varyings[j] = a->varyings[j] + (b->varyings[j] - a->varyings[j]) * t;
+      }
+    }
+  }
+  return out_count;
+}
+
+static unsigned outcode(const v4 &p)
+{
+  return (p.x < -p.w) | ((p.x > p.w) << 1) | ((p.y < -p.w) << 2) | ((p.y > p.w) << 3) | ((p.z < 0.0f) << 4) | ((p.z > p.w) << 5);
+}
+
+static void clip_and_bin(SoftwareRasterizer *rasterizer, unsigned draw_index, const SoftVertex *v0, const SoftVertex *v1,
+                         const SoftVertex *v2)
+{
+  unsigned code0 = outcode(v0->position);
+  unsigned code1 = outcode(v1->position);
+  unsigned code2 = outcode(v2->position);
+  if(code0 & code1 & code2) return; // All outside one plane
+
+  // Only depth is clipped, x and y are left to the bounding box
+  const unsigned DEPTH_CODES = (1 << 4) | (1 << 5);
+  if(!((code0 | code1 | code2) & DEPTH_CODES))
+  {
+    bin_triangle(rasterizer, draw_index, v0, v1, v2);
+    return;
+  }
+
+  unsigned varying_count = rasterizer->draws[draw_index].varying_count;
+  SoftVertex polygon[5];
+  SoftVertex clipped[5];
+  polygon[0] = *v0;
+  polygon[1] = *v1;
+  polygon[2] = *v2;
+  unsigned count = clip_polygon(polygon, 3, 0, varying_count, clipped);
+  count = clip_polygon(clipped, count, 1, varying_count, polygon);
+
+  for(unsigned i = 2; i < count; i++)
+  {
+    bin_triangle(rasterizer, draw_index, &polygon[0], &polygon[i - 1], &polygon[i]);
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Backend
+////////////////////////////////////////////////////////////////////////////////
+
+void SoftwareRasterizer::set_vertex_buffer(unsigned slot, void *buffer, unsigned stride)
+{
+  assert(slot < 2);
+  vertex_buffers[slot] = (SoftBuffer *)buffer;
+  vertex_strides[slot] = stride;
+}
+
+void SoftwareRasterizer::set_index_buffer(void *buffer) { index_buffer = (SoftBuffer *)buffer; }
+void SoftwareRasterizer::set_vertex_shader(void *shader) { vertex_shader = (SoftShader *)shader; }
+void SoftwareRasterizer::set_pixel_shader(void *shader) { pixel_shader = (SoftShader *)shader; }
+
+void SoftwareRasterizer::set_vs_constant_buffer(unsigned slot, void *buffer)
+{
+  assert(slot == 0);
+  vs_constants = (SoftBuffer *)buffer;
+}
+
+void SoftwareRasterizer::set_ps_resource(unsigned slot, void *resource)
+{
+  assert(slot < 5);
+  resources[slot] = (SoftTexture *)resource;
+}
+
+void SoftwareRasterizer::set_depth_stencil_state(void *state) { depth_state = (SoftDepthState *)state; }
+
+// Draws copy their constants when they're binned, so rewriting is safe
+void SoftwareRasterizer::update_buffer(void *buffer, const void *data, unsigned size)
+{
+  SoftBuffer *target = (SoftBuffer *)buffer;
+  target->data.resize(size);
+  memcpy(target->data.data(), data, size);
+}
+
+void SoftwareRasterizer::set_render_target(void *render_target, void *depth_stencil)
+{
+  if(render_target == color_target && depth_stencil == depth_target) return;
+
+  // Binned triangles belong to the old targets
+  soft_flush(this);
+  color_target = (SoftTexture *)render_target;
+  depth_target = (SoftTexture *)depth_stencil;
+
+  SoftTexture *target = color_target ? color_target : depth_target;
+  if(!target) return;
+  assert(!color_target || !depth_target || (color_target->width == depth_target->width && color_target->height == depth_target->height));
+
+  tiles_x = (target->width + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+  tiles_y = (target->height + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+  if(bins.size() < tiles_x * tiles_y) bins.resize(tiles_x * tiles_y);
+}
+
+void SoftwareRasterizer::draw_indexed(unsigned index_count, unsigned instance_count, unsigned first_index, unsigned base_vertex,
+                                      unsigned first_instance)
+{
+  assert(vertex_shader && vertex_buffers[0] && index_buffer && vs_constants);
+  assert(color_target || depth_target);
+
+  SoftDraw draw;
+  draw.program = vertex_shader->program;
+  draw.color_write = pixel_shader && color_target;
+  draw.depth_test = depth_state && depth_state->test && depth_target;
+  draw.depth_write = depth_state && depth_state->write && depth_target;
+  draw.varying_count = program_varyings[draw.program];
+  draw.color_target = color_target;
+  draw.depth_target = depth_target;
+  for(unsigned i = 0; i < 5; i++) draw.textures[i] = resources[i];
+
+  unsigned constant_bytes = vs_constants->data.size() < sizeof(draw.constants) ? vs_constants->data.size() : sizeof(draw.constants);
+  memcpy(draw.constants, vs_constants->data.data(), constant_bytes);
+
+  if(!draw.color_write && !draw.depth_write) return;
+  draws.push_back(draw);
+  unsigned draw_index = draws.size() - 1;
+
+  // Only the vertices the draw uses are shaded
+  const unsigned *indices = (const unsigned *)index_buffer->data.data() + first_index;
+  unsigned min_index = 0xFFFFFFFF;
+  unsigned max_index = 0;
+  for(unsigned i = 0; i < index_count; i++)
+  {
+    if(indices[i] < min_index) min_index = indices[i];
+    if(indices[i] > max_index) max_index = indices[i];
+  }
+  if(min_index > max_index) return;
+
+  mat4 clip_matrix = program_clip_matrix(&draw);
+  bool instanced = draw.program == SOFT_PROGRAM_DEPTH || draw.program == SOFT_PROGRAM_DIFFUSE;
+  const unsigned char *vertices = vertex_buffers[0]->data.data() + (base_vertex + min_index) * vertex_strides[0];
+  shaded.resize(max_index - min_index + 1);
+
+  for(unsigned instance = 0; instance < instance_count; instance++)
+  {
+    const InstanceData *instance_data = 0;
+    if(instanced)
+    {
+      assert(vertex_buffers[1]);
+      instance_data = (const InstanceData *)(vertex_buffers[1]->data.data() + (first_instance + instance) * vertex_strides[1]);
+    }
+
+    for(unsigned i = 0; i < shaded.size(); i++)
+    {
+      shade_vertex(&draws[draw_index], clip_matrix, (const StaticVertex *)(vertices + i * vertex_strides[0]), instance_data, &shaded[i]);
+    }
+
+    for(unsigned i = 0; i + 2 < index_count; i += 3)
+    {
+      clip_and_bin(this, draw_index, &shaded[indices[i] - min_index], &shaded[indices[i + 1] - min_index],
+                   &shaded[indices[i + 2] - min_index]);
+    }
+  }
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Rasterizing
+////////////////////////////////////////////////////////////////////////////////
+
+static float block_max(const float *depth, unsigned stride)
+{
+  __m128 result = _mm_loadu_ps(depth);
+  for(unsigned row = 0; row < SOFT_BLOCK_SIZE; row++)
+  {
+    result = _mm_max_ps(result, _mm_loadu_ps(depth + row * stride));
+    result = _mm_max_ps(result, _mm_loadu_ps(depth + row * stride + 4));
+  }
+  result = _mm_max_ps(result, _mm_shuffle_ps(result, result, _MM_SHUFFLE(1, 0, 3, 2)));
+  result = _mm_max_ps(result, _mm_shuffle_ps(result, result, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtss_f32(result);
+}
+
+// One 8x8 block of a triangle. Returns false when the hierarchical depth test
+// threw the block away.
+static bool rasterize_block(const SoftTriangle *triangle, const SoftDraw *draw, unsigned block_x, unsigned block_y)
+{
+  const float step = (float)(SOFT_BLOCK_SIZE - 1);
+  float center_x = (float)block_x + 0.5f;
+  float center_y = (float)block_y + 0.5f;
+
+  // Edges at the block's first pixel, dropping blocks entirely outside one
+  float edge[3];
+  for(unsigned i = 0; i < 3; i++)
+  {
+    float a = triangle->edge_a[i];
+    float b = triangle->edge_b[i];
+    edge[i] = a * (center_x - triangle->edge_x[i]) + b * (center_y - triangle->edge_y[i]);
+    if(edge[i] + maxf(a * step, 0.0f) + maxf(b * step, 0.0f) < 0.0f) return true;
+  }
+
+  float dx = center_x - triangle->origin_x;
+  float dy = center_y - triangle->origin_y;
+  float z = triangle->z + triangle->z_dx * dx + triangle->z_dy * dy;
+
+  // Nothing in the block can pass if the triangle's nearest point is behind
+  // everything already there
+  SoftTexture *depth_target = draw->depth_target;
+  if(draw->depth_test)
+  {
+    unsigned blocks_x = depth_target->stride / SOFT_BLOCK_SIZE;
+    float farthest = depth_target->block_max_depth[(block_y / SOFT_BLOCK_SIZE) * blocks_x + block_x / SOFT_BLOCK_SIZE];
+    float nearest = maxf(triangle->min_z, z + minf(triangle->z_dx * step, 0.0f) + minf(triangle->z_dy * step, 0.0f));
+    if(nearest >= farthest) return false;
+  }
+
+  const __m128 lane = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+  const __m128 zero = _mm_setzero_ps();
+  __m128 edge_a[3], edge_b[3], top_left[3];
+  for(unsigned i = 0; i < 3; i++)
+  {
+    edge_a[i] = _mm_set1_ps(triangle->edge_a[i]);
+    edge_b[i] = _mm_set1_ps(triangle->edge_b[i]);
+    top_left[i] = _mm_castsi128_ps(_mm_set1_epi32((triangle->top_left >> i) & 1 ? -1 : 0));
+  }
+  __m128 z_dx = _mm_set1_ps(triangle->z_dx);
+
+  SoftTexture *color_target = draw->color_target;
+  unsigned stride = draw_target(draw)->stride;
+  bool wrote_depth = false;
+
+  for(unsigned row = 0; row < SOFT_BLOCK_SIZE; row++)
+  {
+    for(unsigned half = 0; half < SOFT_BLOCK_SIZE; half += 4)
+    {
+      __m128 x = _mm_add_ps(lane, _mm_set1_ps((float)half));
+      __m128 y = _mm_set1_ps((float)row);
+
+      __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+      for(unsigned i = 0; i < 3; i++)
+      {
+        __m128 e = _mm_add_ps(_mm_set1_ps(edge[i]), _mm_add_ps(_mm_mul_ps(edge_a[i], x), _mm_mul_ps(edge_b[i], y)));
+        __m128 covered = _mm_or_ps(_mm_cmpgt_ps(e, zero), _mm_and_ps(_mm_cmpeq_ps(e, zero), top_left[i]));
+        inside = _mm_and_ps(inside, covered);
+      }
+      if(!_mm_movemask_ps(inside)) continue;
+
+      unsigned pixel = (block_y + row) * stride + block_x + half;
+      __m128 depth = _mm_add_ps(_mm_set1_ps(z + triangle->z_dy * (float)row), _mm_mul_ps(z_dx, x));
+      if(draw->depth_test)
+      {
+        inside = _mm_and_ps(inside, _mm_cmplt_ps(depth, _mm_loadu_ps(&depth_target->depth[pixel])));
+      }
+
+      if(!_mm_movemask_ps(inside)) continue;
+
+      if(draw->color_write)
+      {
+        __m128 px = _mm_add_ps(_mm_set1_ps(dx), x);
+        __m128 py = _mm_set1_ps(dy + (float)row);
+        __m128 w = _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(_mm_set1_ps(triangle->inv_w),
+                                                            _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle->inv_w_dx), px),
+                                                                       _mm_mul_ps(_mm_set1_ps(triangle->inv_w_dy), py))));
+        __m128 varyings[12];
+        for(unsigned j = 0; j < draw->varying_count; j++)
+        {
+          __m128 v = _mm_add_ps(_mm_set1_ps(triangle->varyings[j]), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle->varyings_dx[j]), px),
+                                                                               _mm_mul_ps(_mm_set1_ps(triangle->varyings_dy[j]), py)));
+          varyings[j] = _mm_mul_ps(v, w);
+        }
+
+        __m128i colors = pack_colors(shade_pixels(draw, varyings));
+        __m128i covered = _mm_castps_si128(inside);
+        __m128i *target = (__m128i *)&color_target->color[pixel];
+        __m128i old_colors = _mm_loadu_si128(target);
+        _mm_storeu_si128(target, _mm_or_si128(_mm_and_si128(covered, colors), _mm_andnot_si128(covered, old_colors)));
+      }
+
+      if(draw->depth_write)
+      {
+        float *target = &depth_target->depth[pixel];
+        __m128 old_depth = _mm_loadu_ps(target);
+        _mm_storeu_ps(target, _mm_or_ps(_mm_and_ps(inside, depth), _mm_andnot_ps(inside, old_depth)));
+        wrote_depth = true;
+      }
+    }
+  }
+
+  if(wrote_depth)
+  {
+    unsigned blocks_x = depth_target->stride / SOFT_BLOCK_SIZE;
+    depth_target->block_max_depth[(block_y / SOFT_BLOCK_SIZE) * blocks_x + block_x / SOFT_BLOCK_SIZE] =
+      block_max(&depth_target->depth[block_y * depth_target->stride + block_x], depth_target->stride);
+  }
+
+  return true;
+}
+
+static void rasterize_tile(SoftwareRasterizer *rasterizer, unsigned tile, unsigned long long *blocks_rejected)
+{
+  int tile_x = (tile % rasterizer->tiles_x) * SOFT_TILE_SIZE;
+  int tile_y = (tile / rasterizer->tiles_x) * SOFT_TILE_SIZE;
+
+  const std::vector<unsigned> *bin = &rasterizer->bins[tile];
+  for(unsigned i = 0; i < bin->size(); i++)
+  {
+    const SoftTriangle *triangle = &rasterizer->triangles[(*bin)[i]];
+    const SoftDraw *draw = &rasterizer->draws[triangle->draw];
+
+    int min_x = triangle->min_x > tile_x ? triangle->min_x : tile_x;
+    int min_y = triangle->min_y > tile_y ? triangle->min_y : tile_y;
+    int max_x = triangle->max_x < tile_x + (int)SOFT_TILE_SIZE - 1 ? triangle->max_x : tile_x + SOFT_TILE_SIZE - 1;
+    int max_y = triangle->max_y < tile_y + (int)SOFT_TILE_SIZE - 1 ? triangle->max_y : tile_y + SOFT_TILE_SIZE - 1;
+
+    for(int block_y = min_y & ~(SOFT_BLOCK_SIZE - 1); block_y <= max_y; block_y += SOFT_BLOCK_SIZE)
+    {
+      for(int block_x = min_x & ~(SOFT_BLOCK_SIZE - 1); block_x <= max_x; block_x += SOFT_BLOCK_SIZE)
+      {
+        if(!rasterize_block(triangle, draw, block_x, block_y)) (*blocks_rejected)++;
+      }
+    }
+  }
+}
+
+struct TileWork
+{
+  SoftwareRasterizer *rasterizer;
+  const std::vector<unsigned> *tiles;
+  std::atomic<unsigned long long> blocks_rejected;
+};
+
+static void rasterize_tiles(void *data, unsigned first, unsigned end)
+{
+  TileWork *work = (TileWork *)data;
+  unsigned long long blocks_rejected = 0;
+  for(unsigned i = first; i < end; i++)
+  {
+    rasterize_tile(work->rasterizer, (*work->tiles)[i], &blocks_rejected);
+  }
+  work->blocks_rejected += blocks_rejected;
+}
+
+void soft_flush(SoftwareRasterizer *rasterizer)
+{
+  std::vector<unsigned> tiles;
+  for(unsigned i = 0; i < rasterizer->bins.size(); i++)
+  {
+    if(!rasterizer->bins[i].empty()) tiles.push_back(i);
+  }
+
+  if(!tiles.empty())
+  {
+    // Tiles don't share pixels so each is drawn start to finish by one job
+    TileWork work;
+    work.rasterizer = rasterizer;
+    work.tiles = &tiles;
+    work.blocks_rejected = 0;
+    parallel_for(tiles.size(), 1, rasterize_tiles, &work);
+    rasterizer->blocks_rejected += work.blocks_rejected;
+
+    for(unsigned i = 0; i < tiles.size(); i++)
+    {
+      rasterizer->bins[tiles[i]].clear();
+    }
+  }
+
+  rasterizer->triangles.clear();
+  rasterizer->draws.clear();
+}
+
+void soft_clear_color(SoftwareRasterizer *rasterizer, SoftTexture *target, v4 color)
+{
+  soft_flush(rasterizer);
+  assert(target->format == SOFT_FORMAT_RGBA8);
+  SampleColors packed = {_mm_set1_ps(color.x), _mm_set1_ps(color.y), _mm_set1_ps(color.z), _mm_set1_ps(color.w)};
+  std::fill(target->color.begin(), target->color.end(), (unsigned)_mm_cvtsi128_si32(pack_colors(packed)));
+}
+
+void soft_clear_depth(SoftwareRasterizer *rasterizer, SoftTexture *target, float depth)
+{
+  soft_flush(rasterizer);
+  assert(target->format == SOFT_FORMAT_DEPTH);
+  std::fill(target->depth.begin(), target->depth.end(), depth);
+  std::fill(target->block_max_depth.begin(), target->block_max_depth.end(), depth);
+}
+
+void soft_copy_texture(SoftwareRasterizer *rasterizer, SoftTexture *destination, const SoftTexture *source)
+{
+  soft_flush(rasterizer);
+  assert(destination->format == source->format && destination->width == source->width && destination->height == source->height);
+  // Copied in place so the destination's sampler still points at its texels
+  std::copy(source->color.begin(), source->color.end(), destination->color.begin());
+  std::copy(source->depth.begin(), source->depth.end(), destination->depth.begin());
+  std::copy(source->block_max_depth.begin(), source->block_max_depth.end(), destination->block_max_depth.begin());
+}
@@ -0,0 +1,205 @@
+#pragma once
+
+#include "my_math.h" // mat4, v4
+#include "command_buffer.h" // CommandBackend
+#include "texture_sampling.h" // SampleTexture
+
+#include <vector>
+
+// Draws on the CPU what the D3D11 renderer draws on the GPU, for headless
+// captures. Recorded commands replay into it like into any other backend.
+//
+// Draws are shaded and binned into screen tiles as they arrive. Tiles are
+// rasterized in parallel when the render target changes or on soft_flush, with
+// SSE edge functions and an 8x8 block max depth to throw away hidden work
+// before it's shaded.
+//
+// Handles are the Soft* structs below. The shaders in shaders/ are ported as
+// fixed programs reading the same constant buffer layouts. Vertices are always
+// StaticVertex in slot 0 and InstanceData in slot 1. Pixels are shaded four at
+// a time through texture_sampling. Every sampler is linear with clamping,
+// which is all the shaders that sample need.
+
+static const unsigned SOFT_TILE_SIZE = 64;
+static const unsigned SOFT_BLOCK_SIZE = 8; // Hierarchical depth granularity
+
+enum SoftProgram
+{
+  SOFT_PROGRAM_DEPTH,   // depth.vs, no pixel shader
+  SOFT_PROGRAM_DIFFUSE, // diffuse.vs and diffuse.ps
+  SOFT_PROGRAM_SKYBOX,  // skybox.vs and skybox.ps
+  SOFT_PROGRAM_QUAD,    // quad.vs and quad.ps
+};
+
+// Constant buffers, laid out like the cbuffers in the shaders
+struct SoftFrameConstants
+{
+  mat4 view_m_world;
+  mat4 clip_m_view;
+  mat4 light_clip_m_world[4];
+  v4 light_vector;
+  v4 cascade_params[4]; // x is the view depth the cascade ends at, y its depth bias
+  unsigned cascade_count;
+  unsigned padding[3];
+};
+
+struct SoftDepthConstants
+{
+  mat4 clip_m_world;
+};
+
+struct SoftSkyboxConstants
+{
+  mat4 world_m_model;
+  mat4 view_m_world;
+  mat4 clip_m_view;
+};
+
+struct SoftQuadConstants
+{
+  mat4 world_m_model;
+  mat4 view_m_world;
+  mat4 clip_m_view;
+  mat4 light_clip_m_world;
+  v4 color;
+  v4 light_vector;
+};
+
+// Vertex, index, instance and constant buffers
+struct SoftBuffer
+{
+  std::vector<unsigned char> data;
+};
+
+struct SoftShader
+{
+  unsigned program;
+};
+
+struct SoftDepthState
+{
+  bool test; // Less than
+  bool write;
+};
+
+enum SoftFormat
+{
+  SOFT_FORMAT_RGBA8, // Same byte order as stb_image loads
+  SOFT_FORMAT_DEPTH,
+};
+
+// Render target or shader resource. Rows are padded to whole depth blocks.
+// Cube maps are six faces one after another in D3D11 order, +x -x +y -y +z -z.
+struct SoftTexture
+{
+  unsigned format;
+  unsigned width;
+  unsigned height;
+  unsigned faces;
+  unsigned stride; // Texels per row
+  unsigned rows;
+
+  std::vector<unsigned> color;
+  std::vector<float> depth;
+
+  // Farthest depth in each block, never nearer than what is in the block
+  std::vector<float> block_max_depth;
+
+  SampleTexture sampler; // Views of color or depth for the pixel shaders
+};
+
+void init_soft_texture(SoftTexture *texture, unsigned format, unsigned width, unsigned height, unsigned faces = 1);
+
+struct SoftVertex
+{
+  v4 position; // Clip space
+  float varyings[12];
+};
+
+// Everything a triangle needs from the draw it came from
+struct SoftDraw
+{
+  unsigned program;
+  bool color_write;
+  bool depth_test;
+  bool depth_write;
+  unsigned varying_count;
+
+  SoftTexture *color_target;
+  SoftTexture *depth_target;
+  SoftTexture *textures[5];
+
+  // Copied at draw time since buffers are rewritten before the flush
+  unsigned char constants[sizeof(SoftFrameConstants)];
+};
+
+// Screen space setup. Edge functions are positive inside and are evaluated
+// relative to a vertex to keep precision on big screens. Varyings are divided
+// by w so they interpolate linearly across the screen.
+struct SoftTriangle
+{
+  unsigned draw;
+  int min_x, min_y, max_x, max_y; // Inclusive pixels
+
+  float edge_a[3], edge_b[3];
+  float edge_x[3], edge_y[3]; // Point on each edge
+  unsigned top_left; // Bit per edge
+
+  float origin_x, origin_y; // First vertex, the planes are relative to it
+  float z, z_dx, z_dy;
+  float min_z;
+  float inv_w, inv_w_dx, inv_w_dy;
+  float varyings[12], varyings_dx[12], varyings_dy[12];
+};
+
+struct SoftwareRasterizer : CommandBackend
+{
+  // Bound state
+  SoftBuffer *vertex_buffers[2] = {};
+  unsigned vertex_strides[2] = {};
+  SoftBuffer *index_buffer = 0;
+  SoftShader *vertex_shader = 0;
+  SoftShader *pixel_shader = 0;
+  SoftBuffer *vs_constants = 0;
+  SoftTexture *resources[5] = {};
+  SoftDepthState *depth_state = 0;
+  SoftTexture *color_target = 0;
+  SoftTexture *depth_target = 0;
+
+  // Work waiting for the next flush
+  std::vector<SoftDraw> draws;
+  std::vector<SoftTriangle> triangles;
+  std::vector<std::vector<unsigned>> bins; // Triangle indices per tile, in draw order
+  unsigned tiles_x = 0;
+  unsigned tiles_y = 0;
+
+  std::vector<SoftVertex> shaded; // Scratch for the draw being set up
+
+  // Counts since the rasterizer was made
+  unsigned long long triangles_binned = 0;
+  unsigned long long blocks_rejected = 0; // By the hierarchical depth test
+
+  void set_vertex_buffer(unsigned slot, void *buffer, unsigned stride);
+  void set_index_buffer(void *buffer);
+  void set_topology(unsigned) {} // Triangle lists only
+  void set_input_layout(void *) {}
+  void set_vertex_shader(void *shader);
+  void set_pixel_shader(void *shader);
+  void set_vs_constant_buffer(unsigned slot, void *buffer);
+  void set_ps_constant_buffer(unsigned, void *) {} // Shaders share the vertex shader's buffer
+  void set_ps_resource(unsigned slot, void *resource);
+  void set_ps_sampler(unsigned, void *) {}
+  void set_depth_stencil_state(void *state);
+  void set_render_target(void *render_target, void *depth_stencil);
+  void update_buffer(void *buffer, const void *data, unsigned size);
+  void draw_indexed(unsigned index_count, unsigned instance_count, unsigned first_index, unsigned base_vertex,
+                    unsigned first_instance);
+};
+
+// Rasterizes everything binned so far. Targets can be read after this.
+void soft_flush(SoftwareRasterizer *rasterizer);
+
+// These flush first, like the device context calls they stand in for
+void soft_clear_color(SoftwareRasterizer *rasterizer, SoftTexture *target, v4 color);
+void soft_clear_depth(SoftwareRasterizer *rasterizer, SoftTexture *target, float depth);
+void soft_copy_texture(SoftwareRasterizer *rasterizer, SoftTexture *destination, const SoftTexture *source);
@@ -0,0 +1,149 @@
+#include "state_cache.h"
+
+#include <assert.h>
+
+// Never a real handle
+static void *const UNKNOWN_HANDLE = (void *)~(unsigned long long)0;
+static const unsigned UNKNOWN_VALUE = 0xFFFFFFFF;
+
+void init_state_cache(StateCache *cache, StateBackend *backend)
+{
+  cache->backend = backend;
+  reset_state_cache(cache);
+  cache->stats = StateCacheStats();
+}
+
+static void forget_shader_resources(StateCache *cache)
+{
+  for(unsigned i = 0; i < STATE_CACHE_MAX_SLOTS; i++)
+  {
+    cache->ps_resources[i] = UNKNOWN_HANDLE;
+  }
+}
+
+void reset_state_cache(StateCache *cache)
+{
+  cache->index_buffer = UNKNOWN_HANDLE;
+  cache->topology = UNKNOWN_VALUE;
+  cache->input_layout = UNKNOWN_HANDLE;
+  cache->vertex_shader = UNKNOWN_HANDLE;
+  cache->pixel_shader = UNKNOWN_HANDLE;
+  for(unsigned i = 0; i < STATE_CACHE_MAX_SLOTS; i++)
+  {
+    cache->vertex_buffers[i] = UNKNOWN_HANDLE;
+    cache->vertex_strides[i] = UNKNOWN_VALUE;
+    cache->vs_constant_buffers[i] = UNKNOWN_HANDLE;
+    cache->ps_constant_buffers[i] = UNKNOWN_HANDLE;
+    cache->ps_samplers[i] = UNKNOWN_HANDLE;
+  }
+  forget_shader_resources(cache);
+  cache->depth_stencil_state = UNKNOWN_HANDLE;
+  cache->render_target = UNKNOWN_HANDLE;
+  cache->depth_stencil = UNKNOWN_HANDLE;
+}
+
+// Returns true if the call should be forwarded
+static bool changed(StateCache *cache, void **bound, void *value)
+{
+  if(*bound == value)
+  {
+    cache->stats.redundant++;
+    return false;
+  }
+
+  *bound = value;
+  cache->stats.forwarded++;
+  return true;
+}
+
+void state_set_vertex_buffer(StateCache *cache, unsigned slot, void *buffer, unsigned stride)
+{
+  assert(slot < STATE_CACHE_MAX_SLOTS);
+  if(cache->vertex_buffers[slot] == buffer && cache->vertex_strides[slot] == stride)
+  {
+    cache->stats.redundant++;
+    return;
+  }
+
+  cache->vertex_buffers[slot] = buffer;
+  cache->vertex_strides[slot] = stride;
+  cache->stats.forwarded++;
+  cache->backend->set_vertex_buffer(slot, buffer, stride);
+}
+
+void state_set_index_buffer(StateCache *cache, void *buffer)
+{
+  if(changed(cache, &cache->index_buffer, buffer)) cache->backend->set_index_buffer(buffer);
+}
+
+void state_set_topology(StateCache *cache, unsigned topology)
+{
+  if(cache->topology == topology)
+  {
+    cache->stats.redundant++;
+    return;
+  }
+
+  cache->topology = topology;
+  cache->stats.forwarded++;
+  cache->backend->set_topology(topology);
+}
+
+void state_set_input_layout(StateCache *cache, void *layout)
+{
+  if(changed(cache, &cache->input_layout, layout)) cache->backend->set_input_layout(layout);
+}
+
+void state_set_vertex_shader(StateCache *cache, void *shader)
+{
+  if(changed(cache, &cache->vertex_shader, shader)) cache->backend->set_vertex_shader(shader);
+}
+
+void state_set_pixel_shader(StateCache *cache, void *shader)
+{
+  if(changed(cache, &cache->pixel_shader, shader)) cache->backend->set_pixel_shader(shader);
+}
+
+void state_set_vs_constant_buffer(StateCache *cache, unsigned slot, void *buffer)
+{
+  assert(slot < STATE_CACHE_MAX_SLOTS);
+  if(changed(cache, &cache->vs_constant_buffers[slot], buffer)) cache->backend->set_vs_constant_buffer(slot, buffer);
+}
+
+void state_set_ps_constant_buffer(StateCache *cache, unsigned slot, void *buffer)
+{
+  assert(slot < STATE_CACHE_MAX_SLOTS);
+  if(changed(cache, &cache->ps_constant_buffers[slot], buffer)) cache->backend->set_ps_constant_buffer(slot, buffer);
+}
+
+void state_set_ps_resource(StateCache *cache, unsigned slot, void *resource)
+{
+  assert(slot < STATE_CACHE_MAX_SLOTS);
+  if(changed(cache, &cache->ps_resources[slot], resource)) cache->backend->set_ps_resource(slot, resource);
+}
+
+void state_set_ps_sampler(StateCache *cache, unsigned slot, void *sampler)
+{
+  assert(slot < STATE_CACHE_MAX_SLOTS);
+  if(changed(cache, &cache->ps_samplers[slot], sampler)) cache->backend->set_ps_sampler(slot, sampler);
+}
+
+void state_set_depth_stencil_state(StateCache *cache, void *state)
+{
+  if(changed(cache, &cache->depth_stencil_state, state)) cache->backend->set_depth_stencil_state(state);
+}
+
+void state_set_render_target(StateCache *cache, void *render_target, void *depth_stencil)
+{
+  if(cache->render_target == render_target && cache->depth_stencil == depth_stencil)
+  {
+    cache->stats.redundant++;
+    return;
+  }
+
+  cache->render_target = render_target;
+  cache->depth_stencil = depth_stencil;
+  cache->stats.forwarded++;
+  forget_shader_resources(cache);
+  cache->backend->set_render_target(render_target, depth_stencil);
+}
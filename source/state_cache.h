@@ -0,0 +1,82 @@
+#pragma once
+
+// Pipeline state goes through here on its way to the graphics API. Binds that
+// match what is already bound are dropped and counted.
+//
+// Handles are opaque so this doesn't depend on any graphics API. The D3D11
+// renderer passes its COM pointers straight through.
+
+static const unsigned STATE_CACHE_MAX_SLOTS = 8;
+
+// What the cache forwards to. The D3D11 renderer implements this over
+// ID3D11DeviceContext, and tests/state_cache_test.cpp with one that records
+// the calls.
+struct StateBackend
+{
+  virtual ~StateBackend() {}
+
+  virtual void set_vertex_buffer(unsigned slot, void *buffer, unsigned stride) = 0;
+  virtual void set_index_buffer(void *buffer) = 0;
+  virtual void set_topology(unsigned topology) = 0;
+  virtual void set_input_layout(void *layout) = 0;
+  virtual void set_vertex_shader(void *shader) = 0;
+  virtual void set_pixel_shader(void *shader) = 0;
+  virtual void set_vs_constant_buffer(unsigned slot, void *buffer) = 0;
+  virtual void set_ps_constant_buffer(unsigned slot, void *buffer) = 0;
+  virtual void set_ps_resource(unsigned slot, void *resource) = 0;
+  virtual void set_ps_sampler(unsigned slot, void *sampler) = 0;
+  virtual void set_depth_stencil_state(void *state) = 0;
+  virtual void set_render_target(void *render_target, void *depth_stencil) = 0;
+};
+
+struct StateCacheStats
+{
+  unsigned forwarded; // Calls that reached the backend
+  unsigned redundant; // Calls dropped because the state was already set
+};
+
+struct StateCache
+{
+  StateBackend *backend = 0;
+
+  // Last value sent to the backend for each piece of state. Reset to an
+  // unknown value so the first set always goes through.
+  void *vertex_buffers[STATE_CACHE_MAX_SLOTS];
+  unsigned vertex_strides[STATE_CACHE_MAX_SLOTS];
+  void *index_buffer;
+  unsigned topology;
+  void *input_layout;
+  void *vertex_shader;
+  void *pixel_shader;
+  void *vs_constant_buffers[STATE_CACHE_MAX_SLOTS];
+  void *ps_constant_buffers[STATE_CACHE_MAX_SLOTS];
+  void *ps_resources[STATE_CACHE_MAX_SLOTS];
+  void *ps_samplers[STATE_CACHE_MAX_SLOTS];
+  void *depth_stencil_state;
+  void *render_target;
+  void *depth_stencil;
+
+  StateCacheStats stats = {};
+};
+
+void init_state_cache(StateCache *cache, StateBackend *backend);
+
+// Forget everything that is bound. Call after binding around the cache.
+void reset_state_cache(StateCache *cache);
+
+void state_set_vertex_buffer(StateCache *cache, unsigned slot, void *buffer, unsigned stride);
+void state_set_index_buffer(StateCache *cache, void *buffer);
+void state_set_topology(StateCache *cache, unsigned topology);
+void state_set_input_layout(StateCache *cache, void *layout);
+void state_set_vertex_shader(StateCache *cache, void *shader);
+void state_set_pixel_shader(StateCache *cache, void *shader);
+void state_set_vs_constant_buffer(StateCache *cache, unsigned slot, void *buffer);
+void state_set_ps_constant_buffer(StateCache *cache, unsigned slot, void *buffer);
+void state_set_ps_resource(StateCache *cache, unsigned slot, void *resource);
+void state_set_ps_sampler(StateCache *cache, unsigned slot, void *sampler);
+void state_set_depth_stencil_state(StateCache *cache, void *state);
+
+// A texture can't be bound as a render target and a shader input at the same
+// time, and D3D11 quietly unbinds the input. The cache can't tell which
+// resources alias, so changing targets forgets every bound shader resource.
+void state_set_render_target(StateCache *cache, void *render_target, void *depth_stencil);
@@ -0,0 +1,151 @@
+#include "static_geometry.h"
+
+#include <float.h> // FLT_MAX
+#include <math.h> // floorf
+#include <algorithm> // sort
+#include <unordered_map>
+
+struct StaticTriangle
+{
+  int cell[3];
+  unsigned material;
+  unsigned instance;
+  unsigned first_index; // Into the instance's index list
+};
+
+static bool triangle_order(const StaticTriangle &a, const StaticTriangle &b)
+{
+  for(unsigned i = 0; i < 3; i++)
+  {
+    if(a.cell[i] != b.cell[i]) return a.cell[i] < b.cell[i];
+  }
+  if(a.material != b.material) return a.material < b.material;
+  if(a.instance != b.instance) return a.instance < b.instance;
+  return a.first_index < b.first_index;
+}
+
+static bool same_cell(const StaticTriangle &a, const StaticTriangle &b)
+{
+  return a.cell[0] == b.cell[0] && a.cell[1] == b.cell[1] && a.cell[2] == b.cell[2];
+}
+
+static v3 transform_point(const mat4 &m, v3 p)
+{
+  v4 result = m * v4(p, 1.0f);
+  return v3(result.x, result.y, result.z);
+}
+
+void build_static_geometry(const StaticInstance *instances, unsigned count, float cell_size, StaticGeometry *out)
+{
+  out->vertices.clear();
+  out->indices.clear();
+  out->batches.clear();
+  out->cells.clear();
+
+  // Bin every triangle by the cell its centroid lands in
+  std::vector<StaticTriangle> triangles;
+  for(unsigned i = 0; i < count; i++)
+  {
+    const StaticInstance *instance = &instances[i];
+    for(unsigned t = 0; t + 2 < instance->index_count; t += 3)
+    {
+      v3 centroid = v3();
+      for(unsigned k = 0; k < 3; k++)
+      {
+        centroid += transform_point(instance->world_m_model, instance->vertices[instance->indices[t + k]].position);
+      }
+      centroid /= 3.0f;
+
+      StaticTriangle triangle;
+      triangle.cell[0] = (int)floorf(centroid.x / cell_size);
+      triangle.cell[1] = (int)floorf(centroid.y / cell_size);
+      triangle.cell[2] = (int)floorf(centroid.z / cell_size);
+      triangle.material = instance->material;
+      triangle.instance = i;
+      triangle.first_index = t;
+      triangles.push_back(triangle);
+    }
+  }
+  std::sort(triangles.begin(), triangles.end(), triangle_order);
+
+  // Vertices are shared within a batch. Key is (instance, source vertex).
+  std::unordered_map<unsigned long long, unsigned> remap;
+
+  for(unsigned start = 0; start < triangles.size();)
+  {
+    StaticCell cell;
+    cell.first_batch = out->batches.size();
+    cell.batch_count = 0;
+    v3 lower = v3(FLT_MAX, FLT_MAX, FLT_MAX);
+    v3 upper = v3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+    unsigned end = start;
+    while(end < triangles.size() && same_cell(triangles[start], triangles[end]))
+    {
+      StaticBatch batch;
+      batch.material = triangles[end].material;
+      batch.first_index = out->indices.size();
+      remap.clear();
+
+      for(; end < triangles.size() && same_cell(triangles[start], triangles[end]) && triangles[end].material == batch.material; end++)
+      {
+        const StaticTriangle *triangle = &triangles[end];
+        const StaticInstance *instance = &instances[triangle->instance];
+        for(unsigned k = 0; k < 3; k++)
+        {
+          unsigned source = instance->indices[triangle->first_index + k];
+          unsigned long long key = ((unsigned long long)triangle->instance << 32) | source;
+
+          std::unordered_map<unsigned long long, unsigned>::iterator found = remap.find(key);
+          if(found != remap.end())
+          {
+            out->indices.push_back(found->second);
+            continue;
+          }
+
+          // Normals go through the world matrix the same way the shaders do it
+          const StaticVertex *vertex = &instance->vertices[source];
+          const mat4 &m = instance->world_m_model;
+          StaticVertex world_vertex;
+          world_vertex.position = transform_point(m, vertex->position);
+          v4 normal = m * v4(vertex->normal, 0.0f);
+          world_vertex.normal = v3(normal.x, normal.y, normal.z);
+          if(length_squared(world_vertex.normal) > 0.0f) world_vertex.normal = unit(world_vertex.normal);
+          world_vertex.uv = vertex->uv;
+
+          lower = component_min(lower, world_vertex.position);
+          upper = component_max(upper, world_vertex.position);
+
+          unsigned index = out->vertices.size();
+          out->vertices.push_back(world_vertex);
+          out->indices.push_back(index);
+          remap[key] = index;
+        }
+      }
+
+      batch.index_count = out->indices.size() - batch.first_index;
+      out->batches.push_back(batch);
+      cell.batch_count++;
+    }
+
+    cell.bounds.center = (lower + upper) * 0.5f;
+    cell.bounds.extents = (upper - lower) * 0.5f;
+    out->cells.push_back(cell);
+    start = end;
+  }
+}
+
+void cull_static_geometry(const StaticGeometry *geometry, const Frustum *frustum, std::vector<unsigned> *visible_batches)
+{
+  visible_batches->clear();
+  for(unsigned i = 0; i < geometry->cells.size(); i++)
+  {
+    const StaticCell *cell = &geometry->cells[i];
+    if(!frustum_test_box(frustum, cell->bounds)) continue;
+
+    for(unsigned b = 0; b < cell->batch_count; b++)
+    {
+      visible_batches->push_back(cell->first_batch + b);
+    }
+  }
+}
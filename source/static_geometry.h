@@ -0,0 +1,63 @@
+#pragma once
+
+#include "my_math.h" // v2, v3, mat4
+#include "culling.h" // BoundingBox, Frustum
+
+#include <vector>
+
+// World space cell size for partitioning merged static geometry. Bigger cells
+// mean fewer draws but coarser culling.
+static const float STATIC_CELL_SIZE = 500.0f;
+
+// Same layout as the renderer's mesh vertex
+struct StaticVertex
+{
+  v3 position;
+  v3 normal;
+  v2 uv;
+};
+
+// One static model going into the merge
+struct StaticInstance
+{
+  const StaticVertex *vertices;
+  unsigned vertex_count;
+  const unsigned *indices;
+  unsigned index_count;
+
+  mat4 world_m_model;
+
+  // Index into the caller's material table. Only geometry with the same
+  // material is merged into one batch.
+  unsigned material;
+};
+
+// A range of merged indices with one material inside one cell
+struct StaticBatch
+{
+  unsigned material;
+  unsigned first_index;
+  unsigned index_count;
+};
+
+struct StaticCell
+{
+  BoundingBox bounds;
+  unsigned first_batch;
+  unsigned batch_count;
+};
+
+// Every static model pre-transformed to world space and merged into one
+// vertex and index buffer. Triangles go to the cell their centroid is in.
+struct StaticGeometry
+{
+  std::vector<StaticVertex> vertices;
+  std::vector<unsigned> indices; // Index into vertices, no base vertex needed
+  std::vector<StaticBatch> batches;
+  std::vector<StaticCell> cells;
+};
+
+void build_static_geometry(const StaticInstance *instances, unsigned count, float cell_size, StaticGeometry *out);
+
+// Fills visible_batches with the batches of every cell that touches the frustum
+void cull_static_geometry(const StaticGeometry *geometry, const Frustum *frustum, std::vector<unsigned> *visible_batches);
@@ -0,0 +1,337 @@
+#include "texture_sampling.h"
+
+#include <assert.h>
+#include <math.h> // log2f
+
+static __m128 select(__m128 mask, __m128 a, __m128 b)
+{
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static __m128 lerp(__m128 a, __m128 b, __m128 t)
+{
+  return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+}
+
+// NaN comes out as low
+static __m128 clamp(__m128 x, __m128 low, __m128 high)
+{
+  return _mm_min_ps(_mm_max_ps(x, low), high);
+}
+
+// SSE2 has no floor. Only for values that fit in an int.
+static __m128 floor_ps(__m128 x)
+{
+  __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+  return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, x), _mm_set1_ps(1.0f)));
+}
+
+static __m128 negate(__m128 x)
+{
+  return _mm_xor_ps(x, _mm_set1_ps(-0.0f));
+}
+
+static unsigned texel_bytes(unsigned format)
+{
+  switch(format)
+  {
+    case SAMPLE_FORMAT_RGBA8: return 4;
+    case SAMPLE_FORMAT_R32F: return 4;
+    case SAMPLE_FORMAT_RGBA32F: return 16;
+  }
+
+  assert(false && "Unknown sample format");
+  return 0;
+}
+
+void set_sample_image(SampleTexture *texture, unsigned face, unsigned level, const void *texels, unsigned width,
+                      unsigned height, unsigned stride)
+{
+  assert(face < texture->faces && level < SAMPLE_MAX_LEVELS);
+  SampleImage *image = &texture->images[face][level];
+  image->texels = texels;
+  image->width = width;
+  image->height = height;
+  image->stride = stride;
+  if(level >= texture->levels) texture->levels = level + 1;
+}
+
+// Averages the 2x2 texels each smaller texel covers. Odd sizes repeat the
+// last row or column.
+static void downsample(unsigned format, const SampleImage *source, unsigned char *destination, unsigned width, unsigned height)
+{
+  unsigned channels = format == SAMPLE_FORMAT_R32F ? 1 : 4;
+  for(unsigned y = 0; y < height; y++)
+  {
+    unsigned y0 = y * 2 < source->height ? y * 2 : source->height - 1;
+    unsigned y1 = y * 2 + 1 < source->height ? y * 2 + 1 : source->height - 1;
+    for(unsigned x = 0; x < width; x++)
+    {
+      unsigned x0 = x * 2 < source->width ? x * 2 : source->width - 1;
+      unsigned x1 = x * 2 + 1 < source->width ? x * 2 + 1 : source->width - 1;
+      unsigned corners[4] = {y0 * source->stride + x0, y0 * source->stride + x1, y1 * source->stride + x0, y1 * source->stride + x1};
+
+      if(format == SAMPLE_FORMAT_RGBA8)
+      {
+        const unsigned char *texels = (const unsigned char *)source->texels;
+        unsigned char *out = destination + (y * width + x) * 4;
+        for(unsigned c = 0; c < 4; c++)
+        {
+          unsigned sum = texels[corners[0] * 4 + c] + texels[corners[1] * 4 + c] + texels[corners[2] * 4 + c] + texels[corners[3] * 4 + c];
+          out[c] = (unsigned char)((sum + 2) / 4);
+        }
+      }
+      else
+      {
+        const float *texels = (const float *)source->texels;
+        float *out = (float *)destination + (y * width + x) * channels;
+        for(unsigned c = 0; c < channels; c++)
+        {
+          float sum = texels[corners[0] * channels + c] + texels[corners[1] * channels + c] + texels[corners[2] * channels + c] +
+                      texels[corners[3] * channels + c];
+          out[c] = sum * 0.25f;
+        }
+      }
+    }
+  }
+}
+
+void build_sample_mips(SampleTexture *texture, std::vector<unsigned char> *storage)
+{
+  unsigned bytes = texel_bytes(texture->format);
+  const SampleImage *top = &texture->images[0][0];
+
+  // Sized up front so levels don't move while the next ones read them
+  unsigned levels = 1;
+  unsigned long long total = 0;
+  for(unsigned width = top->width, height = top->height; (width > 1 || height > 1) && levels < SAMPLE_MAX_LEVELS; levels++)
+  {
+    width = width > 1 ? width / 2 : 1;
+    height = height > 1 ? height / 2 : 1;
+    total += (unsigned long long)width * height * bytes * texture->faces;
+  }
+  storage->resize(total);
+
+  unsigned long long offset = 0;
+  for(unsigned face = 0; face < texture->faces; face++)
+  {
+    for(unsigned level = 1; level < levels; level++)
+    {
+      const SampleImage *source = &texture->images[face][level - 1];
+      unsigned width = source->width > 1 ? source->width / 2 : 1;
+      unsigned height = source->height > 1 ? source->height / 2 : 1;
+      unsigned char *destination = storage->data() + offset;
+      downsample(texture->format, source, destination, width, height);
+      set_sample_image(texture, face, level, destination, width, height, width);
+      offset += (unsigned long long)width * height * bytes;
+    }
+  }
+}
+
+// Texels at whole coordinates, from a different image per lane. SSE2 can't
+// gather so the loads are one at a time.
+static SampleColors fetch(unsigned format, const SampleImage *const *images, __m128 x, __m128 y)
+{
+  int xs[4], ys[4];
+  _mm_storeu_si128((__m128i *)xs, _mm_cvttps_epi32(x));
+  _mm_storeu_si128((__m128i *)ys, _mm_cvttps_epi32(y));
+
+  SampleColors result;
+  switch(format)
+  {
+    case SAMPLE_FORMAT_RGBA8:
+    {
+      unsigned texels[4];
+      for(unsigned i = 0; i < 4; i++)
+      {
+        texels[i] = ((const unsigned *)images[i]->texels)[ys[i] * images[i]->stride + xs[i]];
+      }
+
+      const __m128i byte = _mm_set1_epi32(0xFF);
+      const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+      __m128i packed = _mm_loadu_si128((const __m128i *)texels);
+      result.r = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(packed, byte)), scale);
+      result.g = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(packed, 8), byte)), scale);
+      result.b = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(packed, 16), byte)), scale);
+      result.a = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(packed, 24)), scale);
+      break;
+    }
+
+    case SAMPLE_FORMAT_R32F:
+    {
+      float texels[4];
+      for(unsigned i = 0; i < 4; i++)
+      {
+        texels[i] = ((const float *)images[i]->texels)[ys[i] * images[i]->stride + xs[i]];
+      }
+      result.r = _mm_loadu_ps(texels);
+      result.g = _mm_setzero_ps();
+      result.b = _mm_setzero_ps();
+      result.a = _mm_set1_ps(1.0f);
+      break;
+    }
+
+    case SAMPLE_FORMAT_RGBA32F:
+    {
+      __m128 texels[4];
+      for(unsigned i = 0; i < 4; i++)
+      {
+        texels[i] = _mm_loadu_ps((const float *)images[i]->texels + (ys[i] * images[i]->stride + xs[i]) * 4);
+      }
+      _MM_TRANSPOSE4_PS(texels[0], texels[1], texels[2], texels[3]);
+      result.r = texels[0];
+      result.g = texels[1];
+      result.b = texels[2];
+      result.a = texels[3];
+      break;
+    }
+
+    default:
+    {
+      assert(false && "Unknown sample format");
+      result.r = result.g = result.b = result.a = _mm_setzero_ps();
+    }
+  }
+
+  return result;
+}
+
+static SampleColors lerp(const SampleColors &a, const SampleColors &b, __m128 t)
+{
+  SampleColors result;
+  result.r = lerp(a.r, b.r, t);
+  result.g = lerp(a.g, b.g, t);
+  result.b = lerp(a.b, b.b, t);
+  result.a = lerp(a.a, b.a, t);
+  return result;
+}
+
+static SampleColors sample_images(unsigned format, bool bilinear, const SampleImage *const *images, __m128 u, __m128 v)
+{
+  __m128 width = _mm_setr_ps((float)images[0]->width, (float)images[1]->width, (float)images[2]->width, (float)images[3]->width);
+  __m128 height = _mm_setr_ps((float)images[0]->height, (float)images[1]->height, (float)images[2]->height, (float)images[3]->height);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  __m128 max_x = _mm_sub_ps(width, one);
+  __m128 max_y = _mm_sub_ps(height, one);
+
+  if(!bilinear)
+  {
+    __m128 x = floor_ps(clamp(_mm_mul_ps(u, width), zero, max_x));
+    __m128 y = floor_ps(clamp(_mm_mul_ps(v, height), zero, max_y));
+    return fetch(format, images, x, y);
+  }
+
+  // Texel centers are at half coordinates
+  const __m128 half = _mm_set1_ps(0.5f);
+  __m128 x = clamp(_mm_sub_ps(_mm_mul_ps(u, width), half), negate(one), width);
+  __m128 y = clamp(_mm_sub_ps(_mm_mul_ps(v, height), half), negate(one), height);
+  __m128 x0 = floor_ps(x);
+  __m128 y0 = floor_ps(y);
+  __m128 tx = _mm_sub_ps(x, x0);
+  __m128 ty = _mm_sub_ps(y, y0);
+  __m128 x1 = clamp(_mm_add_ps(x0, one), zero, max_x);
+  __m128 y1 = clamp(_mm_add_ps(y0, one), zero, max_y);
+  x0 = clamp(x0, zero, max_x);
+  y0 = clamp(y0, zero, max_y);
+
+  SampleColors top = lerp(fetch(format, images, x0, y0), fetch(format, images, x1, y0), tx);
+  SampleColors bottom = lerp(fetch(format, images, x0, y1), fetch(format, images, x1, y1), tx);
+  return lerp(top, bottom, ty);
+}
+
+static SampleColors sample_faces(const SampleTexture *texture, unsigned filter, const int *faces, __m128 u, __m128 v, __m128 lod)
+{
+  lod = clamp(lod, _mm_setzero_ps(), _mm_set1_ps((float)(texture->levels - 1)));
+
+  const SampleImage *images[4];
+  if(filter != SAMPLE_FILTER_TRILINEAR || texture->levels == 1)
+  {
+    int levels[4];
+    _mm_storeu_si128((__m128i *)levels, _mm_cvttps_epi32(_mm_add_ps(lod, _mm_set1_ps(0.5f))));
+    for(unsigned i = 0; i < 4; i++) images[i] = &texture->images[faces[i]][levels[i]];
+    return sample_images(texture->format, filter != SAMPLE_FILTER_POINT, images, u, v);
+  }
+
+  __m128 first = floor_ps(lod);
+  __m128 t = _mm_sub_ps(lod, first);
+  int levels[4];
+  _mm_storeu_si128((__m128i *)levels, _mm_cvttps_epi32(first));
+
+  for(unsigned i = 0; i < 4; i++) images[i] = &texture->images[faces[i]][levels[i]];
+  SampleColors near_level = sample_images(texture->format, true, images, u, v);
+
+  for(unsigned i = 0; i < 4; i++)
+  {
+    unsigned next = levels[i] + 1 < (int)texture->levels ? levels[i] + 1 : levels[i];
+    images[i] = &texture->images[faces[i]][next];
+  }
+  SampleColors far_level = sample_images(texture->format, true, images, u, v);
+
+  return lerp(near_level, far_level, t);
+}
+
+__m128 sample_lod(const SampleTexture *texture, __m128 du_dx, __m128 dv_dx, __m128 du_dy, __m128 dv_dy)
+{
+  __m128 width = _mm_set1_ps((float)texture->images[0][0].width);
+  __m128 height = _mm_set1_ps((float)texture->images[0][0].height);
+  __m128 x_u = _mm_mul_ps(du_dx, width);
+  __m128 x_v = _mm_mul_ps(dv_dx, height);
+  __m128 y_u = _mm_mul_ps(du_dy, width);
+  __m128 y_v = _mm_mul_ps(dv_dy, height);
+  __m128 squared = _mm_max_ps(_mm_add_ps(_mm_mul_ps(x_u, x_u), _mm_mul_ps(x_v, x_v)),
+                              _mm_add_ps(_mm_mul_ps(y_u, y_u), _mm_mul_ps(y_v, y_v)));
+
+  // Half of log2 of the squared length is log2 of the length
+  float lanes[4];
+  _mm_storeu_ps(lanes, squared);
+  for(unsigned i = 0; i < 4; i++) lanes[i] = lanes[i] > 0.0f ? 0.5f * log2f(lanes[i]) : 0.0f;
+  return _mm_loadu_ps(lanes);
+}
+
+SampleColors sample_2d(const SampleTexture *texture, unsigned filter, __m128 u, __m128 v, __m128 lod)
+{
+  static const int faces[4] = {};
+  return sample_faces(texture, filter, faces, u, v, lod);
+}
+
+void cube_face_coordinates(__m128 x, __m128 y, __m128 z, __m128i *face, __m128 *u, __m128 *v)
+{
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+  __m128 ax = _mm_and_ps(x, abs_mask);
+  __m128 ay = _mm_and_ps(y, abs_mask);
+  __m128 az = _mm_and_ps(z, abs_mask);
+
+  __m128 x_major = _mm_and_ps(_mm_cmpge_ps(ax, ay), _mm_cmpge_ps(ax, az));
+  __m128 y_major = _mm_andnot_ps(x_major, _mm_cmpge_ps(ay, az));
+  __m128 positive_x = _mm_cmpgt_ps(x, zero);
+  __m128 positive_y = _mm_cmpgt_ps(y, zero);
+  __m128 positive_z = _mm_cmpgt_ps(z, zero);
+
+  __m128 x_face = select(positive_x, _mm_set1_ps(0.0f), _mm_set1_ps(1.0f));
+  __m128 y_face = select(positive_y, _mm_set1_ps(2.0f), _mm_set1_ps(3.0f));
+  __m128 z_face = select(positive_z, _mm_set1_ps(4.0f), _mm_set1_ps(5.0f));
+  *face = _mm_cvttps_epi32(select(x_major, x_face, select(y_major, y_face, z_face)));
+
+  __m128 s = select(x_major, select(positive_x, negate(z), z), select(y_major, x, select(positive_z, x, negate(x))));
+  __m128 t = select(x_major, negate(y), select(y_major, select(positive_y, z, negate(z)), negate(y)));
+  __m128 major = select(x_major, ax, select(y_major, ay, az));
+
+  const __m128 half = _mm_set1_ps(0.5f);
+  __m128 inv_major = _mm_div_ps(half, major);
+  *u = _mm_add_ps(_mm_mul_ps(s, inv_major), half);
+  *v = _mm_add_ps(_mm_mul_ps(t, inv_major), half);
+}
+
+SampleColors sample_cube(const SampleTexture *texture, unsigned filter, __m128 x, __m128 y, __m128 z, __m128 lod)
+{
+  assert(texture->faces == 6);
+  __m128i face;
+  __m128 u, v;
+  cube_face_coordinates(x, y, z, &face, &u, &v);
+
+  int faces[4];
+  _mm_storeu_si128((__m128i *)faces, face);
+  return sample_faces(texture, filter, faces, u, v, lod);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <emmintrin.h> // SSE2
+#include <vector>
+
+// Reads images on the CPU the way the GPU's samplers do, four lookups at a
+// time with SSE. Texels are read in place from images owned elsewhere, like
+// stb_image output or the software rasterizer's textures.
+//
+// Addressing always clamps. Single channel float images read as
+// (value, 0, 0, 1) like an R32 view.
+
+static const unsigned SAMPLE_MAX_LEVELS = 16;
+
+enum SampleFormat
+{
+  SAMPLE_FORMAT_RGBA8, // Bytes in r g b a order, like stb_image loads with 4 channels
+  SAMPLE_FORMAT_R32F,
+  SAMPLE_FORMAT_RGBA32F,
+};
+
+enum SampleFilter
+{
+  SAMPLE_FILTER_POINT,     // Nearest texel of the nearest mip
+  SAMPLE_FILTER_BILINEAR,  // Four texels of the nearest mip
+  SAMPLE_FILTER_TRILINEAR, // Bilinear in the two nearest mips, blended
+};
+
+// One mip level of one face
+struct SampleImage
+{
+  const void *texels = 0;
+  unsigned width = 0;
+  unsigned height = 0;
+  unsigned stride = 0; // Texels per row
+};
+
+struct SampleTexture
+{
+  unsigned format = SAMPLE_FORMAT_RGBA8;
+  unsigned faces = 1; // 6 for cube maps, in D3D11 order +x -x +y -y +z -z
+  unsigned levels = 1; // Level 0 is full size
+  SampleImage images[6][SAMPLE_MAX_LEVELS];
+};
+
+// Four lookups, one per lane
+struct SampleColors
+{
+  __m128 r;
+  __m128 g;
+  __m128 b;
+  __m128 a;
+};
+
+// Points a face's mip level at texels. Every face needs the same levels.
+void set_sample_image(SampleTexture *texture, unsigned face, unsigned level, const void *texels, unsigned width,
+                      unsigned height, unsigned stride);
+
+// Box filters level 0 of every face down to 1x1. The new levels live in storage.
+void build_sample_mips(SampleTexture *texture, std::vector<unsigned char> *storage);
+
+// Mip level for each lane from how far uv moves across one pixel
+__m128 sample_lod(const SampleTexture *texture, __m128 du_dx, __m128 dv_dx, __m128 du_dy, __m128 dv_dy);
+
+// lod picks the mip level. Point and bilinear filtering round it, trilinear
+// blends the levels on either side.
+SampleColors sample_2d(const SampleTexture *texture, unsigned filter, __m128 u, __m128 v, __m128 lod);
+
+// Directions don't need to be unit length. Filtering doesn't cross into
+// neighbouring faces.
+SampleColors sample_cube(const SampleTexture *texture, unsigned filter, __m128 x, __m128 y, __m128 z, __m128 lod);
+
+// The face a direction lands on and where, picked from the major axis like
+// skybox.ps's TextureCube lookup
+void cube_face_coordinates(__m128 x, __m128 y, __m128 z, __m128i *face, __m128 *u, __m128 *v);
@@ -0,0 +1,267 @@
+#include "tlsf_allocator.h"
+
+#include <assert.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h> // _BitScanForward, _BitScanReverse
+#endif
+
+static unsigned lowest_bit(unsigned bits)
+{
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, bits);
+  return index;
+#else
+  return __builtin_ctz(bits);
+#endif
+}
+
+static unsigned highest_bit(unsigned bits)
+{
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanReverse(&index, bits);
+  return index;
+#else
+  return 31 - __builtin_clz(bits);
+#endif
+}
+
+// Which list a free block of this size goes in
+static void mapping_insert(unsigned size, unsigned *first_level, unsigned *second_level)
+{
+  if(size < TLSF_SECOND_LEVEL_COUNT)
+  {
+    // Small sizes get exact lists in the first level
+    *first_level = 0;
+    *second_level = size;
+    return;
+  }
+
+  unsigned top = highest_bit(size);
+  *first_level = top - TLSF_SECOND_LEVEL_LOG2 + 1;
+  *second_level = (size >> (top - TLSF_SECOND_LEVEL_LOG2)) - TLSF_SECOND_LEVEL_COUNT;
+}
+
+// First list whose blocks are all at least this big, so the head can be taken
+// without searching the list
+static void mapping_search(unsigned size, unsigned *first_level, unsigned *second_level)
+{
+  if(size >= TLSF_SECOND_LEVEL_COUNT)
+  {
+    size += (1u << (highest_bit(size) - TLSF_SECOND_LEVEL_LOG2)) - 1;
+  }
+  mapping_insert(size, first_level, second_level);
+}
+
+static unsigned new_block(TlsfAllocator *allocator)
+{
+  if(allocator->unused_blocks.size())
+  {
+    unsigned index = allocator->unused_blocks.back();
+    allocator->unused_blocks.pop_back();
+    return index;
+  }
+
+  allocator->blocks.push_back(TlsfBlock());
+  return allocator->blocks.size() - 1;
+}
+
+static void insert_free_block(TlsfAllocator *allocator, unsigned index)
+{
+  TlsfBlock *block = &allocator->blocks[index];
+  unsigned fl, sl;
+  mapping_insert(block->size, &fl, &sl);
+
+  unsigned head = allocator->free_lists[fl][sl];
+  block->free = true;
+  block->prev_free = TLSF_INVALID;
+  block->next_free = head;
+  if(head != TLSF_INVALID)
+  {
+    allocator->blocks[head].prev_free = index;
+  }
+
+  allocator->free_lists[fl][sl] = index;
+  allocator->first_level_bitmap |= 1u << fl;
+  allocator->second_level_bitmaps[fl] |= 1u << sl;
+}
+
+static void remove_free_block(TlsfAllocator *allocator, unsigned index)
+{
+  TlsfBlock *block = &allocator->blocks[index];
+  unsigned fl, sl;
+  mapping_insert(block->size, &fl, &sl);
+
+  if(block->prev_free != TLSF_INVALID) allocator->blocks[block->prev_free].next_free = block->next_free;
+  if(block->next_free != TLSF_INVALID) allocator->blocks[block->next_free].prev_free = block->prev_free;
+
+  if(allocator->free_lists[fl][sl] == index)
+  {
+    allocator->free_lists[fl][sl] = block->next_free;
+    if(block->next_free == TLSF_INVALID)
+    {
+      allocator->second_level_bitmaps[fl] &= ~(1u << sl);
+      if(!allocator->second_level_bitmaps[fl])
+      {
+        allocator->first_level_bitmap &= ~(1u << fl);
+      }
+    }
+  }
+
+  block->free = false;
+}
+
+void init_tlsf_allocator(TlsfAllocator *allocator, unsigned capacity)
+{
+  assert(capacity > 0 && capacity < 0x80000000);
+
+  allocator->capacity = capacity;
+  allocator->used = 0;
+  allocator->allocations = 0;
+  allocator->blocks.clear();
+  allocator->unused_blocks.clear();
+
+  allocator->first_level_bitmap = 0;
+  for(unsigned fl = 0; fl < TLSF_FIRST_LEVEL_COUNT; fl++)
+  {
+    allocator->second_level_bitmaps[fl] = 0;
+    for(unsigned sl = 0; sl < TLSF_SECOND_LEVEL_COUNT; sl++)
+    {
+      allocator->free_lists[fl][sl] = TLSF_INVALID;
+    }
+  }
+
+  // Start with the whole range as one free block
+  unsigned index = new_block(allocator);
+  TlsfBlock *block = &allocator->blocks[index];
+  block->offset = 0;
+  block->size = capacity;
+  block->prev_physical = TLSF_INVALID;
+  block->next_physical = TLSF_INVALID;
+  insert_free_block(allocator, index);
+}
+
+TlsfAllocation tlsf_allocate(TlsfAllocator *allocator, unsigned size)
+{
+  assert(size > 0);
+
+  TlsfAllocation allocation;
+  if(size > allocator->capacity) return allocation;
+
+  unsigned fl, sl;
+  mapping_search(size, &fl, &sl);
+  if(fl >= TLSF_FIRST_LEVEL_COUNT) return allocation;
+
+  // Smallest non-empty list at or above the one found
+  unsigned second_level_map = allocator->second_level_bitmaps[fl] & (~0u << sl);
+  if(!second_level_map)
+  {
+    unsigned first_level_map = fl + 1 < TLSF_FIRST_LEVEL_COUNT ? allocator->first_level_bitmap & (~0u << (fl + 1)) : 0;
+    if(!first_level_map) return allocation;
+
+    fl = lowest_bit(first_level_map);
+    second_level_map = allocator->second_level_bitmaps[fl];
+  }
+  sl = lowest_bit(second_level_map);
+
+  unsigned index = allocator->free_lists[fl][sl];
+  remove_free_block(allocator, index);
+
+  // Give the tail back as a new free block
+  if(allocator->blocks[index].size > size)
+  {
+    unsigned rest = new_block(allocator);
+    TlsfBlock *block = &allocator->blocks[index];
+    TlsfBlock *remainder = &allocator->blocks[rest];
+    remainder->offset = block->offset + size;
+    remainder->size = block->size - size;
+    remainder->prev_physical = index;
+    remainder->next_physical = block->next_physical;
+    if(block->next_physical != TLSF_INVALID)
+    {
+      allocator->blocks[block->next_physical].prev_physical = rest;
+    }
+    block->next_physical = rest;
+    block->size = size;
+    insert_free_block(allocator, rest);
+  }
+
+  allocator->used += size;
+  allocator->allocations++;
+
+  allocation.offset = allocator->blocks[index].offset;
+  allocation.block = index;
+  return allocation;
+}
+
+// Folds next into block. Both must be out of the free lists.
+static void merge_blocks(TlsfAllocator *allocator, unsigned index, unsigned next)
+{
+  TlsfBlock *block = &allocator->blocks[index];
+  TlsfBlock *absorbed = &allocator->blocks[next];
+  block->size += absorbed->size;
+  block->next_physical = absorbed->next_physical;
+  if(absorbed->next_physical != TLSF_INVALID)
+  {
+    allocator->blocks[absorbed->next_physical].prev_physical = index;
+  }
+  allocator->unused_blocks.push_back(next);
+}
+
+void tlsf_free(TlsfAllocator *allocator, TlsfAllocation allocation)
+{
+  unsigned index = allocation.block;
+  assert(index < allocator->blocks.size());
+  assert(!allocator->blocks[index].free && allocator->blocks[index].offset == allocation.offset);
+
+  allocator->used -= allocator->blocks[index].size;
+  allocator->allocations--;
+
+  unsigned next = allocator->blocks[index].next_physical;
+  if(next != TLSF_INVALID && allocator->blocks[next].free)
+  {
+    remove_free_block(allocator, next);
+    merge_blocks(allocator, index, next);
+  }
+
+  unsigned prev = allocator->blocks[index].prev_physical;
+  if(prev != TLSF_INVALID && allocator->blocks[prev].free)
+  {
+    remove_free_block(allocator, prev);
+    merge_blocks(allocator, prev, index);
+    index = prev;
+  }
+
+  insert_free_block(allocator, index);
+}
+
+TlsfStats tlsf_stats(const TlsfAllocator *allocator)
+{
+  TlsfStats stats;
+  stats.capacity = allocator->capacity;
+  stats.used = allocator->used;
+  stats.allocations = allocator->allocations;
+  stats.free_blocks = 0;
+  stats.largest_free = 0;
+
+  // Walks the free lists, meant for debug output rather than every frame
+  for(unsigned fl = 0; fl < TLSF_FIRST_LEVEL_COUNT; fl++)
+  {
+    for(unsigned sl = 0; sl < TLSF_SECOND_LEVEL_COUNT; sl++)
+    {
+      for(unsigned index = allocator->free_lists[fl][sl]; index != TLSF_INVALID; index = allocator->blocks[index].next_free)
+      {
+        unsigned size = allocator->blocks[index].size;
+        if(size > stats.largest_free) stats.largest_free = size;
+        stats.free_blocks++;
+      }
+    }
+  }
+
+  unsigned total_free = allocator->capacity - allocator->used;
+  stats.utilization = allocator->capacity ? (float)allocator->used / (float)allocator->capacity : 0.0f;
+  stats.fragmentation = total_free ? 1.0f - (float)stats.largest_free / (float)total_free : 0.0f;
+  return stats;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vector>
+
+// Two level segregated fit allocator for ranges of a buffer the CPU can't
+// touch, like GPU vertex and index buffers. Block headers live on the side
+// instead of in the memory being managed. Allocating and freeing are constant
+// time. Offsets and sizes are in whatever unit the caller uses (elements, bytes).
+
+static const unsigned TLSF_INVALID = 0xFFFFFFFF;
+
+// Each power of two size class is split into 1 << TLSF_SECOND_LEVEL_LOG2 lists
+static const unsigned TLSF_SECOND_LEVEL_LOG2 = 4;
+static const unsigned TLSF_SECOND_LEVEL_COUNT = 1 << TLSF_SECOND_LEVEL_LOG2;
+static const unsigned TLSF_FIRST_LEVEL_COUNT = 32;
+
+struct TlsfBlock
+{
+  unsigned offset;
+  unsigned size;
+
+  // Neighbours in the buffer, TLSF_INVALID at either end
+  unsigned prev_physical;
+  unsigned next_physical;
+
+  // Neighbours in the free list, only valid while the block is free
+  unsigned prev_free;
+  unsigned next_free;
+
+  bool free;
+};
+
+struct TlsfAllocation
+{
+  unsigned offset = TLSF_INVALID;
+  unsigned block = TLSF_INVALID;
+};
+
+struct TlsfStats
+{
+  unsigned capacity;
+  unsigned used;
+  unsigned allocations;
+  unsigned free_blocks;
+  unsigned largest_free;
+
+  // used / capacity
+  float utilization;
+
+  // 1 - largest_free / total free. 0 when all free space is in one block,
+  // close to 1 when it is scattered in pieces too small to use.
+  float fragmentation;
+};
+
+struct TlsfAllocator
+{
+  unsigned capacity = 0;
+  unsigned used = 0;
+  unsigned allocations = 0;
+
+  std::vector<TlsfBlock> blocks;
+  std::vector<unsigned> unused_blocks; // Headers free to reuse
+
+  // Bit per first level with a non-empty list, then bit per list in each level
+  unsigned first_level_bitmap = 0;
+  unsigned second_level_bitmaps[TLSF_FIRST_LEVEL_COUNT];
+  unsigned free_lists[TLSF_FIRST_LEVEL_COUNT][TLSF_SECOND_LEVEL_COUNT];
+};
+
+void init_tlsf_allocator(TlsfAllocator *allocator, unsigned capacity);
+
+// Returns an allocation with offset TLSF_INVALID if no free block fits
+TlsfAllocation tlsf_allocate(TlsfAllocator *allocator, unsigned size);
+
+// Merges the range back with free neighbours
+void tlsf_free(TlsfAllocator *allocator, TlsfAllocation allocation);
+
+TlsfStats tlsf_stats(const TlsfAllocator *allocator);
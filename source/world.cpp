@@ -13,7 +13,14 @@ static Model ground_handle;
 static float camera_latitude = 90.0f;
 static float camera_longitude = -90.0f;
 
-bool cursor_locked = true;
+// Windows virtual key codes, which is what the input has
+static const unsigned KEY_SHIFT = 0x10;
+static const unsigned KEY_CONTROL = 0x11;
+
+static bool key_down(const TraceInput *input, unsigned key)
+{
+  return key < TRACE_MAX_KEYS && ((input->keys[key / 32] >> (key % 32)) & 1);
+}
 
 // In degrees
 static v3 spherical_to_cartesian(float radius, float latitude, float longitude)
@@ -33,23 +40,21 @@ void init_world()
   teapot_handle = create_model("assets/teapot.obj");
   set_model_color(teapot_handle, Color(0.0f, 0.0f, 0.5f));
 
-  ground_handle = create_model("assets/terrain.obj", v3(), v3(1000.0f, 1.0f, 1000.0f));
+  ground_handle = create_static_model("assets/terrain.obj", v3(), v3(1000.0f, 1.0f, 1000.0f));
   set_model_color(ground_handle, Color(0.1f, 0.2f, 0.0f));
 }
 
-void update_world()
+void update_world(const TraceInput *input, WorldRequests *requests, float seconds)
 {
-  /*
   static bool pressed = true;
-  if(key_state(VK_SHIFT) == true && !pressed)
+  if(key_down(input, KEY_SHIFT) && !pressed)
   {
-    cursor_locked = !cursor_locked;
+    requests->cursor_locked = !requests->cursor_locked;
   }
-  pressed = key_state(VK_SHIFT);
-  */
+  pressed = key_down(input, KEY_SHIFT);
 
 
-  if(cursor_locked)
+  if(requests->cursor_locked)
   {
     v3 player_position = get_model_position(teapot_handle);
     float player_rotation = get_model_rotation(teapot_handle).y;
@@ -57,7 +62,7 @@ void update_world()
     v3 camera_position = get_camera_position();
     v3 camera_looking = get_camera_looking_direction();
 
-    v2 delta = v2();//mouse_delta_position();
+    v2 delta = input->mouse_delta;
     float mouse_sensitivity = 0.1f;
     camera_latitude += delta.x * mouse_sensitivity;
     camera_longitude += delta.y * mouse_sensitivity;
@@ -83,31 +88,30 @@ void update_world()
       up_axis = unit(up_axis);
 
       v3 direction = v3();
-      /*
-      if(key_state('W')) direction += forward;
-      if(key_state('S')) direction -= forward;
-      if(key_state('A')) direction -= right_axis;
-      if(key_state('D')) direction += right_axis;
-      if(key_state(' ')) direction += up_axis;
-      if(key_state(VK_CONTROL)) direction -= up_axis;
-      */
+      if(key_down(input, 'W')) direction += forward;
+      if(key_down(input, 'S')) direction -= forward;
+      if(key_down(input, 'A')) direction -= right_axis;
+      if(key_down(input, 'D')) direction += right_axis;
+      if(key_down(input, ' ')) direction += up_axis;
+      if(key_down(input, KEY_CONTROL)) direction -= up_axis;
 
       static v3 velocity;
 
-      float acceleration_speed = 0.0003f;
-      v3 acceleration = direction * acceleration_speed;
+      // Per second, tuned back when the world updated once a frame at 60 fps
+      float acceleration_speed = 1.08f;
+      v3 acceleration = direction * acceleration_speed * seconds;
       velocity += acceleration;
 
 
+      // Fraction of the velocity lost every 60th of a second
       float deceleration_speed = 0.005f;
-      v3 deceleration = -velocity * deceleration_speed;
-      velocity += deceleration;
+      velocity = velocity * powf(1.0f - deceleration_speed, seconds * 60.0f);
 
 
-      float max_speed = 0.05f;
+      float max_speed = 3.0f;
       velocity = clamp_length(velocity, max_speed);
 
-      player_position += velocity;
+      player_position += velocity * seconds;
 
 
       if(length(velocity) != 0.0f)
@@ -1,6 +1,13 @@
 #pragma once
 
+#include "frame_pipeline.h" // TraceInput, WorldRequests
+
+// Fixed rate the world updates at unless the platform is told otherwise.
+// Frames in between are blended.
+static const float DEFAULT_WORLD_STEPS_PER_SECOND = 60.0f;
+
 void init_world();
 
-void update_world();
+// The input is a copy the platform sampled, and requests carry over between steps
+void update_world(const TraceInput *input, WorldRequests *requests, float seconds);
 
@@ -0,0 +1,265 @@
+// Checks the BVH stays a valid tree through building, inserting, refitting,
+// removing and rebuilding, and that culling through it finds the same models
+// as testing every model.
+
+#include "../source/model_storage.cpp"
+#include "../source/culling.cpp"
+#include "../source/bvh.cpp"
+
+#include <stdio.h> // printf
+#include <algorithm> // std::sort
+#include <thread> // std::thread
+
+static float random_float(unsigned *random)
+{
+  *random = *random * 1664525 + 1013904223;
+  return (float)(*random >> 8) / (float)(1 << 24);
+}
+
+static v3 random_position(unsigned *random, float spread)
+{
+  return v3(random_float(random), random_float(random), random_float(random)) * spread - v3(1.0f, 1.0f, 1.0f) * (spread * 0.5f);
+}
+
+static Model add_box(ModelStorage *models, v3 position)
+{
+  Model model = add_model(models);
+  unsigned index = model_index(models, model);
+  models->positions[index] = position;
+  models->local_bounds[index].center = v3();
+  models->local_bounds[index].extents = v3(0.5f, 0.5f, 0.5f);
+  return model;
+}
+
+static void move_box(ModelStorage *models, Model model, v3 position)
+{
+  unsigned index = model_index(models, model);
+  models->positions[index] = position;
+  mark_transform_dirty(models, index);
+}
+
+static bool encloses(v3 lower, v3 upper, v3 inner_lower, v3 inner_upper)
+{
+  return lower.x <= inner_lower.x && lower.y <= inner_lower.y && lower.z <= inner_lower.z &&
+         upper.x >= inner_upper.x && upper.y >= inner_upper.y && upper.z >= inner_upper.z;
+}
+
+// Walks the tree from the root. Every node encloses what is below it, parent
+// links match, and every dynamic model is in exactly one leaf.
+static void check_tree(const Bvh *bvh, const ModelStorage *models)
+{
+  std::vector<unsigned> seen(models->slots.size(), 0);
+  unsigned dynamic_count = 0;
+  for(unsigned i = 0; i < models->count; i++)
+  {
+    if(!(models->flags[i] & MODEL_FLAG_STATIC)) dynamic_count++;
+  }
+
+  if(bvh->root < 0)
+  {
+    assert(dynamic_count == 0);
+    return;
+  }
+  assert(bvh->nodes[bvh->root].parent == -1);
+
+  unsigned items_found = 0;
+  std::vector<int> stack;
+  stack.push_back(bvh->root);
+  while(stack.size())
+  {
+    int node_index = stack.back();
+    stack.pop_back();
+    const BvhNode *node = &bvh->nodes[node_index];
+
+    if(is_leaf(node))
+    {
+      assert(node->item_count > 0 && node->item_count <= BVH_LEAF_SIZE);
+      for(unsigned i = 0; i < node->item_count; i++)
+      {
+        unsigned slot = node->items[i];
+        assert(bvh->item_leaf[slot] == node_index);
+        assert(!seen[slot]);
+        seen[slot] = 1;
+        items_found++;
+
+        v3 lower, upper;
+        get_item_bounds(models, slot, &lower, &upper);
+        assert(encloses(node->lower, node->upper, lower, upper));
+      }
+      continue;
+    }
+
+    for(unsigned c = 0; c < 2; c++)
+    {
+      const BvhNode *child = &bvh->nodes[node->children[c]];
+      assert(child->parent == node_index);
+      assert(encloses(node->lower, node->upper, child->lower, child->upper));
+      stack.push_back(node->children[c]);
+    }
+  }
+
+  assert(items_found == dynamic_count);
+}
+
+static Frustum make_test_frustum()
+{
+  // Orthographic, x and y in [-20, 40], z in [-100, 100]
+  mat4 clip_m_world = mat4(1.0f / 30.0f, 0.0f,         0.0f,           -1.0f / 3.0f,
+                           0.0f,         1.0f / 30.0f, 0.0f,           -1.0f / 3.0f,
+                           0.0f,         0.0f,         1.0f / 200.0f,  0.5f,
+                           0.0f,         0.0f,         0.0f,           1.0f);
+  return make_frustum(clip_m_world);
+}
+
+// Culling the tree finds the same models as testing every shown dynamic model
+static void check_cull(const Bvh *bvh, const ModelStorage *models, const Frustum *frustum)
+{
+  std::vector<BvhCullEntry> stack;
+  std::vector<unsigned> visible;
+  bvh_cull(bvh, models, frustum, &stack, &visible);
+
+  std::vector<unsigned> expected;
+  for(unsigned i = 0; i < models->count; i++)
+  {
+    if(!(models->flags[i] & MODEL_FLAG_SHOW) || (models->flags[i] & MODEL_FLAG_STATIC)) continue;
+
+    BoundingBox box;
+    box.center = v3(models->bounds_center_x[i], models->bounds_center_y[i], models->bounds_center_z[i]);
+    box.extents = v3(models->bounds_extent_x[i], models->bounds_extent_y[i], models->bounds_extent_z[i]);
+    if(frustum_test_box(frustum, box)) expected.push_back(i);
+  }
+
+  std::sort(visible.begin(), visible.end());
+  assert(visible == expected);
+}
+
+static void test_build_update_remove()
+{
+  ModelStorage models;
+  Bvh bvh;
+  Frustum frustum = make_test_frustum();
+  unsigned random = 12345;
+
+  std::vector<Model> boxes;
+  for(unsigned i = 0; i < 300; i++)
+  {
+    boxes.push_back(add_box(&models, random_position(&random, 100.0f)));
+  }
+
+  // A hidden model and a static one, neither may come out of a cull
+  models.flags[model_index(&models, boxes[0])] &= ~MODEL_FLAG_SHOW;
+  models.flags[model_index(&models, boxes[1])] |= MODEL_FLAG_STATIC;
+
+  update_world_transforms(&models);
+  models.moved_slots.clear();
+  bvh_build(&bvh, &models);
+  assert(bvh.rebuild_count == 1);
+  assert(bvh.item_leaf[boxes[1].index] == -1);
+  check_tree(&bvh, &models);
+  check_cull(&bvh, &models, &frustum);
+
+  // Inserting new models
+  for(unsigned i = 0; i < 100; i++)
+  {
+    boxes.push_back(add_box(&models, random_position(&random, 100.0f)));
+  }
+  update_world_transforms(&models);
+  bvh_update(&bvh, &models);
+  assert(models.moved_slots.empty());
+  check_tree(&bvh, &models);
+  check_cull(&bvh, &models, &frustum);
+
+  // Small moves are refits and don't rebuild
+  for(unsigned i = 2; i < boxes.size(); i += 3)
+  {
+    unsigned index = model_index(&models, boxes[i]);
+    move_box(&models, boxes[i], models.positions[index] + random_position(&random, 0.5f));
+  }
+  update_world_transforms(&models);
+  bvh_update(&bvh, &models);
+  assert(bvh.rebuild_count == 1);
+  check_tree(&bvh, &models);
+  check_cull(&bvh, &models, &frustum);
+
+  // Removing every other model, the tree is told before the storage
+  for(unsigned i = 2; i < boxes.size(); i += 2)
+  {
+    bvh_remove(&bvh, &models, boxes[i].index);
+    remove_model(&models, boxes[i]);
+  }
+  check_tree(&bvh, &models);
+  check_cull(&bvh, &models, &frustum);
+
+  // Scattering the rest far from where they were built loosens the tree past
+  // the ratio, so it's rebuilt
+  for(unsigned i = 3; i < boxes.size(); i += 2)
+  {
+    move_box(&models, boxes[i], random_position(&random, 400.0f));
+  }
+  update_world_transforms(&models);
+  bvh_update(&bvh, &models);
+  assert(bvh.rebuild_count == 2);
+  assert(bvh.total_area == bvh.built_area);
+  check_tree(&bvh, &models);
+  check_cull(&bvh, &models, &frustum);
+
+  // Removing the rest empties the tree
+  for(unsigned i = 1; i < boxes.size(); i += 2)
+  {
+    bvh_remove(&bvh, &models, boxes[i].index);
+    remove_model(&models, boxes[i]);
+  }
+  bvh_remove(&bvh, &models, boxes[0].index);
+  remove_model(&models, boxes[0]);
+  assert(bvh.root == -1);
+  check_tree(&bvh, &models);
+}
+
+// Several culls of the same tree at once, each with its own stack
+static void test_concurrent_culls()
+{
+  ModelStorage models;
+  Bvh bvh;
+  unsigned random = 777;
+  for(unsigned i = 0; i < 2000; i++)
+  {
+    add_box(&models, random_position(&random, 100.0f));
+  }
+  update_world_transforms(&models);
+  models.moved_slots.clear();
+  bvh_build(&bvh, &models);
+
+  Frustum frustum = make_test_frustum();
+  std::vector<BvhCullEntry> stack;
+  std::vector<unsigned> expected;
+  bvh_cull(&bvh, &models, &frustum, &stack, &expected);
+
+  static const unsigned THREAD_COUNT = 4;
+  std::vector<unsigned> results[THREAD_COUNT];
+  std::vector<std::thread> threads;
+  for(unsigned t = 0; t < THREAD_COUNT; t++)
+  {
+    std::vector<unsigned> *visible = &results[t];
+    threads.push_back(std::thread([&bvh, &models, &frustum, visible]()
+    {
+      std::vector<BvhCullEntry> thread_stack;
+      for(unsigned i = 0; i < 100; i++)
+      {
+        bvh_cull(&bvh, &models, &frustum, &thread_stack, visible);
+      }
+    }));
+  }
+  for(unsigned t = 0; t < THREAD_COUNT; t++)
+  {
+    threads[t].join();
+    assert(results[t] == expected);
+  }
+}
+
+int main()
+{
+  test_build_update_remove();
+  test_concurrent_culls();
+  printf("bvh_test: ok\n");
+  return 0;
+}
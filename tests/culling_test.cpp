@@ -0,0 +1,76 @@
+// Checks the four wide box test against the one box at a time tests.
+
+#include "../source/culling.cpp"
+
+#include <assert.h>
+#include <stdio.h> // printf
+#include <vector> // std::vector
+
+static float random_float(unsigned *random)
+{
+  *random = *random * 1664525 + 1013904223;
+  return (float)(*random >> 8) / (float)(1 << 24);
+}
+
+static void test_boxes_match_single_tests()
+{
+  // A perspective frustum looking down -z, same handedness as the renderers
+  float n = 0.5f;
+  float f = 50.0f;
+  mat4 clip_m_view = mat4(1.0f, 0.0f, 0.0f,             0.0f,
+                          0.0f, 1.5f, 0.0f,             0.0f,
+                          0.0f, 0.0f, f / (n - f),      n * f / (n - f),
+                          0.0f, 0.0f, -1.0f,            0.0f);
+  Frustum frustum = make_frustum(clip_m_view);
+
+  // Count isn't a multiple of four so the leftovers are tested too
+  static const unsigned COUNT = 1003;
+  std::vector<float> center_x, center_y, center_z, extent_x, extent_y, extent_z;
+  unsigned random = 12345;
+  for(unsigned i = 0; i < COUNT; i++)
+  {
+    center_x.push_back(random_float(&random) * 120.0f - 60.0f);
+    center_y.push_back(random_float(&random) * 120.0f - 60.0f);
+    center_z.push_back(random_float(&random) * -70.0f + 10.0f);
+    extent_x.push_back(random_float(&random) * 3.0f);
+    extent_y.push_back(random_float(&random) * 3.0f);
+    extent_z.push_back(random_float(&random) * 3.0f);
+  }
+
+  std::vector<unsigned> visible(COUNT);
+  unsigned visible_count = frustum_test_boxes(&frustum, center_x.data(), center_y.data(), center_z.data(),
+                                              extent_x.data(), extent_y.data(), extent_z.data(), COUNT,
+                                              visible.data());
+
+  unsigned next = 0;
+  unsigned inside = 0;
+  for(unsigned i = 0; i < COUNT; i++)
+  {
+    BoundingBox box;
+    box.center = v3(center_x[i], center_y[i], center_z[i]);
+    box.extents = v3(extent_x[i], extent_y[i], extent_z[i]);
+
+    bool touches = frustum_test_box(&frustum, box);
+    assert(touches == (frustum_classify_box(&frustum, box, 0x3F) >= 0));
+    if(frustum_classify_box(&frustum, box, 0x3F) == 0) inside++;
+
+    // Visible indices come out in order
+    if(touches)
+    {
+      assert(next < visible_count && visible[next] == i);
+      next++;
+    }
+  }
+  assert(next == visible_count);
+
+  // Enough of each case to mean something
+  assert(visible_count > COUNT / 10 && visible_count < COUNT - COUNT / 10);
+  assert(inside > 0 && inside < visible_count);
+}
+
+int main()
+{
+  test_boxes_match_single_tests();
+  printf("culling_test: ok\n");
+  return 0;
+}
@@ -0,0 +1,321 @@
+// Checks the two slot snapshot queue keeps order and holds the producer back
+// while both slots are in use, the fixed timestep's accumulation and step cap,
+// that blending and simulating write reused snapshots completely, and that
+// stepping straight against the renderer runs the steps that are due.
+
+#include "../source/frame_pipeline.cpp"
+
+#include <assert.h>
+#include <stdio.h> // printf
+#include <math.h> // fabsf
+
+// graphics.h, only reached by init_simulation, apply_next_snapshot and
+// stop_frame_pipeline
+void capture_scene_snapshot(SceneSnapshot *snapshot)
+{
+  *snapshot = SceneSnapshot();
+}
+
+void apply_scene_snapshot(const SceneSnapshot *, std::vector<Model> *) {}
+void return_free_models(std::vector<Model> *free_models) { free_models->clear(); }
+
+static bool near(float a, float b)
+{
+  return fabsf(a - b) < 1.0e-5f;
+}
+
+static SceneModel make_model(unsigned generation, bool movable, v3 position)
+{
+  SceneModel model;
+  model.generation = generation;
+  model.live = true;
+  model.movable = movable;
+  model.position = position;
+  model.scale = v3(1.0f, 1.0f, 1.0f);
+  model.orientation = quat();
+  model.color = v4(1.0f, 1.0f, 1.0f, 1.0f);
+  return model;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Queue
+////////////////////////////////////////////////////////////////////////////////
+
+// Snapshots come out in the order they went in, each as it was written
+static void test_queue_order()
+{
+  static const unsigned SNAPSHOT_COUNT = 2000;
+  SnapshotQueue queue;
+
+  std::thread producer([&queue]()
+  {
+    for(unsigned i = 0; i < SNAPSHOT_COUNT; i++)
+    {
+      SceneSnapshot *snapshot = begin_snapshot(&queue);
+      assert(snapshot);
+      snapshot->steps = i;
+      snapshot->models.assign(i % 7, make_model(i, true, v3((float)i, 0.0f, 0.0f)));
+      assert(publish_snapshot(&queue));
+    }
+  });
+
+  for(unsigned i = 0; i < SNAPSHOT_COUNT; i++)
+  {
+    const SceneSnapshot *snapshot = acquire_snapshot(&queue);
+    assert(snapshot && snapshot->steps == i);
+    assert(snapshot->models.size() == i % 7);
+    for(unsigned j = 0; j < snapshot->models.size(); j++) assert(snapshot->models[j].generation == i);
+    release_snapshot(&queue);
+  }
+
+  producer.join();
+}
+
+// With both slots published the producer waits, and gets the first slot back
+// once it's released. The published ones aren't touched meanwhile.
+static void test_queue_back_pressure()
+{
+  SnapshotQueue queue;
+  SceneSnapshot *first = begin_snapshot(&queue);
+  first->steps = 1;
+  assert(publish_snapshot(&queue));
+  SceneSnapshot *second = begin_snapshot(&queue);
+  second->steps = 2;
+  assert(publish_snapshot(&queue));
+  assert(first != second);
+
+  std::atomic<SceneSnapshot *> third{0};
+  std::thread producer([&queue, &third]() { third = begin_snapshot(&queue); });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  assert(!third.load());
+
+  // Acquiring without releasing doesn't free anything either
+  const SceneSnapshot *acquired = acquire_snapshot(&queue);
+  assert(acquired == first && acquired->steps == 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  assert(!third.load());
+
+  release_snapshot(&queue);
+  producer.join();
+  assert(third.load() == first);
+  assert(second->steps == 2);
+
+  third.load()->steps = 3;
+  assert(publish_snapshot(&queue));
+  assert(acquire_snapshot(&queue)->steps == 2);
+  release_snapshot(&queue);
+  assert(acquire_snapshot(&queue)->steps == 3);
+  release_snapshot(&queue);
+}
+
+// Closing wakes a waiting consumer and a waiting producer
+static void test_queue_close()
+{
+  SnapshotQueue empty;
+  std::thread consumer([&empty]() { assert(!acquire_snapshot(&empty)); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  close_snapshot_queue(&empty);
+  consumer.join();
+
+  SnapshotQueue full;
+  for(unsigned i = 0; i < 2; i++)
+  {
+    assert(begin_snapshot(&full));
+    assert(publish_snapshot(&full));
+  }
+  std::thread producer([&full]() { assert(!begin_snapshot(&full)); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  close_snapshot_queue(&full);
+  producer.join();
+
+  // Publishing into a closed queue tells the producer to stop
+  SnapshotQueue closed;
+  assert(begin_snapshot(&closed));
+  close_snapshot_queue(&closed);
+  assert(!publish_snapshot(&closed));
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Timestep
+////////////////////////////////////////////////////////////////////////////////
+
+static void test_timestep_accumulation()
+{
+  // 64 steps a second keeps the sums exact
+  FixedTimestep timestep;
+  init_fixed_timestep(&timestep, 64.0f);
+  const double step = 1.0 / 64.0;
+
+  // Frames shorter than a step add up until one is due
+  assert(advance_fixed_timestep(&timestep, step / 4.0) == 0);
+  assert(fixed_timestep_alpha(&timestep) == 0.25f);
+  assert(advance_fixed_timestep(&timestep, step / 2.0) == 0);
+  assert(fixed_timestep_alpha(&timestep) == 0.75f);
+  assert(advance_fixed_timestep(&timestep, step / 2.0) == 1);
+  assert(fixed_timestep_alpha(&timestep) == 0.25f);
+
+  // Longer ones run several and keep the rest
+  assert(advance_fixed_timestep(&timestep, step * 3.0) == 3);
+  assert(fixed_timestep_alpha(&timestep) == 0.25f);
+  assert(advance_fixed_timestep(&timestep, step * 2.75) == 3);
+  assert(fixed_timestep_alpha(&timestep) == 0.0f);
+
+  // A second of frames at another rate adds up to a second of steps
+  unsigned steps = 0;
+  for(unsigned i = 0; i < 50; i++) steps += advance_fixed_timestep(&timestep, 1.0 / 50.0);
+  assert(steps == 64 || (steps == 63 && fixed_timestep_alpha(&timestep) > 0.99f));
+}
+
+static void test_timestep_cap()
+{
+  FixedTimestep timestep;
+  init_fixed_timestep(&timestep, 64.0f);
+  const double step = 1.0 / 64.0;
+
+  // Exactly the most is still all run
+  assert(advance_fixed_timestep(&timestep, step * MAX_STEPS_PER_FRAME) == MAX_STEPS_PER_FRAME);
+  assert(fixed_timestep_alpha(&timestep) == 0.0f);
+
+  // A hitch runs the most there can be and drops the rest, leftover included
+  assert(advance_fixed_timestep(&timestep, step * 0.5) == 0);
+  assert(advance_fixed_timestep(&timestep, 2.0) == MAX_STEPS_PER_FRAME);
+  assert(fixed_timestep_alpha(&timestep) == 0.0f);
+  assert(advance_fixed_timestep(&timestep, step * 0.5) == 0);
+  assert(fixed_timestep_alpha(&timestep) == 0.5f);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Blending and simulating
+////////////////////////////////////////////////////////////////////////////////
+
+static void test_blend_into_reused_snapshot()
+{
+  SceneSnapshot a;
+  SceneSnapshot b;
+  a.models.push_back(make_model(1, true, v3(0.0f, 0.0f, 0.0f)));
+  a.models.push_back(make_model(1, false, v3(0.0f, 0.0f, 0.0f)));
+  a.models.push_back(make_model(1, true, v3(0.0f, 0.0f, 0.0f)));
+  b.models.push_back(make_model(1, true, v3(4.0f, 0.0f, 0.0f)));
+  b.models.push_back(make_model(1, false, v3(4.0f, 0.0f, 0.0f))); // Static, not blended
+  b.models.push_back(make_model(2, true, v3(4.0f, 0.0f, 0.0f))); // Remade in between
+  b.models.push_back(make_model(1, true, v3(4.0f, 0.0f, 0.0f))); // New
+  a.camera_position = v3(0.0f, 0.0f, 0.0f);
+  b.camera_position = v3(0.0f, 8.0f, 0.0f);
+  a.camera_looking_direction = v3(1.0f, 0.0f, 0.0f);
+  b.camera_looking_direction = v3(-1.0f, 0.0f, 0.0f); // The blend passes through zero
+  b.steps = 12;
+  b.requests.cursor_locked = false;
+  SceneCommand command = {};
+  command.type = TRACE_SET_OCCLUSION_CULLING;
+  b.commands.push_back(command);
+
+  // Left over from a bigger earlier frame
+  SceneSnapshot result;
+  result.models.assign(10, make_model(9, true, v3(9.0f, 9.0f, 9.0f)));
+  result.commands.assign(5, SceneCommand());
+  result.steps = 99;
+
+  blend_scene_snapshots(&a, &b, 0.5f, &result);
+  assert(result.models.size() == 4);
+  assert(near(result.models[0].position.x, 2.0f) && result.models[0].generation == 1);
+  assert(result.models[1].position.x == 4.0f);
+  assert(result.models[2].position.x == 4.0f && result.models[2].generation == 2);
+  assert(result.models[3].position.x == 4.0f);
+  assert(near(result.camera_position.y, 4.0f));
+  assert(result.camera_looking_direction.x == -1.0f);
+  assert(result.steps == 12 && !result.requests.cursor_locked);
+  assert(result.commands.size() == 1 && result.commands[0].type == TRACE_SET_OCCLUSION_CULLING);
+}
+
+// Moves the camera a unit up per step and counts the mouse movement it saw
+static float seen_mouse_x;
+
+static void climb(const TraceInput *input, WorldRequests *, float)
+{
+  simulation_scene()->camera_position.y += 1.0f;
+  seen_mouse_x += input->mouse_delta.x;
+}
+
+static void test_simulate_frame()
+{
+  Simulation simulation;
+  init_simulation(&simulation, climb, 64.0f);
+  const double step = 1.0 / 64.0;
+  seen_mouse_x = 0.0f;
+
+  SceneSnapshot blended;
+  blended.models.assign(3, SceneModel());
+
+  // Input from frames with no step adds up for the next step
+  TraceInput input = {};
+  input.mouse_delta = v2(2.0f, 0.0f);
+  set_simulation_input(&simulation, &input);
+  simulate_frame(&simulation, step * 0.5, &blended);
+  assert(blended.steps == 0 && blended.camera_position.y == 0.0f && blended.models.empty());
+  set_simulation_input(&simulation, &input);
+
+  // Three steps, blended a quarter of the way from the second to the third.
+  // Only the first step got the mouse.
+  simulate_frame(&simulation, step * 2.75, &blended);
+  assert(blended.steps == 3 && simulation.scene.camera_position.y == 3.0f);
+  assert(simulation.previous.camera_position.y == 2.0f);
+  assert(near(blended.camera_position.y, 2.25f));
+  assert(seen_mouse_x == 4.0f);
+
+  // Calls made while simulating go with the frame that made them only
+  simulation.scene.commands.push_back(SceneCommand());
+  simulate_frame(&simulation, step * 0.25, &blended);
+  assert(blended.commands.empty());
+  assert(near(blended.camera_position.y, 2.5f));
+}
+
+// Counts steps that ran against the renderer rather than a simulation scene
+static unsigned direct_steps;
+
+static void step_directly(const TraceInput *, WorldRequests *requests, float)
+{
+  assert(!simulation_scene());
+  direct_steps++;
+  requests->cursor_locked = false;
+}
+
+// Captures run the steps that are due, not one a frame
+static void test_step_directly()
+{
+  Simulation simulation;
+  init_simulation(&simulation, step_directly, 64.0f);
+  const double step = 1.0 / 64.0;
+  direct_steps = 0;
+
+  assert(step_simulation_directly(&simulation, step * 0.5) == 0);
+  assert(step_simulation_directly(&simulation, step * 2.0) == 2);
+  assert(step_simulation_directly(&simulation, step * 0.5) == 1);
+  assert(direct_steps == 3 && simulation.scene.steps == 3);
+  assert(!simulation.scene.requests.cursor_locked);
+
+  // A faster rate runs more of them for the same time
+  Simulation faster;
+  init_simulation(&faster, step_directly, 128.0f);
+  assert(step_simulation_directly(&faster, step * 3.0) == 6);
+}
+
+int main()
+{
+  test_queue_order();
+  test_queue_back_pressure();
+  test_queue_close();
+  test_timestep_accumulation();
+  test_timestep_cap();
+  test_blend_into_reused_snapshot();
+  test_simulate_frame();
+  test_step_directly();
+  printf("frame_pipeline_test: ok\n");
+  return 0;
+}
@@ -0,0 +1,323 @@
+// Checks that a captured trace replays the same calls after a round trip
+// through a file, and that truncated or corrupt traces and files are turned
+// away with an error instead of being read past their end.
+
+#include "../source/frame_trace.cpp"
+
+#include <assert.h>
+#include <stdio.h> // printf, remove
+
+////////////////////////////////////////////////////////////////////////////////
+// graphics.h, counting what the replay calls
+////////////////////////////////////////////////////////////////////////////////
+
+struct ReplayedCalls
+{
+  unsigned models_made = 0;
+  unsigned static_models_made = 0;
+  unsigned models_destroyed = 0;
+  unsigned model_calls = 0;
+  unsigned settings = 0;
+  unsigned camera_calls = 0;
+
+  char last_name[64] = {};
+  v3 last_position;
+  Model last_model;
+  unsigned last_setting = 0;
+};
+
+static ReplayedCalls calls;
+
+static Model made_model(const char *model_name, v3 position)
+{
+  snprintf(calls.last_name, sizeof(calls.last_name), "%s", model_name);
+  calls.last_position = position;
+  Model model;
+  model.index = 100 + calls.models_made + calls.static_models_made;
+  return model;
+}
+
+Model create_model(const char *model_name, v3 position, v3, v3)
+{
+  Model model = made_model(model_name, position);
+  calls.models_made++;
+  return model;
+}
+
+Model create_static_model(const char *model_name, v3 position, v3, v3)
+{
+  Model model = made_model(model_name, position);
+  calls.static_models_made++;
+  return model;
+}
+
+void destroy_model(Model) { calls.models_destroyed++; }
+
+static void model_call(Model model)
+{
+  calls.last_model = model;
+  calls.model_calls++;
+}
+
+void set_model_position(Model model, v3 position) { model_call(model); calls.last_position = position; }
+void change_model_position(Model model, v3) { model_call(model); }
+void set_model_scale(Model model, v3) { model_call(model); }
+void change_model_scale(Model model, v3) { model_call(model); }
+void set_model_rotation(Model model, v3) { model_call(model); }
+void change_model_rotation(Model model, v3) { model_call(model); }
+void set_model_orientation(Model model, quat) { model_call(model); }
+void set_model_color(Model model, Color) { model_call(model); }
+
+void show_shadow_map_preview(bool) { calls.settings++; }
+void set_shadow_map_resolution(unsigned resolution) { calls.settings++; calls.last_setting = resolution; }
+void set_occlusion_culling(bool) { calls.settings++; }
+
+void set_camera_position(v3) { calls.camera_calls++; }
+void set_camera_looking_direction(v3) { calls.camera_calls++; }
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Tests
+////////////////////////////////////////////////////////////////////////////////
+
+static const char *TEST_FILE = "frame_trace_test.trc";
+
+static Model make_handle(unsigned index, unsigned generation)
+{
+  Model model;
+  model.index = index;
+  model.generation = generation;
+  return model;
+}
+
+// Two frames touching every kind of command
+static void capture_test_trace(FrameTrace *trace)
+{
+  start_trace_capture(trace);
+
+  TraceInput input = {};
+  input.keys[0] = 1 << 5;
+  trace_input(&input);
+  trace_create_model(TRACE_CREATE_MODEL, make_handle(0, 1), "assets/cube.obj", v3(1.0f, 2.0f, 3.0f), v3(1.0f, 1.0f, 1.0f), v3());
+  trace_create_model(TRACE_CREATE_STATIC_MODEL, make_handle(1, 1), "assets/floor.obj", v3(), v3(10.0f, 1.0f, 10.0f), v3());
+  trace_model_call(TRACE_SET_MODEL_POSITION, make_handle(0, 1), v3(4.0f, 5.0f, 6.0f));
+  trace_setting(TRACE_SET_SHADOW_MAP_RESOLUTION, 2048);
+  trace_camera_call(TRACE_SET_CAMERA_POSITION, v3(0.0f, 1.0f, 5.0f));
+  trace_end_frame();
+
+  trace_input(&input); // Unchanged, not written
+  trace_model_call(TRACE_SET_MODEL_COLOR, make_handle(0, 1), v4(1.0f, 0.0f, 0.0f, 1.0f));
+  trace_model_call(TRACE_CHANGE_MODEL_ROTATION, make_handle(0, 1), v3(0.0f, 0.1f, 0.0f));
+  trace_destroy_model(make_handle(0, 1));
+  trace_end_frame();
+
+  stop_trace_capture();
+}
+
+// Replays every frame there is, returning how many went through
+static unsigned replay_all(TraceReplay *replay, const FrameTrace *trace)
+{
+  calls = ReplayedCalls();
+  start_trace_replay(replay, trace);
+  unsigned frames = 0;
+  while(replay_trace_frame(replay)) frames++;
+  return frames;
+}
+
+static void test_round_trip()
+{
+  FrameTrace captured;
+  capture_test_trace(&captured);
+  assert(captured.frame_count == 2);
+  assert(write_trace_file(&captured, TEST_FILE));
+
+  FrameTrace trace;
+  assert(read_trace_file(&trace, TEST_FILE));
+  assert(trace.frame_count == 2 && trace.data == captured.data);
+
+  TraceReplay replay;
+  assert(replay_all(&replay, &trace) == 2);
+  assert(!replay.error);
+  assert(replay.input.keys[0] == 1 << 5);
+  assert(calls.models_made == 1 && calls.static_models_made == 1 && calls.models_destroyed == 1);
+  assert(calls.model_calls == 3 && calls.settings == 1 && calls.camera_calls == 1);
+  assert(!strcmp(calls.last_name, "assets/floor.obj"));
+  assert(calls.last_setting == 2048);
+
+  // Recorded handles map to the ones the replay made
+  assert(calls.last_model.index == 100);
+  assert(replay.models.size() == 2 && replay.models[1].index == 101);
+
+  // Done, and not an error
+  assert(!replay_trace_frame(&replay) && !replay.error);
+}
+
+// Cut anywhere, the replay stops with an error before the frames run out
+static void test_truncated_traces()
+{
+  FrameTrace captured;
+  capture_test_trace(&captured);
+
+  for(unsigned size = 0; size < captured.data.size(); size++)
+  {
+    FrameTrace trace;
+    trace.frame_count = captured.frame_count;
+    trace.data.assign(captured.data.begin(), captured.data.begin() + size);
+
+    TraceReplay replay;
+    unsigned frames = replay_all(&replay, &trace);
+    assert(frames < 2);
+    assert(replay.error);
+
+    // And stays stopped
+    assert(!replay_trace_frame(&replay));
+  }
+}
+
+static void push_unsigned(FrameTrace *trace, unsigned value)
+{
+  const unsigned char *bytes = (const unsigned char *)&value;
+  trace->data.insert(trace->data.end(), bytes, bytes + sizeof(value));
+}
+
+static void test_corrupt_traces()
+{
+  // A model name with no terminator before the end
+  {
+    FrameTrace trace;
+    trace.frame_count = 1;
+    trace.data.push_back(TRACE_CREATE_MODEL);
+    push_unsigned(&trace, 0);
+    push_unsigned(&trace, 1);
+    const char *name = "assets/cube.obj";
+    trace.data.insert(trace.data.end(), name, name + strlen(name));
+
+    TraceReplay replay;
+    assert(replay_all(&replay, &trace) == 0);
+    assert(replay.error && calls.models_made == 0);
+  }
+
+  // A model index no trace of this size could reach, nothing is allocated for it
+  {
+    FrameTrace trace;
+    trace.frame_count = 1;
+    trace.data.push_back(TRACE_CREATE_MODEL);
+    push_unsigned(&trace, 0xFFFFFFF0);
+    push_unsigned(&trace, 1);
+    trace.data.push_back('a');
+    trace.data.push_back(0);
+    for(unsigned i = 0; i < 9; i++) push_unsigned(&trace, 0);
+    trace.data.push_back(TRACE_END_FRAME);
+
+    TraceReplay replay;
+    assert(replay_all(&replay, &trace) == 0);
+    assert(replay.error && calls.models_made == 0 && replay.models.empty());
+  }
+
+  // A model used before it was made
+  {
+    FrameTrace trace;
+    trace.frame_count = 1;
+    trace.data.push_back(TRACE_SET_MODEL_POSITION);
+    push_unsigned(&trace, 3);
+    push_unsigned(&trace, 1);
+    for(unsigned i = 0; i < 3; i++) push_unsigned(&trace, 0);
+    trace.data.push_back(TRACE_END_FRAME);
+
+    TraceReplay replay;
+    assert(replay_all(&replay, &trace) == 0);
+    assert(replay.error && calls.model_calls == 0);
+  }
+
+  // A command that doesn't exist
+  {
+    FrameTrace trace;
+    trace.frame_count = 1;
+    trace.data.push_back(200);
+    trace.data.push_back(TRACE_END_FRAME);
+
+    TraceReplay replay;
+    assert(replay_all(&replay, &trace) == 0);
+    assert(replay.error);
+  }
+
+  // Any byte changed to anything either still replays or stops with an error
+  FrameTrace captured;
+  capture_test_trace(&captured);
+  for(unsigned i = 0; i < captured.data.size(); i++)
+  {
+    static const unsigned char values[] = {0, 1, 0x7F, 0xFF, TRACE_CREATE_MODEL, TRACE_END_FRAME};
+    for(unsigned j = 0; j < sizeof(values); j++)
+    {
+      FrameTrace trace = captured;
+      trace.data[i] = values[j];
+
+      TraceReplay replay;
+      unsigned frames = replay_all(&replay, &trace);
+      assert(frames <= 2);
+      assert(frames == 2 || replay.error);
+    }
+  }
+}
+
+static void write_raw_file(const unsigned *header, unsigned header_words, const FrameTrace *trace, unsigned data_size)
+{
+  FILE *file = fopen(TEST_FILE, "wb");
+  assert(file);
+  fwrite(header, sizeof(unsigned), header_words, file);
+  if(data_size) fwrite(trace->data.data(), data_size, 1, file);
+  fclose(file);
+}
+
+static void test_bad_files()
+{
+  FrameTrace captured;
+  capture_test_trace(&captured);
+  unsigned size = captured.data.size();
+  FrameTrace trace;
+
+  // The good one, written by hand the same way
+  unsigned header[4] = {TRACE_FILE_MAGIC, TRACE_FILE_VERSION, 2, size};
+  write_raw_file(header, 4, &captured, size);
+  assert(read_trace_file(&trace, TEST_FILE) && trace.data == captured.data);
+
+  // Cut short in the data and in the header
+  write_raw_file(header, 4, &captured, size - 1);
+  assert(!read_trace_file(&trace, TEST_FILE));
+  write_raw_file(header, 3, &captured, 0);
+  assert(!read_trace_file(&trace, TEST_FILE));
+
+  // A size far past the file, and trailing bytes the header doesn't cover
+  unsigned huge[4] = {TRACE_FILE_MAGIC, TRACE_FILE_VERSION, 2, 0xFFFFFFF0};
+  write_raw_file(huge, 4, &captured, size);
+  assert(!read_trace_file(&trace, TEST_FILE));
+  unsigned short_size[4] = {TRACE_FILE_MAGIC, TRACE_FILE_VERSION, 2, size - 4};
+  write_raw_file(short_size, 4, &captured, size);
+  assert(!read_trace_file(&trace, TEST_FILE));
+
+  // More frames than there are bytes, another file type, another version
+  unsigned too_many_frames[4] = {TRACE_FILE_MAGIC, TRACE_FILE_VERSION, size + 1, size};
+  write_raw_file(too_many_frames, 4, &captured, size);
+  assert(!read_trace_file(&trace, TEST_FILE));
+  unsigned bad_magic[4] = {0x12345678, TRACE_FILE_VERSION, 2, size};
+  write_raw_file(bad_magic, 4, &captured, size);
+  assert(!read_trace_file(&trace, TEST_FILE));
+  unsigned bad_version[4] = {TRACE_FILE_MAGIC, TRACE_FILE_VERSION + 1, 2, size};
+  write_raw_file(bad_version, 4, &captured, size);
+  assert(!read_trace_file(&trace, TEST_FILE));
+
+  // Not there at all
+  remove(TEST_FILE);
+  assert(!read_trace_file(&trace, TEST_FILE));
+}
+
+int main()
+{
+  test_round_trip();
+  test_truncated_traces();
+  test_corrupt_traces();
+  test_bad_files();
+  printf("frame_trace_test: ok\n");
+  return 0;
+}
@@ -0,0 +1,115 @@
+// Checks how models are grouped into instance batches and how their instance
+// data is packed.
+
+#include "../source/instancing.cpp"
+
+#include <assert.h>
+#include <stdio.h> // printf
+
+// Fake draw data, never dereferenced
+static Mesh *const MESH_A = (Mesh *)0x10;
+static Mesh *const MESH_B = (Mesh *)0x20;
+static Shader *const SHADER = (Shader *)0x30;
+static Texture *const TEXTURE_A = (Texture *)0x40;
+static Texture *const TEXTURE_B = (Texture *)0x50;
+
+// Only fills what batching reads
+static void add_model(ModelStorage *models, Mesh *mesh, Texture *texture, v3 position, v4 color)
+{
+  ModelDrawData draw;
+  draw.mesh = mesh;
+  draw.shader = SHADER;
+  draw.texture = texture;
+  models->draw_data.push_back(draw);
+
+  mat4 world_m_model = mat4(2.0f, 0.0f, 0.0f, position.x,
+                            0.0f, 3.0f, 0.0f, position.y,
+                            0.0f, 0.0f, 4.0f, position.z,
+                            0.0f, 0.0f, 0.0f, 1.0f);
+  models->world_matrices.push_back(world_m_model);
+  models->blend_colors.push_back(color);
+  models->count++;
+}
+
+static bool is_batch(const InstanceBatch &batch, unsigned model_index, unsigned first_instance, unsigned instance_count)
+{
+  return batch.model_index == model_index && batch.first_instance == first_instance &&
+         batch.instance_count == instance_count;
+}
+
+static void make_models(ModelStorage *models)
+{
+  add_model(models, MESH_A, TEXTURE_A, v3(1.0f, 2.0f, 3.0f), v4(1.0f, 0.0f, 0.0f, 1.0f));
+  add_model(models, MESH_A, TEXTURE_B, v3(4.0f, 5.0f, 6.0f), v4(0.0f, 1.0f, 0.0f, 1.0f));
+  add_model(models, MESH_B, TEXTURE_A, v3(7.0f, 8.0f, 9.0f), v4(0.0f, 0.0f, 1.0f, 1.0f));
+  add_model(models, MESH_A, TEXTURE_A, v3(10.0f, 11.0f, 12.0f), v4(1.0f, 1.0f, 1.0f, 0.5f));
+}
+
+static void test_grouping()
+{
+  ModelStorage models;
+  make_models(&models);
+  InstanceBatches out;
+
+  // Runs that share a mesh, whatever the texture
+  unsigned sorted[] = {0, 3, 1, 2};
+  build_instance_batches(&models, sorted, 4, false, &out);
+  assert(out.batches.size() == 2);
+  assert(is_batch(out.batches[0], 0, 0, 3));
+  assert(is_batch(out.batches[1], 2, 3, 1));
+
+  // Matching the material splits on the texture too
+  build_instance_batches(&models, sorted, 4, true, &out);
+  assert(out.batches.size() == 3);
+  assert(is_batch(out.batches[0], 0, 0, 2));
+  assert(is_batch(out.batches[1], 1, 2, 1));
+  assert(is_batch(out.batches[2], 2, 3, 1));
+
+  // Only neighbours are merged
+  unsigned unsorted[] = {0, 2, 3};
+  build_instance_batches(&models, unsorted, 3, false, &out);
+  assert(out.batches.size() == 3);
+  assert(is_batch(out.batches[2], 3, 2, 1));
+
+  build_instance_batches(&models, unsorted, 0, false, &out);
+  assert(out.batches.empty() && out.instances.empty());
+}
+
+static void test_packing()
+{
+  ModelStorage models;
+  make_models(&models);
+  InstanceBatches out;
+
+  unsigned items[] = {3, 0, 2};
+  build_instance_batches(&models, items, 3, false, &out);
+  assert(out.instances.size() == 3);
+
+  // Instances follow the order of items, top three rows of the matrix
+  for(unsigned i = 0; i < 3; i++)
+  {
+    const InstanceData *instance = &out.instances[i];
+    const mat4 &world_m_model = models.world_matrices[items[i]];
+    for(unsigned row = 0; row < 3; row++)
+    {
+      assert(instance->world_m_model[row].x == world_m_model[row][0]);
+      assert(instance->world_m_model[row].y == world_m_model[row][1]);
+      assert(instance->world_m_model[row].z == world_m_model[row][2]);
+      assert(instance->world_m_model[row].w == world_m_model[row][3]);
+    }
+    assert(instance->color.x == models.blend_colors[items[i]].x);
+    assert(instance->color.w == models.blend_colors[items[i]].w);
+  }
+
+  assert(out.instances[0].world_m_model[0].w == 10.0f);
+  assert(out.instances[0].world_m_model[2].z == 4.0f);
+  assert(out.instances[0].color.w == 0.5f);
+}
+
+int main()
+{
+  test_grouping();
+  test_packing();
+  printf("instancing_test: ok\n");
+  return 0;
+}
@@ -0,0 +1,278 @@
+// Stresses the job system: many small jobs overflowing the deques, nested
+// parallel_for, jobs that wait on jobs they queued, continuation chains and
+// jobs handed in from threads that aren't workers, with more workers than
+// cores. Every piece of work has to run exactly once.
+
+#include "../source/job_system.cpp"
+
+#include <assert.h>
+#include <stdio.h> // printf
+#include <thread> // std::thread
+#include <vector>
+
+// One count per piece of work
+struct RunCounts
+{
+  std::vector<std::atomic<unsigned>> counts;
+
+  explicit RunCounts(unsigned size) : counts(size)
+  {
+    for(unsigned i = 0; i < size; i++) counts[i].store(0);
+  }
+};
+
+static void check_ran_once(const RunCounts *runs)
+{
+  for(unsigned i = 0; i < runs->counts.size(); i++) assert(runs->counts[i].load() == 1);
+}
+
+struct CountJob
+{
+  RunCounts *runs;
+  unsigned index;
+};
+
+static void count_job(void *data)
+{
+  CountJob *job = (CountJob *)data;
+  job->runs->counts[job->index].fetch_add(1);
+}
+
+// More jobs than a deque holds, queued in one go and in small batches
+static void test_many_small_jobs()
+{
+  static const unsigned JOB_COUNT = JOB_DEQUE_SIZE * 3;
+  RunCounts runs(JOB_COUNT);
+  std::vector<CountJob> data(JOB_COUNT);
+  std::vector<Job> jobs(JOB_COUNT);
+  for(unsigned i = 0; i < JOB_COUNT; i++)
+  {
+    data[i].runs = &runs;
+    data[i].index = i;
+    jobs[i].function = count_job;
+    jobs[i].data = &data[i];
+  }
+
+  JobCounter counter;
+  run_jobs(jobs.data(), JOB_COUNT, &counter);
+  wait_for_counter(&counter);
+  assert(counter.remaining.load() == 0);
+  check_ran_once(&runs);
+
+  RunCounts batched_runs(JOB_COUNT);
+  for(unsigned i = 0; i < JOB_COUNT; i++) data[i].runs = &batched_runs;
+  JobCounter batched_counter;
+  for(unsigned i = 0; i < JOB_COUNT; i += 7)
+  {
+    run_jobs(&jobs[i], i + 7 < JOB_COUNT ? 7 : JOB_COUNT - i, &batched_counter);
+  }
+  wait_for_counter(&batched_counter);
+  check_ran_once(&batched_runs);
+}
+
+struct Grid
+{
+  unsigned width;
+  RunCounts *runs;
+};
+
+struct GridRow
+{
+  const Grid *grid;
+  unsigned row;
+};
+
+static void count_cells(void *data, unsigned first, unsigned end)
+{
+  GridRow *row = (GridRow *)data;
+  for(unsigned x = first; x < end; x++) row->grid->runs->counts[row->row * row->grid->width + x].fetch_add(1);
+}
+
+static void count_rows(void *data, unsigned first, unsigned end)
+{
+  Grid *grid = (Grid *)data;
+  for(unsigned y = first; y < end; y++)
+  {
+    GridRow row = {grid, y};
+    parallel_for(grid->width, 16, count_cells, &row);
+  }
+}
+
+// Every row's parallel_for waits inside a job of the outer one
+static void test_nested_parallel_for()
+{
+  static const unsigned WIDTH = 1000;
+  static const unsigned HEIGHT = 64;
+  RunCounts runs(WIDTH * HEIGHT);
+  Grid grid = {WIDTH, &runs};
+  parallel_for(HEIGHT, 1, count_rows, &grid);
+  check_ran_once(&runs);
+
+  // Fewer items than the grain and none at all
+  RunCounts few(3);
+  Grid small = {3, &few};
+  parallel_for(1, 1, count_rows, &small);
+  check_ran_once(&few);
+  parallel_for(0, 1, count_rows, &grid);
+}
+
+// A tree of jobs, each queueing its children on its own counter and waiting
+static const unsigned TREE_FANOUT = 4;
+static const unsigned TREE_DEPTH = 5;
+
+struct TreeJob
+{
+  RunCounts *runs;
+  unsigned node; // Heap order, children of n are n * fanout + 1 onwards
+  unsigned depth;
+};
+
+static void tree_job(void *data)
+{
+  TreeJob *job = (TreeJob *)data;
+  job->runs->counts[job->node].fetch_add(1);
+  if(job->depth + 1 == TREE_DEPTH) return;
+
+  TreeJob children[TREE_FANOUT];
+  Job jobs[TREE_FANOUT];
+  for(unsigned i = 0; i < TREE_FANOUT; i++)
+  {
+    children[i].runs = job->runs;
+    children[i].node = job->node * TREE_FANOUT + 1 + i;
+    children[i].depth = job->depth + 1;
+    jobs[i].function = tree_job;
+    jobs[i].data = &children[i];
+  }
+
+  JobCounter counter;
+  run_jobs(jobs, TREE_FANOUT, &counter);
+  wait_for_counter(&counter);
+}
+
+static unsigned tree_size()
+{
+  unsigned size = 0;
+  for(unsigned depth = 0, level = 1; depth < TREE_DEPTH; depth++, level *= TREE_FANOUT) size += level;
+  return size;
+}
+
+static void test_nested_waits()
+{
+  RunCounts runs(tree_size());
+  TreeJob root = {&runs, 0, 0};
+  Job job = {tree_job, &root, 0};
+  JobCounter counter;
+  run_jobs(&job, 1, &counter);
+  wait_for_counter(&counter);
+  check_ran_once(&runs);
+}
+
+// Each link checks every link before it has finished
+static const unsigned CHAIN_LENGTH = 200;
+
+struct ChainLink
+{
+  std::atomic<unsigned> *finished;
+  unsigned index;
+};
+
+static void chain_job(void *data)
+{
+  ChainLink *link = (ChainLink *)data;
+  assert(link->finished->load() == link->index);
+  link->finished->fetch_add(1);
+}
+
+static void test_continuations()
+{
+  std::atomic<unsigned> finished(0);
+  std::vector<ChainLink> links(CHAIN_LENGTH);
+  std::vector<JobCounter> counters(CHAIN_LENGTH);
+  for(unsigned i = 0; i < CHAIN_LENGTH; i++)
+  {
+    links[i].finished = &finished;
+    links[i].index = i;
+  }
+
+  // Link i runs once the counter of link i - 1 is done. Set from the end, a
+  // counter can't have anything counted on it yet when it gets its continuation.
+  for(unsigned i = CHAIN_LENGTH - 1; i > 0; i--)
+  {
+    Job next = {chain_job, &links[i], &counters[i]};
+    set_continuation(&counters[i - 1], next);
+  }
+  Job first = {chain_job, &links[0], 0};
+  run_jobs(&first, 1, &counters[0]);
+
+  // The last counter was counted when its link was chained, so it covers the
+  // whole chain
+  wait_for_counter(&counters[CHAIN_LENGTH - 1]);
+  assert(finished.load() == CHAIN_LENGTH);
+}
+
+// Threads that aren't workers queue jobs and wait on them at the same time as
+// the main thread
+static void test_outside_threads()
+{
+  static const unsigned THREAD_COUNT = 3;
+  static const unsigned JOBS_PER_THREAD = 2000;
+  RunCounts runs(THREAD_COUNT * JOBS_PER_THREAD);
+
+  std::vector<std::thread> threads;
+  for(unsigned t = 0; t < THREAD_COUNT; t++)
+  {
+    threads.push_back(std::thread([&runs, t]()
+    {
+      std::vector<CountJob> data(JOBS_PER_THREAD);
+      std::vector<Job> jobs(JOBS_PER_THREAD);
+      for(unsigned i = 0; i < JOBS_PER_THREAD; i++)
+      {
+        data[i].runs = &runs;
+        data[i].index = t * JOBS_PER_THREAD + i;
+        jobs[i].function = count_job;
+        jobs[i].data = &data[i];
+      }
+
+      // A few at a time so the main thread's work is mixed in
+      JobCounter counter;
+      for(unsigned i = 0; i < JOBS_PER_THREAD; i += 50) run_jobs(&jobs[i], 50, &counter);
+      wait_for_counter(&counter);
+    }));
+  }
+
+  test_nested_parallel_for();
+  for(unsigned t = 0; t < THREAD_COUNT; t++) threads[t].join();
+  check_ran_once(&runs);
+}
+
+static void run_all()
+{
+  test_many_small_jobs();
+  test_nested_parallel_for();
+  test_nested_waits();
+  test_continuations();
+  test_outside_threads();
+}
+
+int main()
+{
+  // Before init everything runs right away on this thread
+  assert(job_worker_count() == 1);
+  test_many_small_jobs();
+  test_nested_parallel_for();
+  test_nested_waits();
+  test_continuations();
+
+  // Just the main thread, a few workers, and far more than there are cores
+  static const unsigned worker_counts[] = {1, 4, JOB_MAX_WORKERS};
+  for(unsigned i = 0; i < sizeof(worker_counts) / sizeof(worker_counts[0]); i++)
+  {
+    init_job_system(worker_counts[i]);
+    assert(job_worker_count() == worker_counts[i]);
+    for(unsigned round = 0; round < 20; round++) run_all();
+    shutdown_job_system();
+  }
+
+  printf("job_system_test: ok\n");
+  return 0;
+}
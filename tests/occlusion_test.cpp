@@ -0,0 +1,183 @@
+// Checks that boxes behind an occluder are hidden and ones in front or beside
+// it aren't, that flagged models are kept without testing, and that occluders
+// are picked by screen covered per triangle within the budget.
+
+#include "../source/model_storage.cpp"
+#include "../source/culling.cpp"
+#include "../source/occlusion.cpp"
+
+#include <assert.h>
+#include <stdio.h> // printf
+
+static const float NEAR_PLANE = 0.5f;
+
+// Camera at the origin looking down -z, infinite far plane like the renderer's.
+// Depth comes out as 1 - near / distance.
+static mat4 make_test_projection()
+{
+  float y_scale = 1.0f / tanf(deg_to_rad(60.0f) / 2.0f);
+  return mat4(y_scale / 2.0f, 0.0f,    0.0f,  0.0f,
+              0.0f,           y_scale, 0.0f,  0.0f,
+              0.0f,           0.0f,    -1.0f, -NEAR_PLANE,
+              0.0f,           0.0f,    -1.0f, 0.0f);
+}
+
+static BoundingBox make_box(v3 center, v3 extents)
+{
+  BoundingBox box;
+  box.center = center;
+  box.extents = extents;
+  return box;
+}
+
+// A rectangle facing the camera at distance, counter clockwise seen from the
+// origin. Flipped, it faces away. Not square so the diagonal doesn't run
+// through pixel centers, which neither triangle would claim.
+static void draw_wall(OcclusionBuffer *buffer, float distance, float half_size, bool flipped)
+{
+  float half_height = half_size * 0.9f;
+  v3 positions[4] = {v3(-half_size, -half_height, -distance), v3(half_size, -half_height, -distance),
+                     v3(half_size, half_height, -distance), v3(-half_size, half_height, -distance)};
+  unsigned front[6] = {0, 1, 2, 0, 2, 3};
+  unsigned back[6] = {0, 2, 1, 0, 3, 2};
+  draw_occluder(buffer, mat4(), positions, sizeof(v3), flipped ? back : front, 6);
+}
+
+static void test_hidden_behind_wall()
+{
+  OcclusionBuffer buffer;
+  clear_occlusion_buffer(&buffer, make_test_projection());
+
+  // Nothing drawn hides nothing
+  assert(occlusion_test_box(&buffer, make_box(v3(0.0f, 0.0f, -30.0f), v3(1.0f, 1.0f, 1.0f))));
+
+  // Wider than the screen at 10 units away
+  draw_wall(&buffer, 10.0f, 20.0f, false);
+  assert(buffer.triangles_drawn == 2);
+
+  // Every subtile got filled by the two triangles together
+  float wall_depth = 1.0f - NEAR_PLANE / 10.0f;
+  for(unsigned i = 0; i < buffer.far_depth.size(); i++)
+  {
+    assert(buffer.far_depth[i] <= wall_depth + 1.0e-4f);
+  }
+
+  assert(!occlusion_test_box(&buffer, make_box(v3(0.0f, 0.0f, -30.0f), v3(1.0f, 1.0f, 1.0f))));
+  assert(!occlusion_test_box(&buffer, make_box(v3(3.0f, -2.0f, -50.0f), v3(2.0f, 2.0f, 2.0f))));
+
+  // In front of the wall, poking through it, and reaching the camera
+  assert(occlusion_test_box(&buffer, make_box(v3(0.0f, 0.0f, -5.0f), v3(1.0f, 1.0f, 1.0f))));
+  assert(occlusion_test_box(&buffer, make_box(v3(0.0f, 0.0f, -12.0f), v3(1.0f, 1.0f, 3.0f))));
+  assert(occlusion_test_box(&buffer, make_box(v3(0.0f, 0.0f, -1.0f), v3(1.0f, 1.0f, 2.0f))));
+}
+
+static void test_partial_wall()
+{
+  OcclusionBuffer buffer;
+  clear_occlusion_buffer(&buffer, make_test_projection());
+
+  // Covers the middle of the screen only, a box far off to the side shows
+  draw_wall(&buffer, 10.0f, 1.0f, false);
+  assert(!occlusion_test_box(&buffer, make_box(v3(0.0f, 0.0f, -40.0f), v3(1.0f, 1.0f, 1.0f))));
+  assert(occlusion_test_box(&buffer, make_box(v3(20.0f, 0.0f, -40.0f), v3(1.0f, 1.0f, 1.0f))));
+}
+
+static void test_skipped_faces()
+{
+  OcclusionBuffer buffer;
+  clear_occlusion_buffer(&buffer, make_test_projection());
+
+  // A wall facing away and one crossing the near plane hide nothing
+  draw_wall(&buffer, 10.0f, 20.0f, true);
+  v3 positions[3] = {v3(-5.0f, -5.0f, 1.0f), v3(5.0f, -5.0f, -10.0f), v3(0.0f, 5.0f, -10.0f)};
+  unsigned indices[3] = {0, 1, 2};
+  draw_occluder(&buffer, mat4(), positions, sizeof(v3), indices, 3);
+
+  assert(buffer.triangles_drawn == 0);
+  assert(occlusion_test_box(&buffer, make_box(v3(0.0f, 0.0f, -30.0f), v3(1.0f, 1.0f, 1.0f))));
+}
+
+static unsigned add_box(ModelStorage *models, v3 position)
+{
+  Model model = add_model(models);
+  unsigned index = model_index(models, model);
+  models->positions[index] = position;
+  models->local_bounds[index].center = v3();
+  models->local_bounds[index].extents = v3(1.0f, 1.0f, 1.0f);
+  return index;
+}
+
+static void test_cull_models()
+{
+  ModelStorage models;
+  unsigned in_front = add_box(&models, v3(0.0f, 0.0f, -5.0f));
+  unsigned behind = add_box(&models, v3(0.0f, 0.0f, -30.0f));
+  unsigned also_behind = add_box(&models, v3(2.0f, 1.0f, -40.0f));
+  unsigned flagged = add_box(&models, v3(-2.0f, 0.0f, -20.0f));
+  update_world_transforms(&models);
+
+  OcclusionBuffer buffer;
+  clear_occlusion_buffer(&buffer, make_test_projection());
+  draw_wall(&buffer, 10.0f, 20.0f, false);
+
+  std::vector<unsigned char> skip(models.count, 0);
+  skip[flagged] = 1;
+
+  std::vector<unsigned> visible;
+  visible.push_back(behind);
+  visible.push_back(in_front);
+  visible.push_back(flagged);
+  visible.push_back(also_behind);
+  assert(occlusion_cull_models(&buffer, &models, &skip, &visible) == 2);
+
+  // What's left keeps its order
+  assert(visible.size() == 2 && visible[0] == in_front && visible[1] == flagged);
+}
+
+static Occluder make_occluder(v3 center, float extent, unsigned triangle_count, unsigned id)
+{
+  Occluder occluder;
+  occluder.bounds = make_box(center, v3(extent, extent, extent));
+  occluder.triangle_count = triangle_count;
+  occluder.id = id;
+  return occluder;
+}
+
+static void test_select_occluders()
+{
+  std::vector<Occluder> candidates;
+
+  // Too small on screen to be worth it
+  candidates.push_back(make_occluder(v3(0.0f, 0.0f, -100.0f), 1.0f, 12, 0));
+
+  // Same size, the cheaper one goes first
+  candidates.push_back(make_occluder(v3(0.0f, 0.0f, -10.0f), 2.0f, 1000, 1));
+  candidates.push_back(make_occluder(v3(5.0f, 0.0f, -10.0f), 2.0f, 12, 2));
+
+  // Around the camera fills the screen
+  candidates.push_back(make_occluder(v3(0.0f, 0.0f, -1.0f), 3.0f, 12, 3));
+
+  // Doesn't fit after the ones before it, but the worse one after it still does
+  candidates.push_back(make_occluder(v3(0.0f, 0.0f, -5.0f), 4.0f, OCCLUDER_TRIANGLE_BUDGET - 5, 4));
+  candidates.push_back(make_occluder(v3(0.0f, 0.0f, -12.0f), 1.0f, 2000, 5));
+
+  select_occluders(make_test_projection(), &candidates);
+
+  assert(candidates.size() == 4);
+  assert(candidates[0].id == 3 && candidates[0].screen_size == 1.0f);
+  assert(candidates[1].id == 2);
+  assert(candidates[2].id == 1);
+  assert(candidates[3].id == 5);
+  assert(candidates[1].screen_size == candidates[2].screen_size);
+}
+
+int main()
+{
+  test_hidden_behind_wall();
+  test_partial_wall();
+  test_skipped_faces();
+  test_cull_models();
+  test_select_occluders();
+  printf("occlusion_test: ok\n");
+  return 0;
+}
@@ -0,0 +1,242 @@
+// Checks which passes the render graph culls, which transients reuse a
+// physical texture, and that recompiling keeps the textures it can.
+
+#include "../source/render_graph.cpp"
+
+#include <stdio.h> // printf
+
+// Hands out dummy handles and counts them
+struct CountingGraphBackend : RenderGraphBackend
+{
+  unsigned long long next_handle = 1;
+  unsigned live = 0;
+
+  void *create_texture(const RenderGraphTextureDesc &)
+  {
+    live++;
+    return (void *)next_handle++;
+  }
+
+  void destroy_texture(void *) { live--; }
+};
+
+// Passes append their index here when they run
+static std::vector<unsigned> executed;
+
+static void run_pass(void *user_data)
+{
+  executed.push_back((unsigned)(unsigned long long)user_data);
+}
+
+static unsigned add_pass(RenderGraph *graph, const char *name)
+{
+  unsigned pass = graph->passes.size();
+  return graph_add_pass(graph, name, run_pass, (void *)(unsigned long long)pass);
+}
+
+static bool executed_passes(const unsigned *passes, unsigned count)
+{
+  if(executed.size() != count) return false;
+  for(unsigned i = 0; i < count; i++)
+  {
+    if(executed[i] != passes[i]) return false;
+  }
+  return true;
+}
+
+static const RenderGraphTextureDesc SCREEN_DESC = {800, 600, 28, 4};
+
+static void test_culling_and_reuse()
+{
+  CountingGraphBackend backend;
+  RenderGraph graph;
+  init_render_graph(&graph, &backend);
+
+  unsigned back_buffer = graph_import_texture(&graph, "back buffer", (void *)0xB0, true);
+  unsigned a = graph_create_texture(&graph, "a", SCREEN_DESC);
+  unsigned b = graph_create_texture(&graph, "b", SCREEN_DESC);
+  unsigned c = graph_create_texture(&graph, "c", SCREEN_DESC);
+  unsigned d = graph_create_texture(&graph, "d", SCREEN_DESC);
+  unsigned f = graph_create_texture(&graph, "f", SCREEN_DESC);
+
+  unsigned depth = add_pass(&graph, "depth");
+  graph_write(&graph, depth, a);
+
+  unsigned lighting = add_pass(&graph, "lighting");
+  graph_read(&graph, lighting, a);
+  graph_write(&graph, lighting, b);
+
+  unsigned tonemap = add_pass(&graph, "tonemap");
+  graph_read(&graph, tonemap, b);
+  graph_write(&graph, tonemap, c);
+
+  // Nothing reads d
+  unsigned debug = add_pass(&graph, "debug");
+  graph_read(&graph, debug, a);
+  graph_write(&graph, debug, d);
+
+  // Only needed by overlay
+  unsigned overlay_prep = add_pass(&graph, "overlay prep");
+  graph_write(&graph, overlay_prep, f);
+
+  unsigned present = add_pass(&graph, "present");
+  graph_read(&graph, present, c);
+  graph_write(&graph, present, back_buffer);
+
+  unsigned overlay = add_pass(&graph, "overlay");
+  graph_read(&graph, overlay, f);
+  graph_write(&graph, overlay, back_buffer);
+  graph_enable_pass(&graph, overlay, false);
+
+  executed.clear();
+  execute_render_graph(&graph);
+  assert(!graph.dirty);
+
+  unsigned expected[] = {depth, lighting, tonemap, present};
+  assert(executed_passes(expected, 4));
+  assert(graph.passes[debug].culled && graph.passes[overlay_prep].culled && graph.passes[overlay].culled);
+
+  // a is done before c is first written, so they share. b overlaps both.
+  assert(graph.physical_textures.size() == 2 && backend.live == 2);
+  assert(graph.resources[a].physical == graph.resources[c].physical);
+  assert(graph.resources[b].physical != graph.resources[a].physical);
+  assert(graph_texture(&graph, a) == graph_texture(&graph, c));
+  assert(graph_texture(&graph, a) != graph_texture(&graph, b));
+  assert(graph_texture(&graph, d) == 0 && graph_texture(&graph, f) == 0);
+  assert(graph_texture(&graph, back_buffer) == (void *)0xB0);
+  assert(render_graph_texture_bytes(&graph) == 2ull * 800 * 600 * 4);
+
+  // Lifetimes only count passes that run
+  assert(graph.resources[a].first_pass == depth && graph.resources[a].last_pass == lighting);
+  assert(graph.resources[c].first_pass == tonemap && graph.resources[c].last_pass == present);
+
+  // Running again without changes doesn't recompile
+  executed.clear();
+  execute_render_graph(&graph);
+  assert(executed_passes(expected, 4));
+  assert(backend.next_handle == 3);
+
+  // Enabling overlay brings back overlay prep, and f fits in b's texture.
+  // Recompiling reuses both textures instead of making new ones.
+  void *a_texture = graph_texture(&graph, a);
+  void *b_texture = graph_texture(&graph, b);
+  graph_enable_pass(&graph, overlay, true);
+  assert(graph.dirty);
+  executed.clear();
+  execute_render_graph(&graph);
+
+  unsigned expected_overlay[] = {depth, lighting, tonemap, overlay_prep, present, overlay};
+  assert(executed_passes(expected_overlay, 6));
+  assert(graph.passes[debug].culled);
+  assert(graph.physical_textures.size() == 2 && backend.live == 2);
+  assert(graph.resources[f].physical == graph.resources[b].physical);
+  assert(backend.next_handle == 3);
+  assert((graph_texture(&graph, a) == a_texture && graph_texture(&graph, b) == b_texture) ||
+         (graph_texture(&graph, a) == b_texture && graph_texture(&graph, b) == a_texture));
+
+  destroy_render_graph(&graph);
+  assert(backend.live == 0);
+}
+
+static void test_different_descs_dont_share()
+{
+  CountingGraphBackend backend;
+  RenderGraph graph;
+  init_render_graph(&graph, &backend);
+
+  RenderGraphTextureDesc half_desc = SCREEN_DESC;
+  half_desc.width /= 2;
+  half_desc.height /= 2;
+
+  unsigned back_buffer = graph_import_texture(&graph, "back buffer", 0, true);
+  unsigned full = graph_create_texture(&graph, "full", SCREEN_DESC);
+  unsigned half = graph_create_texture(&graph, "half", half_desc);
+
+  unsigned first = add_pass(&graph, "first");
+  graph_write(&graph, first, full);
+
+  unsigned second = add_pass(&graph, "second");
+  graph_read(&graph, second, full);
+  graph_write(&graph, second, back_buffer);
+
+  unsigned third = add_pass(&graph, "third");
+  graph_write(&graph, third, half);
+
+  unsigned fourth = add_pass(&graph, "fourth");
+  graph_read(&graph, fourth, half);
+  graph_write(&graph, fourth, back_buffer);
+
+  compile_render_graph(&graph);
+  assert(graph.physical_textures.size() == 2);
+  assert(graph.resources[full].physical != graph.resources[half].physical);
+  assert(render_graph_texture_bytes(&graph) == 800ull * 600 * 4 + 400ull * 300 * 4);
+
+  destroy_render_graph(&graph);
+  assert(backend.live == 0);
+}
+
+// Textures are kept across recompiles by description. The ones that no longer
+// fit anything are freed and new descriptions get new textures.
+static void test_recompile_keeps_textures()
+{
+  CountingGraphBackend backend;
+  RenderGraph graph;
+  init_render_graph(&graph, &backend);
+
+  RenderGraphTextureDesc small_desc = SCREEN_DESC;
+  small_desc.width = 256;
+  small_desc.height = 256;
+
+  unsigned back_buffer = graph_import_texture(&graph, "back buffer", 0, true);
+  unsigned shadow = graph_create_texture(&graph, "shadow", small_desc);
+  unsigned bloom = graph_create_texture(&graph, "bloom", SCREEN_DESC);
+
+  unsigned shadow_pass = add_pass(&graph, "shadow");
+  graph_write(&graph, shadow_pass, shadow);
+
+  unsigned bloom_pass = add_pass(&graph, "bloom");
+  graph_write(&graph, bloom_pass, bloom);
+
+  unsigned main_pass = add_pass(&graph, "main");
+  graph_read(&graph, main_pass, shadow);
+  graph_write(&graph, main_pass, back_buffer);
+
+  unsigned composite = add_pass(&graph, "composite");
+  graph_read(&graph, composite, bloom);
+  graph_write(&graph, composite, back_buffer);
+
+  compile_render_graph(&graph);
+  assert(backend.live == 2 && backend.next_handle == 3);
+  void *shadow_texture = graph_texture(&graph, shadow);
+
+  // Dropping bloom frees only its texture, the shadow map stays put
+  graph_enable_pass(&graph, composite, false);
+  compile_render_graph(&graph);
+  assert(graph.passes[bloom_pass].culled);
+  assert(backend.live == 1 && backend.next_handle == 3);
+  assert(graph_texture(&graph, shadow) == shadow_texture);
+  assert(render_graph_texture_bytes(&graph) == 256ull * 256 * 4);
+
+  // Bringing it back has to make a new one
+  graph_enable_pass(&graph, composite, true);
+  compile_render_graph(&graph);
+  assert(backend.live == 2 && backend.next_handle == 4);
+  assert(graph_texture(&graph, shadow) == shadow_texture);
+
+  // Recompiling with nothing changed creates nothing
+  graph.dirty = true;
+  execute_render_graph(&graph);
+  assert(backend.live == 2 && backend.next_handle == 4);
+
+  destroy_render_graph(&graph);
+  assert(backend.live == 0);
+}
+
+int main()
+{
+  test_culling_and_reuse();
+  test_different_descs_dont_share();
+  test_recompile_keeps_textures();
+  printf("render_graph_test: ok\n");
+  return 0;
+}
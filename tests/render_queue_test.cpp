@@ -0,0 +1,115 @@
+// Checks the radix sorted render queue against std::stable_sort, and that keys
+// order by their fields.
+
+#include "../source/render_queue.cpp"
+
+#include <assert.h>
+#include <stdio.h> // printf
+#include <algorithm> // std::stable_sort
+
+struct KeyedItem
+{
+  SortKey key;
+  unsigned item;
+};
+
+static bool key_less(const KeyedItem &a, const KeyedItem &b)
+{
+  return a.key < b.key;
+}
+
+static unsigned long long random_bits(unsigned long long *random)
+{
+  *random = *random * 6364136223846793005ull + 1442695040888963407ull;
+  return *random;
+}
+
+// Pushes count keys made by picking from the bits of random numbers with mask,
+// items numbered in push order, then compares with a stable sort of the same
+static void check_sort(unsigned count, SortKey mask, unsigned long long seed)
+{
+  RenderQueue queue;
+  std::vector<KeyedItem> expected;
+  unsigned long long random = seed;
+  for(unsigned i = 0; i < count; i++)
+  {
+    SortKey key = random_bits(&random) & mask;
+    push_render_item(&queue, key, i);
+    expected.push_back({key, i});
+  }
+
+  sort_render_queue(&queue);
+  std::stable_sort(expected.begin(), expected.end(), key_less);
+
+  assert(queue.keys.size() == count && queue.items.size() == count);
+  for(unsigned i = 0; i < count; i++)
+  {
+    assert(queue.keys[i] == expected[i].key);
+    assert(queue.items[i] == expected[i].item);
+  }
+}
+
+static void test_sort_matches_stable_sort()
+{
+  check_sort(0, ~0ull, 1);
+  check_sort(1, ~0ull, 2);
+  check_sort(2, ~0ull, 3);
+
+  // Every byte differs, so every pass runs
+  check_sort(10000, ~0ull, 4);
+
+  // A handful of distinct keys, lots of ties whose push order must survive
+  check_sort(10000, 0x0300000000000007ull, 5);
+
+  // Only some bytes differ, so an odd number of passes can run
+  check_sort(5000, 0x00000000FF000000ull, 6);
+  check_sort(5000, 0x00FF0000FF00FF00ull, 7);
+
+  // All keys the same, nothing moves
+  check_sort(1000, 0ull, 8);
+}
+
+static void test_queue_reuse()
+{
+  RenderQueue queue;
+  push_render_item(&queue, 5, 0);
+  push_render_item(&queue, 1, 1);
+  sort_render_queue(&queue);
+  assert(queue.items[0] == 1 && queue.items[1] == 0);
+
+  clear_render_queue(&queue);
+  assert(queue.keys.empty() && queue.items.empty());
+  push_render_item(&queue, 7, 2);
+  push_render_item(&queue, 3, 3);
+  push_render_item(&queue, 7, 4);
+  sort_render_queue(&queue);
+  assert(queue.items[0] == 3 && queue.items[1] == 2 && queue.items[2] == 4);
+}
+
+static void test_key_fields()
+{
+  // Earlier fields win over later ones
+  assert(make_sort_key(0, 9, 9, 9, 100.0f) < make_sort_key(1, 0, 0, 0, 0.0f));
+  assert(make_sort_key(0, 1, 9, 9, 100.0f) < make_sort_key(0, 2, 0, 0, 0.0f));
+  assert(make_sort_key(0, 1, 1, 9, 100.0f) < make_sort_key(0, 1, 2, 0, 0.0f));
+  assert(make_sort_key(0, 1, 1, 1, 100.0f) < make_sort_key(0, 1, 1, 2, 0.0f));
+  assert(make_sort_key(0, 1, 1, 1, 1.0f) < make_sort_key(0, 1, 1, 1, 2.0f));
+
+  // Depth keeps its order, behind the camera is all the same
+  float depths[] = {0.001f, 0.1f, 0.5f, 1.0f, 1.5f, 10.0f, 1000.0f, 1.0e6f};
+  for(unsigned i = 0; i + 1 < sizeof(depths) / sizeof(depths[0]); i++)
+  {
+    assert(quantize_depth(depths[i]) < quantize_depth(depths[i + 1]));
+  }
+  assert(quantize_depth(0.0f) == 0 && quantize_depth(-5.0f) == 0);
+  assert(quantize_depth(1.0e30f) < (1u << SORT_KEY_DEPTH_BITS));
+}
+
+int main()
+{
+  test_sort_matches_stable_sort();
+  test_queue_reuse();
+  test_key_fields();
+  printf("render_queue_test: ok\n");
+  return 0;
+}
@@ -0,0 +1,237 @@
+// Checks that models made off the render thread reuse freed slots instead of
+// reserving new ones: other threads get theirs at each sync, and the world's
+// thread gets them back with each snapshot the renderer applies, stepped on
+// one thread and pipelined on its own.
+
+#include "../source/model_storage.cpp"
+#include "../source/culling.cpp"
+#include "../source/scene_commands.cpp"
+#include "../source/frame_pipeline.cpp"
+
+#include <assert.h>
+#include <stdio.h> // printf
+
+////////////////////////////////////////////////////////////////////////////////
+// graphics.h, a renderer that only keeps the model storage
+////////////////////////////////////////////////////////////////////////////////
+
+static ModelStorage *storage;
+
+Model create_model(const char *model_name, v3 position, v3 scale, v3 rotation)
+{
+  Model handle;
+  if(queue_create_model(TRACE_CREATE_MODEL, storage, &handle, model_name, position, scale, rotation)) return handle;
+  return add_model(storage);
+}
+
+void create_reserved_model(const SceneCommand *command)
+{
+  add_model(storage, command->model);
+}
+
+void destroy_model(Model model)
+{
+  if(queue_destroy_model(model)) return;
+  assert(model_index(storage, model) != INVALID_MODEL_INDEX);
+  remove_model(storage, model);
+}
+
+void set_model_position(Model, v3) {}
+void change_model_position(Model, v3) {}
+void set_model_scale(Model, v3) {}
+void change_model_scale(Model, v3) {}
+void set_model_rotation(Model, v3) {}
+void change_model_rotation(Model, v3) {}
+void set_model_orientation(Model, quat) {}
+void set_model_color(Model, Color) {}
+void show_shadow_map_preview(bool) {}
+void set_shadow_map_resolution(unsigned) {}
+void set_occlusion_culling(bool) {}
+void set_camera_position(v3) {}
+void set_camera_looking_direction(v3) {}
+
+void capture_scene_snapshot(SceneSnapshot *snapshot)
+{
+  *snapshot = SceneSnapshot();
+  snapshot->models.resize(storage->slots.size());
+  for(unsigned slot = 0; slot < storage->slots.size(); slot++)
+  {
+    SceneModel *model = &snapshot->models[slot];
+    model->generation = storage->slots[slot].generation;
+    model->live = storage->slots[slot].dense_index != INVALID_MODEL_INDEX;
+    model->movable = true;
+  }
+}
+
+// Every live model in the snapshot has to be the renderer's, generation and all
+void apply_scene_snapshot(const SceneSnapshot *snapshot, std::vector<Model> *free_models)
+{
+  run_scene_commands(snapshot->commands.data(), snapshot->commands.size());
+  hand_out_free_models(storage, snapshot, free_models);
+
+  for(unsigned slot = 0; slot < snapshot->models.size(); slot++)
+  {
+    if(!snapshot->models[slot].live) continue;
+    Model handle;
+    handle.index = slot;
+    handle.generation = snapshot->models[slot].generation;
+    assert(model_index(storage, handle) != INVALID_MODEL_INDEX);
+  }
+}
+
+void return_free_models(std::vector<Model> *free_models)
+{
+  take_back_free_models(storage, free_models);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Tests
+////////////////////////////////////////////////////////////////////////////////
+
+static void reset_renderer()
+{
+  delete storage;
+  storage = new ModelStorage();
+  init_scene_commands();
+}
+
+// Every slot is either a live model or free, and free only once
+static void check_slots(unsigned reserved)
+{
+  std::vector<unsigned char> freed(storage->slots.size(), 0);
+  for(unsigned i = 0; i < storage->free_slots.size(); i++)
+  {
+    unsigned slot = storage->free_slots[i];
+    assert(slot < storage->slots.size() && !freed[slot]);
+    assert(storage->slots[slot].dense_index == INVALID_MODEL_INDEX);
+    freed[slot] = 1;
+  }
+  assert(storage->reserved_slots.load() == reserved);
+  assert(storage->count + storage->free_slots.size() == reserved);
+}
+
+// A thread that isn't the renderer makes models, the renderer destroys them,
+// and the next ones the thread makes land in the same slots
+static void test_other_thread_reuses_slots()
+{
+  static const unsigned MODEL_COUNT = 20;
+  static const unsigned ROUNDS = 5;
+  reset_renderer();
+
+  std::vector<Model> made(MODEL_COUNT);
+  std::atomic<unsigned> round{0};
+  std::atomic<bool> done{false};
+  std::thread maker([&made, &round, &done]()
+  {
+    for(unsigned i = 0; i < ROUNDS; i++)
+    {
+      while(round.load() != i) std::this_thread::yield();
+      for(unsigned j = 0; j < MODEL_COUNT; j++) made[j] = create_model("assets/cube.obj");
+      done = true;
+    }
+  });
+
+  for(unsigned i = 0; i < ROUNDS; i++)
+  {
+    round = i;
+    while(!done.load()) std::this_thread::yield();
+    done = false;
+
+    // Each round gets the slots the one before it freed, a generation on
+    for(unsigned j = 0; j < MODEL_COUNT; j++)
+    {
+      assert(made[j].index < MODEL_COUNT);
+      if(i) assert(made[j].generation == i);
+    }
+
+    sync_scene_commands(storage);
+    check_slots(MODEL_COUNT);
+    assert(storage->count == MODEL_COUNT);
+    for(unsigned j = 0; j < MODEL_COUNT; j++) destroy_model(made[j]);
+
+    // Hands this round's freed slots to the thread for the next one
+    sync_scene_commands(storage);
+  }
+  maker.join();
+
+  // With the thread gone its unused batch is freed again
+  sync_scene_commands(storage);
+  check_slots(MODEL_COUNT);
+  assert(storage->free_slots.size() == MODEL_COUNT);
+  shutdown_scene_commands();
+}
+
+// Each step remakes the world's models, destroying the last step's
+static const unsigned WORLD_MODEL_COUNT = 16;
+static std::vector<Model> world_models;
+
+static void remake_models(const TraceInput *, WorldRequests *, float)
+{
+  for(unsigned i = 0; i < world_models.size(); i++) destroy_model(world_models[i]);
+  world_models.clear();
+  for(unsigned i = 0; i < WORLD_MODEL_COUNT; i++) world_models.push_back(create_model("assets/cube.obj"));
+}
+
+// Stepped on the render thread, a frame's freed slots come back with the
+// snapshot that freed them, so two frames' worth of slots are all it needs
+static void test_world_reuses_slots()
+{
+  reset_renderer();
+  world_models.clear();
+
+  Simulation simulation;
+  init_simulation(&simulation, remake_models, 64.0f);
+  SceneSnapshot blended;
+  for(unsigned frame = 0; frame < 50; frame++)
+  {
+    simulate_frame(&simulation, 1.0 / 64.0, &blended);
+    apply_scene_snapshot(&blended, &simulation.free_models);
+    assert(storage->count == WORLD_MODEL_COUNT);
+  }
+  assert(storage->reserved_slots.load() == WORLD_MODEL_COUNT * 2);
+  assert(simulation.free_models.size() == WORLD_MODEL_COUNT);
+
+  return_free_models(&simulation.free_models);
+  assert(simulation.free_models.empty());
+  check_slots(WORLD_MODEL_COUNT * 2);
+  shutdown_scene_commands();
+}
+
+// Pipelined, the world runs up to two snapshots ahead, so slots come back
+// later but still stop it reserving more
+static void test_pipelined_world_reuses_slots()
+{
+  reset_renderer();
+  world_models.clear();
+
+  FramePipeline pipeline;
+  pipeline.frame_seconds = 1.0 / 64.0;
+  start_frame_pipeline(&pipeline, remake_models, 64.0f);
+  for(unsigned frame = 0; frame < 200; frame++)
+  {
+    apply_next_snapshot(&pipeline);
+    assert(storage->count == WORLD_MODEL_COUNT);
+  }
+  stop_frame_pipeline(&pipeline);
+
+  // A step's slots are back once the two snapshots after it are applied
+  assert(storage->reserved_slots.load() <= WORLD_MODEL_COUNT * 4);
+  assert(pipeline.simulation.free_models.empty());
+  assert(pipeline.queue.free_models[0].empty() && pipeline.queue.free_models[1].empty());
+
+  // Models only in the snapshots left in the queue never made it
+  unsigned unapplied = storage->reserved_slots.load() - storage->count - storage->free_slots.size();
+  assert(unapplied <= WORLD_MODEL_COUNT * 2);
+  shutdown_scene_commands();
+}
+
+int main()
+{
+  test_other_thread_reuses_slots();
+  test_world_reuses_slots();
+  test_pipelined_world_reuses_slots();
+  printf("scene_commands_test: ok\n");
+  return 0;
+}
@@ -0,0 +1,161 @@
+// Checks cascade splits, that each cascade covers its slice of the view, and
+// that the projections move in whole texels and only as often as the cache
+// margin needs.
+
+#include "../source/shadow_cascades.cpp"
+
+#include <stdio.h> // printf
+
+static const float FOV = PI / 3.0f;
+static const float ASPECT_RATIO = 16.0f / 9.0f;
+static const float NEAR_PLANE = 0.1f;
+
+static bool nearly(float a, float b, float tolerance)
+{
+  return absf(a - b) <= tolerance;
+}
+
+static bool same_matrix(const mat4 &a, const mat4 &b)
+{
+  for(unsigned row = 0; row < 4; row++)
+  {
+    for(unsigned column = 0; column < 4; column++)
+    {
+      if(a[row][column] != b[row][column]) return false;
+    }
+  }
+  return true;
+}
+
+static void test_splits()
+{
+  float splits[MAX_SHADOW_CASCADES + 1];
+
+  compute_cascade_splits(4, 1.0f, 1001.0f, 0.0f, splits);
+  for(unsigned i = 0; i <= 4; i++)
+  {
+    assert(nearly(splits[i], 1.0f + 250.0f * i, 0.01f));
+  }
+
+  compute_cascade_splits(4, 1.0f, 10000.0f, 1.0f, splits);
+  for(unsigned i = 0; i <= 4; i++)
+  {
+    assert(nearly(splits[i], (float)pow(10.0f, (float)i), 0.01f * splits[i]));
+  }
+
+  // Ends are exact and slices grow with distance
+  compute_cascade_splits(3, 0.1f, 1000.0f, 0.75f, splits);
+  assert(splits[0] == 0.1f && splits[3] == 1000.0f);
+  for(unsigned i = 0; i < 3; i++)
+  {
+    assert(splits[i] < splits[i + 1]);
+    if(i > 0) assert(splits[i + 1] - splits[i] > splits[i] - splits[i - 1]);
+  }
+}
+
+// Every corner of each cascade's slice lands inside its projection
+static void check_slices_covered(const ShadowCascadeSettings *settings, v3 camera_position, v3 camera_direction,
+                                 const ShadowCascade *cascades)
+{
+  v3 forward = unit(camera_direction);
+  v3 right = unit(cross(forward, v3(0.0f, 1.0f, 0.0f)));
+  v3 up = cross(right, forward);
+  float tan_y = (float)tan(FOV / 2.0f);
+  float tan_x = tan_y * ASPECT_RATIO;
+
+  for(unsigned i = 0; i < settings->count; i++)
+  {
+    float distances[2] = {cascades[i].near_distance, cascades[i].far_distance};
+    for(unsigned corner = 0; corner < 8; corner++)
+    {
+      float d = distances[corner & 1];
+      float sx = corner & 2 ? 1.0f : -1.0f;
+      float sy = corner & 4 ? 1.0f : -1.0f;
+      v3 position = camera_position + forward * d + right * (sx * d * tan_x) + up * (sy * d * tan_y);
+
+      v4 clip = cascades[i].clip_m_world * v4(position, 1.0f);
+      assert(clip.x >= -1.0f && clip.x <= 1.0f);
+      assert(clip.y >= -1.0f && clip.y <= 1.0f);
+      assert(clip.z > 0.0f && clip.z < 1.0f);
+    }
+  }
+}
+
+static void test_turning_keeps_size()
+{
+  ShadowCascadeSettings settings;
+  v3 light_direction = unit(v3(-0.3f, -1.0f, -0.2f));
+  v3 camera_position = v3(10.0f, 5.0f, -20.0f);
+
+  ShadowCascade first[MAX_SHADOW_CASCADES];
+  fit_shadow_cascades(&settings, camera_position, v3(0.0f, 0.0f, 1.0f), FOV, ASPECT_RATIO, NEAR_PLANE,
+                      light_direction, first);
+  check_slices_covered(&settings, camera_position, v3(0.0f, 0.0f, 1.0f), first);
+
+  for(unsigned step = 1; step < 16; step++)
+  {
+    float angle = 2.0f * PI * step / 16.0f;
+    v3 direction = v3((float)sin(angle), -0.2f, (float)cos(angle));
+
+    ShadowCascade turned[MAX_SHADOW_CASCADES];
+    fit_shadow_cascades(&settings, camera_position, direction, FOV, ASPECT_RATIO, NEAR_PLANE, light_direction, turned);
+    check_slices_covered(&settings, camera_position, direction, turned);
+
+    for(unsigned i = 0; i < settings.count; i++)
+    {
+      assert(same_matrix(first[i].clip_m_view, turned[i].clip_m_view));
+      assert(first[i].texel_size == turned[i].texel_size);
+    }
+  }
+}
+
+// Walks the camera in small steps and counts how often cascade 0 moves
+static unsigned count_moves(float cache_margin)
+{
+  ShadowCascadeSettings settings;
+  settings.cache_margin = cache_margin;
+  v3 light_direction = unit(v3(-0.3f, -1.0f, -0.2f));
+  v3 camera_direction = unit(v3(1.0f, -0.1f, 0.3f));
+
+  unsigned moves = 0;
+  mat4 last_view;
+  for(unsigned frame = 0; frame < 200; frame++)
+  {
+    v3 camera_position = v3(0.05f * frame, 2.0f, 0.02f * frame);
+
+    ShadowCascade cascades[MAX_SHADOW_CASCADES];
+    fit_shadow_cascades(&settings, camera_position, camera_direction, FOV, ASPECT_RATIO, NEAR_PLANE, light_direction,
+                        cascades);
+    check_slices_covered(&settings, camera_position, camera_direction, cascades);
+
+    // Snapped to whole texels in light space
+    for(unsigned i = 0; i < settings.count; i++)
+    {
+      float texels_x = -cascades[i].view_m_world[0][3] / cascades[i].texel_size;
+      float texels_y = -cascades[i].view_m_world[1][3] / cascades[i].texel_size;
+      assert(nearly(texels_x, (float)floor(texels_x + 0.5f), 0.01f));
+      assert(nearly(texels_y, (float)floor(texels_y + 0.5f), 0.01f));
+    }
+
+    if(frame > 0 && !same_matrix(last_view, cascades[0].view_m_world)) moves++;
+    last_view = cascades[0].view_m_world;
+  }
+  return moves;
+}
+
+static void test_margin_keeps_cascades_still()
+{
+  unsigned moves_with_margin = count_moves(0.25f);
+  unsigned moves_without_margin = count_moves(0.0f);
+  assert(moves_with_margin <= 3);
+  assert(moves_without_margin > 10 * (moves_with_margin + 1));
+}
+
+int main()
+{
+  test_splits();
+  test_turning_keeps_size();
+  test_margin_keeps_cascades_still();
+  printf("shadow_cascades_test: ok\n");
+  return 0;
+}
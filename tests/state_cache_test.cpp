@@ -0,0 +1,142 @@
+// Checks the state cache against a backend that records what reaches it.
+
+#include "../source/state_cache.cpp"
+
+#include <stdio.h> // printf
+#include <string.h> // strcmp
+#include <vector> // std::vector
+
+struct RecordedCall
+{
+  const char *name;
+  unsigned slot;
+  void *value;
+};
+
+struct RecordingBackend : StateBackend
+{
+  std::vector<RecordedCall> calls;
+
+  void record(const char *name, unsigned slot, void *value)
+  {
+    RecordedCall call = {name, slot, value};
+    calls.push_back(call);
+  }
+
+  void set_vertex_buffer(unsigned slot, void *buffer, unsigned) { record("vertex_buffer", slot, buffer); }
+  void set_index_buffer(void *buffer) { record("index_buffer", 0, buffer); }
+  void set_topology(unsigned topology) { record("topology", topology, 0); }
+  void set_input_layout(void *layout) { record("input_layout", 0, layout); }
+  void set_vertex_shader(void *shader) { record("vertex_shader", 0, shader); }
+  void set_pixel_shader(void *shader) { record("pixel_shader", 0, shader); }
+  void set_vs_constant_buffer(unsigned slot, void *buffer) { record("vs_constant_buffer", slot, buffer); }
+  void set_ps_constant_buffer(unsigned slot, void *buffer) { record("ps_constant_buffer", slot, buffer); }
+  void set_ps_resource(unsigned slot, void *resource) { record("ps_resource", slot, resource); }
+  void set_ps_sampler(unsigned slot, void *sampler) { record("ps_sampler", slot, sampler); }
+  void set_depth_stencil_state(void *state) { record("depth_stencil_state", 0, state); }
+  void set_render_target(void *render_target, void *) { record("render_target", 0, render_target); }
+};
+
+// Fake handles, never dereferenced
+static void *handle(unsigned long long id)
+{
+  return (void *)id;
+}
+
+static bool last_call_is(RecordingBackend *backend, const char *name, unsigned slot, void *value)
+{
+  const RecordedCall &call = backend->calls.back();
+  return strcmp(call.name, name) == 0 && call.slot == slot && call.value == value;
+}
+
+static void test_redundant_binds_are_dropped()
+{
+  RecordingBackend backend;
+  StateCache cache;
+  init_state_cache(&cache, &backend);
+
+  state_set_vertex_shader(&cache, handle(1));
+  state_set_vertex_shader(&cache, handle(1));
+  state_set_vertex_shader(&cache, handle(1));
+  assert(backend.calls.size() == 1);
+  assert(last_call_is(&backend, "vertex_shader", 0, handle(1)));
+
+  state_set_vertex_shader(&cache, handle(2));
+  assert(backend.calls.size() == 2);
+  assert(last_call_is(&backend, "vertex_shader", 0, handle(2)));
+
+  // Slots are tracked on their own
+  state_set_ps_sampler(&cache, 0, handle(3));
+  state_set_ps_sampler(&cache, 1, handle(3));
+  state_set_ps_sampler(&cache, 0, handle(3));
+  assert(backend.calls.size() == 4);
+  assert(last_call_is(&backend, "ps_sampler", 1, handle(3)));
+
+  // A new stride is a new bind even with the same buffer
+  state_set_vertex_buffer(&cache, 0, handle(4), 12);
+  state_set_vertex_buffer(&cache, 0, handle(4), 12);
+  state_set_vertex_buffer(&cache, 0, handle(4), 24);
+  assert(backend.calls.size() == 6);
+
+  // The first bind of a null handle still goes through
+  state_set_index_buffer(&cache, 0);
+  state_set_index_buffer(&cache, 0);
+  assert(backend.calls.size() == 7);
+  assert(last_call_is(&backend, "index_buffer", 0, 0));
+
+  assert(cache.stats.forwarded == 7);
+  assert(cache.stats.redundant == 5);
+}
+
+static void test_render_target_forgets_shader_resources()
+{
+  RecordingBackend backend;
+  StateCache cache;
+  init_state_cache(&cache, &backend);
+
+  state_set_ps_resource(&cache, 0, handle(1));
+  state_set_pixel_shader(&cache, handle(2));
+  state_set_render_target(&cache, handle(3), handle(4));
+  state_set_ps_resource(&cache, 0, handle(1));
+  state_set_pixel_shader(&cache, handle(2));
+  assert(backend.calls.size() == 4);
+  assert(last_call_is(&backend, "ps_resource", 0, handle(1)));
+}
+
+static void test_reset_forgets_state()
+{
+  RecordingBackend backend;
+  StateCache cache;
+  init_state_cache(&cache, &backend);
+
+  state_set_topology(&cache, 4);
+  state_set_input_layout(&cache, handle(1));
+  state_set_vs_constant_buffer(&cache, 2, handle(2));
+  state_set_depth_stencil_state(&cache, handle(3));
+  assert(backend.calls.size() == 4);
+
+  // Something bound around the cache, so everything goes through again
+  reset_state_cache(&cache);
+  state_set_topology(&cache, 4);
+  state_set_input_layout(&cache, handle(1));
+  state_set_vs_constant_buffer(&cache, 2, handle(2));
+  state_set_depth_stencil_state(&cache, handle(3));
+  assert(backend.calls.size() == 8);
+  assert(last_call_is(&backend, "depth_stencil_state", 0, handle(3)));
+
+  // Resetting keeps the stats
+  assert(cache.stats.forwarded == 8);
+  assert(cache.stats.redundant == 0);
+
+  state_set_topology(&cache, 4);
+  assert(backend.calls.size() == 8);
+}
+
+int main()
+{
+  test_redundant_binds_are_dropped();
+  test_render_target_forgets_shader_resources();
+  test_reset_forgets_state();
+  printf("state_cache_test: ok\n");
+  return 0;
+}
@@ -0,0 +1,321 @@
+// Checks the SIMD sampler against plain per texel math: point and bilinear
+// lookups with clamping for every format, mip building, trilinear blending,
+// lod selection, and cube face picking against the D3D11 face table.
+
+#include "../source/texture_sampling.cpp"
+
+#include <assert.h>
+#include <stdio.h> // printf
+
+static float lane(__m128 x, unsigned i)
+{
+  float lanes[4];
+  _mm_storeu_ps(lanes, x);
+  return lanes[i];
+}
+
+static bool near(float a, float b)
+{
+  return fabsf(a - b) < 1.0e-4f;
+}
+
+static float random_float(unsigned *random)
+{
+  *random = *random * 1664525 + 1013904223;
+  return (float)(*random >> 8) / (float)(1 << 24);
+}
+
+static unsigned pack(unsigned r, unsigned g, unsigned b, unsigned a)
+{
+  return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+// Channel c of the RGBA8 texel at x, y, clamped to the image, from 0 to 1
+static float texel(const SampleImage *image, int x, int y, unsigned c)
+{
+  x = x < 0 ? 0 : (x >= (int)image->width ? image->width - 1 : x);
+  y = y < 0 ? 0 : (y >= (int)image->height ? image->height - 1 : y);
+  unsigned packed = ((const unsigned *)image->texels)[y * image->stride + x];
+  return (float)((packed >> (c * 8)) & 0xFF) / 255.0f;
+}
+
+static float reference_bilinear(const SampleImage *image, float u, float v, unsigned c)
+{
+  float x = u * image->width - 0.5f;
+  float y = v * image->height - 0.5f;
+  float x0 = floorf(x);
+  float y0 = floorf(y);
+  float tx = x - x0;
+  float ty = y - y0;
+  float top = texel(image, (int)x0, (int)y0, c) * (1.0f - tx) + texel(image, (int)x0 + 1, (int)y0, c) * tx;
+  float bottom = texel(image, (int)x0, (int)y0 + 1, c) * (1.0f - tx) + texel(image, (int)x0 + 1, (int)y0 + 1, c) * tx;
+  return top * (1.0f - ty) + bottom * ty;
+}
+
+static float channel(const SampleColors &colors, unsigned c, unsigned i)
+{
+  const __m128 *channels[4] = {&colors.r, &colors.g, &colors.b, &colors.a};
+  return lane(*channels[c], i);
+}
+
+// 5x3 with a wider stride, every texel different
+static void make_rgba8_image(std::vector<unsigned> *texels, SampleTexture *texture)
+{
+  texels->assign(8 * 3, 0xDEADBEEF);
+  for(unsigned y = 0; y < 3; y++)
+  {
+    for(unsigned x = 0; x < 5; x++)
+    {
+      (*texels)[y * 8 + x] = pack(x * 50, y * 100, 255 - x * 20 - y * 30, 128 + x + y);
+    }
+  }
+  set_sample_image(texture, 0, 0, texels->data(), 5, 3, 8);
+}
+
+static void test_point_and_bilinear()
+{
+  std::vector<unsigned> texels;
+  SampleTexture texture;
+  make_rgba8_image(&texels, &texture);
+  const SampleImage *image = &texture.images[0][0];
+
+  // Plenty outside 0 to 1 for the clamping
+  unsigned random = 42;
+  for(unsigned i = 0; i < 1000; i++)
+  {
+    float us[4], vs[4];
+    for(unsigned j = 0; j < 4; j++)
+    {
+      us[j] = random_float(&random) * 1.6f - 0.3f;
+      vs[j] = random_float(&random) * 1.6f - 0.3f;
+    }
+    __m128 u = _mm_loadu_ps(us);
+    __m128 v = _mm_loadu_ps(vs);
+
+    SampleColors point = sample_2d(&texture, SAMPLE_FILTER_POINT, u, v, _mm_setzero_ps());
+    SampleColors bilinear = sample_2d(&texture, SAMPLE_FILTER_BILINEAR, u, v, _mm_setzero_ps());
+    for(unsigned j = 0; j < 4; j++)
+    {
+      int x = (int)floorf(us[j] * image->width);
+      int y = (int)floorf(vs[j] * image->height);
+      for(unsigned c = 0; c < 4; c++)
+      {
+        assert(near(channel(point, c, j), texel(image, x, y, c)));
+        assert(near(channel(bilinear, c, j), reference_bilinear(image, us[j], vs[j], c)));
+      }
+    }
+  }
+
+  // Texel centers read just the texel
+  __m128 u = _mm_setr_ps(0.5f / 5.0f, 1.5f / 5.0f, 4.5f / 5.0f, 2.5f / 5.0f);
+  __m128 v = _mm_setr_ps(0.5f / 3.0f, 0.5f / 3.0f, 2.5f / 3.0f, 1.5f / 3.0f);
+  SampleColors centers = sample_2d(&texture, SAMPLE_FILTER_BILINEAR, u, v, _mm_setzero_ps());
+  assert(near(lane(centers.r, 1), 50.0f / 255.0f));
+  assert(near(lane(centers.g, 2), 200.0f / 255.0f));
+  assert(near(lane(centers.a, 3), 131.0f / 255.0f));
+}
+
+static void test_float_formats()
+{
+  float values[4] = {1.0f, 2.0f, 3.0f, 4.0f}; // 2x2
+  SampleTexture single;
+  single.format = SAMPLE_FORMAT_R32F;
+  set_sample_image(&single, 0, 0, values, 2, 2, 2);
+
+  __m128 u = _mm_setr_ps(0.25f, 0.75f, 0.25f, 0.5f);
+  __m128 v = _mm_setr_ps(0.25f, 0.25f, 0.75f, 0.5f);
+  SampleColors point = sample_2d(&single, SAMPLE_FILTER_POINT, u, v, _mm_setzero_ps());
+  assert(lane(point.r, 0) == 1.0f && lane(point.r, 1) == 2.0f && lane(point.r, 2) == 3.0f);
+  for(unsigned i = 0; i < 4; i++)
+  {
+    assert(lane(point.g, i) == 0.0f && lane(point.b, i) == 0.0f && lane(point.a, i) == 1.0f);
+  }
+
+  // The middle is the average of all four
+  SampleColors bilinear = sample_2d(&single, SAMPLE_FILTER_BILINEAR, u, v, _mm_setzero_ps());
+  assert(near(lane(bilinear.r, 3), 2.5f));
+
+  // Channels come out of the right lanes after the transpose
+  float colors[2 * 4] = {0.1f, 0.2f, 0.3f, 0.4f, 0.5f, 0.6f, 0.7f, 0.8f}; // 2x1
+  SampleTexture rgba;
+  rgba.format = SAMPLE_FORMAT_RGBA32F;
+  set_sample_image(&rgba, 0, 0, colors, 2, 1, 2);
+  SampleColors texels = sample_2d(&rgba, SAMPLE_FILTER_POINT, _mm_setr_ps(0.0f, 0.9f, 0.2f, 0.7f), _mm_setzero_ps(),
+                                  _mm_setzero_ps());
+  for(unsigned i = 0; i < 4; i++)
+  {
+    const float *expected = &colors[(i & 1) * 4];
+    assert(lane(texels.r, i) == expected[0] && lane(texels.g, i) == expected[1]);
+    assert(lane(texels.b, i) == expected[2] && lane(texels.a, i) == expected[3]);
+  }
+}
+
+static void test_mips()
+{
+  // 5x3 goes to 2x1 then 1x1, the odd column and row left out like D3D's
+  // floor sizes
+  std::vector<unsigned> texels;
+  SampleTexture texture;
+  make_rgba8_image(&texels, &texture);
+  std::vector<unsigned char> storage;
+  build_sample_mips(&texture, &storage);
+
+  assert(texture.levels == 3);
+  const SampleImage *level1 = &texture.images[0][1];
+  const SampleImage *level2 = &texture.images[0][2];
+  assert(level1->width == 2 && level1->height == 1);
+  assert(level2->width == 1 && level2->height == 1);
+  assert(storage.size() == (2 + 1) * 4);
+
+  const SampleImage *top = &texture.images[0][0];
+  for(unsigned x = 0; x < 2; x++)
+  {
+    for(unsigned c = 0; c < 4; c++)
+    {
+      float sum = texel(top, x * 2, 0, c) + texel(top, x * 2 + 1, 0, c) + texel(top, x * 2, 1, c) + texel(top, x * 2 + 1, 1, c);
+      assert(fabsf(texel(level1, x, 0, c) - sum * 0.25f) <= 0.5f / 255.0f);
+    }
+  }
+
+  // A 1 texel tall level repeats its row
+  for(unsigned c = 0; c < 4; c++)
+  {
+    float average = (texel(level1, 0, 0, c) + texel(level1, 1, 0, c)) * 0.5f;
+    assert(fabsf(texel(level2, 0, 0, c) - average) <= 0.5f / 255.0f);
+  }
+
+  // Point and bilinear round the lod, trilinear blends, and it clamps to the
+  // levels there are
+  __m128 u = _mm_set1_ps(0.3f);
+  __m128 v = _mm_set1_ps(0.6f);
+  __m128 lod = _mm_setr_ps(0.4f, 0.6f, 0.5f, 7.0f);
+  SampleColors bilinear = sample_2d(&texture, SAMPLE_FILTER_BILINEAR, u, v, lod);
+  SampleColors trilinear = sample_2d(&texture, SAMPLE_FILTER_TRILINEAR, u, v, lod);
+  for(unsigned c = 0; c < 4; c++)
+  {
+    float level0 = reference_bilinear(top, 0.3f, 0.6f, c);
+    float level1_value = reference_bilinear(level1, 0.3f, 0.6f, c);
+    assert(near(channel(bilinear, c, 0), level0));
+    assert(near(channel(bilinear, c, 1), level1_value));
+    assert(near(channel(trilinear, c, 2), (level0 + level1_value) * 0.5f));
+    assert(near(channel(trilinear, c, 3), texel(level2, 0, 0, c)));
+  }
+}
+
+static void test_lod()
+{
+  std::vector<unsigned> texels(64 * 32);
+  SampleTexture texture;
+  set_sample_image(&texture, 0, 0, texels.data(), 64, 32, 64);
+
+  // A texel per pixel is level 0, two level 1, and the longer of the two
+  // screen directions wins
+  __m128 du_dx = _mm_setr_ps(1.0f / 64.0f, 2.0f / 64.0f, 0.0f, 0.0f);
+  __m128 dv_dx = _mm_setzero_ps();
+  __m128 du_dy = _mm_setzero_ps();
+  __m128 dv_dy = _mm_setr_ps(0.0f, 1.0f / 32.0f, 8.0f / 32.0f, 0.0f);
+  __m128 lod = sample_lod(&texture, du_dx, dv_dx, du_dy, dv_dy);
+  assert(near(lane(lod, 0), 0.0f));
+  assert(near(lane(lod, 1), 1.0f));
+  assert(near(lane(lod, 2), 3.0f));
+  assert(lane(lod, 3) == 0.0f); // Not moving at all
+}
+
+// Face, s, t and major axis from the D3D11 cube map face table
+static void reference_cube_face(float x, float y, float z, int *face, float *u, float *v)
+{
+  float ax = fabsf(x), ay = fabsf(y), az = fabsf(z);
+  float s, t, major;
+  if(ax >= ay && ax >= az)
+  {
+    *face = x > 0.0f ? 0 : 1;
+    s = x > 0.0f ? -z : z;
+    t = -y;
+    major = ax;
+  }
+  else if(ay >= az)
+  {
+    *face = y > 0.0f ? 2 : 3;
+    s = x;
+    t = y > 0.0f ? z : -z;
+    major = ay;
+  }
+  else
+  {
+    *face = z > 0.0f ? 4 : 5;
+    s = z > 0.0f ? x : -x;
+    t = -y;
+    major = az;
+  }
+  *u = s / major * 0.5f + 0.5f;
+  *v = t / major * 0.5f + 0.5f;
+}
+
+static void test_cube()
+{
+  // 2x2 faces, each its own color, top left texel a little brighter
+  unsigned faces[6][4];
+  SampleTexture texture;
+  texture.faces = 6;
+  for(unsigned face = 0; face < 6; face++)
+  {
+    for(unsigned i = 0; i < 4; i++) faces[face][i] = pack(face * 40, i == 0 ? 255 : 0, 0, 255);
+    set_sample_image(&texture, face, 0, faces[face], 2, 2, 2);
+  }
+
+  unsigned random = 7;
+  for(unsigned i = 0; i < 1000; i++)
+  {
+    float xs[4], ys[4], zs[4];
+    for(unsigned j = 0; j < 4; j++)
+    {
+      xs[j] = random_float(&random) * 2.0f - 1.0f;
+      ys[j] = random_float(&random) * 2.0f - 1.0f;
+      zs[j] = random_float(&random) * 2.0f - 1.0f;
+    }
+    __m128 x = _mm_loadu_ps(xs);
+    __m128 y = _mm_loadu_ps(ys);
+    __m128 z = _mm_loadu_ps(zs);
+
+    __m128i face;
+    __m128 u, v;
+    cube_face_coordinates(x, y, z, &face, &u, &v);
+    int face_lanes[4];
+    _mm_storeu_si128((__m128i *)face_lanes, face);
+
+    SampleColors colors = sample_cube(&texture, SAMPLE_FILTER_POINT, x, y, z, _mm_setzero_ps());
+    for(unsigned j = 0; j < 4; j++)
+    {
+      int expected_face;
+      float expected_u, expected_v;
+      reference_cube_face(xs[j], ys[j], zs[j], &expected_face, &expected_u, &expected_v);
+      assert(face_lanes[j] == expected_face);
+      assert(near(lane(u, j), expected_u) && near(lane(v, j), expected_v));
+
+      bool top_left = expected_u < 0.5f && expected_v < 0.5f;
+      assert(near(lane(colors.r, j), expected_face * 40.0f / 255.0f));
+      assert(lane(colors.g, j) == (top_left ? 1.0f : 0.0f));
+    }
+  }
+
+  // Straight down each axis lands in the middle of its face
+  __m128i face;
+  __m128 u, v;
+  cube_face_coordinates(_mm_setr_ps(3.0f, -1.0f, 0.0f, 0.0f), _mm_setr_ps(0.0f, 0.0f, 0.5f, 0.0f), _mm_setr_ps(0.0f, 0.0f, 0.0f, -2.0f),
+                        &face, &u, &v);
+  int face_lanes[4];
+  _mm_storeu_si128((__m128i *)face_lanes, face);
+  assert(face_lanes[0] == 0 && face_lanes[1] == 1 && face_lanes[2] == 2 && face_lanes[3] == 5);
+  for(unsigned i = 0; i < 4; i++) assert(lane(u, i) == 0.5f && lane(v, i) == 0.5f);
+}
+
+int main()
+{
+  test_point_and_bilinear();
+  test_float_formats();
+  test_mips();
+  test_lod();
+  test_cube();
+  printf("texture_sampling_test: ok\n");
+  return 0;
+}
@@ -0,0 +1,151 @@
+// Checks allocating, freeing, coalescing and the stats of the TLSF allocator.
+
+#include "../source/tlsf_allocator.cpp"
+
+#include <math.h> // fabsf
+#include <stdio.h> // printf
+
+static bool nearly(float a, float b)
+{
+  return fabsf(a - b) < 0.0001f;
+}
+
+static void test_free_neighbours_coalesce()
+{
+  TlsfAllocator allocator;
+  init_tlsf_allocator(&allocator, 1024);
+
+  TlsfAllocation a = tlsf_allocate(&allocator, 64);
+  TlsfAllocation b = tlsf_allocate(&allocator, 64);
+  TlsfAllocation c = tlsf_allocate(&allocator, 64);
+  TlsfAllocation d = tlsf_allocate(&allocator, 64);
+  assert(a.offset == 0 && b.offset == 64 && c.offset == 128 && d.offset == 192);
+
+  TlsfStats stats = tlsf_stats(&allocator);
+  assert(stats.used == 256 && stats.allocations == 4);
+  assert(stats.free_blocks == 1 && stats.largest_free == 768);
+  assert(nearly(stats.utilization, 0.25f));
+  assert(nearly(stats.fragmentation, 0.0f));
+
+  // A hole between used blocks
+  tlsf_free(&allocator, b);
+  stats = tlsf_stats(&allocator);
+  assert(stats.used == 192 && stats.allocations == 3);
+  assert(stats.free_blocks == 2 && stats.largest_free == 768);
+  assert(nearly(stats.fragmentation, 1.0f - 768.0f / 832.0f));
+
+  // The hole fits and is taken before splitting the big block
+  b = tlsf_allocate(&allocator, 64);
+  assert(b.offset == 64);
+  assert(tlsf_stats(&allocator).free_blocks == 1);
+
+  // c merges with the free block before it, a with the one after it and d
+  // with both
+  tlsf_free(&allocator, b);
+  tlsf_free(&allocator, c);
+  stats = tlsf_stats(&allocator);
+  assert(stats.free_blocks == 2 && stats.largest_free == 768);
+  assert(nearly(stats.fragmentation, 1.0f - 768.0f / 896.0f));
+
+  tlsf_free(&allocator, a);
+  stats = tlsf_stats(&allocator);
+  assert(stats.free_blocks == 2 && stats.largest_free == 768);
+
+  TlsfAllocation merged = tlsf_allocate(&allocator, 192);
+  assert(merged.offset == 0);
+  tlsf_free(&allocator, merged);
+
+  tlsf_free(&allocator, d);
+  stats = tlsf_stats(&allocator);
+  assert(stats.used == 0 && stats.allocations == 0);
+  assert(stats.free_blocks == 1 && stats.largest_free == 1024);
+  assert(nearly(stats.utilization, 0.0f));
+  assert(nearly(stats.fragmentation, 0.0f));
+}
+
+static void test_out_of_space()
+{
+  TlsfAllocator allocator;
+  init_tlsf_allocator(&allocator, 1024);
+
+  assert(tlsf_allocate(&allocator, 2048).offset == TLSF_INVALID);
+
+  TlsfAllocation all = tlsf_allocate(&allocator, 1024);
+  assert(all.offset == 0);
+  assert(tlsf_stats(&allocator).free_blocks == 0);
+  assert(nearly(tlsf_stats(&allocator).utilization, 1.0f));
+  assert(tlsf_allocate(&allocator, 1).offset == TLSF_INVALID);
+
+  tlsf_free(&allocator, all);
+  assert(tlsf_allocate(&allocator, 1).offset == 0);
+}
+
+// Random allocs and frees. Live allocations never overlap, and freeing them
+// all leaves one block again.
+static void test_random_allocations()
+{
+  const unsigned capacity = 1 << 16;
+  TlsfAllocator allocator;
+  init_tlsf_allocator(&allocator, capacity);
+
+  std::vector<TlsfAllocation> live;
+  std::vector<unsigned> sizes;
+  std::vector<unsigned char> owned(capacity, 0);
+  unsigned used = 0;
+
+  unsigned random = 12345;
+  for(unsigned i = 0; i < 20000; i++)
+  {
+    random = random * 1664525 + 1013904223;
+    bool allocate = live.empty() || (random >> 16) % 3 != 0;
+    if(allocate)
+    {
+      unsigned size = 1 + (random >> 8) % 700;
+      TlsfAllocation allocation = tlsf_allocate(&allocator, size);
+      if(allocation.offset == TLSF_INVALID) continue;
+
+      assert(allocation.offset + size <= capacity);
+      for(unsigned j = 0; j < size; j++)
+      {
+        assert(!owned[allocation.offset + j]);
+        owned[allocation.offset + j] = 1;
+      }
+      live.push_back(allocation);
+      sizes.push_back(size);
+      used += size;
+    }
+    else
+    {
+      unsigned pick = (random >> 4) % live.size();
+      for(unsigned j = 0; j < sizes[pick]; j++)
+      {
+        owned[live[pick].offset + j] = 0;
+      }
+      tlsf_free(&allocator, live[pick]);
+      used -= sizes[pick];
+      live[pick] = live.back();
+      sizes[pick] = sizes.back();
+      live.pop_back();
+      sizes.pop_back();
+    }
+
+    assert(allocator.used == used && allocator.allocations == live.size());
+  }
+
+  for(unsigned i = 0; i < live.size(); i++)
+  {
+    tlsf_free(&allocator, live[i]);
+  }
+
+  TlsfStats stats = tlsf_stats(&allocator);
+  assert(stats.used == 0 && stats.free_blocks == 1 && stats.largest_free == capacity);
+}
+
+int main()
+{
+  test_free_neighbours_coalesce();
+  test_out_of_space();
+  test_random_allocations();
+  printf("tlsf_allocator_test: ok\n");
+  return 0;
+}